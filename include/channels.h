@@ -41,9 +41,19 @@ class CoreExport Channel final
 	: public Extensible
 {
 public:
+	/** Provides the slab pool which the nodes of member maps are allocated from. */
+	struct CoreExport MemberPool final
+	{
+		/** Retrieves the member pool, creating it if it does not exist.
+		 * @param size The size of a member map node.
+		 */
+		static SlabPool& GetPool(size_t size);
+	};
+
 	/** A map of Memberships on a channel keyed by User pointers
 	 */
-	typedef std::map<User*, insp::aligned_storage<Membership>> MemberMap;
+	typedef std::map<User*, insp::aligned_storage<Membership>, std::less<User*>,
+		SlabAllocator<std::pair<User* const, insp::aligned_storage<Membership>>, MemberPool>> MemberMap;
 
 private:
 	/** Set default modes for the channel on creation
@@ -73,6 +83,12 @@ public:
 	 */
 	Channel(const std::string& name, time_t ts);
 
+	/** Allocates memory for a channel from the channel slab pool. */
+	static void* operator new(size_t size);
+
+	/** Returns the memory for a channel to the channel slab pool. */
+	static void operator delete(void* ptr, size_t size);
+
 	/** Checks whether the channel should be destroyed, and if yes, begins
 	 * the teardown procedure.
 	 *
@@ -248,6 +264,18 @@ public:
 	 */
 	Membership* ForceJoin(User* user, const std::string* privs = nullptr, bool bursting = false, bool created_by_local = false);
 
+	/** Join multiple users to an existing channel in one pass, without doing any permission checks.
+	 * The users are added to the member list before any of them are announced and the member storage
+	 * is reserved up front so this is considerably cheaper than calling ForceJoin() for each user when
+	 * a large number of users are joining at once (e.g. during a netburst).
+	 * @param users The users to join to the channel.
+	 * @param bursting True if these joins are the result of a netburst (passed to modules in the OnUserJoin hook)
+	 * @return The newly created Membership objects in the same order as the users. An element is NULL if
+	 * the user was already inside the channel, if the user is a server user, or if a module removed the
+	 * user from the channel while the joins were being announced.
+	 */
+	std::vector<Membership*> ForceJoin(const std::vector<User*>& users, bool bursting = false);
+
 	/** Write to all users on a channel except some users
 	 * @param protoev Event to send, may contain any number of messages.
 	 * @param status The status of the users to write to, e.g. '@' or '%'. Use a value of 0 to write to everyone
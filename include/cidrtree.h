@@ -0,0 +1,258 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "socket.h"
+#include "utility/uncopiable.h"
+
+/** A path compressed radix tree which keeps a total of the values added for IP addresses. As every
+ * node holds the total for all of the addresses below it the total for any CIDR range can be looked
+ * up without having to know the range in advance. Adding, removing, and looking up values are all
+ * bounded by the number of bits in an address.
+ * @tparam Value The type of the value to keep a total of. This must be default constructible and
+ * support the += and -= operators.
+ */
+template <typename Value>
+class CIDRTree final
+	: private insp::uncopiable
+{
+private:
+	/** A node in the tree. */
+	struct Node final
+	{
+		/** The nodes below this one keyed by the bit after the prefix. */
+		std::unique_ptr<Node> children[2];
+
+		/** The node above this one or nullptr if this is the root of a family. */
+		Node* parent;
+
+		/** The range of addresses which this node covers. */
+		irc::sockets::cidr_mask prefix;
+
+		/** The number of addresses which have been added below this node. */
+		size_t refs = 0;
+
+		/** The total of the values which have been added below this node. */
+		Value value = {};
+
+		Node(Node* p, const irc::sockets::cidr_mask& pfx)
+			: parent(p)
+			, prefix(pfx)
+		{
+		}
+	};
+
+	/** The root node for each address family. */
+	std::map<sa_family_t, std::unique_ptr<Node>> roots;
+
+	/** Retrieves the value of the specified bit of a CIDR mask. */
+	static unsigned int GetBit(const irc::sockets::cidr_mask& mask, unsigned char bit)
+	{
+		return (mask.bits[bit / 8] >> (7 - (bit % 8))) & 1;
+	}
+
+	/** Retrieves the number of leading bits which are the same in two CIDR masks. */
+	static unsigned char GetCommonLength(const irc::sockets::cidr_mask& lhs, const irc::sockets::cidr_mask& rhs)
+	{
+		const unsigned char maxlength = std::min(lhs.length, rhs.length);
+		unsigned char length = 0;
+		for (size_t idx = 0; length < maxlength; ++idx, length += 8)
+		{
+			const unsigned char diff = lhs.bits[idx] ^ rhs.bits[idx];
+			if (diff)
+			{
+				for (unsigned char mask = 0x80; !(diff & mask); mask >>= 1)
+					length++;
+				break;
+			}
+		}
+		return std::min(length, maxlength);
+	}
+
+	/** Shortens a CIDR mask to the specified length. */
+	static irc::sockets::cidr_mask Truncate(const irc::sockets::cidr_mask& mask, unsigned char length)
+	{
+		irc::sockets::cidr_mask newmask = mask;
+		newmask.length = length;
+		for (size_t idx = 0; idx < sizeof(newmask.bits); ++idx)
+		{
+			if (idx * 8 >= length)
+				newmask.bits[idx] = 0;
+			else if (idx * 8 + 8 > length)
+				newmask.bits[idx] &= static_cast<unsigned char>(0xFF00 >> (length % 8));
+		}
+		return newmask;
+	}
+
+	/** Finds the highest node which only covers addresses within the specified range. */
+	Node* FindNode(const irc::sockets::cidr_mask& mask) const
+	{
+		auto it = roots.find(mask.type);
+		if (it == roots.end())
+			return nullptr;
+
+		Node* node = it->second.get();
+		while (node->prefix.length < mask.length)
+		{
+			Node* child = node->children[GetBit(mask, node->prefix.length)].get();
+			if (!child || GetCommonLength(mask, child->prefix) < std::min(mask.length, child->prefix.length))
+				return nullptr;
+			node = child;
+		}
+		return node;
+	}
+
+	/** Removes a node from the tree and subtracts its total from the nodes above it. Nodes above it
+	 * which become empty are removed and nodes which only have one child are merged into it.
+	 */
+	void RemoveNode(Node* node)
+	{
+		for (Node* parent = node->parent; parent; parent = parent->parent)
+		{
+			parent->value -= node->value;
+			parent->refs -= node->refs;
+		}
+
+		Node* parent = node->parent;
+		if (!parent)
+		{
+			roots.erase(node->prefix.type);
+			return;
+		}
+		parent->children[GetBit(node->prefix, parent->prefix.length)].reset();
+
+		// Walk up the tree removing any empty nodes.
+		while (!parent->refs && parent->parent)
+		{
+			Node* grandparent = parent->parent;
+			grandparent->children[GetBit(parent->prefix, grandparent->prefix.length)].reset();
+			parent = grandparent;
+		}
+		if (!parent->refs)
+		{
+			roots.erase(parent->prefix.type);
+			return;
+		}
+
+		// If the lowest remaining node is now only a junction for a single child then replace it with that child.
+		if (parent->parent && (!parent->children[0] || !parent->children[1]))
+		{
+			std::unique_ptr<Node> child = std::move(parent->children[parent->children[0] ? 0 : 1]);
+			Node* grandparent = parent->parent;
+			child->parent = grandparent;
+			grandparent->children[GetBit(parent->prefix, grandparent->prefix.length)] = std::move(child);
+		}
+	}
+
+public:
+	/** Adds a value for an IP address.
+	 * @param addr The address to add the value for.
+	 * @param value The value to add.
+	 */
+	void Add(const irc::sockets::sockaddrs& addr, const Value& value)
+	{
+		const irc::sockets::cidr_mask key(addr, 128);
+		std::unique_ptr<Node>& root = roots[key.type];
+		if (!root)
+			root = std::make_unique<Node>(nullptr, Truncate(key, 0));
+
+		for (Node* node = root.get(); ; )
+		{
+			node->value += value;
+			node->refs++;
+			if (node->prefix.length >= key.length)
+				return;
+
+			std::unique_ptr<Node>& child = node->children[GetBit(key, node->prefix.length)];
+			if (!child)
+			{
+				// There are no other addresses in this part of the tree.
+				child = std::make_unique<Node>(node, key);
+				child->value = value;
+				child->refs = 1;
+				return;
+			}
+
+			const unsigned char common = GetCommonLength(key, child->prefix);
+			if (common < child->prefix.length)
+			{
+				// The address diverges from the existing child part of the way along
+				// its prefix so a junction node needs to be inserted above it.
+				auto junction = std::make_unique<Node>(node, Truncate(key, common));
+				junction->value = child->value;
+				junction->refs = child->refs;
+				child->parent = junction.get();
+				junction->children[GetBit(child->prefix, common)] = std::move(child);
+				child = std::move(junction);
+			}
+			node = child.get();
+		}
+	}
+
+	/** Removes a value which was previously added for an IP address.
+	 * @param addr The address to remove the value for.
+	 * @param value The value to remove.
+	 * @return True if the address was in the tree; otherwise, false.
+	 */
+	bool Remove(const irc::sockets::sockaddrs& addr, const Value& value)
+	{
+		Node* node = FindNode(irc::sockets::cidr_mask(addr, 128));
+		if (!node)
+			return false;
+
+		if (node->refs > 1)
+		{
+			for (; node; node = node->parent)
+			{
+				node->value -= value;
+				node->refs--;
+			}
+			return true;
+		}
+
+		RemoveNode(node);
+		return true;
+	}
+
+	/** Removes all values for addresses within a CIDR range.
+	 * @param mask The range to remove values from.
+	 */
+	void Erase(const irc::sockets::cidr_mask& mask)
+	{
+		Node* node = FindNode(mask);
+		if (node)
+			RemoveNode(node);
+	}
+
+	/** Retrieves the total of the values for addresses within a CIDR range.
+	 * @param mask The range to retrieve the total for.
+	 * @return The total or nullptr if no values have been added in the range. The returned pointer
+	 * is only valid until the tree is next modified.
+	 */
+	const Value* Get(const irc::sockets::cidr_mask& mask) const
+	{
+		const Node* node = FindNode(mask);
+		return node ? &node->value : nullptr;
+	}
+
+	/** Removes all values from the tree. */
+	void Clear() { roots.clear(); }
+
+	/** Determines whether the tree is empty. */
+	bool IsEmpty() const { return roots.empty(); }
+};
@@ -219,6 +219,43 @@ public:
 		}
 	};
 
+	/** Contains the parts of a serialized message which are the same regardless of which tags are included.
+	 * Serializers can build each serialized form of a message from these rather than serializing it from
+	 * scratch for every distinct tag selection.
+	 */
+	struct SerializedParts final
+	{
+		/** The serializer which created the parts or nullptr if they have not been created yet. */
+		const Serializer* serializer = nullptr;
+
+		/** The message without any tags. */
+		std::string body;
+
+		/** The serialized form of each tag in the same order as the tag map. */
+		std::vector<std::string> tags;
+
+		SerializedParts() = default;
+
+		/** The parts are not copied along with a message as the copy may have tags added to it. */
+		SerializedParts(const SerializedParts&)
+		{
+		}
+
+		SerializedParts& operator=(const SerializedParts&)
+		{
+			Clear();
+			return *this;
+		}
+
+		/** Removes the parts so that they are created again when they are next needed. */
+		void Clear()
+		{
+			serializer = nullptr;
+			body.clear();
+			tags.clear();
+		}
+	};
+
 	class Param final
 	{
 		const std::string* ptr;
@@ -310,6 +347,7 @@ private:
 	std::string command;
 	bool msginit_done = false;
 	mutable SerializedList serlist;
+	mutable SerializedParts serparts;
 	bool sideeffect = false;
 
 protected:
@@ -425,7 +463,8 @@ public:
 	 */
 	void AddTag(const std::string& tagname, MessageTagProvider* tagprov, const std::string& val, void* tagdata = nullptr)
 	{
-		tags.emplace(tagname, MessageTagData(tagprov, val, tagdata));
+		if (tags.emplace(tagname, MessageTagData(tagprov, val, tagdata)).second)
+			serparts.Clear();
 	}
 
 	/** Add all tags in a TagMap to the tags in this message. Existing tags will not be overwritten.
@@ -434,6 +473,7 @@ public:
 	void AddTags(const ClientProtocol::TagMap& newtags)
 	{
 		tags.insert(newtags.begin(), newtags.end());
+		serparts.Clear();
 	}
 
 	/** Get the message in a serialized form.
@@ -461,6 +501,7 @@ public:
 	void InvalidateCache()
 	{
 		serlist.clear();
+		serparts.Clear();
 	}
 
 	void CopyAll()
@@ -722,6 +763,20 @@ private:
 	 */
 	static TagSelection MakeTagWhitelist(LocalUser* user, const TagMap& tagmap);
 
+protected:
+	/** Get the parts of a message which are the same for every user, creating them with SerializeParts() if needed.
+	 * @param msg Message to get the parts of.
+	 * @return The parts of the message. The reference remains valid until the message is changed.
+	 */
+	const Message::SerializedParts& GetSerializedParts(const Message& msg) const;
+
+	/** Serialize the parts of a message which are the same for every user. Serializers which override this can
+	 * use GetSerializedParts() in Serialize() to avoid serializing the entire message for every tag selection.
+	 * @param msg Message to serialize.
+	 * @param parts The parts to fill in.
+	 */
+	virtual void SerializeParts(const Message& msg, Message::SerializedParts& parts) const { }
+
 public:
 	/** Constructor.
 	 * @param mod Module owning the serializer.
@@ -34,7 +34,10 @@ struct ParseStack final
 
 	ParseStack(ServerConfig* conf);
 	bool ParseFile(const std::string& name, int flags, const std::string& mandatory_tag = std::string(), bool isexec = false);
+	bool ParseContents(const std::string& name, const std::string& contents, int flags, const std::string& mandatory_tag);
 	void DoInclude(const std::shared_ptr<ConfigTag>& includeTag, int flags);
 	void DoReadFile(const std::string& key, const std::string& file, int flags, bool exec);
 	static FilePtr DoOpenFile(const std::string& name, bool isexec);
+	static bool DoReadContents(const FilePtr& file, std::string& contents);
+	static void DoReadContents(const std::vector<FilePtr>& files, std::vector<std::string>& contents, std::vector<int>& errors);
 };
@@ -256,9 +256,15 @@ private:
 	/** Holds the server config. */
 	typedef std::multimap<std::string, std::shared_ptr<ConfigTag>, irc::insensitive_swo> TagMap;
 
+	/** Holds a hash of the contents of all of the tags with a specific name. */
+	typedef insp::flat_map<std::string, uint64_t, irc::insensitive_swo> TagHashMap;
+
 	/** The server config. */
 	TagMap config_data;
 
+	/** The hashes of the tags in the server config. */
+	TagHashMap taghashes;
+
 	/** Whether any errors occurred whilst reading the server config. */
 	std::stringstream errstr;
 
@@ -271,6 +277,9 @@ private:
 	/** Whether the server config is valid. */
 	bool valid;
 
+	/** Calculates the hashes of the tags in the server config. */
+	void HashTags();
+
 	/** Loads added modules and unloads any removed ones.
 	 * @param user If non-nullptr then the user who initiated this config load.
 	 */
@@ -538,6 +547,12 @@ public:
 	/** Retrieves the list of modules that were specified in the config. */
 	std::vector<std::string> GetModules() const;
 
+	/** Retrieves a hash of the contents of all tags with the specified name.
+	 * @param tag The name of the tags to retrieve the hash of.
+	 * @return The hash of the tags or 0 if there are no tags with the specified name.
+	 */
+	uint64_t GetTagHash(const std::string& tag) const;
+
 	/** Retrieves the server description which should be shown to users. */
 	const auto& GetServerDesc() const { return HideServer.empty() ? ServerDesc : Network; }
 
@@ -602,13 +617,27 @@ public:
 	/** The user who initiated the config load or NULL if not initiated by a user. */
 	User* const srcuser;
 
+	/** The config which was in use before this config load or NULL if not known. */
+	const ServerConfig* const previous;
+
 	/** Initializes a new instance of the ConfigStatus class.
 	 * @param user The user who initiated the config load or NULL if not initiated by a user.
 	 * @param isinitial Whether this is the initial config load.
+	 * @param prev The config which was in use before this config load or NULL if not known.
 	 */
-	ConfigStatus(User* user = nullptr, bool isinitial = false)
+	ConfigStatus(User* user = nullptr, bool isinitial = false, const ServerConfig* prev = nullptr)
 		: initial(isinitial)
 		, srcuser(user)
+		, previous(prev)
 	{
 	}
+
+	/** Determines whether the tags with the specified name might have changed since the last
+	 * config load. Modules which do expensive work for large numbers of tags can use this to
+	 * skip that work when the tags are unchanged.
+	 * @param tag The name of the tags to check.
+	 * @return True if the tags have changed or it is not known whether they have changed;
+	 *         otherwise, false.
+	 */
+	bool HasChanged(const std::string& tag) const;
 };
@@ -248,6 +248,9 @@ public:
 	/** The number of times this command has been executed. */
 	unsigned long use_count = 0;
 
+	/** The time taken to execute this command when used by local users. */
+	DurationHistogram latency;
+
 	/** If non-empty then the syntax of the parameter for this command. */
 	std::vector<std::string> syntax;
 
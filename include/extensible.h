@@ -43,8 +43,76 @@ class CoreExport Extensible
 	: public Cullable
 {
 public:
-	/** The container which extension values are stored in. */
-	typedef insp::flat_map<ExtensionItem*, void*> ExtensibleStore;
+	/** The container which extension values are stored in. Values are stored in a dense array
+	 * indexed by the slot which ExtensionManager assigned to the extension when it was registered.
+	 * Values for extensions which do not have a slot are kept in a separate list so they are not lost.
+	 */
+	class CoreExport ExtensibleStore final
+	{
+	public:
+		/** Iterates over the extensions which are set in an ExtensibleStore. */
+		class CoreExport const_iterator final
+		{
+		private:
+			/** The store which is being iterated over. */
+			const ExtensibleStore* store;
+
+			/** The current slot within the store. */
+			size_t slot;
+
+			/** Advances to the next slot which has a value set. */
+			void Skip();
+
+		public:
+			const_iterator(const ExtensibleStore* s, size_t sl)
+				: store(s)
+				, slot(sl)
+			{
+				Skip();
+			}
+
+			std::pair<ExtensionItem*, void*> operator*() const;
+			const_iterator& operator++() { slot++; Skip(); return *this; }
+			bool operator==(const const_iterator& other) const { return slot == other.slot; }
+			bool operator!=(const const_iterator& other) const { return slot != other.slot; }
+		};
+
+		ExtensibleStore(ExtensionType exttype)
+			: type(exttype)
+		{
+		}
+
+		const_iterator begin() const { return const_iterator(this, 0); }
+		const_iterator end() const { return const_iterator(this, values.size() + unslotted.size()); }
+
+		/** Removes all values from the store. */
+		void clear() { values.clear(); unslotted.clear(); count = 0; }
+
+		/** Determines whether the store is empty. */
+		bool empty() const { return !count; }
+
+		/** Retrieves the value of the specified extension or nullptr if it is not set. */
+		void* Get(const ExtensionItem* item) const;
+
+		/** Sets the value of the specified extension and returns the old value. */
+		void* Set(const ExtensionItem* item, void* value);
+
+		/** Retrieves the number of extensions which are set. */
+		size_t size() const { return count; }
+
+	private:
+		/** The type of extensible that this store belongs to. */
+		ExtensionType type;
+
+		/** The values of the extensions indexed by slot. */
+		std::vector<void*> values;
+
+		/** The values of extensions which do not have a slot for this type of extensible. */
+		std::vector<std::pair<const ExtensionItem*, void*>> unslotted;
+
+		/** The number of non-null values. */
+		size_t count = 0;
+	};
 
 	/** Allows extensions to access the extension store. */
 	friend class ExtensionItem;
@@ -101,6 +169,22 @@ public:
 	 */
 	ExtensionItem* GetItem(const std::string& name);
 
+	/** Finishes unregistering extensions once they have been removed from all extensibles.
+	 * @param list The list of extensions returned by BeginUnregister.
+	 */
+	void EndUnregister(const std::vector<ExtensionItem*>& list);
+
+	/** Retrieves the extension which is stored in the specified slot.
+	 * @param type The type of extensible that the slot is for.
+	 * @param slot The slot to look up.
+	 * @return Either the extension stored in the specified slot or nullptr if it is unused.
+	 */
+	ExtensionItem* GetSlot(ExtensionType type, size_t slot) const
+	{
+		const auto& typeslots = slots[static_cast<uint8_t>(type)];
+		return slot < typeslots.size() ? typeslots[slot] : nullptr;
+	}
+
 	/** Registers an extension with the manager.
 	 * @return Either true if the extension was registered or false if an extension with the same
 	 *         name already exists.
@@ -110,4 +194,7 @@ public:
 private:
 	/** Registered extensions keyed by their names. */
 	ExtMap types;
+
+	/** Registered extensions indexed by type and then by slot. */
+	std::vector<ExtensionItem*> slots[3];
 };
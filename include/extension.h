@@ -26,6 +26,13 @@
 class CoreExport ExtensionItem
 	: public ServiceProvider
 {
+private:
+	friend class Extensible;
+	friend class ExtensionManager;
+
+	/** The slot that values for this extension are stored in. Assigned when registered. */
+	size_t slot = SIZE_MAX;
+
 public:
 	/** The type of extensible that this extension extends. */
 	const ExtensionType extype:2;
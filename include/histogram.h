@@ -0,0 +1,89 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <chrono>
+
+/** Counts observed values in buckets which each cover twice the range of the previous one. This
+ * is cheap enough to update on hot paths as observing a value only increments two integers.
+ * @tparam Base The inclusive upper bound of the first bucket.
+ */
+template <uint64_t Base>
+class Histogram final
+{
+public:
+	/** The number of buckets including the final bucket which has no upper bound. */
+	static constexpr size_t BUCKETS = 24;
+
+	/** The number of values which have been observed in each bucket. */
+	std::array<uint64_t, BUCKETS> counts = { };
+
+	/** The total of all of the values which have been observed. */
+	uint64_t sum = 0;
+
+	/** Retrieves the inclusive upper bound of the specified bucket. The last bucket has no upper bound. */
+	static constexpr uint64_t GetBound(size_t bucket) { return Base << bucket; }
+
+	/** Retrieves the total number of values which have been observed. */
+	uint64_t GetCount() const
+	{
+		uint64_t count = 0;
+		for (const auto bucketcount : counts)
+			count += bucketcount;
+		return count;
+	}
+
+	/** Observes a value.
+	 * @param value The value to observe.
+	 */
+	void Observe(uint64_t value)
+	{
+		size_t bucket = 0;
+		while (bucket < BUCKETS - 1 && value > GetBound(bucket))
+			bucket++;
+
+		counts[bucket]++;
+		sum += value;
+	}
+};
+
+/** A histogram of durations in nanoseconds with buckets starting at one microsecond. */
+typedef Histogram<1000> DurationHistogram;
+
+/** Observes the time between its creation and its destruction in a DurationHistogram. */
+class ScopedTimer final
+{
+private:
+	/** The histogram to observe the duration in. */
+	DurationHistogram& histogram;
+
+	/** The time at which the timer was created. */
+	const std::chrono::steady_clock::time_point start;
+
+public:
+	ScopedTimer(DurationHistogram& hist)
+		: histogram(hist)
+		, start(std::chrono::steady_clock::now())
+	{
+	}
+
+	~ScopedTimer()
+	{
+		histogram.Observe(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	}
+};
@@ -49,6 +49,7 @@
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #ifndef _WIN32
@@ -72,6 +73,8 @@ CoreExport extern InspIRCd* ServerInstance;
 #include "dynref.h"
 #include "cull.h"
 #include "extensible.h"
+#include "slabpool.h"
+#include "histogram.h"
 #include "ctables.h"
 #include "numeric.h"
 #include "uid.h"
@@ -133,6 +136,10 @@ public:
 	 */
 	unsigned long Recv = 0;
 
+	/** Time spent in each iteration of the main loop, excluding the time spent waiting for events
+	 */
+	DurationHistogram LoopTime;
+
 #ifdef _WIN32
 	/** Cpu usage at last sample
 	*/
@@ -250,6 +250,21 @@ public:
 	/** The properties of this module. */
 	const int properties;
 
+	/** Statistics about the time spent in the event handlers of a module. */
+	struct HookStats final
+	{
+		/** The number of times that the event handlers of the module have been called. */
+		unsigned long calls = 0;
+
+		/** The total time in nanoseconds spent in the event handlers of the module. This includes
+		 * the time spent in the event handlers of other modules which they call.
+		 */
+		uint64_t time = 0;
+	};
+
+	/** Statistics about the time spent in the event handlers of this module. */
+	mutable HookStats hookstats;
+
 	/** Module setup
 	 * \exception ModuleException Throwing this class, or any class derived from ModuleException, causes loading of the module to abort.
 	 */
@@ -953,6 +968,30 @@ public:
 	virtual void OnPostChangeConnectClass(LocalUser* user, bool force) ATTR_NOT_NULL(2);
 };
 
+/** Adds the time between its creation and its destruction to the hook statistics of a module. */
+class HookTimer final
+{
+private:
+	/** The statistics to add the time to. */
+	Module::HookStats& stats;
+
+	/** The time at which the timer was created. */
+	const std::chrono::steady_clock::time_point start;
+
+public:
+	HookTimer(const Module* mod)
+		: stats(mod->hookstats)
+		, start(std::chrono::steady_clock::now())
+	{
+	}
+
+	~HookTimer()
+	{
+		stats.calls++;
+		stats.time += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
 /** ModuleManager takes care of all things module-related
  * in the core.
  */
@@ -1196,7 +1235,10 @@ public:
 			try \
 			{ \
 				if (!_mod->dying) \
+				{ \
+					const HookTimer _timer(_mod); \
 					_mod->EVENT ARGS; \
+				} \
 			} \
 			catch (const CoreException& _exception_ ## EVENT) \
 			{ \
@@ -1221,6 +1263,7 @@ public:
 			{ \
 				if (_mod->dying) \
 					continue; \
+				const HookTimer _timer(_mod); \
 				RESULT = _mod->EVENT ARGS; \
 				if (RESULT != MOD_RES_PASSTHRU) \
 					break; \
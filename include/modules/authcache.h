@@ -0,0 +1,257 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "modules/hash.h"
+
+/** A bounded cache of the results of authenticating users against an external backend. Entries
+ * are keyed on a HMAC-SHA256 of the data which was sent to the backend (including credentials)
+ * using a secret which is generated on load so the cache never holds plaintext credentials.
+ */
+class AuthCache final
+{
+public:
+	/** A cached authentication result. */
+	struct Entry final
+	{
+		/** Backend-specific data about a successful result. */
+		std::string data;
+
+		/** The time at which this entry expires. */
+		time_t expires;
+
+		/** A human readable label which can be used to invalidate the entry (e.g. an account name). */
+		std::string label;
+
+		/** Whether the authentication was successful. */
+		bool success;
+	};
+
+private:
+	typedef std::list<std::pair<std::string, Entry>> EntryList;
+
+	/** The cached entries in most recently used order. */
+	EntryList entries;
+
+	/** The cached entries keyed by the HMAC of their input. */
+	std::unordered_map<std::string, EntryList::iterator> entrymap;
+
+	/** The maximum number of entries to cache. */
+	size_t maxentries = 0;
+
+	/** The duration to cache failed authentication results for. */
+	unsigned long negativettl = 0;
+
+	/** The duration to cache successful authentication results for. */
+	unsigned long positivettl = 0;
+
+	/** The secret used when generating keys. */
+	const std::string secret;
+
+	/** A reference to the SHA-256 provider. */
+	dynamic_reference_nocheck<HashProvider> sha256;
+
+public:
+	/** The number of lookups which were answered from the cache. */
+	unsigned long hits = 0;
+
+	/** The number of lookups which were not answered from the cache. */
+	unsigned long misses = 0;
+
+	AuthCache(Module* mod)
+		: secret(ServerInstance->GenRandomStr(32, false))
+		, sha256(mod, "hash/sha256")
+	{
+	}
+
+	/** Reads the cache settings from the specified config tag and clears the cache. */
+	void Configure(const std::shared_ptr<ConfigTag>& tag)
+	{
+		positivettl = tag->getDuration("cache", 0);
+		negativettl = tag->getDuration("negcache", std::min<unsigned long>(positivettl, 60));
+		maxentries = tag->getNum<size_t>("cachesize", 10000, 1);
+		Clear();
+	}
+
+	/** Clears all entries from the cache.
+	 * @return The number of entries which were removed.
+	 */
+	size_t Clear()
+	{
+		const size_t count = entries.size();
+		entries.clear();
+		entrymap.clear();
+		return count;
+	}
+
+	/** Clears all entries with a label matching the specified glob pattern from the cache.
+	 * @return The number of entries which were removed.
+	 */
+	size_t Clear(const std::string& mask)
+	{
+		size_t count = 0;
+		for (auto it = entries.begin(); it != entries.end(); )
+		{
+			if (InspIRCd::Match(it->second.label, mask))
+			{
+				entrymap.erase(it->first);
+				it = entries.erase(it);
+				count++;
+			}
+			else
+				it++;
+		}
+		return count;
+	}
+
+	/** Determines whether the cache is enabled. */
+	bool IsEnabled() const
+	{
+		return (positivettl || negativettl) && sha256;
+	}
+
+	/** Creates a cache key from the data which is sent to the backend.
+	 * @param parts The data to generate a key from.
+	 * @return The key or an empty string if the cache is not enabled.
+	 */
+	std::string MakeKey(const std::vector<std::string>& parts)
+	{
+		if (!IsEnabled())
+			return {};
+
+		std::string data;
+		for (const auto& part : parts)
+		{
+			// Include the length so that the boundaries between parts can not be moved.
+			data.append(ConvToStr(part.length())).push_back(':');
+			data.append(part);
+		}
+		return sha256->hmac(secret, data);
+	}
+
+	/** Looks up a cached authentication result.
+	 * @param key The key returned by MakeKey.
+	 * @return The cached entry or nullptr if there is no valid entry.
+	 */
+	const Entry* Find(const std::string& key)
+	{
+		if (key.empty())
+			return nullptr;
+
+		auto it = entrymap.find(key);
+		if (it == entrymap.end())
+		{
+			misses++;
+			return nullptr;
+		}
+
+		if (it->second->second.expires <= ServerInstance->Time())
+		{
+			entries.erase(it->second);
+			entrymap.erase(it);
+			misses++;
+			return nullptr;
+		}
+
+		// Move the entry to the front of the list so it is evicted last.
+		entries.splice(entries.begin(), entries, it->second);
+		hits++;
+		return &it->second->second;
+	}
+
+	/** Adds an authentication result to the cache.
+	 * @param key The key returned by MakeKey.
+	 * @param label A human readable label which can be used to invalidate the entry.
+	 * @param success Whether the authentication was successful.
+	 * @param data Backend-specific data about a successful result.
+	 */
+	void Add(const std::string& key, const std::string& label, bool success, const std::string& data = {})
+	{
+		const unsigned long ttl = success ? positivettl : negativettl;
+		if (key.empty() || !ttl)
+			return;
+
+		auto it = entrymap.find(key);
+		if (it != entrymap.end())
+		{
+			entries.erase(it->second);
+			entrymap.erase(it);
+		}
+
+		while (entries.size() >= maxentries)
+		{
+			entrymap.erase(entries.back().first);
+			entries.pop_back();
+		}
+
+		entries.emplace_front(key, Entry { data, ServerInstance->Time() + static_cast<time_t>(ttl), label, success });
+		entrymap.emplace(key, entries.begin());
+	}
+
+	/** Retrieves the number of entries in the cache. */
+	size_t GetSize() const { return entries.size(); }
+
+	/** Retrieves a human readable summary of the cache statistics. */
+	std::string GetStats() const
+	{
+		const unsigned long total = hits + misses;
+		return INSP_FORMAT("{} of {} entries in use; {} hits and {} misses ({}% hit rate)", entries.size(), maxentries,
+			hits, misses, total ? hits * 100 / total : 0);
+	}
+};
+
+/** Handles the command which manages an AuthCache. */
+class CommandAuthCache final
+	: public SplitCommand
+{
+private:
+	AuthCache& cache;
+
+public:
+	CommandAuthCache(Module* mod, const std::string& cmdname, AuthCache& ac)
+		: SplitCommand(mod, cmdname, 1, 2)
+		, cache(ac)
+	{
+		access_needed = CmdAccess::OPERATOR;
+		syntax = { "CLEAR [<mask>]", "STATS" };
+	}
+
+	CmdResult HandleLocal(LocalUser* user, const Params& parameters) override
+	{
+		if (irc::equals(parameters[0], "CLEAR"))
+		{
+			const size_t count = parameters.size() > 1 ? cache.Clear(parameters[1]) : cache.Clear();
+			user->WriteNotice(INSP_FORMAT("*** {}: Removed {} entries from the authentication cache.", name, count));
+			ServerInstance->SNO.WriteToSnoMask('a', "{} cleared {} entries from the {} authentication cache{}{}.", user->nick,
+				count, name, parameters.size() > 1 ? " matching " : "", parameters.size() > 1 ? parameters[1] : "");
+			return CmdResult::SUCCESS;
+		}
+
+		if (irc::equals(parameters[0], "STATS"))
+		{
+			if (cache.IsEnabled())
+				user->WriteNotice(INSP_FORMAT("*** {}: Authentication cache: {}.", name, cache.GetStats()));
+			else
+				user->WriteNotice(INSP_FORMAT("*** {}: The authentication cache is disabled.", name));
+			return CmdResult::SUCCESS;
+		}
+
+		user->WriteNotice(INSP_FORMAT("*** {}: Unknown subcommand {}; valid subcommands are CLEAR and STATS.", name, parameters[0]));
+		return CmdResult::FAILURE;
+	}
+};
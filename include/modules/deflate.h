@@ -0,0 +1,102 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+namespace Deflate
+{
+	class Provider;
+	class Stream;
+
+	/** The smallest LZ77 window size (in bits) which can be requested. */
+	static constexpr int MIN_WINDOW_BITS = 9;
+
+	/** The largest LZ77 window size (in bits) which can be requested. */
+	static constexpr int MAX_WINDOW_BITS = 15;
+
+	/** The smallest amount of memory (in bits) which can be used for the compression state. */
+	static constexpr int MIN_MEM_LEVEL = 1;
+
+	/** The largest amount of memory (in bits) which can be used for the compression state. */
+	static constexpr int MAX_MEM_LEVEL = 9;
+}
+
+/** A raw (headerless) DEFLATE compression or decompression stream. */
+class Deflate::Stream
+{
+public:
+	virtual ~Stream() = default;
+
+	/** Compresses data and flushes it to a byte boundary so the receiver can decompress all of it.
+	 * The output always ends with an empty stored block (00 00 FF FF).
+	 * @param in The data to compress.
+	 * @param out The string to append the compressed data to.
+	 * @return True if the data was compressed; otherwise, false.
+	 */
+	virtual bool Compress(std::string_view in, std::string& out) = 0;
+
+	/** Decompresses data.
+	 * @param in The data to decompress.
+	 * @param out The string to append the decompressed data to.
+	 * @param maxlength The maximum length that out is allowed to reach.
+	 * @return True if the data was decompressed; otherwise, false if the data was malformed or
+	 *         decompressing it would make out longer than maxlength.
+	 */
+	virtual bool Decompress(std::string_view in, std::string& out, size_t maxlength) = 0;
+
+	/** Discards the history of the stream so the next data is processed independently. */
+	virtual void Reset() = 0;
+
+	/** Retrieves the number of bytes of memory which are currently allocated by the stream. */
+	virtual size_t GetMemoryUsage() const = 0;
+};
+
+/** Provides raw DEFLATE compression and decompression streams. */
+class Deflate::Provider
+	: public DataProvider
+{
+public:
+	Provider(Module* mod)
+		: DataProvider(mod, "deflate")
+	{
+	}
+
+	/** Creates a compression stream.
+	 * @param windowbits The size of the LZ77 window in bits (MIN_WINDOW_BITS to MAX_WINDOW_BITS).
+	 * @param level The compression level (1 to 9).
+	 * @param memlevel The amount of memory to use for the compression state (MIN_MEM_LEVEL to MAX_MEM_LEVEL).
+	 * @return The new stream or nullptr if the stream could not be created.
+	 */
+	virtual std::unique_ptr<Stream> CreateCompressor(int windowbits, int level, int memlevel) = 0;
+
+	/** Creates a decompression stream.
+	 * @param windowbits The size of the LZ77 window in bits (MIN_WINDOW_BITS to MAX_WINDOW_BITS).
+	 * @return The new stream or nullptr if the stream could not be created.
+	 */
+	virtual std::unique_ptr<Stream> CreateDecompressor(int windowbits) = 0;
+
+	/** Estimates the number of bytes of memory which a compression stream will use.
+	 * @param windowbits The size of the LZ77 window in bits.
+	 * @param memlevel The amount of memory to use for the compression state.
+	 */
+	virtual size_t GetCompressorMemory(int windowbits, int memlevel) const = 0;
+
+	/** Estimates the number of bytes of memory which a decompression stream will use.
+	 * @param windowbits The size of the LZ77 window in bits.
+	 */
+	virtual size_t GetDecompressorMemory(int windowbits) const = 0;
+};
@@ -174,6 +174,12 @@ namespace DNS
 	class Manager : public DataProvider
 	{
 	public:
+		/** The number of requests which were answered from the cache. */
+		unsigned long stats_cachehits = 0;
+
+		/** The number of requests which were not in the cache or whose cached result had expired. */
+		unsigned long stats_cachemisses = 0;
+
 		Manager(Module* mod)
 			: DataProvider(mod, "DNS")
 		{
@@ -235,6 +235,21 @@ public:
 	}
 };
 
+/** Produces the body of a HTTP response incrementally as the client reads it. This allows
+ * large responses to be sent without building the entire document in memory first.
+ */
+class HTTPResponseStream
+{
+public:
+	virtual ~HTTPResponseStream() = default;
+
+	/** Called when the client is ready for more of the response body.
+	 * @param out The string to append the next part of the response body to.
+	 * @return True if there is more of the response body to write; otherwise, false.
+	 */
+	virtual bool Write(std::string& out) = 0;
+};
+
 /** If you want to reply to HTTP requests, you must return a HTTPDocumentResponse to
  * the httpd module via the HTTPdAPI.
  * When you initialize this class you initialize it with all components required to
@@ -255,6 +270,12 @@ public:
 	 */
 	HTTPHeaders headers;
 
+	/** If set then the rest of the response body after the document is produced by this stream
+	 * as the client reads it. The response is sent using chunked transfer encoding if the client
+	 * supports it.
+	 */
+	std::unique_ptr<HTTPResponseStream> stream;
+
 	HTTPRequest& src;
 
 	/** Initialize a HTTPDocumentResponse ready for sending to the httpd module.
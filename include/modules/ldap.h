@@ -98,6 +98,11 @@ struct LDAPResult final
 	std::vector<LDAPAttributes> messages;
 	std::string error;
 
+	/** Whether the server rejected the request (e.g. invalid credentials or a failed comparison)
+	 * rather than being unable to process it.
+	 */
+	bool rejected = false;
+
 	QueryType type = QUERY_UNKNOWN;
 	LDAPQuery id = -1;
 
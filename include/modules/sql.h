@@ -28,6 +28,7 @@ namespace SQL
 	class Provider;
 	class Query;
 	class Result;
+	class Template;
 
 	/** A list of parameter replacement values. */
 	typedef std::vector<std::string> ParamList;
@@ -231,6 +232,172 @@ public:
 	virtual void Submit(Query* callback, const std::string& format, const ParamMap& p) = 0;
 };
 
+/** Represents a parameterized query template which has been converted into a form that can be
+ * used with a prepared statement. Placeholders are only converted when they are the only content
+ * of a single-quoted string literal (e.g. '$nick'). Unquoted placeholders have always been replaced
+ * with the raw text of the parameter and may be used for things which can not be bound such as
+ * identifiers or lists of values. If a placeholder is unquoted or is embedded inside other text the
+ * template can not be prepared and the provider should fall back to escaping the parameters into the
+ * query string instead.
+ */
+class SQL::Template final
+{
+public:
+	/** A function which returns the backend-specific marker for the 1-indexed parameter. */
+	typedef std::function<std::string(size_t)> MarkerFunc;
+
+	/** The names of the parameters in the order they appear in the query. Empty for '?' templates. */
+	std::vector<std::string> names;
+
+	/** The number of parameters in the query. */
+	size_t params = 0;
+
+	/** The query with the placeholders replaced with backend-specific markers. */
+	std::string query;
+
+	/** Converts a query template.
+	 * @param format The parameterized query string.
+	 * @param named If true then '$name' placeholders are converted; otherwise, '?' placeholders are.
+	 * @param marker A function which returns the backend-specific marker for a parameter.
+	 * @return True if the template could be converted; otherwise, false.
+	 */
+	bool Convert(const std::string& format, bool named, const MarkerFunc& marker)
+	{
+		names.clear();
+		params = 0;
+		query.clear();
+		query.reserve(format.length());
+
+		for (size_t pos = 0; pos < format.length(); )
+		{
+			const char chr = format[pos];
+			if (chr == '\\' || chr == '"')
+			{
+				// We don't parse escaped characters or quoted identifiers so bail if one contains a placeholder.
+				size_t endpos = chr == '\\' ? pos + 2 : format.find('"', pos + 1);
+				if (endpos == std::string::npos)
+					endpos = format.length();
+				else if (chr == '"')
+					endpos++;
+
+				endpos = std::min(endpos, format.length());
+				if (HasPlaceholder(format, pos, endpos, named))
+					return false;
+
+				query.append(format, pos, endpos - pos);
+				pos = endpos;
+			}
+			else if (chr == '\'')
+			{
+				// Find the end of the literal, skipping any doubled or escaped quotes.
+				size_t endpos = pos + 1;
+				while (endpos < format.length())
+				{
+					if (format[endpos] == '\\')
+						endpos += 2;
+					else if (format[endpos] != '\'')
+						endpos++;
+					else if (endpos + 1 < format.length() && format[endpos + 1] == '\'')
+						endpos += 2;
+					else
+						break;
+				}
+				if (endpos >= format.length())
+					return false; // Unterminated literal.
+
+				std::string name;
+				size_t placeholderend = ReadPlaceholder(format, pos + 1, named, name);
+				if (placeholderend != pos + 1 && placeholderend == endpos)
+				{
+					// The literal contains only a placeholder.
+					AddParam(name, marker);
+				}
+				else if (HasPlaceholder(format, pos + 1, endpos, named))
+				{
+					// The placeholder is embedded in other text.
+					return false;
+				}
+				else
+				{
+					query.append(format, pos, endpos - pos + 1);
+				}
+				pos = endpos + 1;
+			}
+			else
+			{
+				std::string name;
+				if (ReadPlaceholder(format, pos, named, name) != pos)
+					return false; // Unquoted placeholders are substituted as raw text.
+
+				query.push_back(chr);
+				pos++;
+			}
+		}
+		return true;
+	}
+
+	/** Retrieves the values of the parameters in the order they appear in the query.
+	 * @param p Parameters to fill in for the '?' entries.
+	 */
+	ParamList GetValues(const ParamList& p) const
+	{
+		ParamList values(p.begin(), p.begin() + std::min(p.size(), params));
+		values.resize(params);
+		return values;
+	}
+
+	/** Retrieves the values of the parameters in the order they appear in the query.
+	 * @param p Parameters to fill in for the '$name' entries.
+	 */
+	ParamList GetValues(const ParamMap& p) const
+	{
+		ParamList values;
+		values.reserve(names.size());
+		for (const auto& name : names)
+		{
+			auto it = p.find(name);
+			values.push_back(it == p.end() ? std::string() : it->second);
+		}
+		return values;
+	}
+
+private:
+	/** Adds a parameter to the converted query. */
+	void AddParam(const std::string& name, const MarkerFunc& marker)
+	{
+		if (!name.empty())
+			names.push_back(name);
+		query.append(marker(++params));
+	}
+
+	/** Determines whether the specified range of a query contains a placeholder. */
+	static bool HasPlaceholder(const std::string& format, size_t pos, size_t endpos, bool named)
+	{
+		const auto it = std::find(format.begin() + pos, format.begin() + endpos, named ? '$' : '?');
+		return it != format.begin() + endpos;
+	}
+
+	/** Reads a placeholder from the specified position.
+	 * @return The position after the placeholder or \p pos if there is no placeholder.
+	 */
+	static size_t ReadPlaceholder(const std::string& format, size_t pos, bool named, std::string& name)
+	{
+		if (pos >= format.length() || format[pos] != (named ? '$' : '?'))
+			return pos;
+
+		size_t endpos = pos + 1;
+		if (named)
+		{
+			while (endpos < format.length() && isalnum(format[endpos]))
+				endpos++;
+			if (endpos == pos + 1)
+				return pos; // No name.
+			name.assign(format, pos + 1, endpos - pos - 1);
+		}
+		return endpos;
+	}
+};
+
 inline void SQL::PopulateUserInfo(User* user, ParamMap& userinfo)
 {
 	userinfo.insert({
@@ -0,0 +1,249 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "threadsocket.h"
+
+namespace SSLHandshake
+{
+	class Job;
+	class Pool;
+	class Transport;
+	class Worker;
+
+	/** The maximum amount of data which will be buffered from a peer whilst its handshake is running. */
+	static constexpr size_t MAX_RECVQ = 65536;
+}
+
+/** Buffers the data which is exchanged with the peer of a TLS session so that its handshake can be
+ * run on a worker thread. Whilst the handshake is offloaded the TLS library must only read from and
+ * write to the queues. Once it has finished it must read any data which is still in the receive
+ * queue and write any data which is still in the send queue before using the socket again.
+ */
+class SSLHandshake::Transport
+{
+public:
+	/** The socket which the session is running over. This must only be used on the main thread. */
+	StreamSocket* const sock;
+
+	/** Data which has been received from the peer but not read by the TLS library yet. */
+	std::string recvq;
+
+	/** Data which has been written by the TLS library but not sent to the peer yet. */
+	std::string sendq;
+
+	/** Whether the handshake is currently running on a worker thread. */
+	bool offloaded = false;
+
+	Transport(StreamSocket* s)
+		: sock(s)
+	{
+	}
+
+	virtual ~Transport() = default;
+
+	/** Moves the data which is waiting on the socket into the receive queue.
+	 * @return The number of bytes which were read or -1 if the socket errored.
+	 */
+	ssize_t Fill()
+	{
+		ssize_t total = 0;
+		char* buffer = ServerInstance->GetReadBuffer();
+		const size_t bufsize = ServerInstance->Config->NetBufferSize;
+		while (recvq.length() < MAX_RECVQ)
+		{
+			const ssize_t ret = SocketEngine::Recv(sock, buffer, bufsize, 0);
+			if (ret > 0)
+			{
+				recvq.append(buffer, ret);
+				total += ret;
+				if (static_cast<size_t>(ret) < bufsize)
+					break; // The socket has been drained.
+			}
+			else if (ret == 0)
+			{
+				sock->SetError("Connection closed");
+				return -1;
+			}
+			else if (SocketEngine::IgnoreError())
+				break;
+			else if (errno != EINTR)
+			{
+				sock->SetError(SocketEngine::LastError());
+				return -1;
+			}
+		}
+		return total;
+	}
+
+	/** Sends as much of the send queue as the socket will accept.
+	 * @return 1 if the send queue was emptied, 0 if the socket blocked, or -1 if the socket errored.
+	 */
+	int Flush()
+	{
+		while (!sendq.empty())
+		{
+			const ssize_t ret = SocketEngine::Send(sock, sendq.data(), sendq.length(), 0);
+			if (ret > 0)
+				sendq.erase(0, ret);
+			else if (ret < 0 && SocketEngine::IgnoreError())
+				return 0;
+			else if (ret < 0 && errno == EINTR)
+				continue;
+			else
+			{
+				sock->SetError(ret ? SocketEngine::LastError() : "Connection closed");
+				return -1;
+			}
+		}
+		return 1;
+	}
+};
+
+/** A step of a TLS handshake which is run on a worker thread. */
+class SSLHandshake::Job
+{
+public:
+	virtual ~Job() = default;
+
+	/** Runs the handshake until it needs more data from the peer. This is called on a worker
+	 * thread so it must not touch anything other than the TLS session and its transport.
+	 */
+	virtual void Run() = 0;
+
+	/** Called on the main thread after Run() has returned. */
+	virtual void OnComplete() = 0;
+};
+
+/** A thread which runs handshake jobs. */
+class SSLHandshake::Worker final
+	: public SocketThread
+{
+private:
+	/** Jobs which are waiting to be run. MUST HOLD MUTEX. */
+	std::deque<Job*> pending;
+
+	/** Jobs which have been run but not completed on the main thread yet. MUST HOLD MUTEX. */
+	std::deque<Job*> finished;
+
+protected:
+	void OnStart() override
+	{
+		LockQueue();
+		while (!IsStopping())
+		{
+			if (pending.empty())
+			{
+				WaitForQueue();
+				continue;
+			}
+
+			Job* job = pending.front();
+			pending.pop_front();
+
+			UnlockQueue();
+			job->Run();
+			LockQueue();
+
+			finished.push_back(job);
+			NotifyParent();
+		}
+		UnlockQueue();
+	}
+
+public:
+	~Worker() override
+	{
+		Stop();
+
+		// The thread has stopped so any jobs it didn't get to have to be run here instead.
+		for (auto* job : pending)
+		{
+			job->Run();
+			finished.push_back(job);
+		}
+		pending.clear();
+		OnNotify();
+	}
+
+	/** Queues a job to be run on this thread. */
+	void Submit(Job* job)
+	{
+		LockQueue();
+		pending.push_back(job);
+		UnlockQueueWakeup();
+	}
+
+	void OnNotify() override
+	{
+		// Take the jobs out of the queue before completing them as completing a job may submit another.
+		std::deque<Job*> jobs;
+		LockQueue();
+		jobs.swap(finished);
+		UnlockQueue();
+
+		for (auto* job : jobs)
+		{
+			job->OnComplete();
+			delete job;
+		}
+	}
+};
+
+/** A pool of threads which run handshake jobs. */
+class SSLHandshake::Pool final
+{
+private:
+	/** The threads in the pool. */
+	std::vector<std::unique_ptr<Worker>> workers;
+
+	/** The index of the thread which the next job will be submitted to. */
+	size_t nextworker = 0;
+
+public:
+	/** Determines whether there are any threads to run jobs on. */
+	bool IsEnabled() const { return !workers.empty(); }
+
+	/** Changes the number of threads in the pool.
+	 * @param count The new number of threads. If this is zero then handshakes are run on the main thread.
+	 */
+	void SetThreads(size_t count)
+	{
+		while (workers.size() > count)
+		{
+			// Remove the thread from the pool first so that jobs which are completed
+			// whilst it is stopping are not submitted to it again.
+			std::unique_ptr<Worker> worker = std::move(workers.back());
+			workers.pop_back();
+		}
+
+		while (workers.size() < count)
+		{
+			workers.push_back(std::make_unique<Worker>());
+			workers.back()->Start();
+		}
+	}
+
+	/** Queues a job to be run on one of the threads in the pool. The pool takes ownership of the job.
+	 * @param job The job to run.
+	 */
+	void Submit(Job* job)
+	{
+		workers[nextworker++ % workers.size()]->Submit(job);
+	}
+};
@@ -0,0 +1,160 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "utility/uncopiable.h"
+
+/** Allocates fixed size objects from large blocks of memory ("slabs") to avoid the overhead and
+ * heap fragmentation of allocating lots of long lived objects individually. Memory is returned to
+ * the pool when an object is deleted and slabs which are entirely unused are released in batches
+ * when Trim() is called.
+ */
+class CoreExport SlabPool final
+	: private insp::uncopiable
+{
+public:
+	/** Statistics about the usage of a slab pool. */
+	struct Stats final
+	{
+		/** The number of objects which can be stored in the slabs that are allocated. */
+		size_t capacity;
+
+		/** The number of objects which are currently allocated. */
+		size_t inuse;
+
+		/** The number of bytes which are allocated for slabs. */
+		size_t memory;
+
+		/** The number of slabs which are allocated. */
+		size_t slabs;
+	};
+
+private:
+	/** A block of memory which objects are allocated from. */
+	struct Slab;
+
+	/** The slabs which have space for at least one more object. */
+	std::unordered_set<Slab*> available;
+
+	/** The number of slabs which have no objects allocated from them. */
+	size_t emptyslabs = 0;
+
+	/** The number of objects which are currently allocated. */
+	size_t inuse = 0;
+
+	/** The number of objects which are stored in each slab. */
+	const size_t perslab;
+
+	/** All slabs keyed by the address of their memory. */
+	std::map<uintptr_t, Slab> slabs;
+
+	/** The distance between objects in a slab. */
+	const size_t stride;
+
+	/** The size of the type which this pool allocates. */
+	const size_t typesize;
+
+	/** Allocates a new slab and adds it to the available slabs. */
+	void AddSlab();
+
+	/** Retrieves a list of all slab pools which exist. */
+	static std::vector<SlabPool*>& GetPoolList();
+
+public:
+	/** The human readable name of this pool. */
+	const std::string name;
+
+	/** Creates a new slab pool for objects of the specified size.
+	 * @param n The human readable name of the pool.
+	 * @param size The size of the type which will be allocated from the pool.
+	 */
+	SlabPool(const std::string& n, size_t size);
+
+	/** Releases all memory owned by the pool. */
+	~SlabPool();
+
+	/** Allocates memory for an object. If the size differs from the type size of the pool (e.g. it
+	 * is for a subclass) then the memory is allocated from the heap instead.
+	 * @param size The size of the object to allocate memory for.
+	 */
+	void* Allocate(size_t size);
+
+	/** Returns memory allocated by Allocate() to the pool.
+	 * @param ptr The memory to deallocate.
+	 * @param size The size of the object which was allocated.
+	 */
+	void Deallocate(void* ptr, size_t size);
+
+	/** Retrieves all slab pools which exist. */
+	static const std::vector<SlabPool*>& GetPools() { return GetPoolList(); }
+
+	/** Retrieves statistics about the usage of this pool. */
+	Stats GetStats() const;
+
+	/** Ensures that the pool has space for at least the specified number of additional objects
+	 * without having to allocate any more slabs.
+	 * @param count The number of objects to reserve space for.
+	 */
+	void Reserve(size_t count);
+
+	/** Releases slabs which have no objects allocated from them, keeping one spare slab. */
+	void Trim();
+
+	/** Calls Trim() on every slab pool. */
+	static void TrimAll();
+};
+
+/** An allocator which allocates single objects from a slab pool. This is intended to be used by
+ * node based containers (e.g. std::map) which allocate their nodes one at a time.
+ * @tparam T The type to allocate.
+ * @tparam Pool A type with a static GetPool(size_t) method which returns the pool to use.
+ */
+template <typename T, typename Pool>
+class SlabAllocator
+{
+public:
+	typedef T value_type;
+
+	SlabAllocator() = default;
+
+	template <typename U>
+	SlabAllocator(const SlabAllocator<U, Pool>&)
+	{
+	}
+
+	T* allocate(size_t n)
+	{
+		if (n != 1)
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+		return static_cast<T*>(Pool::GetPool(sizeof(T)).Allocate(sizeof(T)));
+	}
+
+	void deallocate(T* ptr, size_t n)
+	{
+		if (n != 1)
+			::operator delete(ptr);
+		else
+			Pool::GetPool(sizeof(T)).Deallocate(ptr, sizeof(T));
+	}
+
+	template <typename U>
+	bool operator==(const SlabAllocator<U, Pool>&) const { return true; }
+
+	template <typename U>
+	bool operator!=(const SlabAllocator<U, Pool>&) const { return false; }
+};
@@ -252,6 +252,9 @@ public:
 		unsigned long ReadEvents = 0;
 		unsigned long WriteEvents = 0;
 		unsigned long ErrorEvents = 0;
+
+		/** The time at which the socket engine last stopped waiting for events. */
+		std::chrono::steady_clock::time_point LastWake;
 	};
 
 private:
@@ -200,6 +200,15 @@ public:
 			nbytes += newdata.length();
 		}
 
+		/** Move a new buffer to the end of the queue
+		 * @param newdata Data to add
+		 */
+		void push_back(Element&& newdata)
+		{
+			nbytes += newdata.length();
+			data.push_back(std::move(newdata));
+		}
+
 		/** Clear the queue
 		 */
 		void clear()
@@ -342,6 +351,9 @@ public:
 	/** Retrieves the send queue. */
 	SendQueue& GetSendQ() { return sendq; }
 
+	/** Retrieves the current size of the receive queue. */
+	size_t GetRecvQSize() const { return recvq.length(); }
+
 	/**
 	 * Close the socket, remove from socket engine, etc
 	 */
@@ -26,6 +26,8 @@
 
 #include <list>
 
+#include "cidrtree.h"
+
 /** A mapping of user nicks or uuids to their User object. */
 typedef std::unordered_map<std::string, User*, irc::insensitive, irc::StrHashComp> UserMap;
 
@@ -36,11 +38,26 @@ public:
 	{
 		unsigned int global = 0;
 		unsigned int local = 0;
+
+		CloneCounts& operator+=(const CloneCounts& other)
+		{
+			global += other.global;
+			local += other.local;
+			return *this;
+		}
+
+		CloneCounts& operator-=(const CloneCounts& other)
+		{
+			global -= other.global;
+			local -= other.local;
+			return *this;
+		}
 	};
 
-	/** Container that maps IP addresses to clone counts
+	/** Tree that keeps clone counts for IP addresses. As this keeps counts for every range it
+	 * does not need to be rebuilt when the \<cidr> settings change.
 	 */
-	typedef std::map<irc::sockets::cidr_mask, CloneCounts> CloneMap;
+	typedef CIDRTree<CloneCounts> CloneTree;
 
 	/** Sequence container in which each element is a User*
 	 */
@@ -54,9 +71,9 @@ public:
 	typedef insp::intrusive_list<LocalUser> LocalList;
 
 private:
-	/** Map of IP addresses for clone counting
+	/** Tree of IP addresses for clone counting
 	 */
-	CloneMap clonemap;
+	CloneTree clonetree;
 
 	/** A CloneCounts that contains zero for both local and global
 	 */
@@ -124,7 +141,19 @@ public:
 	 */
 	void QuitUser(User* user, const std::string& quitreason, const std::string* operreason = nullptr) ATTR_NOT_NULL(2);
 
-	/** Add a user to the clone map
+	/** Disconnect multiple users gracefully (e.g. when a server splits from the network).
+	 * This is equivalent to calling QuitUser() for each user but the QUIT messages are delivered by
+	 * walking each affected channel once rather than once per quitting user.
+	 * @param users The users to remove.
+	 * @param quitreason The quit reason to show to normal users
+	 * @param operreason The quit reason to show to opers, can be NULL if same as quitreason
+	 * @param prepare If non-null then a function to call with each QUIT message before it is sent
+	 *                (e.g. to add it to a batch).
+	 */
+	void QuitUsers(const std::vector<User*>& users, const std::string& quitreason, const std::string* operreason = nullptr,
+		const std::function<void(ClientProtocol::Message&)>& prepare = nullptr);
+
+	/** Add a user to the clone tree
 	 * @param user The user to add
 	 */
 	void AddClone(User* user) ATTR_NOT_NULL(2);
@@ -136,10 +165,6 @@ public:
 	 */
 	void RemoveCloneCounts(User* user) ATTR_NOT_NULL(2);
 
-	/** Rebuild clone counts. Required when \<cidr> settings change.
-	 */
-	void RehashCloneCounts();
-
 	/** Return the number of local and global clones of this user
 	 * @param user The user to get the clone counts for
 	 * @return The clone counts of this user. The returned reference is volatile - you
@@ -148,10 +173,10 @@ public:
 	 */
 	const CloneCounts& GetCloneCounts(User* user) const ATTR_NOT_NULL(2);
 
-	/** Return a map containing IP addresses and their clone counts
-	 * @return The clone count map
+	/** Return a tree containing IP addresses and their clone counts
+	 * @return The clone count tree
 	 */
-	const CloneMap& GetCloneMap() const { return clonemap; }
+	const CloneTree& GetCloneTree() const { return clonetree; }
 
 	/** Return a count of local unknown (not fully connected) users.
 	 * @return The number of local unknown (not fully connected) users.
@@ -34,6 +34,7 @@
 #include "streamsocket.h"
 #include "mode.h"
 #include "membership.h"
+#include "utility/shared_string.h"
 
 /** Represents \<connect> class tags from the server config */
 class CoreExport ConnectClass final
@@ -342,19 +343,19 @@ private:
 	std::string cached_realmask;
 
 	/** If set then the hostname which is displayed to users. */
-	std::string displayhost;
+	insp::shared_string displayhost;
 
 	/** The real hostname of this user. */
-	std::string realhost;
+	insp::shared_string realhost;
 
 	/** The real name of this user. */
 	std::string realname;
 
 	/** If set then the username which is displayed to users. */
-	std::string displayuser;
+	insp::shared_string displayuser;
 
 	/** The real username of this user from USER or an ident loookup. */
-	std::string realuser;
+	insp::shared_string realuser;
 
 	/** The user's mode list.
 	 * Much love to the STL for giving us an easy to use bitset, saving us RAM.
@@ -504,20 +505,20 @@ public:
 	/** Retrieves this user's displayed hostname. */
 	inline const std::string& GetDisplayedHost() const
 	{
-		return displayhost.empty() ? realhost : displayhost;
+		return displayhost.empty() ? realhost.str() : displayhost.str();
 	}
 
 	/** Retrieves this user's displayed username. */
 	inline const std::string& GetDisplayedUser() const
 	{
-		return displayuser.empty() ? realuser : displayuser;
+		return displayuser.empty() ? realuser.str() : displayuser.str();
 	}
 
 	/** Retrieves this user's real hostname. */
-	inline const std::string& GetRealHost() const { return realhost; }
+	inline const std::string& GetRealHost() const { return realhost.str(); }
 
 	/** Retrieves this user's real username. */
-	inline const std::string& GetRealUser() const { return realuser; }
+	inline const std::string& GetRealUser() const { return realuser.str(); }
 
 	/** Retrieves this user's real name. */
 	inline const std::string& GetRealName() const { return realname; }
@@ -803,6 +804,12 @@ private:
 public:
 	LocalUser(int fd, const irc::sockets::sockaddrs& client, const irc::sockets::sockaddrs& server);
 
+	/** Allocates memory for a local user from the local user slab pool. */
+	static void* operator new(size_t size);
+
+	/** Returns the memory for a local user to the local user slab pool. */
+	static void operator delete(void* ptr, size_t size);
+
 	Cullable::Result Cull() override;
 
 	UserIOHandler eh;
@@ -921,7 +928,7 @@ public:
 	void Send(ClientProtocol::EventProvider& protoevprov, ClientProtocol::Message& msg);
 };
 
-class RemoteUser
+class CoreExport RemoteUser
 	: public User
 {
 public:
@@ -929,6 +936,12 @@ public:
 		: User(uid, srv, TYPE_REMOTE)
 	{
 	}
+
+	/** Allocates memory for a remote user from the remote user slab pool. */
+	static void* operator new(size_t size);
+
+	/** Returns the memory for a remote user to the remote user slab pool. */
+	static void operator delete(void* ptr, size_t size);
 };
 
 class CoreExport FakeUser final
@@ -0,0 +1,130 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+namespace insp
+{
+	class shared_string;
+}
+
+/** An immutable string which is interned in a global pool and shared between every instance with
+ * the same value. Copying a shared string only increments a reference count and two shared strings
+ * with the same value always point to the same storage so they can be compared by pointer.
+ *
+ * The reference count is not atomic so shared strings must only be used from the main thread.
+ */
+class CoreExport insp::shared_string final
+{
+private:
+	/** The interned value and its reference count. */
+	struct Data;
+
+	/** The data for this string or nullptr if it is empty. */
+	Data* data = nullptr;
+
+	/** Adds a reference to the data, if any. */
+	void Acquire() const;
+
+	/** Retrieves the pool of interned values keyed by a view of the value which is owned by the data. */
+	static std::unordered_map<std::string_view, Data*>& GetPool();
+
+	/** Finds or inserts the data for the specified value. */
+	static Data* Intern(const std::string_view& str);
+
+	/** Removes a reference to the data, if any, and erases it from the pool if unused. */
+	void Release();
+
+public:
+	/** Initializes a new empty shared string. */
+	shared_string() = default;
+
+	/** Initializes a new shared string with the specified value. */
+	shared_string(const std::string& str)
+		: data(str.empty() ? nullptr : Intern(str))
+	{
+	}
+
+	/** Initializes a new shared string with the specified value. */
+	shared_string(const std::string_view& str)
+		: data(str.empty() ? nullptr : Intern(str))
+	{
+	}
+
+	/** Initializes a new shared string with the same value as another shared string. */
+	shared_string(const shared_string& other)
+		: data(other.data)
+	{
+		Acquire();
+	}
+
+	/** Initializes a new shared string by taking the value of another shared string. */
+	shared_string(shared_string&& other) noexcept
+		: data(other.data)
+	{
+		other.data = nullptr;
+	}
+
+	~shared_string()
+	{
+		Release();
+	}
+
+	shared_string& operator=(const shared_string& other)
+	{
+		if (data != other.data)
+		{
+			other.Acquire();
+			Release();
+			data = other.data;
+		}
+		return *this;
+	}
+
+	shared_string& operator=(shared_string&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Release();
+			data = other.data;
+			other.data = nullptr;
+		}
+		return *this;
+	}
+
+	/** Removes the value of this shared string. */
+	void clear() { Release(); }
+
+	/** Determines whether this shared string is empty. */
+	bool empty() const { return !data; }
+
+	/** Retrieves the value of this shared string. */
+	const std::string& str() const;
+
+	/** Determines whether two shared strings have the same value. */
+	bool operator==(const shared_string& other) const { return data == other.data; }
+	bool operator!=(const shared_string& other) const { return data != other.data; }
+
+	/** Determines whether this shared string has the specified value. */
+	bool operator==(const std::string& other) const { return str() == other; }
+	bool operator!=(const std::string& other) const { return str() != other; }
+	bool operator==(const std::string_view& other) const { return str() == other; }
+	bool operator!=(const std::string_view& other) const { return str() != other; }
+
+	/** Retrieves the number of unique values which are currently interned. */
+	static size_t pool_size();
+};
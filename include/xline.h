@@ -433,6 +433,8 @@ protected:
 	XLineContainer lookup_lines;
 
 public:
+	/** The time taken to check users and patterns against the lines of a type. */
+	DurationHistogram matchtime;
 
 	/** Constructor
 	 */
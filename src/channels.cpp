@@ -31,6 +31,27 @@
 namespace
 {
 	ChanModeReference ban(nullptr, "ban");
+	SlabPool channelpool("Channel", sizeof(Channel));
+	SlabPool* memberpool = nullptr;
+}
+
+SlabPool& Channel::MemberPool::GetPool(size_t size)
+{
+	// The size of a member map node is only known to the allocator so the
+	// pool has to be created the first time that a node is allocated.
+	static SlabPool pool("Membership", size);
+	memberpool = &pool;
+	return pool;
+}
+
+void* Channel::operator new(size_t size)
+{
+	return channelpool.Allocate(size);
+}
+
+void Channel::operator delete(void* ptr, size_t size)
+{
+	channelpool.Deallocate(ptr, size);
 }
 
 Channel::Channel(const std::string& cname, time_t ts)
@@ -254,6 +275,82 @@ Membership* Channel::ForceJoin(User* user, const std::string* privs, bool bursti
 	return memb;
 }
 
+std::vector<Membership*> Channel::ForceJoin(const std::vector<User*>& users, bool bursting)
+{
+	std::vector<Membership*> membs(users.size(), nullptr);
+	if (memberpool)
+		memberpool->Reserve(users.size());
+
+	// Insert the members in address order so that the position of the previous
+	// insertion can be used as a hint instead of searching from the root.
+	std::vector<size_t> order;
+	order.reserve(users.size());
+	for (size_t idx = 0; idx < users.size(); ++idx)
+	{
+		if (IS_SERVER(users[idx]))
+			ServerInstance->Logs.Debug("CHANNELS", "Attempted to join server user " + users[idx]->uuid + " to channel " + this->name);
+		else
+			order.push_back(idx);
+	}
+	std::sort(order.begin(), order.end(), [&users](size_t lhs, size_t rhs) { return users[lhs] < users[rhs]; });
+
+	// Local users which have been added but not announced yet must not see the
+	// joins of the users before them.
+	CUList pending;
+	MemberMap::iterator hint = order.empty() ? userlist.end() : userlist.lower_bound(users[order.front()]);
+	for (const auto idx : order)
+	{
+		User* user = users[idx];
+		const size_t oldsize = userlist.size();
+		hint = userlist.emplace_hint(hint, user, insp::aligned_storage<Membership>());
+		if (userlist.size() == oldsize)
+		{
+			// Already on the channel.
+			++hint;
+			continue;
+		}
+
+		Membership* memb = new(hint->second) Membership(user, this);
+		user->chans.push_front(memb);
+		membs[idx] = memb;
+		if (IS_LOCAL(user))
+			pending.insert(user);
+		++hint;
+	}
+
+	for (size_t idx = 0; idx < membs.size(); ++idx)
+	{
+		Membership* memb = membs[idx];
+		if (!memb)
+			continue;
+
+		// A module may have removed the user from the channel while announcing an earlier member.
+		auto it = userlist.find(users[idx]);
+		if (it == userlist.end() || static_cast<Membership*>(it->second) != memb)
+		{
+			membs[idx] = nullptr;
+			continue;
+		}
+
+		pending.erase(memb->user);
+		CUList except_list(pending);
+		FOREACH_MOD(OnUserJoin, (memb, bursting, false, except_list));
+
+		ClientProtocol::Events::Join joinevent(memb);
+		this->Write(joinevent, 0, except_list);
+
+		FOREACH_MOD(OnPostJoin, (memb));
+	}
+
+	// A module may also have removed the user from the channel while announcing a later member.
+	for (size_t idx = 0; idx < membs.size(); ++idx)
+	{
+		if (membs[idx] && GetUser(users[idx]) != membs[idx])
+			membs[idx] = nullptr;
+	}
+	return membs;
+}
+
 bool Channel::IsBanned(User* user)
 {
 	ModResult result;
@@ -68,6 +68,20 @@ const ClientProtocol::SerializedMessage& ClientProtocol::Serializer::SerializeFo
 	return msg.GetSerialized(Message::SerializedInfo(this, MakeTagWhitelist(user, msg.GetTags())));
 }
 
+const ClientProtocol::Message::SerializedParts& ClientProtocol::Serializer::GetSerializedParts(const Message& msg) const
+{
+	Message::SerializedParts& parts = msg.serparts;
+	if (parts.serializer != this || parts.tags.size() != msg.GetTags().size())
+	{
+		// The parts were not created by this serializer or the tags have changed since they were
+		// created so they can't be reused.
+		parts.Clear();
+		parts.serializer = this;
+		SerializeParts(msg, parts);
+	}
+	return parts;
+}
+
 std::string ClientProtocol::Message::EscapeTag(const std::string& value)
 {
 	std::string ret;
@@ -323,7 +323,11 @@ void CommandParser::ProcessCommand(LocalUser* user, std::string& command, Comman
 		/*
 		 * WARNING: be careful, the user may be deleted soon
 		 */
-		CmdResult result = handler->Handle(user, command_p);
+		CmdResult result;
+		{
+			const ScopedTimer timer(handler->latency);
+			result = handler->Handle(user, command_p);
+		}
 
 		FOREACH_MOD(OnPostCommand, (handler, command_p, user, result, false));
 	}
@@ -21,9 +21,11 @@
  */
 
 
+#include <atomic>
 #include <cinttypes>
 #include <filesystem>
 #include <fstream>
+#include <thread>
 
 #include "inspircd.h"
 #include "configparser.h"
@@ -56,17 +58,18 @@ struct Parser final
 {
 	ParseStack& stack;
 	int flags;
-	FilePtr file;
+	const std::string& contents;
+	size_t position = 0;
 	FilePosition current;
 	FilePosition last_tag;
 	std::shared_ptr<ConfigTag> tag;
 	int ungot = -1;
 	std::string mandatory_tag;
 
-	Parser(ParseStack& me, int myflags, FilePtr conf, const std::string& name, const std::string& mandatorytag)
+	Parser(ParseStack& me, int myflags, const std::string& conf, const std::string& name, const std::string& mandatorytag)
 		: stack(me)
 		, flags(myflags)
-		, file(std::move(conf))
+		, contents(conf)
 		, current(name, 1, 0)
 		, last_tag(name, 0, 0)
 		, mandatory_tag(mandatorytag)
@@ -81,7 +84,7 @@ struct Parser final
 			ungot = -1;
 			return ch;
 		}
-		int ch = fgetc(file.get());
+		int ch = position < contents.length() ? static_cast<unsigned char>(contents[position++]) : EOF;
 		if (ch == EOF && !eof_ok)
 		{
 			throw CoreException("Unexpected end-of-file");
@@ -407,10 +410,42 @@ void ParseStack::DoInclude(const std::shared_ptr<ConfigTag>& tag, int flags)
 			throw CoreException("Unable to read directory for include " + includedir + ": " + err.what());
 		}
 
-		for (const auto& config : configs)
+		// The files in a directory are read concurrently but still have to be
+		// parsed in order as they may use entities defined by an earlier file.
+		// They are opened in batches to avoid running out of file descriptors.
+		static constexpr size_t maxopen = 64;
+		for (auto batchstart = configs.begin(); batchstart != configs.end(); )
 		{
-			if (!ParseFile(config, flags, mandatorytag))
-				throw CoreException("Included");
+			std::vector<std::string> batch;
+			std::vector<FilePtr> files;
+			for (; batchstart != configs.end() && batch.size() < maxopen; ++batchstart)
+			{
+				const std::string& config = *batchstart;
+				if (stdalgo::isin(reading, config))
+					throw CoreException("File " + config + " is included recursively (looped inclusion)");
+
+				files.push_back(DoOpenFile(config, false));
+				if (!files.back())
+					throw CoreException(INSP_FORMAT("Could not read \"{}\" for include: {}", config, strerror(errno)));
+				batch.push_back(config);
+			}
+
+			std::vector<std::string> contents;
+			std::vector<int> errors;
+			DoReadContents(files, contents, errors);
+			files.clear();
+
+			for (size_t idx = 0; idx < batch.size(); ++idx)
+			{
+				if (errors[idx])
+					throw CoreException(INSP_FORMAT("Could not read \"{}\" for include: {}", batch[idx], strerror(errors[idx])));
+
+				if (!ParseContents(batch[idx], contents[idx], flags, mandatorytag))
+					throw CoreException("Included");
+
+				// Free the contents as we go to avoid holding every file in memory.
+				std::string().swap(contents[idx]);
+			}
 		}
 	}
 
@@ -459,6 +494,46 @@ FilePtr ParseStack::DoOpenFile(const std::string& name, bool isexec)
 	return FilePtr(fopen(path.c_str(), "r"), fclose);
 }
 
+bool ParseStack::DoReadContents(const FilePtr& file, std::string& contents)
+{
+	char buffer[65536];
+	while (true)
+	{
+		size_t count = fread(buffer, 1, sizeof(buffer), file.get());
+		contents.append(buffer, count);
+		if (count < sizeof(buffer))
+			return !ferror(file.get());
+	}
+}
+
+void ParseStack::DoReadContents(const std::vector<FilePtr>& files, std::vector<std::string>& contents, std::vector<int>& errors)
+{
+	contents.resize(files.size());
+	errors.resize(files.size());
+
+	std::atomic<size_t> next = 0;
+	auto reader = [&]()
+	{
+		for (size_t idx; (idx = next++) < files.size(); )
+		{
+			if (!DoReadContents(files[idx], contents[idx]))
+				errors[idx] = errno ? errno : EIO;
+		}
+	};
+
+	const size_t threadcount = std::min<size_t>(files.size(), std::max(std::thread::hardware_concurrency(), 1U)) - 1;
+	std::vector<std::thread> threads;
+	threads.reserve(threadcount);
+	for (size_t idx = 0; idx < threadcount; ++idx)
+		threads.emplace_back(reader);
+
+	// The calling thread reads files too so there is no need to spawn a thread
+	// for a single file.
+	reader();
+	for (auto& thread : threads)
+		thread.join();
+}
+
 void ParseStack::DoReadFile(const std::string& key, const std::string& name, int flags, bool exec)
 {
 	if (flags & FLAG_NO_INC)
@@ -528,8 +603,18 @@ bool ParseStack::ParseFile(const std::string& path, int flags, const std::string
 		throw CoreException(INSP_FORMAT("Could not read \"{}\" for include: {}", path, strerror(errno)));
 	}
 
+	std::string contents;
+	if (!DoReadContents(file, contents))
+		throw CoreException(INSP_FORMAT("Could not read \"{}\" for include: {}", path, strerror(errno)));
+
+	file.reset();
+	return ParseContents(path, contents, flags, mandatory_tag);
+}
+
+bool ParseStack::ParseContents(const std::string& path, const std::string& contents, int flags, const std::string& mandatory_tag)
+{
 	reading.push_back(path);
-	Parser p(*this, flags, std::move(file), path, mandatory_tag);
+	Parser p(*this, flags, contents, path, mandatory_tag);
 	bool ok = p.outer_parse();
 	reading.pop_back();
 	return ok;
@@ -418,6 +418,45 @@ void ServerConfig::Read()
 		valid = false;
 		errstr << err.GetReason() << std::endl;
 	}
+
+	if (valid)
+		HashTags();
+}
+
+void ServerConfig::HashTags()
+{
+	// This uses 64-bit FNV-1a as it is fast and the result is never exposed.
+	static constexpr uint64_t offset = 0xcbf29ce484222325ULL;
+	static constexpr uint64_t prime = 0x00000100000001b3ULL;
+	auto hash = [](uint64_t& result, const std::string& str)
+	{
+		for (const auto chr : str)
+		{
+			result ^= static_cast<unsigned char>(chr);
+			result *= prime;
+		}
+
+		// Include a terminator so that moving characters between fields changes the hash.
+		result ^= 0xFF;
+		result *= prime;
+	};
+
+	taghashes.clear();
+	for (const auto& [name, tag] : config_data)
+	{
+		auto it = taghashes.find(name);
+		if (it == taghashes.end())
+			it = taghashes.emplace(name, offset).first;
+
+		for (const auto& [key, value] : tag->GetItems())
+		{
+			hash(it->second, key);
+			hash(it->second, value);
+		}
+
+		// Separate tags so that moving keys between tags changes the hash.
+		hash(it->second, name);
+	}
 }
 
 void ServerConfig::Apply(ServerConfig* old, const std::string& useruid)
@@ -710,6 +749,20 @@ std::vector<std::string> ServerConfig::GetModules() const
 	return modules;
 }
 
+uint64_t ServerConfig::GetTagHash(const std::string& tag) const
+{
+	auto it = taghashes.find(tag);
+	return it == taghashes.end() ? 0 : it->second;
+}
+
+bool ConfigStatus::HasChanged(const std::string& tag) const
+{
+	if (initial || !previous)
+		return true;
+
+	return ServerInstance->Config->GetTagHash(tag) != previous->GetTagHash(tag);
+}
+
 void ConfigReaderThread::OnStart()
 {
 	Config->Read();
@@ -731,10 +784,8 @@ void ConfigReaderThread::OnStop()
 		 * XXX: The order of these is IMPORTANT, do not reorder them without testing
 		 * thoroughly!!!
 		 */
-		ServerInstance->Users.RehashCloneCounts();
-
 		auto* user = ServerInstance->Users.FindUUID(UUID);
-		ConfigStatus status(user);
+		ConfigStatus status(user, false, old);
 
 		for (const auto& [modname, mod] : ServerInstance->Modules.GetModules())
 		{
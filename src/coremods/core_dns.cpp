@@ -411,15 +411,21 @@ class MyManager final
 
 		cache_map::iterator it = this->cache.find(question);
 		if (it == this->cache.end())
+		{
+			this->stats_cachemisses++;
 			return false;
+		}
 
 		Query& record = it->second;
 		if (IsExpired(record))
 		{
 			this->cache.erase(it);
+			this->stats_cachemisses++;
 			return false;
 		}
 
+		this->stats_cachehits++;
+
 		ServerInstance->Logs.Debug(MODNAME, "cache: Using cached result for " + question.name);
 		record.cached = true;
 		req->OnLookupComplete(&record);
@@ -935,6 +941,8 @@ public:
 		{
 			stats.AddGenericRow(INSP_FORMAT("DNS requests: {} ({} succeeded, {} failed)",
 				manager.stats_total, manager.stats_success, manager.stats_failure));
+			stats.AddGenericRow(INSP_FORMAT("DNS cache: {} hits, {} misses", manager.stats_cachehits,
+				manager.stats_cachemisses));
 		}
 		return MOD_RES_PASSTHRU;
 	}
@@ -25,8 +25,51 @@
 
 
 #include "inspircd.h"
+#include "extension.h"
 #include "modules/isupport.h"
 
+// The maximum number of channels to check in one go before yielding to the
+// main loop. This avoids blocking the server on very large networks.
+static constexpr size_t MAX_CHANNELS_PER_STEP = 10000;
+
+/** Holds the state of a LIST request which has not been completed yet. */
+struct ListState final
+{
+	// C: Searching based on creation time, via the "C<val" and "C>val" modifiers
+	// to search for a channel creation time that is lower or higher than val
+	// respectively.
+	time_t mincreationtime = 0;
+	time_t maxcreationtime = 0;
+
+	// M: Searching based on mask.
+	std::string match;
+
+	// N: Searching based on !mask.
+	std::string notmatch;
+
+	// T: Searching based on topic time, via the "T<val" and "T>val" modifiers to
+	// search for a topic time that is lower or higher than val respectively.
+	time_t mintopictime = 0;
+	time_t maxtopictime = 0;
+
+	// U: Searching based on user count within the channel, via the "<val" and
+	// ">val" modifiers to search for a channel that has less than or more than
+	// val users respectively.
+	size_t minusers = 0;
+	size_t maxusers = 0;
+
+	// Whether the user can see secret and private channels.
+	bool has_privs = false;
+
+	// The names of the channels which existed when the request was started.
+	// We store names rather than channel pointers as channels may be deleted
+	// whilst the request is in progress.
+	std::vector<std::string> channels;
+
+	// The position in channels of the next channel to check.
+	size_t position = 0;
+};
+
 class CommandList final
 	: public Command
 {
@@ -46,7 +89,20 @@ private:
 		return ServerInstance->Time() - (minutes * 60);
 	}
 
+	/** Sends the RPL_LIST numeric for a channel if it matches the request.
+	 * @param user The user who sent the request.
+	 * @param state The state of the request.
+	 * @param chan The channel to check.
+	 */
+	void SendChannel(User* user, const ListState& state, Channel* chan);
+
 public:
+	// The users who have a LIST request in progress.
+	SimpleExtItem<ListState> liststate;
+
+	// The UUIDs of the users who have a LIST request in progress.
+	std::vector<std::string> pending;
+
 	// Whether to show modes in the LIST response.
 	bool showmodes;
 
@@ -54,38 +110,24 @@ public:
 		: Command(parent, "LIST")
 		, secretmode(creator, "secret")
 		, privatemode(creator, "private")
+		, liststate(parent, "list-state", ExtensionType::USER)
 	{
 		penalty = 5000;
 	}
 
 	CmdResult Handle(User* user, const Params& parameters) override;
+
+	/** Sends the next part of the response to a LIST request.
+	 * @param user The user who sent the request.
+	 * @param state The state of the request.
+	 * @return True if the request has been completed; otherwise, false.
+	 */
+	bool Continue(User* user, ListState& state);
 };
 
 CmdResult CommandList::Handle(User* user, const Params& parameters)
 {
-	// C: Searching based on creation time, via the "C<val" and "C>val" modifiers
-	// to search for a channel creation time that is lower or higher than val
-	// respectively.
-	time_t mincreationtime = 0;
-	time_t maxcreationtime = 0;
-
-	// M: Searching based on mask.
-	std::string match;
-
-	// N: Searching based on !mask.
-	std::string notmatch;
-
-	// T: Searching based on topic time, via the "T<val" and "T>val" modifiers to
-	// search for a topic time that is lower or higher than val respectively.
-	time_t mintopictime = 0;
-	time_t maxtopictime = 0;
-
-	// U: Searching based on user count within the channel, via the "<val" and
-	// ">val" modifiers to search for a channel that has less than or more than
-	// val users respectively.
-	size_t minusers = 0;
-	size_t maxusers = 0;
-
+	auto state = std::make_unique<ListState>();
 	if (!parameters.empty())
 	{
 		irc::commasepstream constraints(parameters[0]);
@@ -93,101 +135,154 @@ CmdResult CommandList::Handle(User* user, const Params& parameters)
 		{
 			if (constraint[0] == '<')
 			{
-				maxusers = ConvToNum<size_t>(constraint.c_str() + 1);
+				state->maxusers = ConvToNum<size_t>(constraint.c_str() + 1);
 			}
 			else if (constraint[0] == '>')
 			{
-				minusers = ConvToNum<size_t>(constraint.c_str() + 1);
+				state->minusers = ConvToNum<size_t>(constraint.c_str() + 1);
 			}
 			else if (!constraint.compare(0, 2, "C<", 2) || !constraint.compare(0, 2, "c<", 2))
 			{
-				mincreationtime = ParseMinutes(constraint);
+				state->mincreationtime = ParseMinutes(constraint);
 			}
 			else if (!constraint.compare(0, 2, "C>", 2) || !constraint.compare(0, 2, "c>", 2))
 			{
-				maxcreationtime = ParseMinutes(constraint);
+				state->maxcreationtime = ParseMinutes(constraint);
 			}
 			else if (!constraint.compare(0, 2, "T<", 2) || !constraint.compare(0, 2, "t<", 2))
 			{
-				mintopictime = ParseMinutes(constraint);
+				state->mintopictime = ParseMinutes(constraint);
 			}
 			else if (!constraint.compare(0, 2, "T>", 2) || !constraint.compare(0, 2, "t>", 2))
 			{
-				maxtopictime = ParseMinutes(constraint);
+				state->maxtopictime = ParseMinutes(constraint);
 			}
 			else if (constraint[0] == '!')
 			{
 				// Ensure that the user didn't just run "LIST !".
 				if (constraint.length() > 2)
-					notmatch = constraint.substr(1);
+					state->notmatch = constraint.substr(1);
 			}
 			else
 			{
-				match = constraint;
+				state->match = constraint;
 			}
 		}
 	}
 
-	const bool has_privs = user->HasPrivPermission("channels/auspex");
+	state->has_privs = user->HasPrivPermission("channels/auspex");
+
+	// If the user already has a LIST request in progress then finish it.
+	if (liststate.Get(user))
+	{
+		liststate.Unset(user);
+		user->WriteNumeric(RPL_LISTEND, "End of channel list.");
+	}
 
 	user->WriteNumeric(RPL_LISTSTART, "Channel", "Users Name");
 
-	for (const auto& [_, chan] : ServerInstance->Channels.GetChans())
+	const auto& chans = ServerInstance->Channels.GetChans();
+	if (!IS_LOCAL(user))
 	{
-		// Check the user count if a search has been specified.
-		const size_t users = chan->GetUsers().size();
-		if ((minusers && users <= minusers) || (maxusers && users >= maxusers))
-			continue;
-
-		// Check the creation ts if a search has been specified.
-		const time_t creationtime = chan->age;
-		if ((mincreationtime && creationtime <= mincreationtime) || (maxcreationtime && creationtime >= maxcreationtime))
-			continue;
-
-		// Check the topic ts if a search has been specified.
-		const time_t topictime = chan->topicset;
-		if ((mintopictime && (!topictime || topictime <= mintopictime)) || (maxtopictime && (!topictime || topictime >= maxtopictime)))
-			continue;
-
-		// Attempt to match a glob pattern.
-		if (!match.empty() && !InspIRCd::Match(chan->name, match) && !InspIRCd::Match(chan->topic, match))
-			continue;
-
-		// Attempt to match an inverted glob pattern.
-		if (!notmatch.empty() && (InspIRCd::Match(chan->name, notmatch) || InspIRCd::Match(chan->topic, notmatch)))
-			continue;
-
-		// if the channel is not private/secret, OR the user is on the channel anyway
-		bool n = (has_privs || chan->HasUser(user));
-
-		// If we're not in the channel and +s is set on it, we want to ignore it
-		if ((n) || (!chan->IsModeSet(secretmode)))
-		{
-			if ((!n) && (chan->IsModeSet(privatemode)))
-			{
-				// Channel is private (+p) and user is outside/not privileged
-				user->WriteNumeric(RPL_LIST, '*', users, "");
-			}
-			else if (showmodes)
-			{
-				// Show the list response with the modes and topic.
-				user->WriteNumeric(RPL_LIST, chan->name, users, INSP_FORMAT("[+{}] {}", chan->ChanModes(n), chan->topic));
-			}
-			else
-			{
-				// Show the list response with just the modes.
-				user->WriteNumeric(RPL_LIST, chan->name, users, chan->topic);
-			}
-		}
+		// Remote users can not be sent the response incrementally.
+		for (const auto& [_, chan] : chans)
+			SendChannel(user, *state, chan);
+
+		user->WriteNumeric(RPL_LISTEND, "End of channel list.");
+		return CmdResult::SUCCESS;
 	}
-	user->WriteNumeric(RPL_LISTEND, "End of channel list.");
 
+	state->channels.reserve(chans.size());
+	for (const auto& [channame, _] : chans)
+		state->channels.push_back(channame);
+
+	if (!Continue(user, *state))
+	{
+		// The user may still be pending from a request which was replaced
+		// above so we need to avoid adding them twice.
+		liststate.Set(user, state.release(), false);
+		if (!stdalgo::isin(pending, user->uuid))
+			pending.push_back(user->uuid);
+	}
 	return CmdResult::SUCCESS;
 }
 
+bool CommandList::Continue(User* user, ListState& state)
+{
+	LocalUser* luser = IS_LOCAL(user);
+
+	// Only fill the sendq up to half of the hard limit so that we don't
+	// disconnect the user for exceeding it.
+	const size_t maxsendq = luser->GetClass()->hardsendqmax / 2;
+
+	const size_t endposition = std::min(state.channels.size(), state.position + MAX_CHANNELS_PER_STEP);
+	while (state.position < endposition && luser->eh.GetSendQSize() < maxsendq)
+	{
+		Channel* chan = ServerInstance->Channels.Find(state.channels[state.position++]);
+		if (chan)
+			SendChannel(user, state, chan);
+	}
+
+	if (state.position < state.channels.size())
+		return false;
+
+	user->WriteNumeric(RPL_LISTEND, "End of channel list.");
+	return true;
+}
+
+void CommandList::SendChannel(User* user, const ListState& state, Channel* chan)
+{
+	// Check the user count if a search has been specified.
+	const size_t users = chan->GetUsers().size();
+	if ((state.minusers && users <= state.minusers) || (state.maxusers && users >= state.maxusers))
+		return;
+
+	// Check the creation ts if a search has been specified.
+	const time_t creationtime = chan->age;
+	if ((state.mincreationtime && creationtime <= state.mincreationtime) || (state.maxcreationtime && creationtime >= state.maxcreationtime))
+		return;
+
+	// Check the topic ts if a search has been specified.
+	const time_t topictime = chan->topicset;
+	if ((state.mintopictime && (!topictime || topictime <= state.mintopictime)) || (state.maxtopictime && (!topictime || topictime >= state.maxtopictime)))
+		return;
+
+	// Attempt to match a glob pattern.
+	if (!state.match.empty() && !InspIRCd::Match(chan->name, state.match) && !InspIRCd::Match(chan->topic, state.match))
+		return;
+
+	// Attempt to match an inverted glob pattern.
+	if (!state.notmatch.empty() && (InspIRCd::Match(chan->name, state.notmatch) || InspIRCd::Match(chan->topic, state.notmatch)))
+		return;
+
+	// if the channel is not private/secret, OR the user is on the channel anyway
+	bool n = (state.has_privs || chan->HasUser(user));
+
+	// If we're not in the channel and +s is set on it, we want to ignore it
+	if ((n) || (!chan->IsModeSet(secretmode)))
+	{
+		if ((!n) && (chan->IsModeSet(privatemode)))
+		{
+			// Channel is private (+p) and user is outside/not privileged
+			user->WriteNumeric(RPL_LIST, '*', users, "");
+		}
+		else if (showmodes)
+		{
+			// Show the list response with the modes and topic.
+			user->WriteNumeric(RPL_LIST, chan->name, users, INSP_FORMAT("[+{}] {}", chan->ChanModes(n), chan->topic));
+		}
+		else
+		{
+			// Show the list response with just the modes.
+			user->WriteNumeric(RPL_LIST, chan->name, users, chan->topic);
+		}
+	}
+}
+
 class CoreModList final
 	: public Module
 	, public ISupport::EventListener
+	, public Timer
 {
 private:
 	CommandList cmd;
@@ -196,10 +291,16 @@ public:
 	CoreModList()
 		: Module(VF_CORE | VF_VENDOR, "Provides the LIST command")
 		, ISupport::EventListener(this)
+		, Timer(1, true)
 		, cmd(this)
 	{
 	}
 
+	void init() override
+	{
+		ServerInstance->Timers.AddTimer(this);
+	}
+
 	void ReadConfig(ConfigStatus& status) override
 	{
 		const auto& tag = ServerInstance->Config->ConfValue("options");
@@ -211,6 +312,24 @@ public:
 		tokens["ELIST"] = "CMNTU";
 		tokens["SAFELIST"];
 	}
+
+	bool Tick() override
+	{
+		for (auto it = cmd.pending.begin(); it != cmd.pending.end(); )
+		{
+			auto* user = ServerInstance->Users.FindUUID<LocalUser>(*it);
+			auto* state = user ? cmd.liststate.Get(user) : nullptr;
+			if (!state || user->quitting || cmd.Continue(user, *state))
+			{
+				if (state)
+					cmd.liststate.Unset(user, false);
+				it = cmd.pending.erase(it);
+			}
+			else
+				it++;
+		}
+		return true;
+	}
 };
 
 MODULE_INIT(CoreModList)
@@ -373,11 +373,11 @@ void DataKeeper::SaveExtensions(Extensible* extensible, std::vector<InstanceData
 	for (const auto& prov : handledexts)
 	{
 		ExtensionItem* const item = prov.extitem;
-		Extensible::ExtensibleStore::const_iterator it = setexts.find(item);
-		if (it == setexts.end())
+		void* const itemvalue = setexts.Get(item);
+		if (!itemvalue)
 			continue;
 
-		std::string value = item->ToInternal(extensible, it->second);
+		std::string value = item->ToInternal(extensible, itemvalue);
 		// If the serialized value is empty the extension won't be saved and restored
 		if (!value.empty())
 			extdata.emplace_back(index, value);
@@ -37,7 +37,10 @@ class RFCSerializer final
 	/** The maximum size of server-originated message tags in an outgoing message including the `@`. */
 	static constexpr std::string::size_type MAX_SERVER_MESSAGE_TAG_LENGTH = 4095;
 
-	static void SerializeTags(const ClientProtocol::TagMap& tags, const ClientProtocol::TagSelection& tagwl, std::string& line);
+	static void SerializeTags(const ClientProtocol::TagMap& tags, const std::vector<std::string>& tagparts, const ClientProtocol::TagSelection& tagwl, std::string& line);
+
+protected:
+	void SerializeParts(const ClientProtocol::Message& msg, ClientProtocol::Message::SerializedParts& parts) const override;
 
 public:
 	RFCSerializer(Module* mod)
@@ -144,57 +147,61 @@ bool RFCSerializer::Parse(LocalUser* user, const std::string& line, ClientProtoc
 
 namespace
 {
-	void CheckTagLength(std::string& line, size_t prevsize, size_t& length, size_t maxlength)
+	bool CheckTagLength(const std::string& tag, size_t& length, size_t maxlength)
 	{
-		const std::string::size_type diffsize = line.size() - prevsize;
-		if (length + diffsize > maxlength)
-			line.erase(prevsize);
-		else
-			length += diffsize;
+		// Include the separator before the tag.
+		const size_t tagsize = tag.size() + 1;
+		if (length + tagsize > maxlength)
+			return false;
+
+		length += tagsize;
+		return true;
 	}
 }
 
-void RFCSerializer::SerializeTags(const ClientProtocol::TagMap& tags, const ClientProtocol::TagSelection& tagwl, std::string& line)
+void RFCSerializer::SerializeTags(const ClientProtocol::TagMap& tags, const std::vector<std::string>& tagparts, const ClientProtocol::TagSelection& tagwl, std::string& line)
 {
 	size_t client_tag_length = 0;
 	size_t server_tag_length = 0;
-	for (ClientProtocol::TagMap::const_iterator i = tags.begin(); i != tags.end(); ++i)
+	std::vector<std::string>::const_iterator tagpart = tagparts.begin();
+	for (ClientProtocol::TagMap::const_iterator i = tags.begin(); i != tags.end(); ++i, ++tagpart)
 	{
 		if (!tagwl.IsSelected(tags, i))
 			continue;
 
-		const std::string::size_type prevsize = line.size();
-		line.push_back(prevsize ? ';' : '@');
-		line.append(i->first);
-		const std::string& val = i->second.value;
-		if (!val.empty())
-		{
-			line.push_back('=');
-			line.append(val);
-		}
-
 		// The tags part of the message must not contain more client and server tags than allowed by the
 		// message tags specification. This is complicated by the tag space having separate limits for
 		// both server-originated and client-originated tags. If either of the tag limits is exceeded then
-		// the most recently added tag is removed.
+		// the tag is skipped.
 		if (i->first[0] == '+')
-			CheckTagLength(line, prevsize, client_tag_length, MAX_CLIENT_MESSAGE_TAG_LENGTH);
-		else
-			CheckTagLength(line, prevsize, server_tag_length, MAX_SERVER_MESSAGE_TAG_LENGTH);
+		{
+			if (!CheckTagLength(*tagpart, client_tag_length, MAX_CLIENT_MESSAGE_TAG_LENGTH))
+				continue;
+		}
+		else if (!CheckTagLength(*tagpart, server_tag_length, MAX_SERVER_MESSAGE_TAG_LENGTH))
+			continue;
+
+		line.push_back(line.empty() ? '@' : ';');
+		line.append(*tagpart);
 	}
 
 	if (!line.empty())
 		line.push_back(' ');
 }
 
-ClientProtocol::SerializedMessage RFCSerializer::Serialize(const ClientProtocol::Message& msg, const ClientProtocol::TagSelection& tagwl) const
+void RFCSerializer::SerializeParts(const ClientProtocol::Message& msg, ClientProtocol::Message::SerializedParts& parts) const
 {
-	std::string line;
-	SerializeTags(msg.GetTags(), tagwl, line);
-
-	// Save position for length calculation later
-	const std::string::size_type rfcmsg_begin = line.size();
+	// Serialize each tag once so that every tag selection can reuse it.
+	const ClientProtocol::TagMap& tags = msg.GetTags();
+	parts.tags.reserve(tags.size());
+	for (const auto& [tagname, tagdata] : tags)
+	{
+		std::string& tag = parts.tags.emplace_back(tagname);
+		if (!tagdata.value.empty())
+			tag.append(1, '=').append(tagdata.value);
+	}
 
+	std::string& line = parts.body;
 	if (msg.GetSource())
 	{
 		line.push_back(':');
@@ -218,10 +225,23 @@ ClientProtocol::SerializedMessage RFCSerializer::Serialize(const ClientProtocol:
 
 	// Truncate if too long
 	std::string::size_type maxline = ServerInstance->Config->Limits.MaxLine - 2;
-	if (line.length() - rfcmsg_begin > maxline)
-		line.erase(rfcmsg_begin + maxline);
+	if (line.length() > maxline)
+		line.erase(maxline);
 
 	line.append("\r\n", 2);
+}
+
+ClientProtocol::SerializedMessage RFCSerializer::Serialize(const ClientProtocol::Message& msg, const ClientProtocol::TagSelection& tagwl) const
+{
+	// The message without tags is the same for every user so only the tags need to be serialized here.
+	const ClientProtocol::Message::SerializedParts& parts = GetSerializedParts(msg);
+
+	std::string line;
+	SerializeTags(msg.GetTags(), parts.tags, tagwl, line);
+	if (line.empty())
+		return parts.body;
+
+	line.append(parts.body);
 	return line;
 }
 
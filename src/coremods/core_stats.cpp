@@ -252,6 +252,13 @@ void CommandStats::DoStats(Stats::Context& stats)
 			stats.AddRow(249, "Channels: "+ConvToStr(ServerInstance->Channels.GetChans().size()));
 			stats.AddRow(249, "Commands: "+ConvToStr(ServerInstance->Parser.GetCommands().size()));
 
+			for (const auto* pool : SlabPool::GetPools())
+			{
+				const SlabPool::Stats poolstats = pool->GetStats();
+				stats.AddRow(249, INSP_FORMAT("{} pool: {} of {} objects in use in {} slabs ({} bytes)", pool->name,
+					poolstats.inuse, poolstats.capacity, poolstats.slabs, poolstats.memory));
+			}
+
 			float kbitpersec_in;
 			float kbitpersec_out;
 			float kbitpersec_total;
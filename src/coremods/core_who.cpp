@@ -26,6 +26,8 @@
  */
 
 
+#include <unordered_set>
+
 #include "inspircd.h"
 #include "modules/account.h"
 #include "modules/isupport.h"
@@ -114,10 +116,278 @@ struct WhoData final
 	}
 };
 
+/** Maintains indexes of users which allow common WHO requests to be answered
+ * without checking every user on the network.
+ */
+class UserIndex final
+{
+private:
+	/** The keys that a user is currently stored under. */
+	struct UserKeys final
+	{
+		std::string account;
+		std::string address;
+		std::string host;
+	};
+
+	/** Users indexed by the name of the account they are logged into. */
+	std::unordered_map<std::string, std::unordered_set<User*>, irc::insensitive, irc::StrHashComp> accounts;
+
+	/** Users indexed by their IP address (see GetAddressKey). */
+	std::multimap<std::string, User*> addresses;
+
+	/** Users indexed by their reversed lowercase displayed hostname. */
+	std::multimap<std::string, User*> hosts;
+
+	/** Users indexed by the server they are connected to. */
+	std::unordered_map<Server*, std::unordered_set<User*>> servers;
+
+	/** The keys of all indexed users. */
+	std::unordered_map<User*, UserKeys> users;
+
+	static void Erase(std::multimap<std::string, User*>& index, const std::string& key, User* user)
+	{
+		auto range = index.equal_range(key);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (it->second == user)
+			{
+				index.erase(it);
+				return;
+			}
+		}
+	}
+
+	/** Converts an IP address into a key which sorts addresses in the same subnet together. */
+	static std::string GetAddressKey(const irc::sockets::sockaddrs& sa)
+	{
+		switch (sa.family())
+		{
+			case AF_INET:
+				return std::string(1, '4') + std::string(reinterpret_cast<const char*>(&sa.in4.sin_addr), 4);
+
+			case AF_INET6:
+				return std::string(1, '6') + std::string(reinterpret_cast<const char*>(&sa.in6.sin6_addr), 16);
+		}
+		return {};
+	}
+
+	/** Converts a hostname into a key which sorts hostnames with the same suffix together. */
+	static std::string GetHostKey(const std::string& host)
+	{
+		std::string key(host.rbegin(), host.rend());
+		for (auto& chr : key)
+			chr = ascii_case_insensitive_map[static_cast<unsigned char>(chr)];
+		return key;
+	}
+
+	static void FindRange(const std::multimap<std::string, User*>& index, const std::string& first, const std::string& last, std::vector<User*>& out)
+	{
+		for (auto it = index.lower_bound(first); it != index.end() && it->first <= last; ++it)
+			out.push_back(it->second);
+	}
+
+public:
+	Account::API accountapi;
+
+	UserIndex(Module* mod)
+		: accountapi(mod)
+	{
+	}
+
+	/** Adds a user to the index. */
+	void Add(User* user)
+	{
+		if (users.find(user) != users.end())
+			return;
+
+		UserKeys& keys = users[user];
+		servers[user->server].insert(user);
+
+		keys.address = GetAddressKey(user->client_sa);
+		if (!keys.address.empty())
+			addresses.emplace(keys.address, user);
+
+		keys.host = GetHostKey(user->GetDisplayedHost());
+		hosts.emplace(keys.host, user);
+
+		const std::string* account = accountapi ? accountapi->GetAccountName(user) : nullptr;
+		if (account)
+			SetAccount(user, *account);
+	}
+
+	/** Removes a user from the index. */
+	void Remove(User* user)
+	{
+		auto it = users.find(user);
+		if (it == users.end())
+			return;
+
+		SetAccount(user, {});
+		Erase(hosts, it->second.host, user);
+		if (!it->second.address.empty())
+			Erase(addresses, it->second.address, user);
+
+		auto sit = servers.find(user->server);
+		if (sit != servers.end())
+		{
+			sit->second.erase(user);
+			if (sit->second.empty())
+				servers.erase(sit);
+		}
+		users.erase(it);
+	}
+
+	/** Updates the account a user is indexed under. */
+	void SetAccount(User* user, const std::string& account)
+	{
+		auto it = users.find(user);
+		if (it == users.end() || it->second.account == account)
+			return;
+
+		auto ait = accounts.find(it->second.account);
+		if (ait != accounts.end())
+		{
+			ait->second.erase(user);
+			if (ait->second.empty())
+				accounts.erase(ait);
+		}
+
+		it->second.account = account;
+		if (!account.empty())
+			accounts[account].insert(user);
+	}
+
+	/** Updates the IP address a user is indexed under. */
+	void SetAddress(User* user)
+	{
+		auto it = users.find(user);
+		if (it == users.end())
+			return;
+
+		if (!it->second.address.empty())
+			Erase(addresses, it->second.address, user);
+
+		it->second.address = GetAddressKey(user->client_sa);
+		if (!it->second.address.empty())
+			addresses.emplace(it->second.address, user);
+	}
+
+	/** Updates the displayed hostname a user is indexed under. */
+	void SetHost(User* user, const std::string& host)
+	{
+		auto it = users.find(user);
+		if (it == users.end())
+			return;
+
+		Erase(hosts, it->second.host, user);
+		it->second.host = GetHostKey(host);
+		hosts.emplace(it->second.host, user);
+	}
+
+	/** Finds the users logged into an account which matches the specified glob pattern. */
+	void FindAccounts(const std::string& pattern, std::vector<User*>& out) const
+	{
+		if (pattern.find_first_of("*?") == std::string::npos)
+		{
+			auto it = accounts.find(pattern);
+			if (it != accounts.end())
+				out.insert(out.end(), it->second.begin(), it->second.end());
+			return;
+		}
+
+		for (const auto& [account, accountusers] : accounts)
+		{
+			if (InspIRCd::Match(account, pattern))
+				out.insert(out.end(), accountusers.begin(), accountusers.end());
+		}
+	}
+
+	/** Finds the users with an IP address within the specified CIDR range.
+	 * @return True if the pattern is a CIDR range or an IP address; otherwise, false.
+	 */
+	bool FindAddresses(const std::string& pattern, std::vector<User*>& out) const
+	{
+		if (pattern.find_first_of("*?@") != std::string::npos)
+			return false;
+
+		const std::string::size_type slashpos = pattern.rfind('/');
+		irc::sockets::sockaddrs sa(false);
+		if (!sa.from_ip(pattern.substr(0, slashpos)))
+			return false;
+
+		const unsigned char maxlength = sa.family() == AF_INET ? 32 : 128;
+		unsigned char length = maxlength;
+		if (slashpos != std::string::npos)
+		{
+			const std::string lengthstr = pattern.substr(slashpos + 1);
+			if (lengthstr.empty() || lengthstr.find_first_not_of("0123456789") != std::string::npos)
+				return false;
+			length = std::min<unsigned char>(ConvToNum<unsigned char>(lengthstr), maxlength);
+		}
+
+		irc::sockets::cidr_mask mask(sa, length);
+		std::string first = GetAddressKey(sa);
+		if (first.empty())
+			return false;
+
+		// Build the first and last addresses in the range.
+		std::string last = first;
+		for (size_t idx = 1; idx < first.length(); ++idx)
+		{
+			const size_t bit = (idx - 1) * 8;
+			first[idx] = static_cast<char>(mask.bits[idx - 1]);
+			if (bit >= length)
+				last[idx] = '\xFF';
+			else if (bit + 8 > length)
+				last[idx] = static_cast<char>(mask.bits[idx - 1] | (0xFF >> (length - bit)));
+			else
+				last[idx] = first[idx];
+		}
+
+		FindRange(addresses, first, last, out);
+		return true;
+	}
+
+	/** Finds the users with a displayed hostname which matches the specified glob pattern.
+	 * @return True if the pattern is a hostname or a hostname suffix; otherwise, false.
+	 */
+	bool FindHosts(const std::string& pattern, std::vector<User*>& out) const
+	{
+		const bool suffix = !pattern.empty() && pattern[0] == '*';
+		if (pattern.find_first_of("*?", suffix ? 1 : 0) != std::string::npos)
+			return false;
+
+		const std::string key = GetHostKey(pattern.substr(suffix ? 1 : 0));
+		if (!suffix)
+		{
+			auto range = hosts.equal_range(key);
+			for (auto it = range.first; it != range.second; ++it)
+				out.push_back(it->second);
+			return true;
+		}
+
+		for (auto it = hosts.lower_bound(key); it != hosts.end() && !it->first.compare(0, key.length(), key); ++it)
+			out.push_back(it->second);
+		return true;
+	}
+
+	/** Finds the users on a server with a name which matches the specified glob pattern. */
+	void FindServers(const std::string& pattern, std::vector<User*>& out) const
+	{
+		for (const auto& [server, serverusers] : servers)
+		{
+			if (InspIRCd::Match(server->GetName(), pattern, ascii_case_insensitive_map))
+				out.insert(out.end(), serverusers.begin(), serverusers.end());
+		}
+	}
+};
+
 class CommandWho final
 	: public SplitCommand
 {
 private:
+	UserIndex& index;
 	Account::API accountapi;
 	ChanModeReference secretmode;
 	ChanModeReference privatemode;
@@ -203,11 +473,17 @@ private:
 	template<typename T>
 	void WhoUsers(LocalUser* source, const std::vector<std::string>& parameters, const T& users, WhoData& data);
 
+	/** Uses the user index to find the users who might match a WHO request.
+	 * @return True if the index could be used; otherwise, false.
+	 */
+	bool FindUsers(LocalUser* source, WhoData& data, std::vector<User*>& users);
+
 public:
 	insp::flat_map<char, std::string> oplevels;
 
-	CommandWho(Module* parent)
+	CommandWho(Module* parent, UserIndex& ui)
 		: SplitCommand(parent, "WHO", 1, 3)
+		, index(ui)
 		, accountapi(parent)
 		, secretmode(parent, "secret")
 		, privatemode(parent, "private")
@@ -457,6 +733,49 @@ void CommandWho::WhoUsers(LocalUser* source, const std::vector<std::string>& par
 	}
 }
 
+bool CommandWho::FindUsers(LocalUser* source, WhoData& data, std::vector<User*>& users)
+{
+	// Modules can match users in ways that we can not index.
+	if (!whomatchevprov.GetSubscribers().empty())
+		return false;
+
+	// Find the field which MatchUser will match against.
+	char field = 0;
+	for (const auto chr : "Aahimnprstu")
+	{
+		if (chr && data.flags[chr])
+		{
+			field = chr;
+			break;
+		}
+	}
+
+	const bool source_has_users_auspex = source->HasPrivPermission("users/auspex");
+	switch (field)
+	{
+		case 'a':
+			index.FindAccounts(data.matchtext, users);
+			return true;
+
+		case 'h':
+			// The index only contains the displayed hostname.
+			return !data.flags['x'] && index.FindHosts(data.matchtext, users);
+
+		case 'i':
+			// Only users with the users/auspex privilege can see the IP address of other users.
+			return source_has_users_auspex && index.FindAddresses(data.matchtext, users);
+
+		case 's':
+			// If the server name is hidden then either all or no users will match.
+			if (!ServerInstance->Config->HideServer.empty() && !(source->HasPrivPermission("servers/auspex") && data.flags['x']))
+				return false;
+
+			index.FindServers(data.matchtext, users);
+			return true;
+	}
+	return false;
+}
+
 void CommandWho::SendWhoLine(LocalUser* source, const std::vector<std::string>& parameters, Membership* memb, User* user, WhoData& data)
 {
 	if (!memb)
@@ -621,9 +940,15 @@ CmdResult CommandWho::HandleLocal(LocalUser* user, const Params& parameters)
 	else if (data.flags['o'])
 		WhoUsers(user, parameters, ServerInstance->Users.all_opers, data);
 
-	// Otherwise we have to use the global user list.
+	// Otherwise we have to use the global user list unless we can use an index.
 	else
-		WhoUsers(user, parameters, ServerInstance->Users.GetUsers(), data);
+	{
+		std::vector<User*> users;
+		if (FindUsers(user, data, users))
+			WhoUsers(user, parameters, users, data);
+		else
+			WhoUsers(user, parameters, ServerInstance->Users.GetUsers(), data);
+	}
 
 	// Send the results to the source.
 	for (const auto& numeric : data.results)
@@ -637,17 +962,62 @@ CmdResult CommandWho::HandleLocal(LocalUser* user, const Params& parameters)
 
 class CoreModWho final
 	: public Module
+	, public Account::EventListener
 	, public ISupport::EventListener
 {
 private:
+	UserIndex index;
 	CommandWho cmd;
 
 public:
 	CoreModWho()
 		: Module(VF_CORE | VF_VENDOR, "Provides the WHO command")
+		, Account::EventListener(this)
 		, ISupport::EventListener(this)
-		, cmd(this)
+		, index(this)
+		, cmd(this, index)
+	{
+	}
+
+	void init() override
+	{
+		// Index any users who connected before we were loaded.
+		for (const auto& [_, user] : ServerInstance->Users.GetUsers())
+		{
+			if (user->IsFullyConnected() && !user->quitting)
+				index.Add(user);
+		}
+	}
+
+	void OnAccountChange(User* user, const std::string& account) override
+	{
+		index.SetAccount(user, account);
+	}
+
+	void OnChangeHost(User* user, const std::string& newhost) override
+	{
+		// This is called before the host is changed so we need to truncate it ourself.
+		index.SetHost(user, newhost.substr(0, ServerInstance->Config->Limits.MaxHost));
+	}
+
+	void OnChangeRemoteAddress(LocalUser* user) override
+	{
+		index.SetAddress(user);
+	}
+
+	void OnPostChangeRealHost(User* user) override
+	{
+		index.SetHost(user, user->GetDisplayedHost());
+	}
+
+	void OnPostConnect(User* user) override
+	{
+		index.Add(user);
+	}
+
+	void OnUserQuit(User* user, const std::string& message, const std::string& oper_message) override
 	{
+		index.Remove(user);
 	}
 
 	void OnBuildISupport(ISupport::TokenMap& tokens) override
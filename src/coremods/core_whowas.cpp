@@ -43,43 +43,70 @@ enum
 
 namespace WhoWas
 {
+	/** An interned string which is shared between all entries with the same value. */
+	typedef const std::string* String;
+
+	/** A pool of reference counted strings which are shared between whowas entries. */
+	class StringPool final
+	{
+	private:
+		/** The strings in the pool mapped to the number of references to them. */
+		std::unordered_map<std::string, size_t> strings;
+
+	public:
+		/** Retrieves the approximate amount of memory used by the pool in bytes. */
+		size_t GetMemory() const;
+
+		/** Retrieves the number of unique strings in the pool. */
+		size_t GetSize() const { return strings.size(); }
+
+		/** Adds a reference to the specified string, inserting it if needed. */
+		String Intern(const std::string& str);
+
+		/** Removes a reference to the specified string, erasing it if it is no longer used. */
+		void Release(String str);
+	};
+
 	/** One entry for a nick. There may be multiple entries for a nick. */
 	struct Entry final
 	{
 		/** Real hostname */
-		const std::string host;
+		String host;
 
 		/** Displayed hostname */
-		const std::string dhost;
+		String dhost;
 
 		/** Real username */
-		const std::string user;
+		String user;
 
 		/** Displayed username */
-		const std::string duser;
+		String duser;
 
 		/** Server name */
-		const std::string server;
+		String server;
 
 		/** Real name */
-		const std::string real;
+		String real;
 
 		/** Signon time */
-		const time_t signon;
+		time_t signon;
 
 		/** Initialize this Entry with a user */
-		Entry(User* user);
+		Entry(StringPool& pool, User* user);
+
+		/** Releases the strings referenced by this entry back to the pool. */
+		void Release(StringPool& pool) const;
 	};
 
 	/** Everything known about one nick */
 	struct Nick final
 		: public insp::intrusive_list_node<Nick>
 	{
-		/** A group of users related by nickname */
-		typedef std::deque<Entry*> List;
+		/** Ring buffer where each element has information about one occurrence of this nick */
+		std::vector<Entry> entries;
 
-		/** Container where each element has information about one occurrence of this nick */
-		List entries;
+		/** The index of the oldest element in the entries ring buffer. */
+		size_t first = 0;
 
 		/** Time this nick was added to the database */
 		const time_t addtime;
@@ -90,8 +117,17 @@ namespace WhoWas
 		/** Constructor to initialize fields */
 		Nick(const std::string& nickname);
 
-		/** Destructor, deallocates all elements in the entries container */
-		~Nick();
+		/** Retrieves an entry by its age where 0 is the oldest entry. */
+		const Entry& operator[](size_t idx) const { return entries[(first + idx) % entries.size()]; }
+
+		/** Adds an entry, replacing the oldest entry if there are already the specified number of entries. */
+		void Add(StringPool& pool, const Entry& entry, size_t max);
+
+		/** Removes the specified number of the oldest entries. */
+		void Remove(StringPool& pool, size_t count);
+
+		/** Retrieves the number of entries for this nick. */
+		size_t size() const { return entries.size(); }
 	};
 
 	class Manager final
@@ -101,6 +137,12 @@ namespace WhoWas
 		{
 			/** Number of currently existing WhoWas::Entry objects */
 			size_t entrycount;
+
+			/** Approximate amount of memory used by the database in bytes. */
+			size_t memory;
+
+			/** Number of unique strings shared between entries */
+			size_t stringcount;
 		};
 
 		/** Add a user to the whowas database. Called when a user quits.
@@ -152,6 +194,9 @@ namespace WhoWas
 		/** List of nicknames in the order they were inserted into the map */
 		FIFO whowas_fifo;
 
+		/** Strings which are shared between entries */
+		StringPool pool;
+
 		/** Max number of WhoWas entries per user. */
 		unsigned int GroupSize = 0;
 
@@ -219,24 +264,25 @@ CmdResult CommandWhowas::Handle(User* user, const Params& parameters)
 	}
 	else
 	{
-		WhoWas::Nick::List::const_reverse_iterator last = nick->entries.rend();
+		size_t count = nick->size();
 		if (parameters.size() > 1)
 		{
-			size_t count = ConvToNum<size_t>(parameters[1]);
-			if (count > 0 && (size_t) std::distance(nick->entries.rbegin(), last) > count)
-				last = nick->entries.rbegin() + count;
+			size_t maxcount = ConvToNum<size_t>(parameters[1]);
+			if (maxcount > 0 && count > maxcount)
+				count = maxcount;
 		}
 
-		for (const auto* u : insp::iterator_range(nick->entries.rbegin(), last))
+		for (size_t idx = nick->size(); idx-- > nick->size() - count; )
 		{
-			user->WriteNumeric(RPL_WHOWASUSER, parameters[0], u->duser, u->dhost, '*', u->real);
+			const WhoWas::Entry& u = (*nick)[idx];
+			user->WriteNumeric(RPL_WHOWASUSER, parameters[0], *u.duser, *u.dhost, '*', *u.real);
 
 			if (user->HasPrivPermission("users/auspex"))
-				user->WriteNumeric(RPL_WHOWASIP, parameters[0], INSP_FORMAT("was connecting from {}@{}", u->user, u->host));
+				user->WriteNumeric(RPL_WHOWASIP, parameters[0], INSP_FORMAT("was connecting from {}@{}", *u.user, *u.host));
 
-			const std::string signon = Time::ToString(u->signon);
+			const std::string signon = Time::ToString(u.signon);
 			bool hide_server = (!ServerInstance->Config->HideServer.empty() && !user->HasPrivPermission("servers/auspex"));
-			user->WriteNumeric(RPL_WHOISSERVER, parameters[0], (hide_server ? ServerInstance->Config->HideServer : u->server), signon);
+			user->WriteNumeric(RPL_WHOISSERVER, parameters[0], (hide_server ? ServerInstance->Config->HideServer : *u.server), signon);
 		}
 	}
 
@@ -255,11 +301,20 @@ const WhoWas::Nick* WhoWas::Manager::FindNick(const std::string& nickname) const
 WhoWas::Manager::Stats WhoWas::Manager::GetStats() const
 {
 	size_t entrycount = 0;
+	size_t memory = pool.GetMemory();
 	for (const auto& [_, nick] : whowas)
-		entrycount += nick->entries.size();
+	{
+		entrycount += nick->size();
+
+		// The map node, the nick, and the ring buffer.
+		memory += sizeof(std::string) + sizeof(nick) + (sizeof(void*) * 2) + sizeof(*nick);
+		memory += nick->entries.capacity() * sizeof(WhoWas::Entry);
+	}
 
 	Stats stats;
 	stats.entrycount = entrycount;
+	stats.memory = memory;
+	stats.stringcount = pool.GetSize();
 	return stats;
 }
 
@@ -276,7 +331,7 @@ void WhoWas::Manager::Add(User* user)
 	{
 		// This nick is new, create a list for it and add the first record to it
 		auto* nick = new WhoWas::Nick(ret.first->first);
-		nick->entries.push_back(new Entry(user));
+		nick->Add(pool, Entry(pool, user), this->GroupSize);
 		ret.first->second = nick;
 
 		// Add this nick to the fifo too
@@ -290,16 +345,8 @@ void WhoWas::Manager::Add(User* user)
 	}
 	else
 	{
-		// We've met this nick before, add a new record to the list
-		WhoWas::Nick::List& list = ret.first->second->entries;
-		list.push_back(new Entry(user));
-
-		// If there are too many records for this nick, remove the oldest (front)
-		if (list.size() > this->GroupSize)
-		{
-			delete list.front();
-			list.pop_front();
-		}
+		// We've met this nick before, add a new record to the list, replacing the oldest if there are too many
+		ret.first->second->Add(pool, Entry(pool, user), this->GroupSize);
 	}
 }
 
@@ -321,14 +368,11 @@ void WhoWas::Manager::Prune()
 	/* Then cut the whowas sets to new size (groupsize) */
 	for (whowas_users::iterator i = whowas.begin(); i != whowas.end(); )
 	{
-		WhoWas::Nick::List& list = i->second->entries;
-		while (list.size() > this->GroupSize)
-		{
-			delete list.front();
-			list.pop_front();
-		}
+		WhoWas::Nick* nick = i->second;
+		if (nick->size() > this->GroupSize)
+			nick->Remove(pool, nick->size() - this->GroupSize);
 
-		if (list.empty())
+		if (!nick->size())
 			PurgeNick(i++);
 		else
 			++i;
@@ -341,14 +385,15 @@ void WhoWas::Manager::Maintain()
 	time_t min = ServerInstance->Time() - this->MaxKeep;
 	for (whowas_users::iterator i = whowas.begin(); i != whowas.end(); )
 	{
-		WhoWas::Nick::List& list = i->second->entries;
-		while (!list.empty() && list.front()->signon < min)
-		{
-			delete list.front();
-			list.pop_front();
-		}
+		WhoWas::Nick* nick = i->second;
+		size_t expired = 0;
+		while (expired < nick->size() && (*nick)[expired].signon < min)
+			expired++;
+
+		if (expired)
+			nick->Remove(pool, expired);
 
-		if (list.empty())
+		if (!nick->size())
 			PurgeNick(i++);
 		else
 			++i;
@@ -380,6 +425,7 @@ void WhoWas::Manager::UpdateConfig(unsigned int NewGroupSize, unsigned int NewMa
 void WhoWas::Manager::PurgeNick(whowas_users::iterator it)
 {
 	WhoWas::Nick* nick = it->second;
+	nick->Remove(pool, nick->size());
 	whowas_fifo.erase(nick);
 	whowas.erase(it);
 	delete nick;
@@ -396,26 +442,90 @@ void WhoWas::Manager::PurgeNick(WhoWas::Nick* nick)
 	PurgeNick(it);
 }
 
-WhoWas::Entry::Entry(User* u)
-	: host(u->GetRealHost())
-	, dhost(u->GetDisplayedHost())
-	, user(u->GetRealUser())
-	, duser(u->GetDisplayedUser())
-	, server(u->server->GetPublicName())
-	, real(u->GetRealName())
+size_t WhoWas::StringPool::GetMemory() const
+{
+	size_t memory = strings.bucket_count() * sizeof(void*);
+	for (const auto& [str, _] : strings)
+	{
+		// The node and any heap allocation made by the string.
+		memory += sizeof(void*) + sizeof(str) + sizeof(size_t);
+		if (str.capacity() >= sizeof(str))
+			memory += str.capacity() + 1;
+	}
+	return memory;
+}
+
+WhoWas::String WhoWas::StringPool::Intern(const std::string& str)
+{
+	auto it = strings.emplace(str, 0).first;
+	it->second++;
+	return &it->first;
+}
+
+void WhoWas::StringPool::Release(String str)
+{
+	auto it = strings.find(*str);
+	if (it != strings.end() && !--it->second)
+		strings.erase(it);
+}
+
+WhoWas::Entry::Entry(StringPool& pool, User* u)
+	: host(pool.Intern(u->GetRealHost()))
+	, dhost(pool.Intern(u->GetDisplayedHost()))
+	, user(pool.Intern(u->GetRealUser()))
+	, duser(pool.Intern(u->GetDisplayedUser()))
+	, server(pool.Intern(u->server->GetPublicName()))
+	, real(pool.Intern(u->GetRealName()))
 	, signon(u->signon)
 {
 }
 
+void WhoWas::Entry::Release(StringPool& pool) const
+{
+	for (const auto* str : { host, dhost, user, duser, server, real })
+		pool.Release(str);
+}
+
 WhoWas::Nick::Nick(const std::string& nickname)
 	: addtime(ServerInstance->Time())
 	, nick(nickname)
 {
 }
 
-WhoWas::Nick::~Nick()
+void WhoWas::Nick::Add(StringPool& pool, const Entry& entry, size_t max)
 {
-	stdalgo::delete_all(entries);
+	if (entries.size() < max)
+	{
+		// The ring buffer has room so make sure the entries are in order and append.
+		if (first)
+		{
+			std::rotate(entries.begin(), entries.begin() + first, entries.end());
+			first = 0;
+		}
+		entries.push_back(entry);
+		return;
+	}
+
+	// The ring buffer is full so overwrite the oldest entry.
+	entries[first].Release(pool);
+	entries[first] = entry;
+	first = (first + 1) % entries.size();
+}
+
+void WhoWas::Nick::Remove(StringPool& pool, size_t count)
+{
+	if (first)
+	{
+		std::rotate(entries.begin(), entries.begin() + first, entries.end());
+		first = 0;
+	}
+
+	count = std::min(count, entries.size());
+	for (size_t idx = 0; idx < count; ++idx)
+		entries[idx].Release(pool);
+	entries.erase(entries.begin(), entries.begin() + count);
+	if (entries.empty())
+		entries.shrink_to_fit();
 }
 
 class ModuleWhoWas final
@@ -446,7 +556,11 @@ public:
 	ModResult OnStats(Stats::Context& stats) override
 	{
 		if (stats.GetSymbol() == 'z')
-			stats.AddRow(249, "Whowas entries: "+ConvToStr(cmd.manager.GetStats().entrycount));
+		{
+			const WhoWas::Manager::Stats whowasstats = cmd.manager.GetStats();
+			stats.AddRow(249, "Whowas entries: "+ConvToStr(whowasstats.entrycount));
+			stats.AddRow(249, INSP_FORMAT("Whowas memory: {} bytes ({} unique strings)", whowasstats.memory, whowasstats.stringcount));
+		}
 
 		return MOD_RES_PASSTHRU;
 	}
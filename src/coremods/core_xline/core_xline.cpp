@@ -68,14 +68,34 @@ private:
 	CommandQline cmdqline;
 	CommandZline cmdzline;
 
-	static void ReadXLine(const std::string& tag, const std::string& key, const std::string& type)
+	static bool ReadXLine(const ConfigStatus& status, const std::string& tag, const std::string& key, const std::string& type)
 	{
 		XLineFactory* make = ServerInstance->XLines->GetFactory(type);
 		if (!make)
 			throw CoreException("BUG: Unable to find the " + type + "-line factory!");
 
+		auto tags = ServerInstance->Config->ConfTags(tag);
+		if (!status.HasChanged(tag))
+		{
+			// The tags have not changed so we only need to re-add them if any
+			// of the config lines have been removed since the last rehash.
+			size_t count = 0;
+			XLineLookup* lookup = ServerInstance->XLines->GetAll(type);
+			if (lookup)
+			{
+				for (const auto& [_, xline] : *lookup)
+				{
+					if (xline->from_config)
+						count++;
+				}
+			}
+
+			if (count == static_cast<size_t>(tags.count()))
+				return false;
+		}
+
 		insp::flat_set<std::string> configlines;
-		for (const auto& [_, ctag] : ServerInstance->Config->ConfTags(tag))
+		for (const auto& [_, ctag] : tags)
 		{
 			const std::string mask = ctag->getString(key);
 			if (mask.empty())
@@ -93,6 +113,7 @@ private:
 		}
 
 		ServerInstance->XLines->ExpireRemovedConfigLines(make->GetType(), configlines);
+		return true;
 	}
 
 public:
@@ -113,10 +134,12 @@ public:
 
 	void ReadConfig(ConfigStatus& status) override
 	{
-		ReadXLine("badip", "ipmask", "Z");
-		ReadXLine("badnick", "nick", "Q");
-		ReadXLine("badhost", "host", "K");
-		ReadXLine("exception", "host", "E");
+		bool changed = ReadXLine(status, "badip", "ipmask", "Z");
+		changed |= ReadXLine(status, "badnick", "nick", "Q");
+		changed |= ReadXLine(status, "badhost", "host", "K");
+		changed |= ReadXLine(status, "exception", "host", "E");
+		if (!changed)
+			return;
 
 		ServerInstance->XLines->CheckELines();
 		ServerInstance->XLines->ApplyLines();
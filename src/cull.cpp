@@ -122,6 +122,9 @@ void CullList::Apply()
 		delete c;
 	}
 
+	// Release any slabs which were emptied by the objects deleted above in one go.
+	SlabPool::TrimAll();
+
 	if (!list.empty())
 	{
 		ServerInstance->Logs.Debug("CULL", "BUG: {} objects were added to the cull list from a destructor",
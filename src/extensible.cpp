@@ -22,7 +22,18 @@
 
 bool ExtensionManager::Register(ExtensionItem* item)
 {
-	return types.emplace(item->name, item).second;
+	if (!types.emplace(item->name, item).second)
+		return false;
+
+	// Reuse the first free slot to keep the per-extensible arrays small.
+	auto& typeslots = slots[static_cast<uint8_t>(item->extype)];
+	auto it = std::find(typeslots.begin(), typeslots.end(), nullptr);
+	item->slot = std::distance(typeslots.begin(), it);
+	if (it == typeslots.end())
+		typeslots.push_back(item);
+	else
+		*it = item;
+	return true;
 }
 
 void ExtensionManager::BeginUnregister(Module* module, std::vector<ExtensionItem*>& items)
@@ -39,6 +50,17 @@ void ExtensionManager::BeginUnregister(Module* module, std::vector<ExtensionItem
 	}
 }
 
+void ExtensionManager::EndUnregister(const std::vector<ExtensionItem*>& items)
+{
+	for (auto* item : items)
+	{
+		auto& typeslots = slots[static_cast<uint8_t>(item->extype)];
+		if (item->slot < typeslots.size() && typeslots[item->slot] == item)
+			typeslots[item->slot] = nullptr;
+		item->slot = SIZE_MAX;
+	}
+}
+
 ExtensionItem* ExtensionManager::GetItem(const std::string& name)
 {
 	ExtMap::iterator iter = types.find(name);
@@ -48,8 +70,88 @@ ExtensionItem* ExtensionManager::GetItem(const std::string& name)
 	return iter->second;
 }
 
+void Extensible::ExtensibleStore::const_iterator::Skip()
+{
+	while (slot < store->values.size() && !store->values[slot])
+		slot++;
+}
+
+std::pair<ExtensionItem*, void*> Extensible::ExtensibleStore::const_iterator::operator*() const
+{
+	if (slot >= store->values.size())
+	{
+		const auto& [item, value] = store->unslotted[slot - store->values.size()];
+		return { const_cast<ExtensionItem*>(item), value };
+	}
+	return { ServerInstance->Extensions.GetSlot(store->type, slot), store->values[slot] };
+}
+
+void* Extensible::ExtensibleStore::Get(const ExtensionItem* item) const
+{
+	if (item->extype != type || item->slot == SIZE_MAX)
+	{
+		for (const auto& [unslotteditem, value] : unslotted)
+		{
+			if (unslotteditem == item)
+				return value;
+		}
+		return nullptr;
+	}
+
+	if (item->slot >= values.size())
+		return nullptr;
+
+	return values[item->slot];
+}
+
+void* Extensible::ExtensibleStore::Set(const ExtensionItem* item, void* value)
+{
+	if (item->extype != type || item->slot == SIZE_MAX)
+	{
+		// The extension does not have a slot (e.g. because it is not registered) so
+		// keep the value in the unslotted list rather than losing track of it.
+		auto it = std::find_if(unslotted.begin(), unslotted.end(), [item](const auto& entry) { return entry.first == item; });
+		if (it == unslotted.end())
+		{
+			if (value)
+			{
+				unslotted.emplace_back(item, value);
+				count++;
+			}
+			return nullptr;
+		}
+
+		void* old = it->second;
+		if (value)
+			it->second = value;
+		else
+		{
+			unslotted.erase(it);
+			count--;
+		}
+		return old;
+	}
+
+	if (item->slot >= values.size())
+	{
+		if (!value)
+			return nullptr;
+		values.resize(item->slot + 1);
+	}
+
+	void* old = values[item->slot];
+	values[item->slot] = value;
+	count += !!value - !!old;
+
+	// Shrink the array if the last slot was unset.
+	while (!values.empty() && !values.back())
+		values.pop_back();
+	return old;
+}
+
 Extensible::Extensible(ExtensionType exttype)
 	: extype(exttype)
+	, extensions(exttype)
 	, culled(false)
 {
 }
@@ -73,7 +175,10 @@ Cullable::Result Extensible::Cull()
 void Extensible::FreeAllExtItems()
 {
 	for (const auto& [extension, item] : extensions)
-		extension->Delete(this, item);
+	{
+		if (extension)
+			extension->Delete(this, item);
+	}
 	extensions.clear();
 }
 
@@ -81,12 +186,9 @@ void Extensible::UnhookExtensions(const std::vector<ExtensionItem*>& items)
 {
 	for (auto* item : items)
 	{
-		ExtensibleStore::iterator iter = extensions.find(item);
-		if (iter != extensions.end())
-		{
-			item->Delete(this, iter->second);
-			extensions.erase(iter);
-		}
+		void* value = extensions.Set(item, nullptr);
+		if (value)
+			item->Delete(this, value);
 	}
 }
 
@@ -104,33 +206,17 @@ void ExtensionItem::RegisterService()
 
 void* ExtensionItem::GetRaw(const Extensible* container) const
 {
-	auto iter = container->extensions.find(const_cast<ExtensionItem*>(this));
-	if (iter == container->extensions.end())
-		return nullptr;
-
-	return iter->second;
+	return container->extensions.Get(this);
 }
 
 void* ExtensionItem::SetRaw(Extensible* container, void* value)
 {
-	auto result = container->extensions.emplace(this, value);
-	if (result.second)
-		return nullptr;
-
-	void* old = result.first->second;
-	result.first->second = value;
-	return old;
+	return container->extensions.Set(this, value);
 }
 
 void* ExtensionItem::UnsetRaw(Extensible* container)
 {
-	auto iter = container->extensions.find(this);
-	if (iter == container->extensions.end())
-		return nullptr;
-
-	void* result = iter->second;
-	container->extensions.erase(iter);
-	return result;
+	return container->extensions.Set(this, nullptr);
 }
 
 void ExtensionItem::Sync(const Extensible* container, void* item)
@@ -90,6 +90,10 @@ bool irc::equals(const std::string_view& s1, const std::string_view& s2)
 	if (s1.size() != s2.size())
 		return false;
 
+	// Interned strings (e.g. the hostnames of users) share the same storage.
+	if (s1.data() == s2.data())
+		return true;
+
 	for (size_t idx = 0; idx < s1.length(); ++idx)
 	{
 		const unsigned char c1 = s1[idx];
@@ -669,6 +669,12 @@ void InspIRCd::Run()
 		 * dispatched to their handlers.
 		 */
 		SocketEngine::DispatchTrialWrites();
+
+		// Everything since the socket engine last woke up has been part of this iteration.
+		const auto& lastwake = SocketEngine::GetStats().LastWake;
+		if (lastwake.time_since_epoch().count())
+			Stats.LoopTime.Observe(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - lastwake).count());
+
 		SocketEngine::DispatchEvents();
 
 		/* if any users were quit, take them out */
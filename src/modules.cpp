@@ -446,6 +446,7 @@ void ModuleManager::DoSafeUnload(Module* mod)
 		mod->OnCleanup(ExtensionType::USER, user);
 		user->UnhookExtensions(items);
 	}
+	ServerInstance->Extensions.EndUnregister(items);
 
 	for (DataProviderMap::iterator i = DataProviders.begin(); i != DataProviders.end(); )
 	{
@@ -705,6 +706,16 @@ dynamic_reference_base::dynamic_reference_base(Module* Creator, const std::strin
 		resolve();
 }
 
+dynamic_reference_base::dynamic_reference_base(const dynamic_reference_base& other)
+	: name(other.name)
+	, hook(other.hook)
+	, value(other.value)
+	, creator(other.creator)
+{
+	// The list node must not be copied from the other reference as this one is not in the list yet.
+	dynrefs->push_front(this);
+}
+
 dynamic_reference_base::~dynamic_reference_base()
 {
 	dynrefs->erase(this);
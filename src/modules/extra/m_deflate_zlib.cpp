@@ -0,0 +1,239 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/// $CompilerFlags: find_compiler_flags("zlib")
+/// $LinkerFlags: find_linker_flags("zlib")
+
+/// $PackageInfo: require_system("alpine") zlib-dev
+/// $PackageInfo: require_system("arch") zlib
+/// $PackageInfo: require_system("darwin") zlib
+/// $PackageInfo: require_system("debian~") zlib1g-dev
+/// $PackageInfo: require_system("rhel~") zlib-devel
+
+
+#include "inspircd.h"
+#include "modules/deflate.h"
+
+#include <zlib.h>
+
+#ifdef _WIN32
+# pragma comment(lib, "zlib.lib")
+#endif
+
+class ZlibStream final
+	: public Deflate::Stream
+{
+private:
+	// The size of the chunks that output is written in.
+	static constexpr size_t CHUNK_SIZE = 4096;
+
+	// The size of the header which is prepended to allocations to record their size.
+	static constexpr size_t ALLOC_HEADER = alignof(std::max_align_t);
+
+	// Whether this stream compresses rather than decompresses.
+	const bool compress;
+
+	// The number of bytes which are currently allocated by zlib.
+	size_t memory = 0;
+
+	// The underlying zlib stream.
+	z_stream stream;
+
+	static voidpf Allocate(voidpf opaque, uInt items, uInt size)
+	{
+		const size_t length = static_cast<size_t>(items) * size;
+		auto* ptr = static_cast<char*>(malloc(length + ALLOC_HEADER));
+		if (!ptr)
+			return Z_NULL;
+
+		memcpy(ptr, &length, sizeof(length));
+		static_cast<ZlibStream*>(opaque)->memory += length;
+		return ptr + ALLOC_HEADER;
+	}
+
+	static void Deallocate(voidpf opaque, voidpf address)
+	{
+		auto* ptr = static_cast<char*>(address) - ALLOC_HEADER;
+
+		size_t length;
+		memcpy(&length, ptr, sizeof(length));
+		static_cast<ZlibStream*>(opaque)->memory -= length;
+		free(ptr);
+	}
+
+public:
+	bool initialized = false;
+
+	ZlibStream(bool c)
+		: compress(c)
+	{
+		memset(&stream, 0, sizeof(stream));
+		stream.zalloc = Allocate;
+		stream.zfree = Deallocate;
+		stream.opaque = this;
+	}
+
+	~ZlibStream() override
+	{
+		if (!initialized)
+			return;
+
+		if (compress)
+			deflateEnd(&stream);
+		else
+			inflateEnd(&stream);
+	}
+
+	bool InitCompressor(int windowbits, int level, int memlevel)
+	{
+		// A negative window size tells zlib to not write a zlib header or trailer.
+		initialized = deflateInit2(&stream, level, Z_DEFLATED, -windowbits, memlevel, Z_DEFAULT_STRATEGY) == Z_OK;
+		return initialized;
+	}
+
+	bool InitDecompressor(int windowbits)
+	{
+		initialized = inflateInit2(&stream, -windowbits) == Z_OK;
+		return initialized;
+	}
+
+	bool Compress(std::string_view in, std::string& out) override
+	{
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+		stream.avail_in = static_cast<uInt>(in.length());
+		do
+		{
+			const size_t oldlength = out.length();
+			out.resize(oldlength + CHUNK_SIZE);
+			stream.next_out = reinterpret_cast<Bytef*>(out.data() + oldlength);
+			stream.avail_out = CHUNK_SIZE;
+
+			const int ret = deflate(&stream, Z_SYNC_FLUSH);
+			out.resize(out.length() - stream.avail_out);
+			if (ret != Z_OK && ret != Z_BUF_ERROR)
+				return false;
+		}
+		while (!stream.avail_out); // If the buffer was filled there may be more data to flush.
+
+		return true;
+	}
+
+	bool Decompress(std::string_view in, std::string& out, size_t maxlength) override
+	{
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+		stream.avail_in = static_cast<uInt>(in.length());
+		do
+		{
+			// Allow one byte more than the maximum so we can tell if the output was truncated.
+			const size_t oldlength = out.length();
+			if (oldlength > maxlength)
+				return false;
+
+			const size_t chunklength = std::min(CHUNK_SIZE, maxlength - oldlength + 1);
+			out.resize(oldlength + chunklength);
+			stream.next_out = reinterpret_cast<Bytef*>(out.data() + oldlength);
+			stream.avail_out = static_cast<uInt>(chunklength);
+
+			const int ret = inflate(&stream, Z_SYNC_FLUSH);
+			out.resize(out.length() - stream.avail_out);
+			if (ret == Z_STREAM_END)
+			{
+				// The peer finished the stream; the next data starts a new one.
+				inflateReset(&stream);
+				break;
+			}
+
+			if (ret != Z_OK && ret != Z_BUF_ERROR)
+				return false;
+		}
+		while (!stream.avail_out); // If the buffer was filled there may be more data to write.
+
+		return out.length() <= maxlength;
+	}
+
+	void Reset() override
+	{
+		if (compress)
+			deflateReset(&stream);
+		else
+			inflateReset(&stream);
+	}
+
+	size_t GetMemoryUsage() const override
+	{
+		return memory + sizeof(*this);
+	}
+};
+
+class ZlibProvider final
+	: public Deflate::Provider
+{
+public:
+	ZlibProvider(Module* mod)
+		: Deflate::Provider(mod)
+	{
+	}
+
+	std::unique_ptr<Deflate::Stream> CreateCompressor(int windowbits, int level, int memlevel) override
+	{
+		auto stream = std::make_unique<ZlibStream>(true);
+		if (!stream->InitCompressor(windowbits, level, memlevel))
+			return nullptr;
+		return stream;
+	}
+
+	std::unique_ptr<Deflate::Stream> CreateDecompressor(int windowbits) override
+	{
+		auto stream = std::make_unique<ZlibStream>(false);
+		if (!stream->InitDecompressor(windowbits))
+			return nullptr;
+		return stream;
+	}
+
+	size_t GetCompressorMemory(int windowbits, int memlevel) const override
+	{
+		// As documented in zconf.h with some headroom for the internal state.
+		return (size_t(1) << (windowbits + 2)) + (size_t(1) << (memlevel + 9)) + 6144 + sizeof(ZlibStream);
+	}
+
+	size_t GetDecompressorMemory(int windowbits) const override
+	{
+		// As documented in zconf.h with some headroom for the internal state.
+		return (size_t(1) << windowbits) + 7168 + sizeof(ZlibStream);
+	}
+};
+
+class ModuleDeflateZlib final
+	: public Module
+{
+private:
+	ZlibProvider zlibprov;
+
+public:
+	ModuleDeflateZlib()
+		: Module(VF_VENDOR, "Provides DEFLATE compression using the zlib library.")
+		, zlibprov(this)
+	{
+	}
+
+	void init() override
+	{
+		ServerInstance->Logs.Normal(MODNAME, "Module was compiled against zlib version {} and is running against version {}",
+			ZLIB_VERSION, zlibVersion());
+	}
+};
+
+MODULE_INIT(ModuleDeflateZlib)
@@ -470,6 +470,7 @@ private:
 		if (res != req->success)
 		{
 			ldap_result->error = INSP_FORMAT("{} ({})", ldap_err2string(res), req->info());
+			ldap_result->rejected = (res == LDAP_INVALID_CREDENTIALS || res == LDAP_COMPARE_FALSE || res == LDAP_NO_SUCH_OBJECT);
 			return;
 		}
 
@@ -55,21 +55,22 @@
  * that instead, you should thread your program. This is what i've done here to allow for
  * asynchronous SQL requests via mysql. The way this works is as follows:
  *
- * The module spawns a thread via class Thread, and performs its mysql queries in this thread,
- * using a queue with priorities. There is a mutex on either end which prevents two threads
- * adjusting the queue at the same time, and crashing the ircd. Every 50 milliseconds, the
- * worker thread wakes up, and checks if there is a request at the head of its queue.
- * If there is, it processes this request, blocking the worker thread but leaving the ircd
- * thread to go about its business as usual. During this period, the ircd thread is able
- * to insert further pending requests into the queue.
+ * The module spawns a pool of threads via class Thread, and performs its mysql queries in
+ * these threads, using a shared queue. There is a mutex on either end which prevents two
+ * threads adjusting the queue at the same time, and crashing the ircd. Each database can
+ * have more than one connection (<database:connections>) and there is one worker thread for
+ * each connection. When a worker thread is woken up it takes the first request in the queue
+ * which is for a database with an idle connection and processes this request, blocking the
+ * worker thread but leaving the ircd thread to go about its business as usual. During this
+ * period, the ircd thread is able to insert further pending requests into the queue. As
+ * requests can be processed in parallel they may complete out of order.
  *
- * Once the processing of a request is complete, it is removed from the incoming queue to
- * an outgoing queue, and initialized as a 'response'. The worker thread then signals the
- * ircd thread (via a loopback socket) of the fact a result is available, by sending the
- * connection ID through the connection.
+ * Once the processing of a request is complete, it is removed from the worker thread and put
+ * onto an outgoing queue, and initialized as a 'response'. The worker thread then signals the
+ * ircd thread (via a loopback socket) of the fact a result is available.
  *
- * The ircd thread then mutexes the queue once more, reads the outbound response off the head
- * of the queue, and sends it on its way to the original calling module.
+ * The ircd thread then mutexes the queue once more, takes the outbound responses off the
+ * queue, and sends them on their way to the original calling modules.
  *
  * XXX: You might be asking "why doesnt it just send the response from within the worker thread?"
  * The answer to this is simple. The majority of InspIRCd, and in fact most ircd's are not
@@ -82,6 +83,7 @@
  */
 
 class SQLConnection;
+class MySQLHandle;
 class MySQLresult;
 class DispatcherThread;
 
@@ -129,7 +131,9 @@ class ModuleSQL final
 	: public Module
 {
 public:
-	DispatcherThread* Dispatcher = nullptr;
+	std::vector<DispatcherThread*> Dispatchers;
+	std::mutex queuelock;
+	std::condition_variable queuecond;
 	QueryQueue qq;       // MUST HOLD MUTEX
 	ResultQueue rq;      // MUST HOLD MUTEX
 	ConnMap connections; // main thread only
@@ -137,6 +141,8 @@ public:
 	void init() override;
 	ModuleSQL();
 	~ModuleSQL() override;
+	void DispatchResults();
+	void FailQueries(const std::vector<SQL::Query*>& queries);
 	void ReadConfig(ConfigStatus& status) override;
 	void OnUnloadModule(Module* mod) override;
 };
@@ -147,11 +153,15 @@ class DispatcherThread final
 private:
 	ModuleSQL* const Parent;
 public:
+	// The query this thread is currently executing. MUST HOLD MUTEX
+	std::optional<QueryQueueItem> current;
+
 	DispatcherThread(ModuleSQL* CreatorModule)
 		: Parent(CreatorModule)
 	{
 	}
 	void OnStart() override;
+	void OnStop() override;
 	void OnNotify() override;
 };
 
@@ -265,7 +275,60 @@ public:
 	}
 };
 
-/** Represents a connection to a mysql database
+/** Represents a single connection to a mysql database
+ */
+class MySQLHandle final
+{
+public:
+	SQLConnection* const parent;
+	MYSQL* connection = nullptr;
+
+	// Whether a worker thread is executing a query on this connection. MUST HOLD MUTEX
+	bool busy = false;
+
+	MySQLHandle(SQLConnection* p)
+		: parent(p)
+	{
+	}
+
+	~MySQLHandle()
+	{
+		mysql_close(connection);
+	}
+
+	// This method connects to the database using the credentials supplied to the parent, and returns
+	// true upon success.
+	bool Connect();
+
+	MySQLresult* DoBlockingQuery(const std::string& query)
+	{
+
+		/* Parse the command string and dispatch it to mysql */
+		if (CheckConnection() && !mysql_real_query(connection, query.data(), query.length()))
+		{
+			/* Successful query */
+			MYSQL_RES* res = mysql_use_result(connection);
+			unsigned long rows = mysql_affected_rows(connection);
+			return new MySQLresult(res, rows);
+		}
+		else
+		{
+			/* XXX: See /usr/include/mysql/mysqld_error.h for a list of
+			 * possible error numbers and error messages */
+			SQL::Error e(SQL::QREPLY_FAIL, INSP_FORMAT("{}: {}", mysql_errno(connection), mysql_error(connection)));
+			return new MySQLresult(e);
+		}
+	}
+
+	bool CheckConnection()
+	{
+		if (!connection || mysql_ping(connection) != 0)
+			return Connect();
+		return true;
+	}
+};
+
+/** Represents a mysql database
  */
 class SQLConnection final
 	: public SQL::Provider
@@ -286,7 +349,7 @@ private:
 		unsigned long escapedsize = mysql_escape_string(buffer.data(), in.c_str(), in.length());
 		if (escapedsize == static_cast<unsigned long>(-1))
 		{
-			SQL::Error err(SQL::QSEND_FAIL, INSP_FORMAT("{}: {}", mysql_errno(connection), mysql_error(connection)));
+			SQL::Error err(SQL::QSEND_FAIL, "Unable to escape query parameter");
 			query->OnError(err);
 			return false;
 		}
@@ -297,130 +360,54 @@ private:
 
 public:
 	std::shared_ptr<ConfigTag> config;
-	MYSQL* connection = nullptr;
-	std::mutex lock;
+
+	// The connections to this database. The size of this does not change after construction.
+	std::vector<std::unique_ptr<MySQLHandle>> handles;
 
 	// This constructor creates an SQLConnection object with the given credentials, but does not connect yet.
 	SQLConnection(Module* p, const std::shared_ptr<ConfigTag>& tag)
 		: SQL::Provider(p, tag->getString("id"))
 		, config(tag)
 	{
+		const auto count = tag->getNum<size_t>("connections", 1, 1, 64);
+		for (size_t i = 0; i < count; ++i)
+			handles.push_back(std::make_unique<MySQLHandle>(this));
 	}
 
-	~SQLConnection() override
+	/** Retrieves an idle connection to this database. MUST HOLD MUTEX */
+	MySQLHandle* GetIdleHandle()
 	{
-		mysql_close(connection);
-	}
-
-	// This method connects to the database using the credentials supplied to the constructor, and returns
-	// true upon success.
-	bool Connect()
-	{
-		if (connection)
+		for (const auto& handle : handles)
 		{
-			mysql_close(connection);
-			connection = NULL;
+			if (!handle->busy)
+				return handle.get();
 		}
-
-		connection = mysql_init(connection);
-
-		// Set the connection timeout.
-		unsigned int timeout = static_cast<unsigned int>(config->getDuration("timeout", 5, 1, 30));
-		mysql_options(connection, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
-
-		// Enable SSL if requested.
-#if defined LIBMYSQL_VERSION_ID && LIBMYSQL_VERSION_ID > 80000
-		unsigned int ssl = config->getBool("ssl") ? SSL_MODE_REQUIRED : SSL_MODE_PREFERRED;
-		mysql_options(connection, MYSQL_OPT_SSL_MODE, &ssl);
-#endif
-
-		// Attempt to connect to the database.
-		const std::string host = config->getString("host");
-		const std::string user = config->getString("user");
-		const std::string pass = config->getString("pass");
-		const std::string dbname = config->getString("name");
-
-		MYSQL* result;
-#if defined LIBMYSQL_VERSION_ID && LIBMYSQL_VERSION_ID > 80000
-		if (config->getBool("srv"))
-		{
-			result = mysql_real_connect_dns_srv(connection, host.c_str(), user.c_str(),
-				pass.c_str(), dbname.c_str(), CLIENT_IGNORE_SIGPIPE);
-		}
-		else
-#endif
-		{
-			auto port = config->getNum<unsigned int>("port", 3306, 1, 65535);
-			result = mysql_real_connect(connection, host.c_str(), user.c_str(), pass.c_str(),
-				dbname.c_str(), port, nullptr, CLIENT_IGNORE_SIGPIPE);
-		}
-
-		if (!result)
-		{
-			ServerInstance->Logs.Critical(MODNAME, "Unable to connect to the {} MySQL server: {}",
-				GetId(), mysql_error(connection));
-			return false;
-		}
-
-		// Set the default character set.
-		const std::string charset = config->getString("charset");
-		if (!charset.empty() && mysql_set_character_set(connection, charset.c_str()))
-		{
-			ServerInstance->Logs.Critical(MODNAME, "Could not set character set for {} to \"{}\": {}",
-				GetId(), charset, mysql_error(connection));
-			return false;
-		}
-
-		// Execute the initial SQL query.
-		const std::string initialquery = config->getString("initialquery");
-		if (!initialquery.empty() && mysql_real_query(connection, initialquery.data(), initialquery.length()))
-		{
-			ServerInstance->Logs.Critical(MODNAME, "Could not execute initial query \"{}\" for {}: {}",
-				initialquery, name, mysql_error(connection));
-			return false;
-		}
-
-		return true;
+		return nullptr;
 	}
 
-	ModuleSQL* Parent()
-	{
-		return (ModuleSQL*)(Module*)creator;
-	}
-
-	MySQLresult* DoBlockingQuery(const std::string& query)
+	/** Determines whether any of the connections to this database are in use. MUST HOLD MUTEX */
+	bool IsBusy() const
 	{
-
-		/* Parse the command string and dispatch it to mysql */
-		if (CheckConnection() && !mysql_real_query(connection, query.data(), query.length()))
+		for (const auto& handle : handles)
 		{
-			/* Successful query */
-			MYSQL_RES* res = mysql_use_result(connection);
-			unsigned long rows = mysql_affected_rows(connection);
-			return new MySQLresult(res, rows);
-		}
-		else
-		{
-			/* XXX: See /usr/include/mysql/mysqld_error.h for a list of
-			 * possible error numbers and error messages */
-			SQL::Error e(SQL::QREPLY_FAIL, INSP_FORMAT("{}: {}", mysql_errno(connection), mysql_error(connection)));
-			return new MySQLresult(e);
+			if (handle->busy)
+				return true;
 		}
+		return false;
 	}
 
-	bool CheckConnection()
+	ModuleSQL* Parent()
 	{
-		if (!connection || mysql_ping(connection) != 0)
-			return Connect();
-		return true;
+		return (ModuleSQL*)(Module*)creator;
 	}
 
 	void Submit(SQL::Query* q, const std::string& qs) override
 	{
 		ServerInstance->Logs.Debug(MODNAME, "Executing MySQL query: " + qs);
-		Parent()->Dispatcher->LockQueue();
-		Parent()->qq.emplace_back(q, qs, this);
-		Parent()->Dispatcher->UnlockQueueWakeup();
+		ModuleSQL* mod = Parent();
+		std::lock_guard<std::mutex> lock(mod->queuelock);
+		mod->qq.emplace_back(q, qs, this);
+		mod->queuecond.notify_all();
 	}
 
 	void Submit(SQL::Query* call, const std::string& q, const SQL::ParamList& p) override
@@ -461,6 +448,76 @@ public:
 	}
 };
 
+bool MySQLHandle::Connect()
+{
+	if (connection)
+	{
+		mysql_close(connection);
+		connection = NULL;
+	}
+
+	connection = mysql_init(connection);
+
+	// Set the connection timeout.
+	const auto& config = parent->config;
+	unsigned int timeout = static_cast<unsigned int>(config->getDuration("timeout", 5, 1, 30));
+	mysql_options(connection, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+
+	// Enable SSL if requested.
+#if defined LIBMYSQL_VERSION_ID && LIBMYSQL_VERSION_ID > 80000
+	unsigned int ssl = config->getBool("ssl") ? SSL_MODE_REQUIRED : SSL_MODE_PREFERRED;
+	mysql_options(connection, MYSQL_OPT_SSL_MODE, &ssl);
+#endif
+
+	// Attempt to connect to the database.
+	const std::string host = config->getString("host");
+	const std::string user = config->getString("user");
+	const std::string pass = config->getString("pass");
+	const std::string dbname = config->getString("name");
+
+	MYSQL* result;
+#if defined LIBMYSQL_VERSION_ID && LIBMYSQL_VERSION_ID > 80000
+	if (config->getBool("srv"))
+	{
+		result = mysql_real_connect_dns_srv(connection, host.c_str(), user.c_str(),
+			pass.c_str(), dbname.c_str(), CLIENT_IGNORE_SIGPIPE);
+	}
+	else
+#endif
+	{
+		auto port = config->getNum<unsigned int>("port", 3306, 1, 65535);
+		result = mysql_real_connect(connection, host.c_str(), user.c_str(), pass.c_str(),
+			dbname.c_str(), port, nullptr, CLIENT_IGNORE_SIGPIPE);
+	}
+
+	if (!result)
+	{
+		ServerInstance->Logs.Critical(MODNAME, "Unable to connect to the {} MySQL server: {}",
+			parent->GetId(), mysql_error(connection));
+		return false;
+	}
+
+	// Set the default character set.
+	const std::string charset = config->getString("charset");
+	if (!charset.empty() && mysql_set_character_set(connection, charset.c_str()))
+	{
+		ServerInstance->Logs.Critical(MODNAME, "Could not set character set for {} to \"{}\": {}",
+			parent->GetId(), charset, mysql_error(connection));
+		return false;
+	}
+
+	// Execute the initial SQL query.
+	const std::string initialquery = config->getString("initialquery");
+	if (!initialquery.empty() && mysql_real_query(connection, initialquery.data(), initialquery.length()))
+	{
+		ServerInstance->Logs.Critical(MODNAME, "Could not execute initial query \"{}\" for {}: {}",
+			initialquery, parent->GetId(), mysql_error(connection));
+		return false;
+	}
+
+	return true;
+}
+
 void ModuleSQL::init()
 {
 	if (mysql_library_init(0, nullptr, nullptr))
@@ -468,9 +525,6 @@ void ModuleSQL::init()
 
 	ServerInstance->Logs.Normal(MODNAME, "Module was compiled against MySQL version {}.{}.{} and is running against version {}",
 		MYSQL_VERSION_ID / 10000, MYSQL_VERSION_ID / 100 % 100, MYSQL_VERSION_ID % 100, mysql_get_client_info());
-
-	Dispatcher = new DispatcherThread(this);
-	Dispatcher->Start();
 }
 
 ModuleSQL::ModuleSQL()
@@ -480,12 +534,17 @@ ModuleSQL::ModuleSQL()
 
 ModuleSQL::~ModuleSQL()
 {
-	if (Dispatcher)
+	for (auto* dispatcher : Dispatchers)
 	{
-		Dispatcher->Stop();
-		Dispatcher->OnNotify();
-		delete Dispatcher;
+		dispatcher->Stop();
+		delete dispatcher;
 	}
+	DispatchResults();
+
+	std::vector<SQL::Query*> removed;
+	for (const auto& item : qq)
+		removed.push_back(item.query);
+	FailQueries(removed);
 
 	for (const auto& [_, connection] : connections)
 		delete connection;
@@ -493,9 +552,43 @@ ModuleSQL::~ModuleSQL()
 	mysql_library_end();
 }
 
+void ModuleSQL::DispatchResults()
+{
+	// Take the results out of the queue before dispatching them as the result handler may
+	// submit another query.
+	ResultQueue results;
+	{
+		std::lock_guard<std::mutex> lock(queuelock);
+		results.swap(rq);
+	}
+
+	for (const auto& item : results)
+	{
+		MySQLresult* res = item.result;
+		if (res->err.code == SQL::SUCCESS)
+			item.query->OnResult(*res);
+		else
+			item.query->OnError(res->err);
+		delete item.query;
+		delete item.result;
+	}
+}
+
+void ModuleSQL::FailQueries(const std::vector<SQL::Query*>& queries)
+{
+	// This must not be called with the queue locked as the error handler may submit another query.
+	SQL::Error err(SQL::BAD_DBID);
+	for (auto* query : queries)
+	{
+		query->OnError(err);
+		delete query;
+	}
+}
+
 void ModuleSQL::ReadConfig(ConfigStatus& status)
 {
 	ConnMap conns;
+	size_t handles = 0;
 
 	for (const auto& [_, tag] : ServerInstance->Config->ConfTags("database"))
 	{
@@ -507,129 +600,151 @@ void ModuleSQL::ReadConfig(ConfigStatus& status)
 		if (curr == connections.end())
 		{
 			auto* conn = new SQLConnection(this, tag);
+			handles += conn->handles.size();
 			conns.emplace(id, conn);
 			ServerInstance->Modules.AddService(*conn);
 		}
 		else
 		{
+			handles += curr->second->handles.size();
 			conns.insert(*curr);
 			connections.erase(curr);
 		}
 	}
 
 	// now clean up the deleted databases
-	Dispatcher->LockQueue();
-	SQL::Error err(SQL::BAD_DBID);
-
-	for (const auto& [_, connection] : connections)
+	std::vector<SQL::Query*> removed;
 	{
-		ServerInstance->Modules.DelService(*connection);
-		// it might be running a query on this database. Wait for that to complete
-		connection->lock.lock();
-		connection->lock.unlock();
-		// now remove all active queries to this DB
-		for (size_t j = qq.size(); j > 0; j--)
+		std::unique_lock<std::mutex> lock(queuelock);
+		for (const auto& [_, connection] : connections)
 		{
-			size_t k = j - 1;
-			if (qq[k].connection == connection)
+			ServerInstance->Modules.DelService(*connection);
+			// it might be running a query on this database. Wait for that to complete
+			queuecond.wait(lock, [connection] { return !connection->IsBusy(); });
+			// now remove all active queries to this DB
+			for (size_t j = qq.size(); j > 0; j--)
 			{
-				qq[k].query->OnError(err);
-				delete qq[k].query;
-				qq.erase(qq.begin() + k);
+				size_t k = j - 1;
+				if (qq[k].connection == connection)
+				{
+					removed.push_back(qq[k].query);
+					qq.erase(qq.begin() + k);
+				}
 			}
+			// finally, nuke the connection
+			delete connection;
 		}
-		// finally, nuke the connection
-		delete connection;
 	}
-	Dispatcher->UnlockQueue();
+	FailQueries(removed);
 	connections.swap(conns);
+
+	// We need a worker thread for every connection so that they can all be in use at once.
+	while (Dispatchers.size() < handles)
+	{
+		auto* dispatcher = new DispatcherThread(this);
+		Dispatchers.push_back(dispatcher);
+		dispatcher->Start();
+	}
 }
 
 void ModuleSQL::OnUnloadModule(Module* mod)
 {
-	SQL::Error err(SQL::BAD_DBID);
-	Dispatcher->LockQueue();
-	size_t i = qq.size();
-	while (i > 0)
+	std::vector<SQL::Query*> removed;
 	{
-		i--;
-		if (qq[i].query->creator == mod)
+		std::lock_guard<std::mutex> lock(queuelock);
+		size_t i = qq.size();
+		while (i > 0)
 		{
-			if (i == 0)
+			i--;
+			if (qq[i].query->creator == mod)
 			{
-				// need to wait until the query is done
-				// (the result will be discarded)
-				qq[i].connection->lock.lock();
+				removed.push_back(qq[i].query);
+				qq.erase(qq.begin() + i);
+			}
+		}
+
+		// The worker threads will discard the results of these when they finish.
+		for (auto* dispatcher : Dispatchers)
+		{
+			auto& current = dispatcher->current;
+			if (current && current->query && current->query->creator == mod)
+			{
+				removed.push_back(current->query);
+				current->query = nullptr;
 			}
-			qq[i].query->OnError(err);
-			delete qq[i].query;
-			qq.erase(qq.begin() + i);
 		}
 	}
-	Dispatcher->UnlockQueue();
+	FailQueries(removed);
+
 	// clean up any result queue entries
-	Dispatcher->OnNotify();
+	DispatchResults();
 }
 
 void DispatcherThread::OnStart()
 {
-	this->LockQueue();
+	std::unique_lock<std::mutex> lock(Parent->queuelock);
 	while (!this->IsStopping())
 	{
-		if (!Parent->qq.empty())
+		// Find the first query for a database which has an idle connection.
+		MySQLHandle* handle = nullptr;
+		QueryQueue::iterator it = Parent->qq.begin();
+		for ( ; it != Parent->qq.end(); ++it)
 		{
-			QueryQueueItem i = Parent->qq.front();
-			i.connection->lock.lock();
-			this->UnlockQueue();
-			MySQLresult* res = i.connection->DoBlockingQuery(i.querystr);
-			i.connection->lock.unlock();
-
-			/*
-			 * At this point, the main thread could be working on:
-			 *  Rehash - delete i.connection out from under us. We don't care about that.
-			 *  UnloadModule - delete i.query and the qq item. Need to avoid reporting results.
+			handle = it->connection->GetIdleHandle();
+			if (handle)
+				break;
+		}
+
+		if (!handle)
+		{
+			/* We know there is nothing we can do, we can safely hang this thread until
+			 * something happens
 			 */
+			Parent->queuecond.wait(lock);
+			continue;
+		}
 
-			this->LockQueue();
-			if (!Parent->qq.empty() && Parent->qq.front().query == i.query)
-			{
-				Parent->qq.pop_front();
-				Parent->rq.emplace_back(i.query, res);
-				NotifyParent();
-			}
-			else
-			{
-				// UnloadModule ate the query
-				delete res;
-			}
+		current.emplace(std::move(*it));
+		Parent->qq.erase(it);
+		handle->busy = true;
+
+		/*
+		 * At this point, the main thread could be working on:
+		 *  Rehash - wait for the handle to stop being busy before deleting the connection.
+		 *  UnloadModule - delete current->query. Need to avoid reporting results.
+		 */
+		const std::string querystr = current->querystr;
+		lock.unlock();
+		MySQLresult* res = handle->DoBlockingQuery(querystr);
+		lock.lock();
+
+		handle->busy = false;
+		if (current->query)
+		{
+			Parent->rq.emplace_back(current->query, res);
+			NotifyParent();
 		}
 		else
 		{
-			/* We know the queue is empty, we can safely hang this thread until
-			 * something happens
-			 */
-			this->WaitForQueue();
+			// UnloadModule ate the query
+			delete res;
 		}
+		current.reset();
+
+		// Wake up anything which is waiting for a connection to become idle.
+		Parent->queuecond.notify_all();
 	}
-	this->UnlockQueue();
+}
+
+void DispatcherThread::OnStop()
+{
+	std::lock_guard<std::mutex> lock(Parent->queuelock);
+	Parent->queuecond.notify_all();
 }
 
 void DispatcherThread::OnNotify()
 {
-	// this could unlock during the dispatch, but OnResult isn't expected to take that long
-	this->LockQueue();
-	for (const auto& item : Parent->rq)
-	{
-		MySQLresult* res = item.result;
-		if (res->err.code == SQL::SUCCESS)
-			item.query->OnResult(*res);
-		else
-			item.query->OnError(res->err);
-		delete item.query;
-		delete item.result;
-	}
-	Parent->rq.clear();
-	this->UnlockQueue();
+	Parent->DispatchResults();
 }
 
 MODULE_INIT(ModuleSQL)
@@ -90,8 +90,18 @@ public:
 
 struct QueueItem final
 {
+	// An object which handles the result of the query.
 	SQL::Query* c;
+
+	// The SQL query which is to be executed.
 	std::string q;
+
+	// If bind is true then the values to bind to the parameters of q.
+	SQL::ParamList p;
+
+	// Whether q contains parameter markers and should be executed as a prepared statement.
+	bool bind = false;
+
 	QueueItem(SQL::Query* C, const std::string& Q)
 		: c(C)
 		, q(Q)
@@ -99,6 +109,25 @@ struct QueueItem final
 	}
 };
 
+struct PendingItem final
+{
+	// The item being executed or nullptr if this is a statement being prepared.
+	std::optional<QueueItem> item;
+
+	// If item is nullptr then the name of the statement being prepared.
+	std::string statement;
+
+	PendingItem(const QueueItem& i)
+		: item(i)
+	{
+	}
+
+	PendingItem(const std::string& s)
+		: statement(s)
+	{
+	}
+};
+
 /** PgSQLresult is a subclass of the mostly-pure-virtual class SQLresult.
  * All SQL providers must create their own subclass and define it's methods using that
  * database library's data retrieval functions. The aim is to avoid a slow and inefficient process
@@ -136,6 +165,11 @@ public:
 		PQclear(res);
 	}
 
+	const char* GetError() const
+	{
+		return PQresultErrorMessage(res);
+	}
+
 	int Rows() override
 	{
 		return rows;
@@ -195,17 +229,45 @@ class SQLConn final
 	: public SQL::Provider
 	, public EventHandler
 {
+private:
+	// Whether queries are sent in pipeline mode.
+	bool pipeline = false;
+
+	// The result of the command at the front of the pending queue.
+	PGresult* result = nullptr;
+
+	// The prepared statements for this connection keyed by query.
+	std::unordered_map<std::string, std::string> statements;
+
+	// The maximum number of prepared statements to create.
+	size_t maxstatements;
+
+	// The identifier of the last prepared statement.
+	unsigned long statementid = 0;
+
+	static std::string GetMarker(size_t param)
+	{
+		return "$" + ConvToStr(param);
+	}
+
+	static void ReportError(SQL::Query* query, SQL::ErrorCode code, const char* message = nullptr)
+	{
+		SQL::Error err = message ? SQL::Error(code, message) : SQL::Error(code);
+		query->OnError(err);
+		delete query;
+	}
+
 public:
 	std::shared_ptr<ConfigTag> conf; /* The <database> entry */
-	std::deque<QueueItem> queue;
+	std::deque<QueueItem> queue; /* Queries which have not been sent yet */
+	std::deque<PendingItem> pending; /* Commands which have been sent and are awaiting results */
 	PGconn* sql = nullptr; /* PgSQL database connection handle */
 	SQLstatus status = CWRITE; /* PgSQL database connection status */
-	QueueItem qinprog; /* If there is currently a query in progress */
 
 	SQLConn(Module* Creator, const std::shared_ptr<ConfigTag>& tag)
 		: SQL::Provider(Creator, tag->getString("id"))
+		, maxstatements(tag->getNum<size_t>("statements", 64))
 		, conf(tag)
-		, qinprog(nullptr, "")
 	{
 		if (!DoConnect())
 			DelayReconnect();
@@ -221,10 +283,13 @@ public:
 	~SQLConn() override
 	{
 		SQL::Error err(SQL::BAD_DBID);
-		if (qinprog.c)
+		for (const auto& item : pending)
 		{
-			qinprog.c->OnError(err);
-			delete qinprog.c;
+			if (item.item && item.item->c)
+			{
+				item.item->c->OnError(err);
+				delete item.item->c;
+			}
 		}
 		for (const auto& item : queue)
 		{
@@ -360,6 +425,12 @@ public:
 			case PGRES_POLLING_OK:
 				SocketEngine::ChangeEventMask(this, FD_WANT_POLL_READ | FD_WANT_NO_WRITE);
 				status = WWRITE;
+#ifdef LIBPQ_HAS_PIPELINING
+				// In pipeline mode we can send queries without waiting for the results of
+				// the previous ones which avoids a round trip per query.
+				if (conf->getBool("pipeline"))
+					pipeline = PQenterPipelineMode(sql);
+#endif
 				DoConnectedPoll();
 				return true;
 			default:
@@ -369,74 +440,122 @@ public:
 
 	void DoConnectedPoll()
 	{
-restart:
-		while (qinprog.q.empty() && !queue.empty())
+		if (!PQconsumeInput(sql))
 		{
-			/* There's no query currently in progress, and there's queries in the queue. */
-			DoQuery(queue.front());
-			queue.pop_front();
+			/* I think we'll assume this means the server died...it might not,
+			 * but I think that any error serious enough we actually get here
+			 * deserves to reconnect [/excuse]
+			 * Returning true so the core doesn't try and close the connection.
+			 */
+			DelayReconnect();
+			return;
 		}
 
-		if (PQconsumeInput(sql))
+		while (!pending.empty() && !PQisBusy(sql))
 		{
-			if (PQisBusy(sql))
+			PGresult* temp = PQgetResult(sql);
+#ifdef LIBPQ_HAS_PIPELINING
+			if (temp && PQresultStatus(temp) == PGRES_PIPELINE_SYNC)
 			{
-				/* Nothing happens here */
+				// We sync after every query so we can ignore these.
+				PQclear(temp);
+				continue;
 			}
-			else if (qinprog.c)
+#endif
+			if (temp)
 			{
-				/* Fetch the result.. */
-				PGresult* result = PQgetResult(sql);
-
 				/* PgSQL would allow a query string to be sent which has multiple
 				 * queries in it, this isn't portable across database backends and
 				 * we don't want modules doing it. But just in case we make sure we
 				 * drain any results there are and just use the last one.
 				 * If the module devs are behaving there will only be one result.
 				 */
-				while (PGresult* temp = PQgetResult(sql))
-				{
+				if (result)
 					PQclear(result);
-					result = temp;
-				}
+				result = temp;
+				continue;
+			}
 
-				/* ..and the result */
-				PgSQLresult reply(result);
-				switch(PQresultStatus(result))
-				{
-					case PGRES_EMPTY_QUERY:
-					case PGRES_BAD_RESPONSE:
-					case PGRES_FATAL_ERROR:
-					{
-						SQL::Error err(SQL::QREPLY_FAIL, PQresultErrorMessage(result));
-						qinprog.c->OnError(err);
-						break;
-					}
-					default:
-						/* Other values are not errors */
-						qinprog.c->OnResult(reply);
-				}
+			// A null result means that the command at the front of the queue has completed.
+			PendingItem item = std::move(pending.front());
+			pending.pop_front();
+			if (item.item)
+				HandleResult(*item.item);
+			else
+				HandlePrepareResult(item.statement);
 
-				delete qinprog.c;
-				qinprog = QueueItem(nullptr, "");
-				goto restart;
+			if (result)
+			{
+				PQclear(result);
+				result = nullptr;
 			}
-			else
+		}
+
+		SendQueue();
+	}
+
+	void HandlePrepareResult(const std::string& statement)
+	{
+		const ExecStatusType rstatus = result ? PQresultStatus(result) : PGRES_FATAL_ERROR;
+		if (rstatus == PGRES_COMMAND_OK)
+			return;
+
+		// Forget about the statement so we try to prepare it again next time.
+		for (auto it = statements.begin(); it != statements.end(); ++it)
+		{
+			if (it->second == statement)
 			{
-				qinprog.q.clear();
+				statements.erase(it);
+				break;
 			}
 		}
-		else
+
+		// If we are not pipelining then the query which needs this statement has not been sent
+		// yet and is at the front of the queue.
+		if (!pipeline && !queue.empty())
 		{
-			/* I think we'll assume this means the server died...it might not,
-			 * but I think that any error serious enough we actually get here
-			 * deserves to reconnect [/excuse]
-			 * Returning true so the core doesn't try and close the connection.
-			 */
-			DelayReconnect();
+			SQL::Query* query = queue.front().c;
+			queue.pop_front();
+			ReportError(query, SQL::QSEND_FAIL, result ? PQresultErrorMessage(result) : PQerrorMessage(sql));
 		}
 	}
 
+	void HandleResult(const QueueItem& item)
+	{
+		if (!item.c)
+			return; // The module which sent this query has been unloaded.
+
+		if (!result)
+		{
+			ReportError(item.c, SQL::QREPLY_FAIL, PQerrorMessage(sql));
+			return;
+		}
+
+		/* ..and the result */
+		const ExecStatusType rstatus = PQresultStatus(result);
+		PgSQLresult reply(result);
+		result = nullptr; // Owned by reply now.
+
+		switch (rstatus)
+		{
+			case PGRES_EMPTY_QUERY:
+			case PGRES_BAD_RESPONSE:
+			case PGRES_FATAL_ERROR:
+#ifdef LIBPQ_HAS_PIPELINING
+			case PGRES_PIPELINE_ABORTED:
+#endif
+			{
+				SQL::Error err(SQL::QREPLY_FAIL, reply.GetError());
+				item.c->OnError(err);
+				break;
+			}
+			default:
+				/* Other values are not errors */
+				item.c->OnResult(reply);
+		}
+		delete item.c;
+	}
+
 	void DelayReconnect();
 
 	void DoEvent()
@@ -454,19 +573,18 @@ restart:
 	void Submit(SQL::Query* req, const std::string& q) override
 	{
 		ServerInstance->Logs.Debug(MODNAME, "Executing PostgreSQL query: " + q);
-		if (qinprog.q.empty())
-		{
-			DoQuery(QueueItem(req, q));
-		}
-		else
-		{
-			// wait your turn.
-			queue.emplace_back(req, q);
-		}
+		DoQuery(QueueItem(req, q));
 	}
 
 	void Submit(SQL::Query* req, const std::string& q, const SQL::ParamList& p) override
 	{
+		SQL::Template tmpl;
+		if (tmpl.Convert(q, false, GetMarker))
+		{
+			SubmitTemplate(req, tmpl, tmpl.GetValues(p));
+			return;
+		}
+
 		std::string res;
 		unsigned int param = 0;
 		for (const auto chr : q)
@@ -492,6 +610,13 @@ restart:
 
 	void Submit(SQL::Query* req, const std::string& q, const SQL::ParamMap& p) override
 	{
+		SQL::Template tmpl;
+		if (tmpl.Convert(q, true, GetMarker))
+		{
+			SubmitTemplate(req, tmpl, tmpl.GetValues(p));
+			return;
+		}
+
 		std::string res;
 		for(std::string::size_type i = 0; i < q.length(); i++)
 		{
@@ -521,26 +646,124 @@ restart:
 		Submit(req, res);
 	}
 
+	void SubmitTemplate(SQL::Query* req, const SQL::Template& tmpl, const SQL::ParamList& values)
+	{
+		ServerInstance->Logs.Debug(MODNAME, "Executing PostgreSQL query: " + tmpl.query);
+		QueueItem item(req, tmpl.query);
+		item.p = values;
+		item.bind = true;
+		DoQuery(item);
+	}
+
 	void DoQuery(const QueueItem& req)
 	{
 		if (status != WREAD && status != WWRITE)
 		{
 			// whoops, not connected...
-			SQL::Error err(SQL::BAD_CONN);
-			req.c->OnError(err);
-			delete req.c;
+			ReportError(req.c, SQL::BAD_CONN);
 			return;
 		}
 
-		if(PQsendQuery(sql, req.q.c_str()))
+		queue.push_back(req);
+		SendQueue();
+	}
+
+	bool SendPrepare(const QueueItem& item, std::string& statement)
+	{
+		auto it = statements.find(item.q);
+		if (it != statements.end())
 		{
-			qinprog = req;
+			statement = it->second;
+			return true;
 		}
-		else
+
+		if (statements.size() >= maxstatements)
+			return true; // Execute without a named statement.
+
+		statement = INSP_FORMAT("inspircd_{}", ++statementid);
+		if (!PQsendPrepare(sql, statement.c_str(), item.q.c_str(), static_cast<int>(item.p.size()), nullptr))
+			return false;
+
+		statements.emplace(item.q, statement);
+		pending.emplace_back(statement);
+		return true;
+	}
+
+	bool SendQuery(const QueueItem& item, const std::string& statement)
+	{
+		if (!item.bind)
 		{
-			SQL::Error err(SQL::QSEND_FAIL, PQerrorMessage(sql));
-			req.c->OnError(err);
-			delete req.c;
+			// PQsendQuery is not allowed in pipeline mode. Unlike PQsendQuery this does not
+			// allow the query to contain more than one statement.
+			if (pipeline)
+				return PQsendQueryParams(sql, item.q.c_str(), 0, nullptr, nullptr, nullptr, nullptr, 0);
+			return PQsendQuery(sql, item.q.c_str());
+		}
+
+		std::vector<const char*> values;
+		values.reserve(item.p.size());
+		for (const auto& value : item.p)
+			values.push_back(value.c_str());
+
+		const int nparams = static_cast<int>(values.size());
+		if (statement.empty())
+			return PQsendQueryParams(sql, item.q.c_str(), nparams, nullptr, values.data(), nullptr, nullptr, 0);
+		return PQsendQueryPrepared(sql, statement.c_str(), nparams, values.data(), nullptr, nullptr, 0);
+	}
+
+	void SendQueue()
+	{
+		while (!queue.empty() && (pipeline || pending.empty()))
+		{
+			const QueueItem& item = queue.front();
+
+			std::string statement;
+			if (item.bind && !SendPrepare(item, statement))
+			{
+				SQL::Query* query = item.c;
+				queue.pop_front();
+				ReportError(query, SQL::QSEND_FAIL, PQerrorMessage(sql));
+				continue;
+			}
+
+			if (!pipeline && !pending.empty())
+				break; // Wait for the statement to be prepared.
+
+			if (!SendQuery(item, statement))
+			{
+				SQL::Query* query = item.c;
+				queue.pop_front();
+				ReportError(query, SQL::QSEND_FAIL, PQerrorMessage(sql));
+				continue;
+			}
+
+			pending.emplace_back(item);
+			queue.pop_front();
+
+#ifdef LIBPQ_HAS_PIPELINING
+			// Sync after every query so that an error only aborts the query that caused it.
+			if (pipeline && !PQpipelineSync(sql))
+			{
+				DelayReconnect();
+				return;
+			}
+#endif
+		}
+
+		// In non-blocking mode libpq may not have been able to send everything yet.
+		switch (PQflush(sql))
+		{
+			case 0:
+				SocketEngine::ChangeEventMask(this, FD_WANT_POLL_READ | FD_WANT_NO_WRITE);
+				status = WREAD;
+				break;
+			case 1:
+				SocketEngine::ChangeEventMask(this, FD_WANT_POLL_READ | FD_WANT_POLL_WRITE);
+				status = WWRITE;
+				break;
+			default:
+				DelayReconnect();
+				break;
 		}
 	}
 
@@ -548,6 +771,12 @@ restart:
 	{
 		status = DEAD;
 
+		if (result)
+		{
+			PQclear(result);
+			result = nullptr;
+		}
+
 		if (HasFd() && SocketEngine::HasFd(GetFd()))
 			SocketEngine::DelFd(this);
 
@@ -644,11 +873,16 @@ public:
 		SQL::Error err(SQL::BAD_DBID);
 		for (const auto& [_, conn] : connections)
 		{
-			if (conn->qinprog.c && conn->qinprog.c->creator == mod)
+			for (auto& item : conn->pending)
 			{
-				conn->qinprog.c->OnError(err);
-				delete conn->qinprog.c;
-				conn->qinprog.c = nullptr;
+				// The result of this query will be discarded when it arrives.
+				SQL::Query* q = item.item ? item.item->c : nullptr;
+				if (q && q->creator == mod)
+				{
+					q->OnError(err);
+					delete q;
+					item.item->c = nullptr;
+				}
 			}
 			std::deque<QueueItem>::iterator j = conn->queue.begin();
 			while (j != conn->queue.end())
@@ -35,6 +35,7 @@
 
 #include "inspircd.h"
 #include "modules/sql.h"
+#include "threadsocket.h"
 #include "utility/string.h"
 
 #include <sqlite3.h>
@@ -43,18 +44,121 @@
 # pragma comment(lib, "sqlite3.lib")
 #endif
 
+/* SQLite does not have an asynchronous API so, like the MySQL module, we run queries on a worker
+ * thread. Queries are pushed onto a queue by the main thread and the worker thread pops as many
+ * queries for the same database as it can and executes them inside a single transaction. Once a
+ * batch has been executed the results are pushed onto the result queue and the main thread is
+ * notified through the SocketThread so that it can deliver them to the calling modules.
+ *
+ * The worker thread never touches the SQL::Query objects. This means that if a module is unloaded
+ * whilst one of its queries is being executed the main thread can just report the error and null
+ * the query out of the in progress list without having to wait for the worker thread.
+ */
+
+class DispatcherThread;
+class ModuleSQLite3;
 class SQLConn;
+class SQLite3Result;
+
+struct QueryQueueItem final
+{
+	// The SQLite database which this query is executed on.
+	SQLConn* connection;
+
+	// An object which handles the result of the query.
+	SQL::Query* query;
+
+	// The SQL query which is to be executed.
+	std::string querystr;
+
+	// If non-empty then the values to bind to the parameters of querystr.
+	SQL::ParamList params;
+
+	QueryQueueItem(SQL::Query* q, const std::string& s, SQLConn* c)
+		: connection(c)
+		, query(q)
+		, querystr(s)
+	{
+	}
+};
+
+struct ResultQueueItem final
+{
+	// An object which handles the result of the query.
+	SQL::Query* query;
+
+	// The result returned from executing the SQLite query.
+	SQLite3Result* result;
+
+	ResultQueueItem(SQL::Query* q, SQLite3Result* r)
+		: query(q)
+		, result(r)
+	{
+	}
+};
+
 typedef insp::flat_map<std::string, SQLConn*> ConnMap;
+typedef std::deque<QueryQueueItem> QueryQueue;
+typedef std::deque<ResultQueueItem> ResultQueue;
+
+class DispatcherThread final
+	: public SocketThread
+{
+private:
+	ModuleSQLite3* const Parent;
+
+public:
+	DispatcherThread(ModuleSQLite3* CreatorModule)
+		: Parent(CreatorModule)
+	{
+	}
+
+	void OnStart() override;
+	void OnNotify() override;
+};
+
+class ModuleSQLite3 final
+	: public Module
+{
+public:
+	DispatcherThread* Dispatcher = nullptr;
+	QueryQueue qq;         // MUST HOLD MUTEX
+	QueryQueue inprogress; // MUST HOLD MUTEX
+	ResultQueue rq;        // MUST HOLD MUTEX
+	ConnMap conns;         // main thread only
+
+	// Modules which have been unloaded but which might not have been deleted yet. Main thread only.
+	insp::flat_set<Module*> unloaded;
+
+	ModuleSQLite3();
+	~ModuleSQLite3() override;
+	void init() override;
+	void FailQueries(const std::vector<SQL::Query*>& queries);
+	void ReadConfig(ConfigStatus& status) override;
+	void OnLoadModule(Module* mod) override;
+	void OnUnloadModule(Module* mod) override;
+};
 
 class SQLite3Result final
 	: public SQL::Result
 {
 public:
+	SQL::Error err;
 	int currentrow = 0;
 	int rows = 0;
 	std::vector<std::string> columns;
 	std::vector<SQL::Row> fieldlists;
 
+	SQLite3Result()
+		: err(SQL::SUCCESS)
+	{
+	}
+
+	SQLite3Result(const SQL::Error& e)
+		: err(e)
+	{
+	}
+
 	int Rows() override
 	{
 		return rows;
@@ -97,90 +201,273 @@ public:
 class SQLConn final
 	: public SQL::Provider
 {
-	sqlite3* conn;
+private:
+	typedef std::list<std::pair<std::string, sqlite3_stmt*>> StatementList;
+
+	sqlite3* conn = nullptr;
 	std::shared_ptr<ConfigTag> config;
 
-public:
-	SQLConn(Module* Parent, const std::shared_ptr<ConfigTag>& tag)
-		: SQL::Provider(Parent, tag->getString("id"))
-		, config(tag)
+	// Prepared statements in most recently used order. Worker thread only.
+	StatementList statements;
+	std::unordered_map<std::string, StatementList::iterator> statementmap;
+
+	// The maximum number of prepared statements to keep.
+	size_t maxstatements;
+
+	static bool IsTransactionControl(const std::string& q)
 	{
-		std::string host = tag->getString("hostname");
-		if (sqlite3_open_v2(host.c_str(), &conn, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK)
+		const std::string::size_type start = q.find_first_not_of(" \t\r\n(");
+		if (start == std::string::npos)
+			return false;
+
+		const std::string::size_type end = q.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz", start);
+		const std::string keyword = q.substr(start, end == std::string::npos ? end : end - start);
+		for (const auto* txkeyword : { "BEGIN", "COMMIT", "END", "RELEASE", "ROLLBACK", "SAVEPOINT" })
 		{
-			// Even in case of an error conn must be closed
-			sqlite3_close(conn);
-			conn = nullptr;
-			ServerInstance->Logs.Critical(MODNAME, "WARNING: Could not open DB with id: " + tag->getString("id"));
+			if (insp::equalsci(keyword, txkeyword))
+				return true;
 		}
+		return false;
 	}
 
-	~SQLConn() override
+	// This is called from the worker thread so it must not log.
+	bool Execute(const char* q)
 	{
-		if (conn)
+		return sqlite3_exec(conn, q, nullptr, nullptr, nullptr) == SQLITE_OK;
+	}
+
+	void ExecuteOrWarn(const char* q)
+	{
+		if (!Execute(q))
 		{
-			sqlite3_interrupt(conn);
-			sqlite3_close(conn);
+			ServerInstance->Logs.Warning(MODNAME, "Unable to execute \"{}\" on the {} database: {}",
+				q, GetId(), sqlite3_errmsg(conn));
 		}
 	}
 
-	void Query(SQL::Query* query, const std::string& q)
+	sqlite3_stmt* GetStatement(const std::string& q)
 	{
-		SQLite3Result res;
+		auto it = statementmap.find(q);
+		if (it != statementmap.end())
+		{
+			// Move the statement to the front of the list so it is evicted last.
+			statements.splice(statements.begin(), statements, it->second);
+			return it->second->second;
+		}
+
 		sqlite3_stmt* stmt;
-		int err = sqlite3_prepare_v2(conn, q.c_str(), static_cast<int>(q.length()), &stmt, nullptr);
-		if (err != SQLITE_OK)
+		if (sqlite3_prepare_v2(conn, q.c_str(), static_cast<int>(q.length()), &stmt, nullptr) != SQLITE_OK)
+			return nullptr;
+
+		if (!maxstatements)
+			return stmt;
+
+		while (statements.size() >= maxstatements)
 		{
-			SQL::Error error(SQL::QSEND_FAIL, sqlite3_errmsg(conn));
-			query->OnError(error);
+			sqlite3_finalize(statements.back().second);
+			statementmap.erase(statements.back().first);
+			statements.pop_back();
+		}
+		statements.emplace_front(q, stmt);
+		statementmap.emplace(q, statements.begin());
+		return stmt;
+	}
+
+	void ReleaseStatement(sqlite3_stmt* stmt)
+	{
+		if (!maxstatements)
+		{
+			sqlite3_finalize(stmt);
 			return;
 		}
+
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+
+	SQLite3Result* Query(const QueryQueueItem& item)
+	{
+		if (!conn)
+			return new SQLite3Result(SQL::Error(SQL::BAD_CONN));
+
+		sqlite3_stmt* stmt = GetStatement(item.querystr);
+		if (!stmt)
+			return new SQLite3Result(SQL::Error(SQL::QSEND_FAIL, sqlite3_errmsg(conn)));
+
+		for (size_t i = 0; i < item.params.size(); ++i)
+		{
+			const std::string& param = item.params[i];
+			if (sqlite3_bind_text(stmt, static_cast<int>(i + 1), param.c_str(), static_cast<int>(param.length()), SQLITE_TRANSIENT) != SQLITE_OK)
+			{
+				auto* res = new SQLite3Result(SQL::Error(SQL::QSEND_FAIL, sqlite3_errmsg(conn)));
+				ReleaseStatement(stmt);
+				return res;
+			}
+		}
+
+		auto* res = new SQLite3Result();
 		int cols = sqlite3_column_count(stmt);
-		res.columns.resize(cols);
+		res->columns.resize(cols);
 		for(int i=0; i < cols; i++)
 		{
-			res.columns[i] = sqlite3_column_name(stmt, i);
+			res->columns[i] = sqlite3_column_name(stmt, i);
 		}
 		while (true)
 		{
-			err = sqlite3_step(stmt);
+			int err = sqlite3_step(stmt);
 			if (err == SQLITE_ROW)
 			{
 				// Add the row
-				res.fieldlists.resize(res.rows + 1);
-				res.fieldlists[res.rows].resize(cols);
+				res->fieldlists.resize(res->rows + 1);
+				res->fieldlists[res->rows].resize(cols);
 				for(int i=0; i < cols; i++)
 				{
 					const char* txt = (const char*)sqlite3_column_text(stmt, i);
 					if (txt)
-						res.fieldlists[res.rows][i] = txt;
+						res->fieldlists[res->rows][i] = txt;
 				}
-				res.rows++;
+				res->rows++;
 			}
 			else if (err == SQLITE_DONE)
 			{
-				query->OnResult(res);
 				break;
 			}
 			else
 			{
-				SQL::Error error(SQL::QREPLY_FAIL, sqlite3_errmsg(conn));
-				query->OnError(error);
+				delete res;
+				res = new SQLite3Result(SQL::Error(SQL::QREPLY_FAIL, sqlite3_errmsg(conn)));
 				break;
 			}
 		}
-		sqlite3_finalize(stmt);
+		ReleaseStatement(stmt);
+		return res;
 	}
 
-	void Submit(SQL::Query* query, const std::string& q) override
+	void Enqueue(SQL::Query* query, const std::string& q, const SQL::ParamList& params)
 	{
+		ModuleSQLite3* mod = Parent();
+		if (mod->unloaded.count(query->creator))
+		{
+			// The module which submitted this query is being unloaded (e.g. it logged something
+			// after OnUnloadModule) so nothing will be around to handle the result. We can't call
+			// OnError or log here as either might just submit another query.
+			delete query;
+			return;
+		}
+
 		ServerInstance->Logs.Debug(MODNAME, "Executing SQLite3 query: " + q);
-		Query(query, q);
-		delete query;
+		mod->Dispatcher->LockQueue();
+		QueryQueueItem& item = mod->qq.emplace_back(query, q, this);
+		item.params = params;
+		mod->Dispatcher->UnlockQueueWakeup();
+	}
+
+	static std::string GetMarker(size_t param)
+	{
+		return "?" + ConvToStr(param);
+	}
+
+public:
+	// The maximum number of queries to execute in a single transaction.
+	size_t maxbatch;
+
+	std::mutex lock;
+
+	SQLConn(Module* Parent, const std::shared_ptr<ConfigTag>& tag)
+		: SQL::Provider(Parent, tag->getString("id"))
+		, config(tag)
+		, maxstatements(tag->getNum<size_t>("statements", 64))
+		, maxbatch(tag->getNum<size_t>("batch", 50, 1))
+	{
+		std::string host = tag->getString("hostname");
+		if (sqlite3_open_v2(host.c_str(), &conn, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK)
+		{
+			// Even in case of an error conn must be closed
+			sqlite3_close(conn);
+			conn = nullptr;
+			ServerInstance->Logs.Critical(MODNAME, "WARNING: Could not open DB with id: " + tag->getString("id"));
+			return;
+		}
+
+		const auto timeout = tag->getDuration("timeout", 5, 0, 60);
+		sqlite3_busy_timeout(conn, static_cast<int>(timeout * 1000));
+
+		// WAL mode allows readers to continue whilst we are writing and requires fewer syncs.
+		if (tag->getBool("wal", true))
+		{
+			ExecuteOrWarn("PRAGMA journal_mode=WAL");
+			ExecuteOrWarn("PRAGMA synchronous=NORMAL");
+		}
+	}
+
+	~SQLConn() override
+	{
+		for (const auto& [_, stmt] : statements)
+			sqlite3_finalize(stmt);
+
+		if (conn)
+		{
+			sqlite3_interrupt(conn);
+			sqlite3_close(conn);
+		}
+	}
+
+	ModuleSQLite3* Parent()
+	{
+		return static_cast<ModuleSQLite3*>(static_cast<Module*>(creator));
+	}
+
+	/** Determines whether the specified query can be executed in a batch with other queries. */
+	static bool CanBatch(const QueryQueueItem& item)
+	{
+		return !IsTransactionControl(item.querystr);
+	}
+
+	/** Executes a batch of queries. Called on the worker thread with the connection lock held. */
+	void Execute(const QueryQueue& batch, std::vector<SQLite3Result*>& results)
+	{
+		// If we are executing more than one query then wrap them in a transaction so that we only
+		// need to sync the database to disk once.
+		bool transaction = batch.size() > 1 && conn && sqlite3_get_autocommit(conn) && Execute("BEGIN");
+
+		results.reserve(batch.size());
+		for (const auto& item : batch)
+			results.push_back(Query(item));
+
+		// SQLite automatically rolls back the transaction on some errors so we need to check
+		// that it is still active before committing.
+		if (transaction && (sqlite3_get_autocommit(conn) || !Execute("COMMIT")))
+		{
+			// The transaction failed so none of the changes have been written.
+			const std::string errmsg = sqlite3_errmsg(conn);
+			if (!sqlite3_get_autocommit(conn))
+				Execute("ROLLBACK");
+
+			for (auto& result : results)
+			{
+				if (result->err.code != SQL::SUCCESS)
+					continue;
+
+				delete result;
+				result = new SQLite3Result(SQL::Error(SQL::QREPLY_FAIL, errmsg));
+			}
+		}
+	}
+
+	void Submit(SQL::Query* query, const std::string& q) override
+	{
+		Enqueue(query, q, SQL::ParamList());
 	}
 
 	void Submit(SQL::Query* query, const std::string& q, const SQL::ParamList& p) override
 	{
+		SQL::Template tmpl;
+		if (tmpl.Convert(q, false, GetMarker))
+		{
+			Enqueue(query, tmpl.query, tmpl.GetValues(p));
+			return;
+		}
+
 		std::string res;
 		unsigned int param = 0;
 		for (const auto chr : q)
@@ -202,6 +489,13 @@ public:
 
 	void Submit(SQL::Query* query, const std::string& q, const SQL::ParamMap& p) override
 	{
+		SQL::Template tmpl;
+		if (tmpl.Convert(q, true, GetMarker))
+		{
+			Enqueue(query, tmpl.query, tmpl.GetValues(p));
+			return;
+		}
+
 		std::string res;
 		for(std::string::size_type i = 0; i < q.length(); i++)
 		{
@@ -228,53 +522,200 @@ public:
 	}
 };
 
-class ModuleSQLite3 final
-	: public Module
+ModuleSQLite3::ModuleSQLite3()
+	: Module(VF_VENDOR, "Provides the ability for SQL modules to query a SQLite 3 database.")
 {
-private:
-	ConnMap conns;
+}
 
-public:
-	ModuleSQLite3()
-		: Module(VF_VENDOR, "Provides the ability for SQL modules to query a SQLite 3 database.")
+ModuleSQLite3::~ModuleSQLite3()
+{
+	if (Dispatcher)
+	{
+		Dispatcher->Stop();
+		Dispatcher->OnNotify();
+		delete Dispatcher;
+	}
+
+	std::vector<SQL::Query*> removed;
+	for (const auto& item : qq)
+		removed.push_back(item.query);
+	FailQueries(removed);
+
+	for (const auto& [_, conn] : conns)
+	{
+		ServerInstance->Modules.DelService(*conn);
+		delete conn;
+	}
+}
+
+void ModuleSQLite3::init()
+{
+	ServerInstance->Logs.Normal(MODNAME, "Module was compiled against SQLite version {} and is running against version {}",
+		SQLITE_VERSION, sqlite3_libversion());
+
+	if (!sqlite3_threadsafe())
+		throw ModuleException(this, "Unable to use a SQLite library which was compiled without thread safety!");
+
+	Dispatcher = new DispatcherThread(this);
+	Dispatcher->Start();
+}
+
+void ModuleSQLite3::ReadConfig(ConfigStatus& status)
+{
+	// Remove the old databases before opening the new ones.
+	std::vector<SQL::Query*> removed;
+	Dispatcher->LockQueue();
+	for (const auto& [_, conn] : conns)
+	{
+		ServerInstance->Modules.DelService(*conn);
+
+		// It might be running a query on this database. Wait for that to complete.
+		conn->lock.lock();
+		conn->lock.unlock();
+
+		// Now remove all pending queries to this database.
+		for (size_t i = qq.size(); i > 0; i--)
+		{
+			if (qq[i - 1].connection == conn)
+			{
+				removed.push_back(qq[i - 1].query);
+				qq.erase(qq.begin() + i - 1);
+			}
+		}
+		delete conn;
+	}
+	conns.clear();
+	Dispatcher->UnlockQueue();
+	FailQueries(removed);
+
+	for (const auto& [_, tag] : ServerInstance->Config->ConfTags("database"))
 	{
+		if (!insp::equalsci(tag->getString("module"), "sqlite"))
+			continue;
+
+		auto* conn = new SQLConn(this, tag);
+		conns.emplace(tag->getString("id"), conn);
+		ServerInstance->Modules.AddService(*conn);
 	}
+}
 
-	~ModuleSQLite3() override
+void ModuleSQLite3::FailQueries(const std::vector<SQL::Query*>& queries)
+{
+	// This must not be called with the queue locked as the error handler may submit another query.
+	SQL::Error err(SQL::BAD_DBID);
+	for (auto* query : queries)
 	{
-		ClearConns();
+		query->OnError(err);
+		delete query;
 	}
+}
+
+void ModuleSQLite3::OnLoadModule(Module* mod)
+{
+	// A new module might have been allocated at the same address as an old one.
+	unloaded.erase(mod);
+}
 
-	void init() override
+void ModuleSQLite3::OnUnloadModule(Module* mod)
+{
+	// Any queries submitted from now on (including by the error handlers below) are discarded.
+	unloaded.insert(mod);
+
+	std::vector<SQL::Query*> removed;
+	Dispatcher->LockQueue();
+	for (size_t i = qq.size(); i > 0; i--)
 	{
-		ServerInstance->Logs.Normal(MODNAME, "Module was compiled against SQLite version {} and is running against version {}",
-			SQLITE_VERSION, sqlite3_libversion());
+		if (qq[i - 1].query->creator == mod)
+		{
+			removed.push_back(qq[i - 1].query);
+			qq.erase(qq.begin() + i - 1);
+		}
 	}
 
-	void ClearConns()
+	// The worker thread will discard the results of these when it finishes.
+	for (auto& item : inprogress)
 	{
-		for (const auto& [_, conn] : conns)
+		if (item.query && item.query->creator == mod)
 		{
-			ServerInstance->Modules.DelService(*conn);
-			delete conn;
+			removed.push_back(item.query);
+			item.query = nullptr;
 		}
-		conns.clear();
 	}
+	Dispatcher->UnlockQueue();
+	FailQueries(removed);
+
+	// Clean up any result queue entries.
+	Dispatcher->OnNotify();
+}
 
-	void ReadConfig(ConfigStatus& status) override
+void DispatcherThread::OnStart()
+{
+	std::vector<SQLite3Result*> results;
+	this->LockQueue();
+	while (!this->IsStopping())
 	{
-		ClearConns();
+		if (Parent->qq.empty())
+		{
+			/* We know the queue is empty, we can safely hang this thread until
+			 * something happens
+			 */
+			this->WaitForQueue();
+			continue;
+		}
 
-		for (const auto& [_, tag] : ServerInstance->Config->ConfTags("database"))
+		// Grab as many queries for the same database as we are allowed to.
+		SQLConn* conn = Parent->qq.front().connection;
+		do
 		{
-			if (!insp::equalsci(tag->getString("module"), "sqlite"))
-				continue;
+			Parent->inprogress.push_back(std::move(Parent->qq.front()));
+			Parent->qq.pop_front();
+		}
+		while (!Parent->qq.empty() && Parent->inprogress.size() < conn->maxbatch
+			&& Parent->qq.front().connection == conn && SQLConn::CanBatch(Parent->qq.front())
+			&& SQLConn::CanBatch(Parent->inprogress.front()));
+
+		// The main thread may null out the query but it will not touch anything else so we can
+		// safely read from the in progress queue whilst unlocked.
+		conn->lock.lock();
+		this->UnlockQueue();
+		conn->Execute(Parent->inprogress, results);
+		conn->lock.unlock();
 
-			auto* conn = new SQLConn(this, tag);
-			conns.emplace(tag->getString("id"), conn);
-			ServerInstance->Modules.AddService(*conn);
+		this->LockQueue();
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			SQL::Query* query = Parent->inprogress[i].query;
+			if (query)
+				Parent->rq.emplace_back(query, results[i]);
+			else
+				delete results[i]; // UnloadModule ate the query.
 		}
+		Parent->inprogress.clear();
+		results.clear();
+		NotifyParent();
 	}
-};
+	this->UnlockQueue();
+}
+
+void DispatcherThread::OnNotify()
+{
+	// Take the results out of the queue before dispatching them as the result handler may
+	// submit another query.
+	ResultQueue results;
+	this->LockQueue();
+	results.swap(Parent->rq);
+	this->UnlockQueue();
+
+	for (const auto& item : results)
+	{
+		SQLite3Result* res = item.result;
+		if (res->err.code == SQL::SUCCESS)
+			item.query->OnResult(*res);
+		else
+			item.query->OnError(res->err);
+		delete item.query;
+		delete item.result;
+	}
+}
 
 MODULE_INIT(ModuleSQLite3)
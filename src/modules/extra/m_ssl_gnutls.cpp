@@ -40,6 +40,8 @@
 
 #include "inspircd.h"
 #include "modules/ssl.h"
+#include "modules/ssl_handshake.h"
+#include "modules/stats.h"
 #include "stringutils.h"
 #include "timeutils.h"
 #include "utility/string.h"
@@ -63,6 +65,7 @@
 #endif
 
 static Module* thismod;
+static SSLHandshake::Pool handshakepool;
 
 namespace GnuTLS
 {
@@ -149,6 +152,47 @@ namespace GnuTLS
 		std::vector<std::pair<gnutls_digest_algorithm_t, bool>> get() const { return hashes; }
 	};
 
+	/** The master key which GnuTLS derives session ticket keys from. As GnuTLS rotates the keys
+	 * which it derives based on the time servers which share a master key can resume each other's
+	 * sessions without needing to exchange keys.
+	 */
+	class TicketKey final
+	{
+		gnutls_datum_t key;
+
+	public:
+		TicketKey(const std::string& secret)
+		{
+			if (secret.empty())
+			{
+				// Tickets will only be valid on this server until it is restarted.
+				ThrowOnError(gnutls_session_ticket_key_generate(&key), "Unable to generate a session ticket key");
+				return;
+			}
+
+			// GnuTLS requires a 64 byte master key so derive one from the secret.
+			key.size = 64;
+			key.data = static_cast<unsigned char*>(gnutls_malloc(key.size));
+			if (!key.data)
+				throw Exception("Unable to allocate a session ticket key");
+
+			int ret = gnutls_hash_fast(GNUTLS_DIG_SHA512, secret.data(), secret.length(), key.data);
+			if (ret < 0)
+			{
+				gnutls_free(key.data);
+				ThrowOnError(ret, "Unable to derive a session ticket key");
+			}
+		}
+
+		~TicketKey()
+		{
+			gnutls_memset(key.data, 0, key.size);
+			gnutls_free(key.data);
+		}
+
+		const gnutls_datum_t* get() const { return &key; }
+	};
+
 #ifndef GNUTLS_AUTO_DH
 	class DHParams final
 	{
@@ -494,6 +538,14 @@ namespace GnuTLS
 		 */
 		const bool requestclientcert;
 
+		/** The master key for session tickets or nullptr if session tickets are disabled
+		 */
+		std::shared_ptr<TicketKey> ticketkey;
+
+		/** The number of seconds that session tickets are valid for
+		 */
+		const unsigned long ticketlifetime;
+
 		static std::string ReadFile(const std::string& filename)
 		{
 			auto file = ServerInstance->Config->ReadFile(filename, ServerInstance->Time());
@@ -548,6 +600,9 @@ namespace GnuTLS
 			unsigned int outrecsize;
 			bool requestclientcert;
 
+			std::shared_ptr<TicketKey> ticketkey;
+			unsigned long ticketlifetime;
+
 			Config(const std::string& profilename, const std::shared_ptr<ConfigTag>& tag)
 				: name(profilename)
 				, certstr(ReadFile(tag->getString("certfile", "cert.pem", 1)))
@@ -572,6 +627,24 @@ namespace GnuTLS
 				}
 
 				outrecsize = tag->getNum<unsigned int>("outrecsize", 2048, 512);
+
+				ticketlifetime = tag->getDuration("ticketlifetime", 60*60, 60, 7*24*60*60);
+				if (tag->getBool("sessiontickets", true))
+					ticketkey = std::make_shared<TicketKey>(ReadTicketSecret(tag));
+			}
+
+			static std::string ReadTicketSecret(const std::shared_ptr<ConfigTag>& tag)
+			{
+				const std::string filename = tag->getString("ticketkeyfile");
+				if (filename.empty())
+					return {};
+
+				// Ignore any trailing newline so the file can be edited by hand.
+				std::string secret = ReadFile(filename);
+				secret.erase(secret.find_last_not_of("\r\n") + 1);
+				if (secret.length() < 32)
+					throw Exception("Session ticket key file " + filename + " must contain at least 32 characters");
+				return secret;
 			}
 		};
 
@@ -583,6 +656,8 @@ namespace GnuTLS
 			, priority(config.priostr)
 			, outrecsize(config.outrecsize)
 			, requestclientcert(config.requestclientcert)
+			, ticketkey(config.ticketkey)
+			, ticketlifetime(config.ticketlifetime)
 		{
 #ifndef GNUTLS_AUTO_DH
 			x509cred.SetDH(config.dh);
@@ -591,7 +666,7 @@ namespace GnuTLS
 		}
 		/** Set up the given session with the settings in this profile
 		 */
-		void SetupSession(gnutls_session_t sess)
+		void SetupSession(gnutls_session_t sess, bool server)
 		{
 			priority.SetupSession(sess);
 			x509cred.SetupSession(sess);
@@ -600,15 +675,91 @@ namespace GnuTLS
 			// Request client certificate if enabled and we are a server, no-op if we're a client
 			if (requestclientcert)
 				gnutls_certificate_server_set_request(sess, GNUTLS_CERT_REQUEST);
+
+			// GnuTLS rotates the keys it derives from the master key based on the expiration time.
+			if (server && ticketkey)
+			{
+				gnutls_session_ticket_enable_server(sess, ticketkey->get());
+				gnutls_db_set_cache_expiration(sess, static_cast<int>(ticketlifetime));
+			}
 		}
 
+		/** The number of handshakes which have been completed as a server. */
+		unsigned long handshakes = 0;
+
+		/** The number of handshakes which have been completed as a server by resuming a session. */
+		unsigned long resumed = 0;
+
 		const std::string& GetName() const { return name; }
 		X509Credentials& GetX509Credentials() { return x509cred; }
 		std::vector<std::pair<gnutls_digest_algorithm_t, bool>> GetHash() const { return hash.get(); }
 		unsigned int GetOutgoingRecordSize() const { return outrecsize; }
 	};
+
+	/** The transport which a session uses to exchange data with its peer. */
+	class Transport final
+		: public SSLHandshake::Transport
+	{
+	public:
+		/** The session which is using this transport. */
+		const gnutls_session_t sess;
+
+		Transport(StreamSocket* s, gnutls_session_t session)
+			: SSLHandshake::Transport(s)
+			, sess(session)
+		{
+		}
+
+		/** Sets the error code which the session will see for a failed transport operation. */
+		void SetErrno(int err)
+		{
+#ifdef _WIN32
+			gnutls_transport_set_errno(sess, err);
+#else
+			errno = err;
+#endif
+		}
+	};
 }
 
+class GnuTLSIOHook;
+
+/** Runs a step of a server handshake on a worker thread. */
+class GnuTLSHandshakeJob final
+	: public SSLHandshake::Job
+{
+public:
+	/** The hook which the handshake is for or nullptr if the hook was destroyed whilst the job was running. */
+	GnuTLSIOHook* hook;
+
+	/** The session which the handshake is being run on. */
+	const gnutls_session_t sess;
+
+	/** Keeps the profile alive if the hook is destroyed whilst the job is running. */
+	const std::shared_ptr<IOHookProvider> prov;
+
+	/** Keeps the buffers alive if the hook is destroyed whilst the job is running. */
+	const std::shared_ptr<GnuTLS::Transport> transport;
+
+	/** The return value of gnutls_handshake(). */
+	int result = 0;
+
+	GnuTLSHandshakeJob(GnuTLSIOHook* h, gnutls_session_t session, const std::shared_ptr<IOHookProvider>& hookprov, const std::shared_ptr<GnuTLS::Transport>& trans)
+		: hook(h)
+		, sess(session)
+		, prov(hookprov)
+		, transport(trans)
+	{
+	}
+
+	void Run() override
+	{
+		result = gnutls_handshake(sess);
+	}
+
+	void OnComplete() override;
+};
+
 class GnuTLSIOHook final
 	: public SSLIOHook
 {
@@ -616,9 +767,30 @@ private:
 	gnutls_session_t sess = nullptr;
 	size_t gbuffersize = 0;
 
+	/** Whether we are the server side of the session. */
+	const bool server;
+
+	/** The buffers which the session uses to exchange data with the peer whilst the handshake is running on a worker thread. */
+	std::shared_ptr<GnuTLS::Transport> transport;
+
+	/** The handshake job which is running on a worker thread or nullptr if there isn't one. */
+	GnuTLSHandshakeJob* job = nullptr;
+
+	/** Whether a handshake job has completed but its result has not been handled yet. */
+	bool jobdone = false;
+
+	/** The return value of gnutls_handshake() from the last handshake job. */
+	int jobresult = 0;
+
 	void CloseSession()
 	{
-		if (this->sess)
+		if (job)
+		{
+			// The worker thread is still using the session so the job will free it.
+			job->hook = nullptr;
+			job = nullptr;
+		}
+		else if (this->sess)
 		{
 			gnutls_bye(this->sess, GNUTLS_SHUT_WR);
 			gnutls_deinit(this->sess);
@@ -628,10 +800,62 @@ private:
 		status = STATUS_NONE;
 	}
 
+	// Runs the next step of a server handshake on a worker thread once the peer has sent something.
+	int OffloadHandshake(StreamSocket* user)
+	{
+		this->status = STATUS_HANDSHAKING;
+
+		const int flushed = transport->Flush();
+		if (flushed < 0 || transport->Fill() < 0)
+		{
+			CloseSession();
+			return -1;
+		}
+
+		if (transport->recvq.empty())
+		{
+			// Wait for the peer to send something.
+			SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | (flushed ? FD_WANT_NO_WRITE : FD_WANT_SINGLE_WRITE));
+			return 0;
+		}
+
+		// The session must not be touched on the main thread until the job has completed.
+		transport->offloaded = true;
+		SocketEngine::ChangeEventMask(user, FD_WANT_NO_READ | FD_WANT_NO_WRITE);
+
+		job = new GnuTLSHandshakeJob(this, sess, prov, transport);
+		handshakepool.Submit(job);
+		return 0;
+	}
+
 	// Returns 1 if handshake succeeded, 0 if it is still in progress, -1 if it failed
 	int Handshake(StreamSocket* user)
 	{
-		int ret = gnutls_handshake(this->sess);
+		// The handshake is still running on a worker thread.
+		if (job)
+			return 0;
+
+		int ret;
+		const bool offloaded = jobdone;
+		if (jobdone)
+		{
+			// Send whatever the worker thread wrote before continuing.
+			jobdone = false;
+			ret = jobresult;
+			if (transport->Flush() < 0)
+			{
+				CloseSession();
+				return -1;
+			}
+
+			// If the handshake needs more data then start the next step.
+			if ((ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED) && handshakepool.IsEnabled())
+				return OffloadHandshake(user);
+		}
+		else if (server && handshakepool.IsEnabled())
+			return OffloadHandshake(user);
+		else
+			ret = gnutls_handshake(this->sess);
 
 		if (ret < 0)
 		{
@@ -665,10 +889,19 @@ private:
 			// Change the session state
 			this->status = STATUS_OPEN;
 
+			if (server)
+			{
+				GnuTLS::Profile& profile = GetProfile();
+				profile.handshakes++;
+				if (gnutls_session_is_resumed(this->sess))
+					profile.resumed++;
+			}
+
 			VerifyCertificate();
 
-			// Finish writing, if any left
-			SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | FD_WANT_NO_WRITE | FD_ADD_TRIAL_WRITE);
+			// Finish writing, if any left. The peer may also have sent data after the
+			// handshake whilst it was running on a worker thread.
+			SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | FD_WANT_NO_WRITE | FD_ADD_TRIAL_WRITE | (offloaded ? FD_ADD_TRIAL_READ : 0));
 
 			return 1;
 		}
@@ -875,18 +1108,27 @@ info_done_dealloc:
 
 	static ssize_t gnutls_pull_wrapper(gnutls_transport_ptr_t session_wrap, void* buffer, size_t size)
 	{
-		StreamSocket* sock = reinterpret_cast<StreamSocket*>(session_wrap);
-#ifdef _WIN32
-		GnuTLSIOHook* session = static_cast<GnuTLSIOHook*>(sock->GetModHook(thismod));
-#endif
+		auto* transport = reinterpret_cast<GnuTLS::Transport*>(session_wrap);
+		if (!transport->recvq.empty())
+		{
+			// Read anything that was received whilst the handshake was running on a worker thread first.
+			const size_t length = std::min(size, transport->recvq.length());
+			memcpy(buffer, transport->recvq.data(), length);
+			transport->recvq.erase(0, length);
+			return length;
+		}
 
+		// The handshake is running on a worker thread and needs more data.
+		if (transport->offloaded)
+		{
+			transport->SetErrno(EAGAIN);
+			return -1;
+		}
+
+		StreamSocket* sock = transport->sock;
 		if (sock->GetEventMask() & FD_READ_WILL_BLOCK)
 		{
-#ifdef _WIN32
-			gnutls_transport_set_errno(session->sess, EAGAIN);
-#else
-			errno = EAGAIN;
-#endif
+			transport->SetErrno(EAGAIN);
 			return -1;
 		}
 
@@ -900,7 +1142,7 @@ info_done_dealloc:
 			 * The gnutls library may also have a different errno variable than us, see
 			 * gnutls_transport_set_errno(3).
 			 */
-			gnutls_transport_set_errno(session->sess, SocketEngine::IgnoreError() ? EAGAIN : errno);
+			transport->SetErrno(SocketEngine::IgnoreError() ? EAGAIN : errno);
 		}
 #endif
 
@@ -910,18 +1152,33 @@ info_done_dealloc:
 	}
 	static ssize_t VectorPush(gnutls_transport_ptr_t transportptr, const giovec_t* iov, int iovcnt)
 	{
-		StreamSocket* sock = reinterpret_cast<StreamSocket*>(transportptr);
-#ifdef _WIN32
-		GnuTLSIOHook* session = static_cast<GnuTLSIOHook*>(sock->GetModHook(thismod));
-#endif
+		auto* transport = reinterpret_cast<GnuTLS::Transport*>(transportptr);
+		if (transport->offloaded)
+		{
+			// The handshake is running on a worker thread.
+			ssize_t size = 0;
+			for (int i = 0; i < iovcnt; i++)
+			{
+				transport->sendq.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+				size += iov[i].iov_len;
+			}
+			return size;
+		}
 
+		StreamSocket* sock = transport->sock;
 		if (sock->GetEventMask() & FD_WRITE_WILL_BLOCK)
 		{
-#ifdef _WIN32
-			gnutls_transport_set_errno(session->sess, EAGAIN);
-#else
-			errno = EAGAIN;
-#endif
+			transport->SetErrno(EAGAIN);
+			return -1;
+		}
+
+		// Send anything that was written whilst the handshake was running on a worker thread first.
+		const int flushed = transport->Flush();
+		if (flushed <= 0)
+		{
+			if (!flushed)
+				SocketEngine::ChangeEventMask(sock, FD_WRITE_WILL_BLOCK);
+			transport->SetErrno(flushed ? ECONNRESET : EAGAIN);
 			return -1;
 		}
 
@@ -930,7 +1187,7 @@ info_done_dealloc:
 #ifdef _WIN32
 		// See the function above for more info about the usage of gnutls_transport_set_errno() on Windows
 		if (ret < 0)
-			gnutls_transport_set_errno(session->sess, SocketEngine::IgnoreError() ? EAGAIN : errno);
+			transport->SetErrno(SocketEngine::IgnoreError() ? EAGAIN : errno);
 #endif
 
 		ssize_t size = 0;
@@ -945,12 +1202,15 @@ info_done_dealloc:
 public:
 	GnuTLSIOHook(const std::shared_ptr<IOHookProvider>& hookprov, StreamSocket* sock, unsigned int flags)
 		: SSLIOHook(hookprov)
+		, server(flags & GNUTLS_SERVER)
 	{
 		gnutls_init(&sess, flags);
-		gnutls_transport_set_ptr(sess, reinterpret_cast<gnutls_transport_ptr_t>(sock));
+		transport = std::make_shared<GnuTLS::Transport>(sock, sess);
+		gnutls_session_set_ptr(sess, &GetProfile().GetX509Credentials());
+		gnutls_transport_set_ptr(sess, transport.get());
 		gnutls_transport_set_vec_push_function(sess, VectorPush);
 		gnutls_transport_set_pull_function(sess, gnutls_pull_wrapper);
-		GetProfile().SetupSession(sess);
+		GetProfile().SetupSession(sess, server);
 
 		sock->AddIOHook(this);
 		Handshake(sock);
@@ -961,6 +1221,18 @@ public:
 		CloseSession();
 	}
 
+	// Called on the main thread when a handshake job has finished running.
+	void OnHandshakeJobComplete(int result)
+	{
+		job = nullptr;
+		jobdone = true;
+		jobresult = result;
+		transport->offloaded = false;
+
+		// Continue the handshake from the socket so that errors are handled as normal.
+		SocketEngine::ChangeEventMask(transport->sock, FD_WANT_POLL_READ | FD_WANT_NO_WRITE | FD_ADD_TRIAL_READ);
+	}
+
 	ssize_t OnStreamSocketRead(StreamSocket* user, std::string& recvq) override
 	{
 		// Finish handshake if needed
@@ -1076,8 +1348,8 @@ int GnuTLS::X509Credentials::cert_callback(gnutls_session_t sess, const gnutls_d
 	st->cert_type = GNUTLS_CRT_X509;
 	st->key_type = GNUTLS_PRIVKEY_X509;
 
-	StreamSocket* sock = reinterpret_cast<StreamSocket*>(gnutls_transport_get_ptr(sess));
-	GnuTLS::X509Credentials& cred = static_cast<GnuTLSIOHook*>(sock->GetModHook(thismod))->GetProfile().GetX509Credentials();
+	// This may be called on a worker thread so the credentials are stored in the session rather than looked up from the hook.
+	GnuTLS::X509Credentials& cred = *static_cast<GnuTLS::X509Credentials*>(gnutls_session_get_ptr(sess));
 
 	st->ncerts = static_cast<unsigned int>(cred.certs.size());
 	st->cert.x509 = cred.certs.raw();
@@ -1087,6 +1359,14 @@ int GnuTLS::X509Credentials::cert_callback(gnutls_session_t sess, const gnutls_d
 	return 0;
 }
 
+void GnuTLSHandshakeJob::OnComplete()
+{
+	if (hook)
+		hook->OnHandshakeJobComplete(result);
+	else
+		gnutls_deinit(sess);
+}
+
 class GnuTLSIOHookProvider final
 	: public SSLIOHookProvider
 {
@@ -1125,6 +1405,7 @@ GnuTLS::Profile& GnuTLSIOHook::GetProfile()
 
 class ModuleSSLGnuTLS final
 	: public Module
+	, public Stats::EventListener
 {
 	typedef std::vector<std::shared_ptr<GnuTLSIOHookProvider>> ProfileList;
 
@@ -1159,18 +1440,18 @@ class ModuleSSLGnuTLS final
 				continue;
 			}
 
-			std::shared_ptr<GnuTLSIOHookProvider> prov;
+			std::shared_ptr<GnuTLSIOHookProvider> newprov;
 			try
 			{
 				GnuTLS::Profile::Config profileconfig(name, tag);
-				prov = std::make_shared<GnuTLSIOHookProvider>(this, profileconfig);
+				newprov = std::make_shared<GnuTLSIOHookProvider>(this, profileconfig);
 			}
 			catch (const CoreException& ex)
 			{
 				throw ModuleException(this, "Error while initializing TLS profile \"" + name + "\" at " + tag->source.str() + " - " + ex.GetReason());
 			}
 
-			newprofiles.push_back(prov);
+			newprofiles.push_back(newprov);
 		}
 
 		// New profiles are ok, begin using them
@@ -1184,6 +1465,7 @@ class ModuleSSLGnuTLS final
 public:
 	ModuleSSLGnuTLS()
 		: Module(VF_VENDOR, "Allows TLS encrypted connections using the GnuTLS library.")
+		, Stats::EventListener(this)
 		, rememberer(ServerInstance->GenRandom)
 	{
 		thismod = this;
@@ -1199,6 +1481,7 @@ public:
 	void ReadConfig(ConfigStatus& status) override
 	{
 		const auto& tag = ServerInstance->Config->ConfValue("gnutls");
+		handshakepool.SetThreads(tag->getNum<size_t>("handshakethreads", 0, 0, 64));
 		if (status.initial || tag->getBool("onrehash", true))
 		{
 			// Try to help people who have outdated configs.
@@ -1229,6 +1512,7 @@ public:
 
 	~ModuleSSLGnuTLS() override
 	{
+		handshakepool.SetThreads(0);
 		ServerInstance->GenRandom = rememberer;
 	}
 
@@ -1247,6 +1531,20 @@ public:
 		}
 	}
 
+	ModResult OnStats(Stats::Context& stats) override
+	{
+		if (stats.GetSymbol() != 'T')
+			return MOD_RES_PASSTHRU;
+
+		for (const auto& profileprov : profiles)
+		{
+			const GnuTLS::Profile& profile = profileprov->GetProfile();
+			stats.AddGenericRow(INSP_FORMAT("TLS profile {}: {} handshakes ({} resumed, {}%)", profile.GetName(),
+				profile.handshakes, profile.resumed, profile.handshakes ? profile.resumed * 100 / profile.handshakes : 0));
+		}
+		return MOD_RES_PASSTHRU;
+	}
+
 	ModResult OnCheckReady(LocalUser* user) override
 	{
 		const GnuTLSIOHook* const iohook = static_cast<GnuTLSIOHook*>(user->eh.GetModHook(this));
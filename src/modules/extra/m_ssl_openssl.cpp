@@ -41,6 +41,8 @@
 #include "inspircd.h"
 #include "iohook.h"
 #include "modules/ssl.h"
+#include "modules/ssl_handshake.h"
+#include "modules/stats.h"
 #include "stringutils.h"
 #include "timeutils.h"
 #include "utility/string.h"
@@ -48,6 +50,8 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/dh.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
 
 #ifdef _WIN32
 # define timegm _mkgmtime
@@ -64,8 +68,12 @@
 # define INSPIRCD_OPENSSL_AUTO_DH
 #endif
 
-static bool SelfSigned = false;
+#if defined SSL_OP_ENABLE_KTLS && !defined OPENSSL_NO_KTLS
+# define INSPIRCD_OPENSSL_KTLS
+#endif
+
 static int exdataindex;
+static int ctxexdataindex;
 static Module* thismod;
 
 char* get_error()
@@ -75,6 +83,11 @@ char* get_error()
 
 static int OnVerify(int preverify_ok, X509_STORE_CTX* ctx);
 static void StaticSSLInfoCallback(const SSL* ssl, int where, int rc);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, EVP_MAC_CTX* macctx, int enc);
+#else
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, HMAC_CTX* macctx, int enc);
+#endif
 
 namespace OpenSSL
 {
@@ -119,6 +132,108 @@ namespace OpenSSL
 	};
 #endif
 
+	/** A key which is used to encrypt and authenticate session tickets. */
+	struct TicketKey final
+	{
+		/** The name which identifies the key in a ticket. */
+		unsigned char name[16];
+
+		/** The key used to encrypt tickets with AES-256-CBC. */
+		unsigned char aeskey[32];
+
+		/** The key used to authenticate tickets with HMAC-SHA256. */
+		unsigned char hmackey[32];
+	};
+
+	/** Derives session ticket keys from a secret. A new key is used for each lifetime period and
+	 * tickets issued using the key from the previous period are still accepted. As the keys only
+	 * depend on the secret and the time servers which share a secret can resume each other's
+	 * sessions without needing to exchange keys. As handshakes may be run on worker threads keys
+	 * are returned by value.
+	 */
+	class TicketKeys final
+	{
+	private:
+		/** The secret to derive keys from. */
+		const std::string secret;
+
+		/** The number of seconds between key rotations. */
+		const unsigned long lifetime;
+
+		/** The period that keys[0] was derived for. */
+		time_t period = -1;
+
+		/** The keys for the current and previous periods. */
+		TicketKey keys[2];
+
+		/** Protects the keys from being updated whilst they are being read. */
+		std::mutex mutex;
+
+		void Derive(time_t keyperiod, TicketKey& key) const
+		{
+			unsigned char digest[EVP_MAX_MD_SIZE];
+			auto derive = [&](const char* label, unsigned char* out, size_t outlen) {
+				const std::string data = INSP_FORMAT("{}:{}", label, keyperiod);
+				unsigned int digestlen = 0;
+				HMAC(EVP_sha256(), secret.data(), static_cast<int>(secret.length()), reinterpret_cast<const unsigned char*>(data.data()), data.length(), digest, &digestlen);
+				memcpy(out, digest, std::min<size_t>(outlen, digestlen));
+			};
+
+			derive("name", key.name, sizeof(key.name));
+			derive("aes", key.aeskey, sizeof(key.aeskey));
+			derive("hmac", key.hmackey, sizeof(key.hmackey));
+		}
+
+		void Update()
+		{
+			// This may be called on a worker thread so we can't use ServerInstance->Time().
+			const time_t newperiod = time(nullptr) / static_cast<time_t>(lifetime);
+			if (newperiod == period)
+				return;
+
+			period = newperiod;
+			Derive(period, keys[0]);
+			Derive(period - 1, keys[1]);
+		}
+
+	public:
+		TicketKeys(const std::string& keysecret, unsigned long keylifetime)
+			: secret(keysecret)
+			, lifetime(keylifetime)
+		{
+		}
+
+		/** Retrieves the key which new tickets should be encrypted with. */
+		TicketKey GetCurrent()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Update();
+			return keys[0];
+		}
+
+		/** Finds the key with the specified name.
+		 * @param name The name of the key.
+		 * @param key Set to the key if it is found.
+		 * @param current Set to true if the key is the current key; otherwise, false.
+		 * @return True if a key with the specified name was found; otherwise, false.
+		 */
+		bool Find(const unsigned char* name, TicketKey& key, bool& current)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Update();
+			for (size_t idx = 0; idx < 2; ++idx)
+			{
+				if (!CRYPTO_memcmp(name, keys[idx].name, sizeof(keys[idx].name)))
+				{
+					key = keys[idx];
+					current = !idx;
+					return true;
+				}
+			}
+			return false;
+		}
+	};
+
 	class Context final
 	{
 		SSL_CTX* const ctx;
@@ -209,6 +324,34 @@ namespace OpenSSL
 			return SSL_CTX_load_verify_locations(ctx, filename.c_str(), nullptr);
 		}
 
+		void EnableTickets(TicketKeys* keys, unsigned long lifetime)
+		{
+			// Tickets are validated by OnTicketKey so we don't need a session cache.
+			SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+			ctx_options &= ~SSL_OP_NO_TICKET;
+			SSL_CTX_set_timeout(ctx, static_cast<long>(lifetime));
+			SSL_CTX_set_num_tickets(ctx, 1);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, OnTicketKey);
+#else
+			SSL_CTX_set_tlsext_ticket_key_cb(ctx, OnTicketKey);
+#endif
+			SSL_CTX_set_ex_data(ctx, ctxexdataindex, keys);
+
+			// Resumed sessions must have been created in the same context.
+			static const unsigned char sessionctx[] = "inspircd";
+			SSL_CTX_set_session_id_context(ctx, sessionctx, sizeof(sessionctx) - 1);
+		}
+
+#ifdef INSPIRCD_OPENSSL_KTLS
+		void EnableKTLS()
+		{
+			// OpenSSL will only offload to the kernel if the cipher is supported by it.
+			SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+			ctx_options |= SSL_OP_ENABLE_KTLS;
+		}
+#endif
+
 		void SetCRL(const std::string& crlfile, const std::string& crlpath, const std::string& crlmode)
 		{
 			if (crlfile.empty() && crlpath.empty())
@@ -315,6 +458,14 @@ namespace OpenSSL
 		 */
 		const unsigned int outrecsize;
 
+		/** The keys used for session tickets or nullptr if session tickets are disabled.
+		 */
+		std::unique_ptr<TicketKeys> ticketkeys;
+
+		/** True if OpenSSL should try to offload encryption to the kernel.
+		 */
+		const bool ktls;
+
 		static int error_callback(const char* str, size_t len, void* u)
 		{
 			Profile* profile = reinterpret_cast<Profile*>(u);
@@ -374,6 +525,7 @@ namespace OpenSSL
 			, clientctx(SSL_CTX_new(TLS_client_method()))
 			, allowrenego(tag->getBool("renegotiation")) // Disallow by default
 			, outrecsize(tag->getNum<unsigned int>("outrecsize", 2048, 512, 16384))
+			, ktls(tag->getBool("ktls"))
 		{
 #ifndef INSPIRCD_OPENSSL_AUTO_DH
 			if ((!ctx.SetDH(dh)) || (!clientctx.SetDH(dh)))
@@ -453,14 +605,68 @@ namespace OpenSSL
 			clientctx.SetVerifyCert();
 			if (tag->getBool("requestclientcert", true))
 				ctx.SetVerifyCert();
+
+			if (tag->getBool("sessiontickets", true))
+			{
+				const unsigned long lifetime = tag->getDuration("ticketlifetime", 60*60, 60, 7*24*60*60);
+				ticketkeys = std::make_unique<TicketKeys>(ReadTicketSecret(tag), lifetime);
+
+				// Tickets issued using the previous key are still accepted so they last for up to two lifetimes.
+				ctx.EnableTickets(ticketkeys.get(), lifetime * 2);
+			}
+
+			if (ktls)
+			{
+#ifdef INSPIRCD_OPENSSL_KTLS
+				ctx.EnableKTLS();
+				clientctx.EnableKTLS();
+#else
+				throw Exception("Kernel TLS is not supported by the version of OpenSSL this module was compiled against");
+#endif
+			}
 		}
 
+		static std::string ReadTicketSecret(const std::shared_ptr<ConfigTag>& tag)
+		{
+			const std::string keyfile = tag->getString("ticketkeyfile");
+			if (keyfile.empty())
+			{
+				// Tickets will only be valid on this server until it is restarted.
+				unsigned char secret[32];
+				if (RAND_bytes(secret, sizeof(secret)) != 1)
+					throw Exception("Unable to generate a session ticket secret");
+				return std::string(reinterpret_cast<const char*>(secret), sizeof(secret));
+			}
+
+			const std::string filename = ServerInstance->Config->Paths.PrependConfig(keyfile);
+			auto file = ServerInstance->Config->ReadFile(filename, ServerInstance->Time());
+			if (!file)
+				throw Exception("Can't read session ticket key file " + filename + ": " + file.error);
+
+			// Ignore any trailing newline so the file can be edited by hand.
+			std::string secret = file.contents;
+			secret.erase(secret.find_last_not_of("\r\n") + 1);
+			if (secret.length() < 32)
+				throw Exception("Session ticket key file " + filename + " must contain at least 32 characters");
+			return secret;
+		}
+
+		/** The number of handshakes which have been completed as a server. */
+		unsigned long handshakes = 0;
+
+		/** The number of handshakes which have been completed as a server by resuming a session. */
+		unsigned long resumed = 0;
+
+		/** The number of handshakes after which the kernel took over encrypting data. */
+		unsigned long offloaded = 0;
+
 		const std::string& GetName() const { return name; }
 		SSL* CreateServerSession() { return ctx.CreateServerSession(); }
 		SSL* CreateClientSession() { return clientctx.CreateClientSession(); }
 		const std::vector<const EVP_MD*> GetDigests() { return digests; }
 		bool AllowRenegotiation() const { return allowrenego; }
 		unsigned int GetOutgoingRecordSize() const { return outrecsize; }
+		bool UseKTLS() const { return ktls; }
 	};
 
 	namespace BIOMethod
@@ -505,6 +711,7 @@ namespace OpenSSL
 }
 
 static BIO_METHOD* biomethods;
+static SSLHandshake::Pool handshakepool;
 
 static int OnVerify(int preverify_ok, X509_STORE_CTX* ctx)
 {
@@ -513,13 +720,56 @@ static int OnVerify(int preverify_ok, X509_STORE_CTX* ctx)
 	 * we can just return preverify_ok here, and openssl
 	 * will boot off self-signed and invalid peer certs.
 	 */
-	int ve = X509_STORE_CTX_get_error(ctx);
-
-	SelfSigned = (ve == X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT);
-
 	return 1;
 }
 
+class OpenSSLIOHook;
+
+/** Runs a step of a server handshake on a worker thread. */
+class OpenSSLHandshakeJob final
+	: public SSLHandshake::Job
+{
+public:
+	/** The hook which the handshake is for or nullptr if the hook was destroyed whilst the job was running. */
+	OpenSSLIOHook* hook;
+
+	/** The session which the handshake is being run on. */
+	SSL* const sess;
+
+	/** Keeps the profile alive if the hook is destroyed whilst the job is running. */
+	const std::shared_ptr<IOHookProvider> prov;
+
+	/** Keeps the buffers alive if the hook is destroyed whilst the job is running. */
+	const std::shared_ptr<SSLHandshake::Transport> transport;
+
+	/** The return value of SSL_do_handshake(). */
+	int result = 0;
+
+	/** The error code for the return value of SSL_do_handshake(). */
+	int error = SSL_ERROR_NONE;
+
+	OpenSSLHandshakeJob(OpenSSLIOHook* h, SSL* session, const std::shared_ptr<IOHookProvider>& hookprov, const std::shared_ptr<SSLHandshake::Transport>& trans)
+		: hook(h)
+		, sess(session)
+		, prov(hookprov)
+		, transport(trans)
+	{
+	}
+
+	void Run() override
+	{
+		ERR_clear_error();
+		result = SSL_do_handshake(sess);
+		if (result <= 0)
+			error = SSL_get_error(sess, result);
+
+		// The error queue is per-thread so don't leave anything in it for the next job.
+		ERR_clear_error();
+	}
+
+	void OnComplete() override;
+};
+
 class OpenSSLIOHook final
 	: public SSLIOHook
 {
@@ -527,14 +777,93 @@ private:
 	SSL* sess;
 	bool data_to_write = false;
 
+	/** Whether the kernel is encrypting the data we send so we can write to the socket directly. */
+	bool ktlssend = false;
+
+	/** The buffers which the session uses to exchange data with the peer whilst the handshake is
+	 * running on a worker thread or nullptr if the session is using a socket BIO.
+	 */
+	std::shared_ptr<SSLHandshake::Transport> transport;
+
+	/** The handshake job which is running on a worker thread or nullptr if there isn't one. */
+	OpenSSLHandshakeJob* job = nullptr;
+
+	/** Whether a handshake job has completed but its result has not been handled yet. */
+	bool jobdone = false;
+
+	/** The return value of SSL_do_handshake() from the last handshake job. */
+	int jobresult = 0;
+
+	/** The error code for the return value of SSL_do_handshake() from the last handshake job. */
+	int joberror = SSL_ERROR_NONE;
+
+	// Runs the next step of a server handshake on a worker thread once the peer has sent something.
+	int OffloadHandshake(StreamSocket* user)
+	{
+		this->status = STATUS_HANDSHAKING;
+
+		const int flushed = transport->Flush();
+		if (flushed < 0 || transport->Fill() < 0)
+		{
+			CloseSession();
+			return -1;
+		}
+
+		if (transport->recvq.empty())
+		{
+			// Wait for the peer to send something.
+			SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | (flushed ? FD_WANT_NO_WRITE : FD_WANT_SINGLE_WRITE));
+			return 0;
+		}
+
+		// The session must not be touched on the main thread until the job has completed.
+		transport->offloaded = true;
+		SSL_set_ex_data(sess, exdataindex, nullptr);
+		SocketEngine::ChangeEventMask(user, FD_WANT_NO_READ | FD_WANT_NO_WRITE);
+
+		job = new OpenSSLHandshakeJob(this, sess, prov, transport);
+		handshakepool.Submit(job);
+		return 0;
+	}
+
 	// Returns 1 if handshake succeeded, 0 if it is still in progress, -1 if it failed
 	int Handshake(StreamSocket* user)
 	{
-		ERR_clear_error();
-		int ret = SSL_do_handshake(sess);
+		// The handshake is still running on a worker thread.
+		if (job)
+			return 0;
+
+		int ret;
+		int err = SSL_ERROR_NONE;
+		const bool offloaded = jobdone;
+		if (jobdone)
+		{
+			// Send whatever the worker thread wrote before continuing.
+			jobdone = false;
+			ret = jobresult;
+			err = joberror;
+			if (transport->Flush() < 0)
+			{
+				CloseSession();
+				return -1;
+			}
+
+			// If the handshake needs more data then start the next step.
+			if (err == SSL_ERROR_WANT_READ && handshakepool.IsEnabled())
+				return OffloadHandshake(user);
+		}
+		else if (transport && SSL_is_server(sess) && handshakepool.IsEnabled())
+			return OffloadHandshake(user);
+		else
+		{
+			ERR_clear_error();
+			ret = SSL_do_handshake(sess);
+			if (ret < 0)
+				err = SSL_get_error(sess, ret);
+		}
+
 		if (ret < 0)
 		{
-			int err = SSL_get_error(sess, ret);
 
 			if (err == SSL_ERROR_WANT_READ)
 			{
@@ -557,11 +886,30 @@ private:
 		else if (ret > 0)
 		{
 			// Handshake complete.
+			if (SSL_is_server(sess))
+			{
+				OpenSSL::Profile& profile = GetProfile();
+				profile.handshakes++;
+				if (SSL_session_reused(sess))
+					profile.resumed++;
+			}
 			VerifyCertificate();
 
+#ifdef INSPIRCD_OPENSSL_KTLS
+			ktlssend = BIO_get_ktls_send(SSL_get_wbio(sess));
+			const bool ktlsrecv = BIO_get_ktls_recv(SSL_get_rbio(sess));
+			if (ktlssend || ktlsrecv)
+			{
+				GetProfile().offloaded++;
+				ServerInstance->Logs.Debug(MODNAME, "Session {} is using kernel TLS (send: {}, receive: {})",
+					fmt::ptr(sess), ktlssend ? "yes" : "no", ktlsrecv ? "yes" : "no");
+			}
+#endif
+
 			status = STATUS_OPEN;
 
-			SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | FD_WANT_NO_WRITE | FD_ADD_TRIAL_WRITE);
+			// The peer may have sent data after the handshake whilst it was running on a worker thread.
+			SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | FD_WANT_NO_WRITE | FD_ADD_TRIAL_WRITE | (offloaded ? FD_ADD_TRIAL_READ : 0));
 
 			return 1;
 		}
@@ -574,7 +922,13 @@ private:
 
 	void CloseSession()
 	{
-		if (sess)
+		if (job)
+		{
+			// The worker thread is still using the session so the job will free it.
+			job->hook = nullptr;
+			job = nullptr;
+		}
+		else if (sess)
 		{
 			SSL_shutdown(sess);
 			SSL_free(sess);
@@ -600,9 +954,11 @@ private:
 			return;
 		}
 
-		certinfo->invalid = (SSL_get_verify_result(sess) != X509_V_OK);
+		// The verification result is stored in the session so this also works for resumed sessions.
+		const long verifyresult = SSL_get_verify_result(sess);
+		certinfo->invalid = (verifyresult != X509_V_OK);
 
-		if (!SelfSigned)
+		if (verifyresult != X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT)
 		{
 			certinfo->unknownsigner = false;
 			certinfo->trusted = true;
@@ -682,9 +1038,9 @@ private:
 			// The other side is trying to renegotiate, kill the connection and change status
 			// to STATUS_NONE so CheckRenego() closes the session
 			status = STATUS_NONE;
-			BIO* bio = SSL_get_rbio(sess);
-			EventHandler* eh = static_cast<StreamSocket*>(BIO_get_data(bio));
-			SocketEngine::Shutdown(eh, 2);
+			EventHandler* eh = transport ? transport->sock : SocketEngine::GetRef(SSL_get_rfd(sess));
+			if (eh)
+				SocketEngine::Shutdown(eh, 2);
 		}
 	}
 
@@ -717,14 +1073,78 @@ private:
 	// Calls our private SSLInfoCallback()
 	friend void StaticSSLInfoCallback(const SSL* ssl, int where, int rc);
 
+	// Writes the send queue directly to a socket which the kernel is encrypting data for.
+	ssize_t WriteKernelTLS(StreamSocket* user, StreamSocket::SendQueue& sendq)
+	{
+		// Writes blocked earlier, don't retry syscall.
+		if (user->GetEventMask() & FD_WRITE_WILL_BLOCK)
+			return 0;
+
+		while (!sendq.empty())
+		{
+			SocketEngine::IOVector iovecs[64];
+			const size_t bufcount = std::min(sendq.size(), std::size(iovecs));
+			size_t idx = 0;
+			for (auto it = sendq.begin(); idx < bufcount; ++it, ++idx)
+			{
+				iovecs[idx].iov_base = const_cast<char*>(it->data());
+				iovecs[idx].iov_len = it->length();
+			}
+
+			ssize_t ret = SocketEngine::WriteV(user, iovecs, static_cast<int>(bufcount));
+			if (ret < 0)
+			{
+				if (!SocketEngine::IgnoreError() && errno != EINTR)
+				{
+					CloseSession();
+					return -1;
+				}
+
+				SocketEngine::ChangeEventMask(user, FD_WANT_SINGLE_WRITE | FD_WRITE_WILL_BLOCK);
+				return 0;
+			}
+
+			for (size_t written = static_cast<size_t>(ret); written && !sendq.empty(); )
+			{
+				const size_t length = sendq.front().length();
+				if (length > written)
+				{
+					// The socket blocked part of the way through this buffer.
+					sendq.erase_front(written);
+					SocketEngine::ChangeEventMask(user, FD_WANT_SINGLE_WRITE | FD_WRITE_WILL_BLOCK);
+					return 0;
+				}
+
+				written -= length;
+				sendq.pop_front();
+			}
+		}
+
+		data_to_write = false;
+		SocketEngine::ChangeEventMask(user, FD_WANT_POLL_READ | FD_WANT_NO_WRITE);
+		return 1;
+	}
+
 public:
 	OpenSSLIOHook(const std::shared_ptr<IOHookProvider>& hookprov, StreamSocket* sock, SSL* session)
 		: SSLIOHook(hookprov)
 		, sess(session)
 	{
-		// Create BIO instance and store a pointer to the socket in it which will be used by the read and write functions
-		BIO* bio = BIO_new(biomethods);
-		BIO_set_data(bio, sock);
+		BIO* bio;
+#ifdef INSPIRCD_OPENSSL_KTLS
+		if (GetProfile().UseKTLS())
+		{
+			// OpenSSL can only hand the session over to the kernel if it has direct access to the socket.
+			bio = BIO_new_socket(sock->GetFd(), BIO_NOCLOSE);
+		}
+		else
+#endif
+		{
+			// Create BIO instance and store a pointer to the transport in it which will be used by the read and write functions
+			transport = std::make_shared<SSLHandshake::Transport>(sock);
+			bio = BIO_new(biomethods);
+			BIO_set_data(bio, transport.get());
+		}
 		SSL_set_bio(sess, bio, bio);
 
 		SSL_set_ex_data(sess, exdataindex, this);
@@ -737,6 +1157,20 @@ public:
 		CloseSession();
 	}
 
+	// Called on the main thread when a handshake job has finished running.
+	void OnHandshakeJobComplete(int result, int error)
+	{
+		job = nullptr;
+		jobdone = true;
+		jobresult = result;
+		joberror = error;
+		transport->offloaded = false;
+		SSL_set_ex_data(sess, exdataindex, this);
+
+		// Continue the handshake from the socket so that errors are handled as normal.
+		SocketEngine::ChangeEventMask(transport->sock, FD_WANT_POLL_READ | FD_WANT_NO_WRITE | FD_ADD_TRIAL_READ);
+	}
+
 	ssize_t OnStreamSocketRead(StreamSocket* user, std::string& recvq) override
 	{
 		// Finish handshake if needed
@@ -806,6 +1240,10 @@ public:
 
 		data_to_write = true;
 
+		// Unless OpenSSL needs to send a key update of its own the kernel can encrypt the send queue for us.
+		if (ktlssend && SSL_get_key_update_type(sess) == SSL_KEY_UPDATE_NONE)
+			return WriteKernelTLS(user, sendq);
+
 		// Session is ready for transferring application data
 		while (!sendq.empty())
 		{
@@ -883,15 +1321,81 @@ public:
 
 static void StaticSSLInfoCallback(const SSL* ssl, int where, int rc)
 {
+	// The hook is not set whilst the handshake is running on a worker thread.
 	OpenSSLIOHook* hook = static_cast<OpenSSLIOHook*>(SSL_get_ex_data(ssl, exdataindex));
-	hook->SSLInfoCallback(where, rc);
+	if (hook)
+		hook->SSLInfoCallback(where, rc);
+}
+
+void OpenSSLHandshakeJob::OnComplete()
+{
+	if (hook)
+		hook->OnHandshakeJobComplete(result, error);
+	else
+		SSL_free(sess);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, EVP_MAC_CTX* macctx, int enc)
+#else
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, HMAC_CTX* macctx, int enc)
+#endif
+{
+	// This may be called on a worker thread so the keys are stored in the context rather than looked up via the hook.
+	auto* keys = static_cast<OpenSSL::TicketKeys*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ctxexdataindex));
+	if (!keys)
+		return -1;
+
+	OpenSSL::TicketKey key;
+	bool current = true;
+	if (enc)
+	{
+		// We are issuing a new ticket.
+		key = keys->GetCurrent();
+		memcpy(keyname, key.name, sizeof(key.name));
+		if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1)
+			return -1;
+	}
+	else
+	{
+		// We are checking a ticket sent by the client.
+		if (!keys->Find(keyname, key, current))
+			return 0; // Unknown key; do a full handshake instead.
+	}
+
+	if (!EVP_CipherInit_ex(cipherctx, EVP_aes_256_cbc(), nullptr, key.aeskey, iv, enc))
+		return -1;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	char digest[] = "SHA256";
+	const OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_utf8_string("digest", digest, 0),
+		OSSL_PARAM_construct_end(),
+	};
+	if (!EVP_MAC_init(macctx, key.hmackey, sizeof(key.hmackey), params))
+		return -1;
+#else
+	if (!HMAC_Init_ex(macctx, key.hmackey, sizeof(key.hmackey), EVP_sha256(), nullptr))
+		return -1;
+#endif
+
+	// If the ticket was encrypted using the previous key then issue a new one.
+	return current ? 1 : 2;
 }
 
 static int OpenSSL::BIOMethod::write(BIO* bio, const char* buffer, int size)
 {
 	BIO_clear_retry_flags(bio);
 
-	StreamSocket* sock = static_cast<StreamSocket*>(BIO_get_data(bio));
+	auto* transport = static_cast<SSLHandshake::Transport*>(BIO_get_data(bio));
+	if (transport->offloaded)
+	{
+		// The handshake is running on a worker thread.
+		transport->sendq.append(buffer, size);
+		return size;
+	}
+
+	StreamSocket* sock = transport->sock;
 	if (sock->GetEventMask() & FD_WRITE_WILL_BLOCK)
 	{
 		// Writes blocked earlier, don't retry syscall
@@ -899,6 +1403,18 @@ static int OpenSSL::BIOMethod::write(BIO* bio, const char* buffer, int size)
 		return -1;
 	}
 
+	// Send anything that was written whilst the handshake was running on a worker thread first.
+	const int flushed = transport->Flush();
+	if (flushed <= 0)
+	{
+		if (!flushed)
+		{
+			SocketEngine::ChangeEventMask(sock, FD_WRITE_WILL_BLOCK);
+			BIO_set_retry_write(bio);
+		}
+		return -1;
+	}
+
 	ssize_t ret = SocketEngine::Send(sock, buffer, size, 0);
 	if ((ret < size) && ((ret > 0) || (SocketEngine::IgnoreError())))
 	{
@@ -914,7 +1430,24 @@ static int OpenSSL::BIOMethod::read(BIO* bio, char* buffer, int size)
 {
 	BIO_clear_retry_flags(bio);
 
-	StreamSocket* sock = static_cast<StreamSocket*>(BIO_get_data(bio));
+	auto* transport = static_cast<SSLHandshake::Transport*>(BIO_get_data(bio));
+	if (!transport->recvq.empty())
+	{
+		// Read anything that was received whilst the handshake was running on a worker thread first.
+		const size_t length = std::min<size_t>(size, transport->recvq.length());
+		memcpy(buffer, transport->recvq.data(), length);
+		transport->recvq.erase(0, length);
+		return static_cast<int>(length);
+	}
+
+	if (transport->offloaded)
+	{
+		// The handshake is running on a worker thread and needs more data.
+		BIO_set_retry_read(bio);
+		return -1;
+	}
+
+	StreamSocket* sock = transport->sock;
 	if (sock->GetEventMask() & FD_READ_WILL_BLOCK)
 	{
 		// Reads blocked earlier, don't retry syscall
@@ -971,6 +1504,7 @@ OpenSSL::Profile& OpenSSLIOHook::GetProfile()
 
 class ModuleSSLOpenSSL final
 	: public Module
+	, public Stats::EventListener
 {
 	typedef std::vector<std::shared_ptr<OpenSSLIOHookProvider>> ProfileList;
 
@@ -998,17 +1532,17 @@ class ModuleSSLOpenSSL final
 				continue;
 			}
 
-			std::shared_ptr<OpenSSLIOHookProvider> prov;
+			std::shared_ptr<OpenSSLIOHookProvider> newprov;
 			try
 			{
-				prov = std::make_shared<OpenSSLIOHookProvider>(this, name, tag);
+				newprov = std::make_shared<OpenSSLIOHookProvider>(this, name, tag);
 			}
 			catch (const CoreException& ex)
 			{
 				throw ModuleException(this, "Error while initializing TLS profile \"" + name + "\" at " + tag->source.str() + " - " + ex.GetReason());
 			}
 
-			newprofiles.push_back(prov);
+			newprofiles.push_back(newprov);
 		}
 
 		for (const auto& profile : profiles)
@@ -1020,6 +1554,7 @@ class ModuleSSLOpenSSL final
 public:
 	ModuleSSLOpenSSL()
 		: Module(VF_VENDOR, "Allows TLS encrypted connections using the OpenSSL library.")
+		, Stats::EventListener(this)
 	{
 		// Initialize OpenSSL
 		OPENSSL_init_ssl(0, nullptr);
@@ -1030,6 +1565,8 @@ public:
 
 	~ModuleSSLOpenSSL() override
 	{
+		// Any sessions which are still in the pool use the BIO method.
+		handshakepool.SetThreads(0);
 		BIO_meth_free(biomethods);
 	}
 
@@ -1043,11 +1580,16 @@ public:
 		exdataindex = SSL_get_ex_new_index(0, exdatastr, nullptr, nullptr, nullptr);
 		if (exdataindex < 0)
 			throw ModuleException(this, "Failed to register application specific data");
+
+		ctxexdataindex = SSL_CTX_get_ex_new_index(0, exdatastr, nullptr, nullptr, nullptr);
+		if (ctxexdataindex < 0)
+			throw ModuleException(this, "Failed to register application specific data");
 	}
 
 	void ReadConfig(ConfigStatus& status) override
 	{
 		const auto& tag = ServerInstance->Config->ConfValue("openssl");
+		handshakepool.SetThreads(tag->getNum<size_t>("handshakethreads", 0, 0, 64));
 		if (status.initial || tag->getBool("onrehash", true))
 		{
 			// Try to help people who have outdated configs.
@@ -1091,6 +1633,22 @@ public:
 		}
 	}
 
+	ModResult OnStats(Stats::Context& stats) override
+	{
+		if (stats.GetSymbol() != 'T')
+			return MOD_RES_PASSTHRU;
+
+		for (const auto& profileprov : profiles)
+		{
+			const OpenSSL::Profile& profile = profileprov->GetProfile();
+			stats.AddGenericRow(INSP_FORMAT("TLS profile {}: {} handshakes ({} resumed, {}%)", profile.GetName(),
+				profile.handshakes, profile.resumed, profile.handshakes ? profile.resumed * 100 / profile.handshakes : 0));
+			if (profile.UseKTLS())
+				stats.AddGenericRow(INSP_FORMAT("TLS profile {}: {} sessions offloaded to kernel TLS", profile.GetName(), profile.offloaded));
+		}
+		return MOD_RES_PASSTHRU;
+	}
+
 	ModResult OnCheckReady(LocalUser* user) override
 	{
 		const OpenSSLIOHook* const iohook = static_cast<OpenSSLIOHook*>(user->eh.GetModHook(this));
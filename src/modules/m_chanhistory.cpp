@@ -22,6 +22,10 @@
  */
 
 
+#include <filesystem>
+#include <fstream>
+#include <unordered_set>
+
 #include "inspircd.h"
 #include "clientprotocolmsg.h"
 #include "modules/ircv3_batch.h"
@@ -29,39 +33,48 @@
 #include "modules/server.h"
 #include "numerichelper.h"
 
-typedef insp::flat_map<std::string, std::string> HistoryTagMap;
+class HistoryEngine;
+
+/** A string which has been interned by a HistoryEngine. */
+typedef const std::string* HistoryString;
+
+/** A list of message tags where the names and values have been interned. */
+typedef std::vector<std::pair<HistoryString, HistoryString>> HistoryTagList;
 
 struct HistoryItem final
 {
+	uint64_t serial;
 	time_t ts;
 	std::string text;
 	MessageType type;
-	HistoryTagMap tags;
-	std::string sourcemask;
+	HistoryTagList tags;
+	HistoryString sourcemask;
 
-	HistoryItem(User* source, const MessageDetails& details)
-		: ts(ServerInstance->Time())
-		, text(details.text)
-		, type(details.type)
-		, sourcemask(source->GetMask())
+	/** Retrieves the approximate amount of memory used by this item (excluding interned strings). */
+	size_t GetMemory() const
 	{
-		tags.reserve(details.tags_out.size());
-		for (const auto& [tagname, tagvalue] : details.tags_out)
-			tags[tagname] = tagvalue.value;
+		size_t memory = sizeof(*this) + (tags.capacity() * sizeof(HistoryTagList::value_type));
+		if (text.capacity() >= sizeof(text))
+			memory += text.capacity() + 1;
+		return memory;
 	}
 };
 
 struct HistoryList final
 {
+	HistoryEngine& engine;
 	std::deque<HistoryItem> lines;
 	unsigned long maxlen;
 	unsigned long maxtime;
 
-	HistoryList(unsigned long len, unsigned long time)
-		: maxlen(len)
-		, maxtime(time)
-	{
-	}
+	HistoryList(HistoryEngine& e, unsigned long len, unsigned long time);
+	~HistoryList();
+
+	/** Adds a line to the end of the list and removes any lines over the length limit. */
+	void Add(HistoryItem&& item);
+
+	/** Removes the oldest line from the list. */
+	void PopFront();
 
 	size_t Prune()
 	{
@@ -70,10 +83,507 @@ struct HistoryList final
 		{
 			time_t mintime = ServerInstance->Time() - maxtime;
 			while (!lines.empty() && lines.front().ts < mintime)
-				lines.pop_front();
+				PopFront();
 		}
 		return lines.size();
 	}
+
+	/** Shrinks the list to the specified number of lines. */
+	void Resize(unsigned long len)
+	{
+		while (lines.size() > len)
+			PopFront();
+	}
+};
+
+/** An append-only store of history lines split into segment files within a directory. */
+class HistoryStore final
+{
+private:
+	/** The directory which segments are stored in. */
+	std::string directory;
+
+	/** The maximum number of segment files to keep. */
+	size_t maxsegments = 0;
+
+	/** The size at which to start writing a new segment. */
+	size_t segmentsize = 0;
+
+	/** The segments which exist mapped to the time of the newest line within them. */
+	std::map<uint64_t, time_t> segments;
+
+	/** The stream for the segment which is currently being written to. */
+	std::ofstream stream;
+
+	/** The number of bytes which have been written to the current segment. */
+	size_t streamsize = 0;
+
+	// Calculates the 64-bit FNV-1a checksum of the specified data.
+	static uint64_t Checksum(std::string_view data)
+	{
+		uint64_t result = 0xcbf29ce484222325ULL;
+		for (const auto chr : data)
+		{
+			result ^= static_cast<unsigned char>(chr);
+			result *= 0x00000100000001b3ULL;
+		}
+		return result;
+	}
+
+	static void WriteInt(std::string& out, uint64_t value, size_t bytes)
+	{
+		for (size_t idx = 0; idx < bytes; ++idx)
+			out.push_back(static_cast<char>((value >> (idx * 8)) & 0xFF));
+	}
+
+	static void WriteStr(std::string& out, const std::string& value)
+	{
+		WriteInt(out, value.length(), 4);
+		out.append(value);
+	}
+
+	static bool ReadInt(std::string_view& in, uint64_t& value, size_t bytes)
+	{
+		if (in.length() < bytes)
+			return false;
+
+		value = 0;
+		for (size_t idx = 0; idx < bytes; ++idx)
+			value |= static_cast<uint64_t>(static_cast<unsigned char>(in[idx])) << (idx * 8);
+		in.remove_prefix(bytes);
+		return true;
+	}
+
+	static bool ReadStr(std::string_view& in, std::string& value)
+	{
+		uint64_t length;
+		if (!ReadInt(in, length, 4) || in.length() < length)
+			return false;
+
+		value.assign(in.data(), length);
+		in.remove_prefix(length);
+		return true;
+	}
+
+	std::string GetPath(uint64_t segment) const
+	{
+		return INSP_FORMAT("{}/{:08}.seg", directory, segment);
+	}
+
+	void OpenSegment(uint64_t segment)
+	{
+		stream.close();
+		stream.open(GetPath(segment), std::ios::binary | std::ios::app);
+		streamsize = 0;
+		segments[segment] = ServerInstance->Time();
+		if (!stream.is_open())
+		{
+			ServerInstance->Logs.Warning(MODNAME, "Unable to open history segment {}: {}",
+				GetPath(segment), strerror(errno));
+		}
+
+		// Remove the oldest segments if there are too many.
+		while (segments.size() > maxsegments)
+			RemoveSegment(segments.begin());
+	}
+
+	void RemoveSegment(std::map<uint64_t, time_t>::iterator it)
+	{
+		std::error_code ec;
+		std::filesystem::remove(GetPath(it->first), ec);
+		segments.erase(it);
+	}
+
+public:
+	/** A callback which is called for every line which is loaded. */
+	typedef std::function<void(const std::string&, time_t, MessageType, const std::string&, const std::vector<std::pair<std::string, std::string>>&, const std::string&)> LoadCallback;
+
+	~HistoryStore()
+	{
+		Close();
+	}
+
+	/** Appends a line to the current segment. */
+	void Append(const std::string& channel, const HistoryItem& item)
+	{
+		if (!stream.is_open())
+			return;
+
+		std::string record;
+		WriteStr(record, channel);
+		WriteInt(record, static_cast<uint64_t>(item.ts), 8);
+		WriteInt(record, static_cast<uint8_t>(item.type), 1);
+		WriteStr(record, *item.sourcemask);
+		WriteInt(record, item.tags.size(), 4);
+		for (const auto& [tagname, tagvalue] : item.tags)
+		{
+			WriteStr(record, *tagname);
+			WriteStr(record, *tagvalue);
+		}
+		WriteStr(record, item.text);
+
+		std::string header;
+		WriteInt(header, record.length(), 4);
+		WriteInt(header, Checksum(record), 8);
+		stream.write(header.data(), header.length());
+		stream.write(record.data(), record.length());
+		streamsize += header.length() + record.length();
+		segments.rbegin()->second = item.ts;
+
+		if (streamsize >= segmentsize)
+			OpenSegment(segments.rbegin()->first + 1);
+	}
+
+	/** Closes the store. */
+	void Close()
+	{
+		stream.close();
+		segments.clear();
+		directory.clear();
+	}
+
+	/** Removes segments which only contain lines older than the specified time. */
+	void Expire(time_t mintime)
+	{
+		// Never remove the segment which is currently being written to.
+		for (auto it = segments.begin(); it != segments.end() && std::next(it) != segments.end(); )
+		{
+			if (it->second < mintime)
+				RemoveSegment(it++);
+			else
+				break;
+		}
+	}
+
+	/** Flushes any buffered lines to disk. */
+	void Flush()
+	{
+		if (stream.is_open())
+			stream.flush();
+	}
+
+	/** Retrieves the directory the store is using or an empty string if it is disabled. */
+	const std::string& GetDirectory() const { return directory; }
+
+	/** Opens the store, loads the lines stored within it, and starts a new segment for writing. */
+	void Open(const std::string& dir, size_t size, size_t max, time_t mintime, const LoadCallback& callback)
+	{
+		Close();
+		directory = dir;
+		segmentsize = size;
+		maxsegments = max;
+
+		std::error_code ec;
+		std::filesystem::create_directories(directory, ec);
+		for (const auto& entry : std::filesystem::directory_iterator(directory, ec))
+		{
+			const std::filesystem::path& path = entry.path();
+			if (path.extension() != ".seg" || !entry.is_regular_file(ec))
+				continue;
+
+			const uint64_t segment = ConvToNum<uint64_t>(path.stem().string());
+			if (segment)
+				segments[segment] = 0;
+		}
+
+		size_t count = 0;
+		for (auto& [segment, newest] : segments)
+		{
+			std::ifstream instream(GetPath(segment), std::ios::binary);
+			const std::string contents((std::istreambuf_iterator<char>(instream)), std::istreambuf_iterator<char>());
+
+			std::string_view in(contents);
+			std::string channel;
+			std::string sourcemask;
+			std::string text;
+			std::vector<std::pair<std::string, std::string>> tags;
+			uint64_t length;
+			uint64_t checksum;
+			for (std::string_view header = in; ReadInt(header, length, 4) && ReadInt(header, checksum, 8) && header.length() >= length; )
+			{
+				std::string_view record = header.substr(0, length);
+				if (Checksum(record) != checksum)
+					break;
+
+				uint64_t ts;
+				uint64_t type;
+				uint64_t tagcount;
+				// Each tag takes at least eight bytes so a record with more tags than would fit is corrupt.
+				if (!ReadStr(record, channel) || !ReadInt(record, ts, 8) || !ReadInt(record, type, 1)
+					|| type > static_cast<uint8_t>(MessageType::NOTICE) || !ReadStr(record, sourcemask)
+					|| !ReadInt(record, tagcount, 4) || tagcount > record.length() / 8)
+					break;
+
+				tags.resize(tagcount);
+				bool valid = true;
+				for (auto& [tagname, tagvalue] : tags)
+					valid = valid && ReadStr(record, tagname) && ReadStr(record, tagvalue);
+				if (!valid || !ReadStr(record, text))
+					break;
+
+				header.remove_prefix(length);
+				in = header;
+
+				newest = std::max<time_t>(newest, static_cast<time_t>(ts));
+				if (static_cast<time_t>(ts) >= mintime)
+				{
+					callback(channel, static_cast<time_t>(ts), static_cast<MessageType>(type), sourcemask, tags, text);
+					count++;
+				}
+			}
+
+			if (!in.empty())
+			{
+				ServerInstance->Logs.Warning(MODNAME, "History segment {} is truncated or corrupt; ignoring the remaining {} bytes.",
+					GetPath(segment), in.length());
+			}
+		}
+
+		ServerInstance->Logs.Debug(MODNAME, "Loaded {} history lines from {} segments in {}.", count, segments.size(), directory);
+
+		// Always start a new segment so that a truncated segment is never appended to.
+		OpenSegment(segments.empty() ? 1 : segments.rbegin()->first + 1);
+	}
+};
+
+/** Stores the history of all channels within a global memory budget. */
+class HistoryEngine final
+{
+private:
+	/** Lists which are not attached to a channel keyed by the channel name. */
+	typedef std::unordered_map<std::string, std::unique_ptr<HistoryList>, irc::insensitive, irc::StrHashComp> RestoredMap;
+
+	/** Every line which has been added in the order it was added. Lines which have already been
+	 * removed from their list are skipped when evicting.
+	 */
+	std::deque<std::pair<HistoryList*, uint64_t>> fifo;
+
+	/** The lists which currently exist. */
+	std::unordered_set<HistoryList*> lists;
+
+	/** The total number of lines which are stored in lists. */
+	size_t linecount = 0;
+
+	/** The serial number to assign to the next line. */
+	uint64_t nextserial = 1;
+
+	/** Lines which were loaded from disk for channels that do not currently have history enabled. */
+	RestoredMap restored;
+
+	/** Interned strings mapped to their reference count. */
+	std::unordered_map<std::string, size_t> strings;
+
+	/** Rebuilds the eviction queue from the lists that exist. */
+	void Compact()
+	{
+		fifo.clear();
+		for (auto* list : lists)
+		{
+			for (const auto& line : list->lines)
+				fifo.emplace_back(list, line.serial);
+		}
+		std::sort(fifo.begin(), fifo.end(), [](const auto& lhs, const auto& rhs) {
+			return lhs.second < rhs.second;
+		});
+	}
+
+	/** Retrieves the approximate amount of memory used by an interned string. */
+	static size_t GetMemory(const std::string& str)
+	{
+		size_t memory = sizeof(str) + sizeof(size_t) + (sizeof(void*) * 2);
+		if (str.capacity() >= sizeof(str))
+			memory += str.capacity() + 1;
+		return memory;
+	}
+
+public:
+	/** The maximum amount of memory that history may use or 0 for no limit. */
+	size_t maxmemory = 0;
+
+	/** The approximate amount of memory used by history. */
+	size_t memory = 0;
+
+	~HistoryEngine()
+	{
+		restored.clear();
+	}
+
+	/** Moves any lines which were loaded from disk for the specified channel into a list. */
+	void Adopt(const std::string& channel, HistoryList* list)
+	{
+		auto it = restored.find(channel);
+		if (it == restored.end())
+			return;
+
+		// Only adopt into an empty list so that lines stay in chronological order.
+		if (list->lines.empty())
+		{
+			list->lines.swap(it->second->lines);
+			for (const auto& line : list->lines)
+				fifo.emplace_back(list, line.serial);
+			list->Resize(list->maxlen);
+			list->Prune();
+		}
+		restored.erase(it);
+	}
+
+	/** Creates a new history line. */
+	HistoryItem Create(time_t ts, MessageType type, const std::string& sourcemask, const std::string& text)
+	{
+		return HistoryItem { nextserial++, ts, text, type, {}, Intern(sourcemask) };
+	}
+
+	/** Evicts the oldest lines until the memory budget is honoured. */
+	void Enforce()
+	{
+		while (maxmemory && memory > maxmemory && !fifo.empty())
+		{
+			const auto [list, serial] = fifo.front();
+			fifo.pop_front();
+
+			if (lists.count(list) && !list->lines.empty() && list->lines.front().serial == serial)
+				list->PopFront();
+		}
+
+		// Don't let lines which were removed by other means build up in the queue.
+		while (!fifo.empty())
+		{
+			const auto [list, serial] = fifo.front();
+			if (lists.count(list) && !list->lines.empty() && list->lines.front().serial <= serial)
+				break;
+			fifo.pop_front();
+		}
+		if (fifo.size() > (linecount * 2) + 1024)
+			Compact();
+	}
+
+	/** Adds a reference to the specified string, inserting it if needed. */
+	HistoryString Intern(const std::string& str)
+	{
+		auto [it, inserted] = strings.emplace(str, 0);
+		if (inserted)
+			memory += GetMemory(it->first);
+		it->second++;
+		return &it->first;
+	}
+
+	/** Retrieves the number of lines which are stored. */
+	size_t GetLineCount() const { return linecount; }
+
+	/** Retrieves the number of unique interned strings. */
+	size_t GetStringCount() const { return strings.size(); }
+
+	/** Prunes expired lines from every list. */
+	void Prune()
+	{
+		for (auto* list : lists)
+			list->Prune();
+
+		for (auto it = restored.begin(); it != restored.end(); )
+		{
+			if (it->second->lines.empty())
+				it = restored.erase(it);
+			else
+				it++;
+		}
+	}
+
+	/** Registers a new list with the engine. */
+	void Register(HistoryList* list)
+	{
+		lists.insert(list);
+	}
+
+	/** Removes a reference to the specified string, erasing it if it is no longer used. */
+	void Release(HistoryString str)
+	{
+		auto it = strings.find(*str);
+		if (it != strings.end() && !--it->second)
+		{
+			memory -= GetMemory(it->first);
+			strings.erase(it);
+		}
+	}
+
+	/** Adds a line which was loaded from disk to the list for the specified channel. */
+	void Restore(const std::string& channel, unsigned long maxlines, HistoryItem&& item)
+	{
+		auto& list = restored[channel];
+		if (!list)
+			list = std::make_unique<HistoryList>(*this, maxlines, 0);
+		list->Add(std::move(item));
+	}
+
+	/** Starts tracking a line which has been added to a list. */
+	void Track(HistoryList* list, const HistoryItem& item)
+	{
+		fifo.emplace_back(list, item.serial);
+		memory += item.GetMemory();
+		linecount++;
+	}
+
+	/** Unregisters a list and releases all of its lines. */
+	void Unregister(HistoryList* list)
+	{
+		for (const auto& line : list->lines)
+			Untrack(line);
+		lists.erase(list);
+	}
+
+	/** Stops tracking a line which has been removed from a list. */
+	void Untrack(const HistoryItem& item)
+	{
+		for (const auto& [tagname, tagvalue] : item.tags)
+		{
+			Release(tagname);
+			Release(tagvalue);
+		}
+		Release(item.sourcemask);
+		memory -= item.GetMemory();
+		linecount--;
+	}
+};
+
+HistoryList::HistoryList(HistoryEngine& e, unsigned long len, unsigned long time)
+	: engine(e)
+	, maxlen(len)
+	, maxtime(time)
+{
+	engine.Register(this);
+}
+
+HistoryList::~HistoryList()
+{
+	engine.Unregister(this);
+}
+
+void HistoryList::Add(HistoryItem&& item)
+{
+	engine.Track(this, item);
+	lines.push_back(std::move(item));
+	Resize(maxlen);
+}
+
+void HistoryList::PopFront()
+{
+	engine.Untrack(lines.front());
+	lines.pop_front();
+}
+
+/** The state of a history replay which is being streamed to a user. */
+struct HistoryReplay final
+{
+	/** The name of the channel which history is being replayed for. */
+	std::string channel;
+
+	/** The serial of the first line which has not been sent yet. */
+	uint64_t nextserial;
+
+	/** The serial after the last line which should be sent. */
+	uint64_t endserial;
+
+	/** The unique identifier of the user which history is being replayed to. */
+	std::string uuid;
 };
 
 class HistoryMode final
@@ -112,11 +622,13 @@ private:
 	}
 
 public:
+	HistoryEngine& engine;
 	unsigned long maxduration;
 	unsigned long maxlines;
 
-	HistoryMode(Module* Creator)
+	HistoryMode(Module* Creator, HistoryEngine& e)
 		: ParamMode<HistoryMode, SimpleExtItem<HistoryList>>(Creator, "history", 'H')
+		, engine(e)
 	{
 		syntax = "<max-messages>:<max-duration>";
 	}
@@ -137,8 +649,7 @@ public:
 		if (history)
 		{
 			// Shrink the list if the new line number limit is lower than the old one
-			if (lines < history->lines.size())
-				history->lines.erase(history->lines.begin(), history->lines.begin() + (history->lines.size() - lines));
+			history->Resize(lines);
 
 			history->maxlen = lines;
 			history->maxtime = duration;
@@ -146,7 +657,8 @@ public:
 		}
 		else
 		{
-			ext.SetFwd(channel, lines, duration);
+			ext.SetFwd(channel, engine, lines, duration);
+			engine.Adopt(channel->name, ext.Get(channel));
 		}
 		return true;
 	}
@@ -162,13 +674,19 @@ public:
 class ModuleChanHistory final
 	: public Module
 	, public ServerProtocol::RouteEventListener
+	, public Timer
 {
 private:
+	HistoryEngine engine;
+	HistoryStore store;
+	std::list<HistoryReplay> replays;
 	HistoryMode historymode;
 	SimpleUserMode nohistorymode;
 	bool prefixmsg;
 	UserModeReference botmode;
 	bool dobots;
+	size_t replaybudget = 0;
+	size_t replayrate;
 	IRCv3::Batch::CapReference batchcap;
 	IRCv3::Batch::API batchmanager;
 	IRCv3::Batch::Batch batch;
@@ -188,34 +706,85 @@ private:
 		}
 	}
 
-	void SendHistory(LocalUser* user, Channel* channel, HistoryList* list)
+	void SendLine(LocalUser* user, Channel* channel, const HistoryItem& item)
+	{
+		ClientProtocol::Messages::Privmsg msg(ClientProtocol::Messages::Privmsg::nocopy, *item.sourcemask, channel, item.text, item.type);
+		for (const auto& [tagname, tagvalue] : item.tags)
+		{
+			std::string value(*tagvalue);
+			AddTag(msg, *tagname, value);
+		}
+		if (servertimemanager)
+			servertimemanager->Set(msg, item.ts);
+		batch.AddToBatch(msg);
+		user->Send(ServerInstance->GetRFCEvents().privmsg, msg);
+	}
+
+	// Sends as much of a replay as the user's sendq and the global replay rate allow. Returns
+	// true if the replay is finished and false if there are still lines left to send.
+	bool ContinueReplay(HistoryReplay& replay)
 	{
+		auto* user = ServerInstance->Users.FindUUID<LocalUser>(replay.uuid);
+		auto* channel = ServerInstance->Channels.Find(replay.channel);
+		if (!user || user->quitting || !channel || !channel->HasUser(user))
+			return true;
+
+		HistoryList* list = historymode.ext.Get(channel);
+		if (!list)
+			return true;
+
+		// Only fill the sendq up to half of the hard limit so that the user is not disconnected
+		// and so that live messages can still be delivered whilst history is being replayed.
+		const size_t maxsendq = user->GetClass()->hardsendqmax / 2;
+
+		// Each part of the replay is sent in its own batch so that batch identifiers, of which
+		// there are only a few, are not held by replays which are waiting for a sendq to drain.
 		if (batchmanager)
 		{
 			batchmanager->Start(batch);
-			batch.GetBatchStartMessage().PushParamRef(channel->name);
+			if (batch.IsRunning())
+				batch.GetBatchStartMessage().PushParamRef(channel->name);
 		}
 
-		for (auto& item : list->lines)
+		bool finished = true;
+		auto it = std::lower_bound(list->lines.begin(), list->lines.end(), replay.nextserial, [](const HistoryItem& item, uint64_t serial) {
+			return item.serial < serial;
+		});
+		for (; it != list->lines.end() && it->serial < replay.endserial; ++it)
 		{
-			ClientProtocol::Messages::Privmsg msg(ClientProtocol::Messages::Privmsg::nocopy, item.sourcemask, channel, item.text, item.type);
-			for (auto& [tagname, tagvalue] : item.tags)
-				AddTag(msg, tagname, tagvalue);
-			if (servertimemanager)
-				servertimemanager->Set(msg, item.ts);
-			batch.AddToBatch(msg);
-			user->Send(ServerInstance->GetRFCEvents().privmsg, msg);
+			if (!replaybudget || user->eh.GetSendQSize() >= maxsendq)
+			{
+				replay.nextserial = it->serial;
+				finished = false;
+				break;
+			}
+
+			SendLine(user, channel, *it);
+			replaybudget--;
 		}
 
 		if (batchmanager)
 			batchmanager->End(batch);
+		return finished;
+	}
+
+	void LoadLine(const std::string& channel, time_t ts, MessageType type, const std::string& sourcemask, const std::vector<std::pair<std::string, std::string>>& tags, const std::string& text)
+	{
+		HistoryItem item = engine.Create(ts, type, sourcemask, text);
+		item.tags.reserve(tags.size());
+		for (const auto& [tagname, tagvalue] : tags)
+			item.tags.emplace_back(engine.Intern(tagname), engine.Intern(tagvalue));
+
+		engine.Restore(channel, historymode.maxlines ? historymode.maxlines : ULONG_MAX, std::move(item));
+		engine.Enforce();
 	}
 
 public:
 	ModuleChanHistory()
 		: Module(VF_VENDOR, "Adds channel mode H (history) which allows message history to be viewed on joining the channel.")
 		, ServerProtocol::RouteEventListener(this)
-		, historymode(this)
+		, Timer(1, true)
+		, historymode(this, engine)
 		, nohistorymode(this, "nohistory", 'N')
 		, botmode(this, "bot")
 		, batchcap(this)
@@ -226,6 +795,11 @@ public:
 	{
 	}
 
+	void init() override
+	{
+		ServerInstance->Timers.AddTimer(this);
+	}
+
 	void ReadConfig(ConfigStatus& status) override
 	{
 		const auto& tag = ServerInstance->Config->ConfValue("chanhistory");
@@ -233,6 +807,32 @@ public:
 		historymode.maxlines = tag->getNum<unsigned long>("maxlines", 50);
 		prefixmsg = tag->getBool("prefixmsg", true);
 		dobots = tag->getBool("bots", true);
+		replayrate = tag->getNum<size_t>("replayrate", 1000, 1);
+		replaybudget = replayrate;
+		engine.maxmemory = tag->getNum<size_t>("maxmemory", 0);
+
+		const std::string persistdir = tag->getString("persistdir");
+		const std::string directory = persistdir.empty() ? "" : ServerInstance->Config->Paths.PrependData(persistdir);
+		if (directory != store.GetDirectory())
+		{
+			if (directory.empty())
+				store.Close();
+			else
+			{
+				const time_t mintime = historymode.maxduration ? ServerInstance->Time() - historymode.maxduration : 0;
+				store.Open(directory, tag->getNum<size_t>("segmentsize", 4*1024*1024, 1024), tag->getNum<size_t>("maxsegments", 16, 1), mintime,
+					[this](auto&&... args) { LoadLine(args...); });
+
+				// Channels may have had history enabled before the store was opened.
+				for (const auto& [_, chan] : ServerInstance->Channels.GetChans())
+				{
+					HistoryList* list = historymode.ext.Get(chan);
+					if (list)
+						engine.Adopt(chan->name, list);
+				}
+			}
+		}
+		engine.Enforce();
 	}
 
 	ModResult OnRouteMessage(const Channel* channel, const Server* server) override
@@ -249,13 +849,19 @@ public:
 		if (details.IsCTCP(ctcpname) && !irc::equals(ctcpname, "ACTION"))
 			return;
 
-		HistoryList* list = historymode.ext.Get(target.Get<Channel>());
+		auto* channel = target.Get<Channel>();
+		HistoryList* list = historymode.ext.Get(channel);
 		if (!list)
 			return;
 
-		list->lines.emplace_back(user, details);
-		if (list->lines.size() > list->maxlen)
-			list->lines.pop_front();
+		HistoryItem item = engine.Create(ServerInstance->Time(), details.type, user->GetMask(), details.text);
+		item.tags.reserve(details.tags_out.size());
+		for (const auto& [tagname, tagvalue] : details.tags_out)
+			item.tags.emplace_back(engine.Intern(tagname), engine.Intern(tagvalue.value));
+
+		store.Append(channel->name, item);
+		list->Add(std::move(item));
+		engine.Enforce();
 	}
 
 	void OnPostJoin(Membership* memb) override
@@ -282,7 +888,51 @@ public:
 			memb->WriteNotice(message);
 		}
 
-		SendHistory(localuser, memb->chan, list);
+		// History is streamed to the user as their sendq drains rather than all at once so that
+		// many users joining a busy channel at the same time do not cause a burst of output.
+		HistoryReplay& replay = replays.emplace_back();
+		replay.channel = memb->chan->name;
+		replay.nextserial = list->lines.front().serial;
+		replay.endserial = list->lines.back().serial + 1;
+		replay.uuid = localuser->uuid;
+		if (ContinueReplay(replay))
+			replays.pop_back();
+	}
+
+	void OnUserQuit(User* user, const std::string& message, const std::string& oper_message) override
+	{
+		// Stop replaying history to the user now rather than waiting for the next tick.
+		replays.remove_if([user](const HistoryReplay& replay) {
+			return replay.uuid == user->uuid;
+		});
+	}
+
+	void OnGarbageCollect() override
+	{
+		engine.Prune();
+		if (historymode.maxduration)
+			store.Expire(ServerInstance->Time() - historymode.maxduration);
+	}
+
+	bool Tick() override
+	{
+		store.Flush();
+
+		replaybudget = replayrate;
+		for (auto it = replays.begin(); it != replays.end(); )
+		{
+			if (ContinueReplay(*it))
+				it = replays.erase(it);
+			else if (!replaybudget)
+			{
+				// Move the replay that ran out of budget to the end so every replay makes progress.
+				replays.splice(replays.end(), replays, it);
+				break;
+			}
+			else
+				it++;
+		}
+		return true;
 	}
 };
 
@@ -37,9 +37,7 @@ class ModuleConnectBan final
 	, public WebIRC::EventListener
 {
 private:
-	typedef std::map<irc::sockets::cidr_mask, unsigned int> ConnectMap;
-
-	ConnectMap connects;
+	CIDRTree<unsigned int> connects;
 	unsigned long threshold;
 	unsigned long banduration;
 	unsigned int ipv4_cidr;
@@ -121,10 +119,7 @@ public:
 		// HACK: Lower the connection attempts for the gateway IP address. The user
 		// will be rechecked for connect spamming shortly after when their IP address
 		// is changed and OnChangeRemoteAddress is called.
-		irc::sockets::cidr_mask mask(user->client_sa, GetRange(user));
-		ConnectMap::iterator iter = connects.find(mask);
-		if (iter != connects.end() && iter->second)
-			iter->second--;
+		connects.Remove(user->client_sa, 1);
 	}
 
 	void OnServerSplit(const Server* server, bool error) override
@@ -139,13 +134,12 @@ public:
 			return;
 
 		irc::sockets::cidr_mask mask(u->client_sa, GetRange(u));
-		ConnectMap::iterator i = connects.find(mask);
+		const bool known = connects.Get(mask);
+		connects.Add(u->client_sa, 1);
 
-		if (i != connects.end())
+		if (known)
 		{
-			i->second++;
-
-			if (i->second >= threshold)
+			if (*connects.Get(mask) >= threshold)
 			{
 				// Create Z-line for set duration.
 				auto* zl = new ZLine(ServerInstance->Time(), banduration, MODNAME "@" + ServerInstance->Config->ServerName, banmessage, mask.str());
@@ -159,20 +153,16 @@ public:
 					zl->source, maskstr, Duration::ToString(zl->duration),
 					Time::ToString(zl->expiry), zl->reason);
 				ServerInstance->SNO.WriteGlobalSno('a', "Connect flooding from IP range {} ({})", maskstr, threshold);
-				connects.erase(i);
+				connects.Erase(mask);
 				ServerInstance->XLines->ApplyLines();
 			}
 		}
-		else
-		{
-			connects[mask] = 1;
-		}
 	}
 
 	void OnGarbageCollect() override
 	{
 		ServerInstance->Logs.Debug(MODNAME, "Clearing map.");
-		connects.clear();
+		connects.Clear();
 	}
 };
 
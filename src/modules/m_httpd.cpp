@@ -49,7 +49,23 @@
 
 class ModuleHttpServer;
 
+struct HttpConfig final
+{
+	// Whether to keep connections open after a response has been sent.
+	bool keepalive;
+
+	// The time to wait for another request on an idle connection.
+	unsigned long keepalivetimeout;
+
+	// The maximum number of requests which can be sent on a single connection.
+	unsigned long maxrequests;
+
+	// The time to wait for a request to be received.
+	unsigned long timeout;
+};
+
 static ModuleHttpServer* HttpModule;
+static HttpConfig httpconfig;
 static insp::intrusive_list<HttpServerSocket> sockets;
 static Events::ModuleEventProvider* aclevprov;
 static Events::ModuleEventProvider* reqevprov;
@@ -65,6 +81,12 @@ class HttpServerSocket final
 private:
 	friend class ModuleHttpServer;
 
+	/** The maximum amount of pipelined request data to buffer whilst a response is being sent. */
+	static constexpr size_t MAX_PIPELINE_LENGTH = 65536;
+
+	/** The amount of data to keep in the send queue whilst streaming a response. */
+	static constexpr size_t STREAM_WATERMARK = 65536;
+
 	http_parser parser;
 	http_parser_url url;
 	std::string ip;
@@ -74,11 +96,32 @@ private:
 	size_t total_buffers;
 	int status_code = 0;
 
+	/** The stream which is producing the body of the current response. */
+	std::unique_ptr<HTTPResponseStream> stream;
+
+	/** The module which created the current response stream. */
+	Module* streammodule = nullptr;
+
+	/** The number of requests which have been received on this connection. */
+	unsigned long requests = 0;
+
 	/** True if this object is in the cull list
 	 */
 	bool waitingcull = false;
 	bool messagecomplete = false;
 
+	/** Whether the current response is being sent using chunked transfer encoding. */
+	bool chunked = false;
+
+	/** Whether the connection should be kept open after the current response. */
+	bool keepalive = false;
+
+	/** Whether requests are currently being parsed. */
+	bool parsing = false;
+
+	/** Whether a request has been received but the response has not been fully sent. */
+	bool responding = false;
+
 	bool Tick() override
 	{
 		if (!messagecomplete)
@@ -121,8 +164,14 @@ private:
 	{
 		uri.clear();
 		header_state = HEADER_NONE;
+		headers.Clear();
 		body.clear();
 		total_buffers = 0;
+		status_code = 0;
+
+		// If this is a pipelined request the keep-alive timeout is no longer relevant.
+		if (requests)
+			SetInterval(httpconfig.timeout);
 		return 0;
 	}
 
@@ -201,10 +250,90 @@ private:
 	int OnMessageComplete()
 	{
 		messagecomplete = true;
+		responding = true;
+		keepalive = httpconfig.keepalive && http_should_keep_alive(&parser) && ++requests < httpconfig.maxrequests;
 		ServeData();
+
+		// Stop parsing pipelined requests until the response has been sent.
+		if (responding || !keepalive)
+			http_parser_pause(&parser, 1);
 		return 0;
 	}
 
+	void ParseRequests()
+	{
+		parsing = true;
+		http_parser_pause(&parser, 0);
+		const size_t parsed = http_parser_execute(&parser, &parser_settings, recvq.data(), recvq.size());
+		parsing = false;
+
+		if (!HasFd())
+			return; // The socket was closed whilst handling a request.
+
+		recvq.erase(0, parsed);
+		if (HTTP_PARSER_ERRNO(&parser) == HPE_PAUSED)
+			return; // Waiting for a response to be sent.
+
+		if (parser.upgrade)
+		{
+			keepalive = false;
+			SendHTTPError(status_code ? status_code : 400);
+		}
+		else if (HTTP_PARSER_ERRNO(&parser))
+		{
+			keepalive = false;
+			SendHTTPError(status_code ? status_code : 400, http_errno_description((http_errno)parser.http_errno));
+		}
+	}
+
+	void FinishResponse()
+	{
+		responding = false;
+		if (!keepalive)
+		{
+			BufferedSocket::Close(true);
+			return;
+		}
+
+		// Wait for the next request. The parser may have been paused whilst the response was
+		// being sent and the client will usually only send another request after receiving it.
+		messagecomplete = false;
+		SetInterval(httpconfig.keepalivetimeout);
+		http_parser_pause(&parser, 0);
+		if (!parsing && !recvq.empty())
+			ParseRequests();
+	}
+
+	void WriteChunk(const std::string& data)
+	{
+		if (data.empty())
+			return; // An empty chunk would end the response.
+
+		if (chunked)
+			WriteData(INSP_FORMAT("{:x}\r\n", data.length()));
+		WriteData(data);
+		if (chunked)
+			WriteData("\r\n");
+	}
+
+	void PumpStream()
+	{
+		while (stream && GetSendQSize() < STREAM_WATERMARK && HasFd())
+		{
+			std::string data;
+			const bool more = stream->Write(data);
+			WriteChunk(data);
+			if (more)
+				continue;
+
+			stream.reset();
+			streammodule = nullptr;
+			if (chunked)
+				WriteData("0\r\n\r\n");
+			FinishResponse();
+		}
+	}
+
 public:
 	HttpServerSocket(int newfd, const std::string& IP, ListenSocket* via, const irc::sockets::sockaddrs& client, const irc::sockets::sockaddrs& server, unsigned long timeoutsec)
 		: BufferedSocket(newfd)
@@ -229,6 +358,17 @@ public:
 		ServerInstance->Timers.AddTimer(this);
 	}
 
+	/** Closes the connection if its response is being streamed by the specified module. */
+	void CloseStream(Module* mod)
+	{
+		if (streammodule != mod)
+			return;
+
+		stream.reset();
+		streammodule = nullptr;
+		Close();
+	}
+
 	~HttpServerSocket() override
 	{
 		sockets.erase(this);
@@ -267,23 +407,30 @@ public:
 		Page(data, response, &empty);
 	}
 
-	void SendHeaders(unsigned long size, unsigned int response, HTTPHeaders& rheaders)
+	void SendHeaders(unsigned long size, unsigned int response, HTTPHeaders& rheaders, bool streamed = false)
 	{
 		WriteData(INSP_FORMAT("HTTP/{}.{} {} {}\r\n", parser.http_major ? parser.http_major : 1, parser.http_major ? parser.http_minor : 1, response, http_status_str((http_status)response)));
 
 		rheaders.CreateHeader("Date", Time::ToString(ServerInstance->Time(), "%a, %d %b %Y %H:%M:%S GMT", true));
 		rheaders.CreateHeader("Server", INSPIRCD_BRANCH);
-		rheaders.SetHeader("Content-Length", ConvToStr(size));
 
-		if (size)
+		if (!streamed)
+			rheaders.SetHeader("Content-Length", ConvToStr(size));
+		else if (chunked)
+			rheaders.SetHeader("Transfer-Encoding", "chunked");
+
+		if (size || streamed)
 			rheaders.CreateHeader("Content-Type", "text/html");
 		else
 			rheaders.RemoveHeader("Content-Type");
 
-		/* Supporting Connection: keep-alive causes a whole world of hurt synchronizing timeouts,
-		 * so remove it, its not essential for what we need.
-		 */
-		rheaders.SetHeader("Connection", "Close");
+		if (keepalive)
+		{
+			rheaders.SetHeader("Connection", "keep-alive");
+			rheaders.SetHeader("Keep-Alive", INSP_FORMAT("timeout={}, max={}", httpconfig.keepalivetimeout, httpconfig.maxrequests - requests));
+		}
+		else
+			rheaders.SetHeader("Connection", "close");
 
 		WriteData(rheaders.GetFormattedHeaders());
 		WriteData("\r\n");
@@ -291,13 +438,38 @@ public:
 
 	void OnDataReady() override
 	{
-		if (parser.upgrade || HTTP_PARSER_ERRNO(&parser))
+		if (responding)
+		{
+			// Pipelined requests are parsed once the current response has been sent.
+			if (recvq.length() > MAX_PIPELINE_LENGTH)
+			{
+				ServerInstance->Logs.Debug(MODNAME, "HTTP socket {} sent too many pipelined requests", GetFd());
+				Close();
+			}
 			return;
-		http_parser_execute(&parser, &parser_settings, recvq.data(), recvq.size());
-		if (parser.upgrade)
-			SendHTTPError(status_code ? status_code : 400);
-		else if (HTTP_PARSER_ERRNO(&parser))
-			SendHTTPError(status_code ? status_code : 400, http_errno_description((http_errno)parser.http_errno));
+		}
+
+		// A paused parser is resumed by ParseRequests().
+		const http_errno parsererror = HTTP_PARSER_ERRNO(&parser);
+		if (parser.upgrade || (parsererror != HPE_OK && parsererror != HPE_PAUSED))
+			return;
+
+		ParseRequests();
+	}
+
+	void OnEventHandlerWrite() override
+	{
+		BufferedSocket::OnEventHandlerWrite();
+
+		// If the send queue drains completely then the socket engine will not tell us when we can
+		// write again so keep refilling it until it stops draining or the stream ends.
+		while (stream && HasFd())
+		{
+			PumpStream();
+			DoWrite();
+			if (GetSendQSize() || (GetEventMask() & FD_WRITE_WILL_BLOCK))
+				break;
+		}
 	}
 
 	void ServeData()
@@ -322,7 +494,23 @@ public:
 	{
 		SendHeaders(s.length(), response, *hheaders);
 		WriteData(s);
-		BufferedSocket::Close(true);
+		FinishResponse();
+	}
+
+	void StreamPage(const std::string& s, unsigned int response, HTTPHeaders* hheaders, std::unique_ptr<HTTPResponseStream> newstream, Module* mod)
+	{
+		// HTTP/1.0 clients do not support chunked transfer encoding so the end of the
+		// response has to be indicated by closing the connection.
+		chunked = parser.http_major > 1 || (parser.http_major == 1 && parser.http_minor >= 1);
+		if (!chunked)
+			keepalive = false;
+
+		SendHeaders(0, response, *hheaders, true);
+		WriteChunk(s);
+
+		stream = std::move(newstream);
+		streammodule = mod;
+		PumpStream();
 	}
 
 	void Page(std::stringstream* n, unsigned int response, HTTPHeaders* hheaders)
@@ -401,7 +589,10 @@ public:
 
 	void SendResponse(HTTPDocumentResponse& resp) override
 	{
-		resp.src.sock->Page(resp.document, resp.responsecode, &resp.headers);
+		if (resp.stream)
+			resp.src.sock->StreamPage(resp.document->str(), resp.responsecode, &resp.headers, std::move(resp.stream), resp.module);
+		else
+			resp.src.sock->Page(resp.document, resp.responsecode, &resp.headers);
 	}
 };
 
@@ -410,7 +601,6 @@ class ModuleHttpServer final
 {
 private:
 	HTTPdAPIImpl APIImpl;
-	unsigned long timeoutsec;
 	Events::ModuleEventProvider acleventprov;
 	Events::ModuleEventProvider reqeventprov;
 
@@ -434,7 +624,10 @@ public:
 	void ReadConfig(ConfigStatus& status) override
 	{
 		const auto& tag = ServerInstance->Config->ConfValue("httpd");
-		timeoutsec = tag->getDuration("timeout", 10, 1);
+		httpconfig.keepalive = tag->getBool("keepalive", true);
+		httpconfig.keepalivetimeout = tag->getDuration("keepalivetimeout", 15, 1);
+		httpconfig.maxrequests = tag->getNum<unsigned long>("maxrequests", 100, 1);
+		httpconfig.timeout = tag->getDuration("timeout", 10, 1);
 	}
 
 	ModResult OnAcceptConnection(int nfd, ListenSocket* from, const irc::sockets::sockaddrs& client, const irc::sockets::sockaddrs& server) override
@@ -442,7 +635,7 @@ public:
 		if (!insp::equalsci(from->bind_tag->getString("type"), "httpd"))
 			return MOD_RES_PASSTHRU;
 
-		sockets.push_front(new HttpServerSocket(nfd, client.addr(), from, client, server, timeoutsec));
+		sockets.push_front(new HttpServerSocket(nfd, client.addr(), from, client, server, httpconfig.timeout));
 		return MOD_RES_ALLOW;
 	}
 
@@ -456,7 +649,11 @@ public:
 			{
 				sock->Cull();
 				delete sock;
+				continue;
 			}
+
+			// The stream which is producing the response belongs to the module.
+			sock->CloseStream(mod);
 		}
 	}
 
@@ -0,0 +1,303 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+#include "modules/dns.h"
+#include "modules/httpd.h"
+#include "utility/string.h"
+#include "xline.h"
+
+namespace Metrics
+{
+	/** The number of nanoseconds in a second. */
+	static constexpr double NANOSECONDS = 1e9;
+
+	/** A histogram of queue sizes in bytes with buckets starting at 64 bytes. */
+	typedef Histogram<64> SizeHistogram;
+
+	/** Escapes a label value for use in the OpenMetrics text format. */
+	std::string Escape(const std::string& str)
+	{
+		std::string ret;
+		ret.reserve(str.length());
+		for (const auto chr : str)
+		{
+			switch (chr)
+			{
+				case '\\':
+					ret.append("\\\\");
+					break;
+				case '"':
+					ret.append("\\\"");
+					break;
+				case '\n':
+					ret.append("\\n");
+					break;
+				default:
+					ret.push_back(chr);
+					break;
+			}
+		}
+		return ret;
+	}
+
+	/** Writes metrics in the OpenMetrics text format. */
+	class Writer final
+	{
+	private:
+		std::string data;
+
+	public:
+		/** Writes the metadata of a metric family.
+		 * @param name The name of the metric family.
+		 * @param type The type of the metric family.
+		 * @param help A description of the metric family.
+		 * @param unit If non-empty then the unit that the metric family is measured in.
+		 */
+		void Family(const std::string& name, const char* type, const char* help, const char* unit = "")
+		{
+			data.append(INSP_FORMAT("# TYPE {} {}\n", name, type));
+			if (*unit)
+				data.append(INSP_FORMAT("# UNIT {} {}\n", name, unit));
+			data.append(INSP_FORMAT("# HELP {} {}\n", name, help));
+		}
+
+		/** Writes a single sample.
+		 * @param name The name of the sample.
+		 * @param labels The labels of the sample in the format name="value" separated by commas.
+		 * @param value The value of the sample.
+		 */
+		template <typename Numeric>
+		void Sample(const std::string& name, const std::string& labels, Numeric value)
+		{
+			if (labels.empty())
+				data.append(INSP_FORMAT("{} {}\n", name, value));
+			else
+				data.append(INSP_FORMAT("{}{{{}}} {}\n", name, labels, value));
+		}
+
+		/** Writes the samples of a histogram.
+		 * @param name The name of the histogram family.
+		 * @param labels The labels of the histogram in the format name="value" separated by commas.
+		 * @param histogram The histogram to write.
+		 * @param divisor The amount to divide the values in the histogram by.
+		 * @param gauge Whether the histogram is a gauge histogram rather than a counter histogram.
+		 */
+		template <uint64_t Base>
+		void Samples(const std::string& name, const std::string& labels, const Histogram<Base>& histogram, double divisor, bool gauge = false)
+		{
+			const std::string prefix = labels.empty() ? labels : labels + ",";
+
+			uint64_t count = 0;
+			for (size_t bucket = 0; bucket < Histogram<Base>::BUCKETS; ++bucket)
+			{
+				count += histogram.counts[bucket];
+
+				const std::string bound = bucket == Histogram<Base>::BUCKETS - 1
+					? "+Inf"
+					: INSP_FORMAT("{}", Histogram<Base>::GetBound(bucket) / divisor);
+				Sample(name + "_bucket", INSP_FORMAT("{}le=\"{}\"", prefix, bound), count);
+			}
+
+			Sample(name + (gauge ? "_gcount" : "_count"), labels, count);
+			Sample(name + (gauge ? "_gsum" : "_sum"), labels, histogram.sum / divisor);
+		}
+
+		/** Ends the exposition and retrieves the data. */
+		std::string Finish()
+		{
+			data.append("# EOF\n");
+			return std::move(data);
+		}
+	};
+
+	/** The number of bytes which have been transferred on a listener. */
+	struct Traffic final
+	{
+		/** The number of bytes received from users. */
+		uint64_t in = 0;
+
+		/** The number of bytes sent to users. */
+		uint64_t out = 0;
+	};
+}
+
+class ModuleHttpMetrics final
+	: public Module
+	, public HTTPRequestEventListener
+{
+private:
+	HTTPdAPI API;
+	dynamic_reference_nocheck<DNS::Manager> dns;
+
+	/** The traffic of users who have disconnected keyed by the listener they connected to. */
+	std::map<std::string, Metrics::Traffic> pasttraffic;
+
+	/** Retrieves the name of the listener that a user connected to. */
+	static std::string GetListener(LocalUser* user)
+	{
+		const irc::sockets::sockaddrs& sa = user->server_sa;
+		const ListenSocket* wildcard = nullptr;
+		for (const auto* ls : ServerInstance->ports)
+		{
+			if (ls->bind_sa == sa)
+				return ls->bind_sa.str();
+
+			const std::string addr = ls->bind_sa.addr();
+			if (!wildcard && sa.is_ip() && ls->bind_sa.is_ip() && ls->bind_sa.port() == sa.port() && (addr == "0.0.0.0" || addr == "::"))
+				wildcard = ls;
+		}
+		return wildcard ? wildcard->bind_sa.str() : sa.str();
+	}
+
+	void WriteServer(Metrics::Writer& writer)
+	{
+		writer.Family("inspircd_users", "gauge", "The number of users on the network.");
+		writer.Sample("inspircd_users", "", ServerInstance->Users.GetUsers().size());
+
+		writer.Family("inspircd_local_users", "gauge", "The number of users on this server.");
+		writer.Sample("inspircd_local_users", "", ServerInstance->Users.GetLocalUsers().size());
+
+		writer.Family("inspircd_channels", "gauge", "The number of channels on the network.");
+		writer.Sample("inspircd_channels", "", ServerInstance->Channels.GetChans().size());
+
+		writer.Family("inspircd_sockets", "gauge", "The number of sockets which are open.");
+		writer.Sample("inspircd_sockets", "", SocketEngine::GetUsedFds());
+
+		writer.Family("inspircd_loop_duration_seconds", "histogram", "The time spent in each iteration of the main loop excluding the time spent waiting for events.", "seconds");
+		writer.Samples("inspircd_loop_duration_seconds", "", ServerInstance->Stats.LoopTime, Metrics::NANOSECONDS);
+
+		writer.Family("inspircd_xline_match_duration_seconds", "histogram", "The time taken to check users and patterns against X-lines.", "seconds");
+		writer.Samples("inspircd_xline_match_duration_seconds", "", ServerInstance->XLines->matchtime, Metrics::NANOSECONDS);
+
+		if (dns)
+		{
+			writer.Family("inspircd_dns_cache_hits", "counter", "The number of DNS requests which were answered from the cache.");
+			writer.Sample("inspircd_dns_cache_hits_total", "", dns->stats_cachehits);
+
+			writer.Family("inspircd_dns_cache_misses", "counter", "The number of DNS requests which were not in the cache or whose cached result had expired.");
+			writer.Sample("inspircd_dns_cache_misses_total", "", dns->stats_cachemisses);
+		}
+	}
+
+	void WriteCommands(Metrics::Writer& writer)
+	{
+		const CommandParser::CommandMap& commands = ServerInstance->Parser.GetCommands();
+
+		writer.Family("inspircd_command_uses", "counter", "The number of times that a command has been used by local users.");
+		for (const auto& [name, cmd] : commands)
+			writer.Sample("inspircd_command_uses_total", INSP_FORMAT("command=\"{}\"", Metrics::Escape(name)), cmd->use_count);
+
+		writer.Family("inspircd_command_duration_seconds", "histogram", "The time taken to execute a command when used by local users.", "seconds");
+		for (const auto& [name, cmd] : commands)
+		{
+			// Most commands are never used so skip them to keep the exposition small.
+			if (cmd->latency.GetCount())
+				writer.Samples("inspircd_command_duration_seconds", INSP_FORMAT("command=\"{}\"", Metrics::Escape(name)), cmd->latency, Metrics::NANOSECONDS);
+		}
+	}
+
+	void WriteModules(Metrics::Writer& writer)
+	{
+		const ModuleManager::ModuleMap& modules = ServerInstance->Modules.GetModules();
+
+		writer.Family("inspircd_module_hook_calls", "counter", "The number of times that the event handlers of a module have been called.");
+		for (const auto& [name, mod] : modules)
+			writer.Sample("inspircd_module_hook_calls_total", INSP_FORMAT("module=\"{}\"", Metrics::Escape(name)), mod->hookstats.calls);
+
+		writer.Family("inspircd_module_hook_seconds", "counter", "The time spent in the event handlers of a module including any event handlers that they call.", "seconds");
+		for (const auto& [name, mod] : modules)
+			writer.Sample("inspircd_module_hook_seconds_total", INSP_FORMAT("module=\"{}\"", Metrics::Escape(name)), mod->hookstats.time / Metrics::NANOSECONDS);
+	}
+
+	void WriteUsers(Metrics::Writer& writer)
+	{
+		// Start with the traffic of users who have disconnected and every client listener
+		// so that the counters do not disappear when all of the users on a listener leave.
+		std::map<std::string, Metrics::Traffic> traffic = pasttraffic;
+		for (const auto* ls : ServerInstance->ports)
+		{
+			if (insp::equalsci(ls->bind_tag->getString("type", "clients", 1), "clients"))
+				traffic.emplace(ls->bind_sa.str(), Metrics::Traffic());
+		}
+
+		Metrics::SizeHistogram recvq;
+		Metrics::SizeHistogram sendq;
+		for (auto* lu : ServerInstance->Users.GetLocalUsers())
+		{
+			Metrics::Traffic& listener = traffic[GetListener(lu)];
+			listener.in += lu->bytes_in;
+			listener.out += lu->bytes_out;
+
+			recvq.Observe(lu->eh.GetRecvQSize());
+			sendq.Observe(lu->eh.GetSendQSize());
+		}
+
+		writer.Family("inspircd_listener_received_bytes", "counter", "The number of bytes received from users on a listener.", "bytes");
+		for (const auto& [name, listener] : traffic)
+			writer.Sample("inspircd_listener_received_bytes_total", INSP_FORMAT("listener=\"{}\"", Metrics::Escape(name)), listener.in);
+
+		writer.Family("inspircd_listener_sent_bytes", "counter", "The number of bytes sent to users on a listener.", "bytes");
+		for (const auto& [name, listener] : traffic)
+			writer.Sample("inspircd_listener_sent_bytes_total", INSP_FORMAT("listener=\"{}\"", Metrics::Escape(name)), listener.out);
+
+		writer.Family("inspircd_user_recvq_bytes", "gaugehistogram", "The size of the receive queues of local users.", "bytes");
+		writer.Samples("inspircd_user_recvq_bytes", "", recvq, 1, true);
+
+		writer.Family("inspircd_user_sendq_bytes", "gaugehistogram", "The size of the send queues of local users.", "bytes");
+		writer.Samples("inspircd_user_sendq_bytes", "", sendq, 1, true);
+	}
+
+public:
+	ModuleHttpMetrics()
+		: Module(VF_VENDOR, "Provides statistics about the server in the OpenMetrics format over HTTP via the /metrics path.")
+		, HTTPRequestEventListener(this)
+		, API(this)
+		, dns(this, "DNS")
+	{
+	}
+
+	void OnUserDisconnect(LocalUser* user) override
+	{
+		Metrics::Traffic& traffic = pasttraffic[GetListener(user)];
+		traffic.in += user->bytes_in;
+		traffic.out += user->bytes_out;
+	}
+
+	ModResult OnHTTPRequest(HTTPRequest& request) override
+	{
+		if (request.GetPath() != "/metrics")
+			return MOD_RES_PASSTHRU;
+
+		ServerInstance->Logs.Debug(MODNAME, "Handling HTTP request for {}", request.GetPath());
+
+		Metrics::Writer writer;
+		WriteServer(writer);
+		WriteCommands(writer);
+		WriteModules(writer);
+		WriteUsers(writer);
+
+		std::stringstream data(writer.Finish());
+		HTTPDocumentResponse response(this, request, &data, 200);
+		response.headers.SetHeader("X-Powered-By", MODNAME);
+		response.headers.SetHeader("Content-Type", "application/openmetrics-text; version=1.0.0; charset=utf-8");
+		API->SendResponse(response);
+		return MOD_RES_DENY;
+	}
+};
+
+MODULE_INIT(ModuleHttpMetrics)
@@ -33,12 +33,17 @@
 #include "modules/httpd.h"
 #include "xline.h"
 
-#include <stack>
+#define UTF_CPP_CPLUSPLUS 199711L
+#include <utfcpp/core.h>
+#include <utfcpp/unchecked.h>
 
 static ISupport::EventProvider* isevprov;
 
 namespace Stats
 {
+	/** The number of items which are serialized each time the client is ready for more data. */
+	static constexpr size_t BATCH_SIZE = 500;
+
 	static const insp::flat_map<char, char const*> xmlentities = {
 		{ '<', "lt"   },
 		{ '>', "gt"   },
@@ -81,49 +86,233 @@ namespace Stats
 		return ret;
 	}
 
-	class XMLSerializer final
+	void JSONEscape(const std::string& str, std::string& out)
+	{
+		// JSON strings must be valid UTF-8 so replace any malformed sequences.
+		std::string valid;
+		const std::string* source = &str;
+		if (utf8::find_invalid(str.begin(), str.end()) != str.end())
+		{
+			utf8::unchecked::replace_invalid(str.begin(), str.end(), std::back_inserter(valid));
+			source = &valid;
+		}
+
+		for (const auto chr : *source)
+		{
+			switch (chr)
+			{
+				case '"':
+					out.append("\\\"");
+					break;
+				case '\\':
+					out.append("\\\\");
+					break;
+				default:
+					if (static_cast<unsigned char>(chr) < 0x20)
+						out.append(INSP_FORMAT("\\u{:04x}", static_cast<unsigned char>(chr)));
+					else
+						out.push_back(chr);
+					break;
+			}
+		}
+	}
+
+	/** Serializes statistics as either JSON or XML. */
+	class Serializer final
 	{
+	public:
+		enum Format
+		{
+			FORMAT_JSON,
+			FORMAT_XML
+		};
+
 	private:
-		std::stack<const char*> blocks;
-		std::stringstream data;
+		struct Block final
+		{
+			/** The name of the block. */
+			const char* name;
+
+			/** Whether the block contains a list of unnamed blocks. */
+			bool list;
+
+			/** Whether the block has no element of its own in XML. */
+			bool inlinexml;
+
+			/** Whether nothing has been written to the block yet. */
+			bool empty = true;
+
+			Block(const char* n, bool l, bool i)
+				: name(n)
+				, list(l)
+				, inlinexml(i)
+			{
+			}
+		};
+
+		std::vector<Block> blocks;
+		std::string data;
+		const Format format;
+
+		/** If non-empty then the only fields which should be written at the field depth. */
+		const std::set<std::string>* fields = nullptr;
+
+		/** The block depth that the field filter applies at. */
+		size_t fielddepth = 0;
+
+		/** The number of blocks which are currently being skipped by the field filter. */
+		size_t skipping = 0;
+
+		bool IsFiltered(const char* name) const
+		{
+			return fields && !fields->empty() && blocks.size() == fielddepth && !fields->count(name);
+		}
+
+		void WriteKey(const char* name)
+		{
+			if (blocks.empty())
+				return;
+
+			Block& parent = blocks.back();
+			if (!parent.empty)
+				data.push_back(',');
+			parent.empty = false;
+
+			if (!parent.list)
+			{
+				data.push_back('"');
+				data.append(name);
+				data.append("\":");
+			}
+		}
+
+		Serializer& Begin(const char* name, bool list, bool inlinexml)
+		{
+			if (skipping || IsFiltered(name))
+			{
+				skipping++;
+				return *this;
+			}
+
+			if (format == FORMAT_JSON)
+			{
+				WriteKey(name);
+				data.push_back(list ? '[' : '{');
+			}
+			else if (!inlinexml)
+			{
+				data.append("<").append(name).append(">");
+			}
+			blocks.emplace_back(name, list, inlinexml);
+			return *this;
+		}
 
 	public:
-		XMLSerializer& Attribute(const char* name, const std::string& value)
+		Serializer(Format fmt)
+			: format(fmt)
+		{
+			if (format == FORMAT_JSON)
+			{
+				data.push_back('{');
+				blocks.emplace_back("", false, false);
+			}
+		}
+
+		Serializer& Attribute(const char* name, const std::string& value)
 		{
-			if (value.empty())
-				data << '<' << name << "/>";
+			if (skipping || IsFiltered(name))
+				return *this;
+
+			if (format == FORMAT_JSON)
+			{
+				WriteKey(name);
+				data.push_back('"');
+				JSONEscape(value, data);
+				data.push_back('"');
+			}
+			else if (value.empty())
+				data.append("<").append(name).append("/>");
 			else
-				data << '<' << name << '>' << Sanitize(value) << "</" << name << '>';
+				data.append("<").append(name).append(">").append(Sanitize(value)).append("</").append(name).append(">");
 			return *this;
 		}
 
 		template<typename Numeric>
-		std::enable_if_t<std::is_arithmetic_v<Numeric>, XMLSerializer&> Attribute(const char* name, const Numeric& value)
+		std::enable_if_t<std::is_arithmetic_v<Numeric>, Serializer&> Attribute(const char* name, const Numeric& value)
+		{
+			if (format == FORMAT_XML)
+				return Attribute(name, ConvToStr(value));
+
+			if (!skipping && !IsFiltered(name))
+			{
+				WriteKey(name);
+				data.append(ConvToStr(value));
+			}
+			return *this;
+		}
+
+		/** Begins a block of named fields. */
+		Serializer& BeginBlock(const char* name)
 		{
-			return Attribute(name, ConvToStr(value));
+			return Begin(name, false, false);
 		}
 
-		std::stringstream* GetData() { return &data; }
+		/** Begins a list of unnamed blocks.
+		 * @param name The name of the list.
+		 * @param inlinexml If true then the blocks in the list are written directly to the parent block in XML.
+		 */
+		Serializer& BeginList(const char* name, bool inlinexml = false)
+		{
+			return Begin(name, true, inlinexml);
+		}
 
-		XMLSerializer& BeginBlock(const char* name)
+		Serializer& EndBlock()
 		{
-			blocks.push(name);
-			data << '<' << name << '>';
+			if (skipping)
+			{
+				skipping--;
+				return *this;
+			}
+
+			const Block& block = blocks.back();
+			if (format == FORMAT_JSON)
+				data.push_back(block.list ? ']' : '}');
+			else if (!block.inlinexml)
+				data.append("</").append(block.name).append(">");
+			blocks.pop_back();
 			return *this;
 		}
 
-		XMLSerializer& EndBlock()
+		/** Ends the document. */
+		void Finish()
 		{
-			const char* name = blocks.top();
-			data << "</" << name << '>';
-			blocks.pop();
-			return *this;
+			if (format == FORMAT_JSON)
+				EndBlock();
+		}
+
+		/** Restricts the fields which are written in the current block.
+		 * @param newfields The fields to write or nullptr to write all fields.
+		 */
+		void SetFields(const std::set<std::string>* newfields)
+		{
+			fields = newfields;
+			fielddepth = blocks.size();
+		}
+
+		Format GetFormat() const { return format; }
+
+		/** Retrieves the data which has been serialized since this was last called. */
+		std::string Take()
+		{
+			std::string ret;
+			ret.swap(data);
+			return ret;
 		}
 	};
 
-	void DumpMeta(XMLSerializer& serializer, Extensible* ext)
+	void DumpMeta(Serializer& serializer, Extensible* ext)
 	{
-		serializer.BeginBlock("metadata");
+		serializer.BeginList("metadata");
 		for (const auto& [item, obj] : ext->GetExtList())
 		{
 			serializer.BeginBlock("meta")
@@ -136,7 +325,7 @@ namespace Stats
 		serializer.EndBlock();
 	}
 
-	void ServerInfo(XMLSerializer& serializer)
+	void ServerInfo(Serializer& serializer)
 	{
 		serializer.BeginBlock("server")
 			.Attribute("id", ServerInstance->Config->ServerId)
@@ -147,12 +336,12 @@ namespace Stats
 			.EndBlock();
 	}
 
-	void ISupport(XMLSerializer& serializer)
+	void ISupport(Serializer& serializer)
 	{
 		ISupport::TokenMap tokens;
 		isevprov->Call(&ISupport::EventListener::OnBuildISupport, tokens);
 
-		serializer.BeginBlock("isupport");
+		serializer.BeginList("isupport");
 		for (const auto& [key, value] : tokens)
 		{
 			serializer.BeginBlock("token")
@@ -163,7 +352,7 @@ namespace Stats
 		serializer.EndBlock();
 	}
 
-	void General(XMLSerializer& serializer)
+	void General(Serializer& serializer)
 	{
 		serializer.BeginBlock("general")
 			.Attribute("usercount", ServerInstance->Users.GetUsers().size())
@@ -179,9 +368,9 @@ namespace Stats
 		serializer.EndBlock();
 	}
 
-	void XLines(XMLSerializer& serializer)
+	void XLines(Serializer& serializer)
 	{
-		serializer.BeginBlock("xlines");
+		serializer.BeginList("xlines");
 		for (const auto& xltype : ServerInstance->XLines->GetAllTypes())
 		{
 			XLineLookup* lookup = ServerInstance->XLines->GetAll(xltype);
@@ -202,9 +391,9 @@ namespace Stats
 		serializer.EndBlock();
 	}
 
-	void Modules(XMLSerializer& serializer)
+	void Modules(Serializer& serializer)
 	{
-		serializer.BeginBlock("modulelist");
+		serializer.BeginList("modulelist");
 		for (const auto& [modname, mod] : ServerInstance->Modules.GetModules())
 		{
 			serializer.BeginBlock("module")
@@ -215,46 +404,46 @@ namespace Stats
 		serializer.EndBlock();
 	}
 
-	void Channels(XMLSerializer& serializer)
+	void DumpChannel(Serializer& serializer, Channel* c, const std::set<std::string>& fields)
 	{
-		serializer.BeginBlock("channellist");
-		for (const auto& [_, c] : ServerInstance->Channels.GetChans())
-		{
-			serializer.BeginBlock("channel")
-				.Attribute("channelname", c->name)
-				.Attribute("usercount", c->GetUsers().size())
-				.Attribute("channelmodes", c->ChanModes(true));
-
-			if (!c->topic.empty())
-			{
-				serializer.BeginBlock("channeltopic")
-					.Attribute("topictext", c->topic)
-					.Attribute("setby", c->setby)
-					.Attribute("settime", c->topicset)
-					.EndBlock();
-			}
+		serializer.BeginBlock("channel");
+		serializer.SetFields(&fields);
+		serializer.Attribute("channelname", c->name)
+			.Attribute("usercount", c->GetUsers().size())
+			.Attribute("channelmodes", c->ChanModes(true));
 
-			for (const auto& [__, memb] : c->GetUsers())
-			{
-				serializer.BeginBlock("channelmember")
-					.Attribute("uid", memb->user->uuid)
-					.Attribute("privs", memb->GetAllPrefixChars())
-					.Attribute("modes", memb->GetAllPrefixModes());
+		if (!c->topic.empty())
+		{
+			serializer.BeginBlock("channeltopic")
+				.Attribute("topictext", c->topic)
+				.Attribute("setby", c->setby)
+				.Attribute("settime", c->topicset)
+				.EndBlock();
+		}
 
-				DumpMeta(serializer, memb);
-				serializer.EndBlock();
-			}
+		serializer.BeginList("channelmembers", true);
+		for (const auto& [_, memb] : c->GetUsers())
+		{
+			serializer.BeginBlock("channelmember")
+				.Attribute("uid", memb->user->uuid)
+				.Attribute("privs", memb->GetAllPrefixChars())
+				.Attribute("modes", memb->GetAllPrefixModes());
 
-			DumpMeta(serializer, c);
+			DumpMeta(serializer, memb);
 			serializer.EndBlock();
 		}
 		serializer.EndBlock();
+
+		DumpMeta(serializer, c);
+		serializer.SetFields(nullptr);
+		serializer.EndBlock();
 	}
 
-	void DumpUser(XMLSerializer& serializer, User* u)
+	void DumpUser(Serializer& serializer, User* u, const std::set<std::string>& fields)
 	{
-		serializer.BeginBlock("user")
-			.Attribute("nickname", u->nick)
+		serializer.BeginBlock("user");
+		serializer.SetFields(&fields);
+		serializer.Attribute("nickname", u->nick)
 			.Attribute("uuid", u->uuid)
 			.Attribute("realhost", u->GetRealHost())
 			.Attribute("displayhost", u->GetDisplayedHost())
@@ -286,28 +475,16 @@ namespace Stats
 		}
 
 		DumpMeta(serializer, u);
+		serializer.SetFields(nullptr);
 		serializer.EndBlock();
 	}
 
-	void Users(XMLSerializer& serializer)
-	{
-		serializer.BeginBlock("userlist");
-		for (const auto& [_, u] : ServerInstance->Users.GetUsers())
-		{
-			if (!u->IsFullyConnected())
-				continue;
-
-			DumpUser(serializer, u);
-		}
-		serializer.EndBlock();
-	}
-
-	void Servers(XMLSerializer& serializer)
+	void Servers(Serializer& serializer)
 	{
 		ProtocolInterface::ServerList sl;
 		ServerInstance->PI->GetServerList(sl);
 
-		serializer.BeginBlock("serverlist");
+		serializer.BeginList("serverlist");
 		for (const auto& server : sl)
 		{
 			serializer.BeginBlock("server")
@@ -322,9 +499,9 @@ namespace Stats
 		serializer.EndBlock();
 	}
 
-	void Commands(XMLSerializer& serializer)
+	void Commands(Serializer& serializer)
 	{
-		serializer.BeginBlock("commandlist");
+		serializer.BeginList("commandlist");
 		for (const auto& [cmdname, cmd] : ServerInstance->Parser.GetCommands())
 		{
 			serializer.BeginBlock("command")
@@ -335,111 +512,336 @@ namespace Stats
 		serializer.EndBlock();
 	}
 
-	enum OrderBy
+	std::string FoldCase(const std::string& str)
 	{
-		OB_NICK,
-		OB_LASTMSG,
-
-		OB_NONE
-	};
+		std::string ret(str);
+		for (auto& chr : ret)
+			chr = static_cast<char>(national_case_insensitive_map[static_cast<unsigned char>(chr)]);
+		return ret;
+	}
 
-	struct UserSorter final
+	/** Serializes a list of users or channels in batches ordered by a cursor key. The keys of the
+	 * items are sorted once when the list is started and each item is looked up again when its
+	 * batch is serialized so items which are removed between batches are skipped.
+	 */
+	template <typename Item>
+	class Paginator
 	{
-		OrderBy order;
-		bool desc;
+	private:
+		/** The name of the list. */
+		const char* const name;
+
+		/** The key of the last item which was serialized. */
+		std::string cursor;
+
+		/** Whether the list has been started. */
+		bool started = false;
+
+		/** The key and identifier of each item which will be serialized in the order they will be serialized in. */
+		std::vector<std::pair<std::string, std::string>> snapshot;
 
-		UserSorter(OrderBy Order, bool Desc = false)
-			: order(Order)
-			, desc(Desc)
+		/** The index within the snapshot of the next item to serialize. */
+		size_t position = 0;
+
+		void TakeSnapshot()
 		{
+			const auto before = [this](const std::string& lhs, const std::string& rhs) {
+				return desc ? lhs > rhs : lhs < rhs;
+			};
+
+			GetItems([&](Item* item) {
+				std::string key = GetKey(item);
+				if (key.empty() || (!cursor.empty() && !before(cursor, key)))
+					return; // Filtered or before the cursor.
+
+				snapshot.emplace_back(std::move(key), GetId(item));
+			});
+
+			const auto compare = [&before](const std::pair<std::string, std::string>& lhs, const std::pair<std::string, std::string>& rhs) {
+				return before(lhs.first, rhs.first);
+			};
+
+			if (limited && remaining < snapshot.size())
+			{
+				// Only the items within the limit need to be sorted. We keep one more than we need
+				// so we can tell whether there are any more items after the limit.
+				std::partial_sort(snapshot.begin(), snapshot.begin() + remaining + 1, snapshot.end(), compare);
+				snapshot.resize(remaining + 1);
+			}
+			else
+				std::sort(snapshot.begin(), snapshot.end(), compare);
+		}
+
+	protected:
+		/** Whether to serialize the items in descending order. */
+		bool desc = false;
+
+		/** If non-empty then the only fields which should be serialized. */
+		std::set<std::string> fields;
+
+		/** The maximum number of items which can still be serialized or 0 for no limit. */
+		size_t remaining = 0;
+
+		/** Whether the limit was set by the client. */
+		bool limited = false;
+
+		/** Retrieves the items which can be serialized. */
+		virtual void GetItems(const std::function<void(Item*)>& callback) = 0;
+
+		/** Retrieves the key of an item, or an empty string if it should not be serialized. */
+		virtual std::string GetKey(Item* item) = 0;
+
+		/** Retrieves an identifier which can be used to find an item again. */
+		virtual std::string GetId(Item* item) = 0;
+
+		/** Finds an item by its identifier or returns nullptr if it no longer exists. */
+		virtual Item* FindItem(const std::string& id) = 0;
+
+		/** Serializes a single item. */
+		virtual void Dump(Serializer& serializer, Item* item) = 0;
+
+		void ReadParams(const HTTPQueryParameters& params)
+		{
+			cursor = params.getString("cursor");
+			desc = params.getBool("desc", false);
+			remaining = params.getNum<size_t>("limit");
+			limited = remaining;
+
+			irc::commasepstream fieldstream(params.getString("fields"));
+			for (std::string field; fieldstream.GetToken(field); )
+				fields.insert(field);
 		}
 
-		template <typename T>
-		inline bool Compare(const T& a, const T& b)
+	public:
+		Paginator(const char* n)
+			: name(n)
 		{
-			return desc ? a > b : a < b;
 		}
 
-		bool operator()(User* u1, User* u2)
+		virtual ~Paginator() = default;
+
+		/** Serializes the next batch of items.
+		 * @return True if all of the items have been serialized; otherwise, false.
+		 */
+		bool Step(Serializer& serializer)
 		{
-			switch (order)
+			if (!started)
 			{
-				case OB_LASTMSG:
-					return Compare(IS_LOCAL(u1)->idle_lastmsg, IS_LOCAL(u2)->idle_lastmsg);
-				case OB_NICK:
-					return Compare(u1->nick, u2->nick);
-				default:
-					return false;
+				serializer.BeginList(name);
+				TakeSnapshot();
+				started = true;
+			}
+
+			const size_t batchend = std::min(snapshot.size(), position + BATCH_SIZE);
+			for (; position < batchend && (!limited || remaining); ++position)
+			{
+				const auto& [key, id] = snapshot[position];
+				Item* item = FindItem(id);
+				if (!item)
+					continue; // Removed since the list was started.
+
+				Dump(serializer, item);
+				cursor = key;
+				if (limited)
+					remaining--;
 			}
+
+			const bool more = position < snapshot.size();
+			if (more && (!limited || remaining))
+				return false;
+
+			serializer.EndBlock();
+			if (more)
+				serializer.Attribute("nextcursor", cursor);
+			return true;
 		}
 	};
 
-	void ListUsers(XMLSerializer& serializer, const HTTPQueryParameters& params)
+	class ChannelPaginator final
+		: public Paginator<Channel>
 	{
-		if (params.empty())
+	protected:
+		void GetItems(const std::function<void(Channel*)>& callback) override
 		{
-			Users(serializer);
-			return;
+			for (const auto& [_, chan] : ServerInstance->Channels.GetChans())
+				callback(chan);
 		}
 
-		serializer.BeginBlock("userlist");
+		std::string GetKey(Channel* chan) override
+		{
+			return FoldCase(chan->name);
+		}
+
+		std::string GetId(Channel* chan) override
+		{
+			return chan->name;
+		}
+
+		Channel* FindItem(const std::string& id) override
+		{
+			return ServerInstance->Channels.Find(id);
+		}
+
+		void Dump(Serializer& serializer, Channel* chan) override
+		{
+			DumpChannel(serializer, chan, fields);
+		}
 
-		// Filters
-		size_t limit = params.getNum<size_t>("limit");
-		bool showunreg = params.getBool("showunreg");
-		bool localonly = params.getBool("localonly");
+	public:
+		ChannelPaginator(const HTTPQueryParameters* params = nullptr)
+			: Paginator<Channel>("channellist")
+		{
+			if (params)
+				ReadParams(*params);
+		}
+	};
 
-		// Minimum time since a user's last message
-		unsigned long min_idle = params.getDuration("minidle");
-		time_t maxlastmsg = ServerInstance->Time() - min_idle;
+	enum OrderBy
+	{
+		OB_NICK,
+		OB_LASTMSG,
 
-		if (min_idle)
-			// We can only check idle times on local users
-			localonly = true;
+		OB_NONE
+	};
 
-		// Sorting
-		const std::string& sortmethod = params.getString("sortby");
-		bool desc = params.getBool("desc", false);
+	class UserPaginator final
+		: public Paginator<User>
+	{
+	private:
+		bool localonly = false;
+		unsigned long minidle = 0;
+		OrderBy orderby = OB_NONE;
+		bool showunreg = false;
 
-		OrderBy orderby;
-		if (insp::equalsci(sortmethod, "nick"))
-			orderby = OB_NICK;
-		else if (insp::equalsci(sortmethod, "lastmsg"))
+	protected:
+		void GetItems(const std::function<void(User*)>& callback) override
 		{
-			orderby = OB_LASTMSG;
-			// We can only check idle times on local users
-			localonly = true;
+			if (localonly)
+			{
+				for (auto* lu : ServerInstance->Users.GetLocalUsers())
+					callback(lu);
+			}
+			else
+			{
+				for (const auto& [_, u] : ServerInstance->Users.GetUsers())
+					callback(u);
+			}
 		}
-		else
-			orderby = OB_NONE;
 
-		typedef std::list<User*> NewUserList;
-		NewUserList user_list;
-		for (const auto& [_, u] : ServerInstance->Users.GetUsers())
+		std::string GetKey(User* u) override
 		{
 			if (!showunreg && !u->IsFullyConnected())
-				continue;
+				return {};
 
 			LocalUser* lu = IS_LOCAL(u);
-			if (localonly && !lu)
-				continue;
+			if (minidle && lu->idle_lastmsg > ServerInstance->Time() - static_cast<time_t>(minidle))
+				return {};
 
-			if (min_idle && lu->idle_lastmsg > maxlastmsg)
-				continue;
+			switch (orderby)
+			{
+				case OB_NICK:
+					return FoldCase(u->nick);
+
+				case OB_LASTMSG:
+					// Zero pad the time so that keys sort in time order.
+					return INSP_FORMAT("{:020}.{}", lu->idle_lastmsg, u->uuid);
+
+				default:
+					return u->uuid;
+			}
+		}
+
+		std::string GetId(User* u) override
+		{
+			return u->uuid;
+		}
 
-			user_list.push_back(u);
+		User* FindItem(const std::string& id) override
+		{
+			User* u = ServerInstance->Users.FindUUID(id);
+			return u && !u->quitting ? u : nullptr;
 		}
 
-		UserSorter sorter(orderby, desc);
-		if (sorter.order != OB_NONE && !(!localonly && sorter.order == OB_LASTMSG))
-			user_list.sort(sorter);
+		void Dump(Serializer& serializer, User* u) override
+		{
+			DumpUser(serializer, u, fields);
+		}
 
-		size_t count = 0;
-		for (NewUserList::const_iterator i = user_list.begin(); i != user_list.end() && (!limit || count < limit); ++i, ++count)
-			DumpUser(serializer, *i);
+	public:
+		UserPaginator(const HTTPQueryParameters* params = nullptr)
+			: Paginator<User>("userlist")
+		{
+			if (!params)
+				return;
+
+			ReadParams(*params);
+			showunreg = params->getBool("showunreg");
+			localonly = params->getBool("localonly");
+
+			// Minimum time since a user's last message
+			minidle = params->getDuration("minidle");
+			if (minidle)
+				localonly = true; // We can only check idle times on local users
+
+			const std::string& sortmethod = params->getString("sortby");
+			if (insp::equalsci(sortmethod, "nick"))
+				orderby = OB_NICK;
+			else if (insp::equalsci(sortmethod, "lastmsg"))
+			{
+				orderby = OB_LASTMSG;
+				localonly = true; // We can only check idle times on local users
+			}
+		}
+	};
 
-		serializer.EndBlock();
-	}
+	/** Streams the parts of a statistics document which may be too large to build in memory. */
+	class Stream final
+		: public HTTPResponseStream
+	{
+	private:
+		Serializer serializer;
+		std::unique_ptr<ChannelPaginator> channels;
+		std::unique_ptr<UserPaginator> users;
+		bool trailer;
+
+	public:
+		Stream(Serializer&& ser, std::unique_ptr<ChannelPaginator> chans, std::unique_ptr<UserPaginator> usrs, bool trl)
+			: serializer(std::move(ser))
+			, channels(std::move(chans))
+			, users(std::move(usrs))
+			, trailer(trl)
+		{
+		}
+
+		bool Write(std::string& out) override
+		{
+			if (channels)
+			{
+				if (channels->Step(serializer))
+					channels.reset();
+			}
+			else if (users)
+			{
+				if (users->Step(serializer))
+					users.reset();
+			}
+
+			const bool done = !channels && !users;
+			if (done)
+			{
+				if (trailer)
+				{
+					Servers(serializer);
+					Commands(serializer);
+				}
+				serializer.EndBlock();
+				serializer.Finish();
+			}
+
+			out.append(serializer.Take());
+			return !done;
+		}
+	};
 }
 
 class ModuleHttpStats final
@@ -452,7 +854,7 @@ private:
 
 public:
 	ModuleHttpStats()
-		: Module(VF_VENDOR, "Provides XML-serialised statistics about the server, channels, and users over HTTP via the /stats path.")
+		: Module(VF_VENDOR, "Provides XML and JSON serialised statistics about the server, channels, and users over HTTP via the /stats path.")
 		, HTTPRequestEventListener(this)
 		, API(this)
 		, isupportevprov(this)
@@ -467,7 +869,15 @@ public:
 
 		ServerInstance->Logs.Debug(MODNAME, "Handling HTTP request for {}", request.GetPath());
 
-		Stats::XMLSerializer serializer;
+		const HTTPQueryParameters& params = request.GetParsedURI().query_params;
+		const bool json = insp::equalsci(params.getString("format"), "json");
+		Stats::Serializer serializer(json ? Stats::Serializer::FORMAT_JSON : Stats::Serializer::FORMAT_XML);
+
+		// Lists which may be large are streamed to the client as it reads the response.
+		std::unique_ptr<Stats::ChannelPaginator> channels;
+		std::unique_ptr<Stats::UserPaginator> users;
+		bool trailer = false;
+
 		serializer.BeginBlock("inspircdstats");
 		if (request.GetPath() == "/stats")
 		{
@@ -475,29 +885,43 @@ public:
 			Stats::General(serializer);
 			Stats::XLines(serializer);
 			Stats::Modules(serializer);
-			Stats::Channels(serializer);
-			Stats::Users(serializer);
-			Stats::Servers(serializer);
-			Stats::Commands(serializer);
+			channels = std::make_unique<Stats::ChannelPaginator>();
+			users = std::make_unique<Stats::UserPaginator>();
+			trailer = true;
 		}
 		else if (request.GetPath() == "/stats/general")
 		{
 			Stats::General(serializer);
 		}
+		else if (request.GetPath() == "/stats/channels")
+		{
+			channels = std::make_unique<Stats::ChannelPaginator>(&params);
+		}
 		else if (request.GetPath() == "/stats/users")
 		{
-			Stats::ListUsers(serializer, request.GetParsedURI().query_params);
+			users = std::make_unique<Stats::UserPaginator>(&params);
 		}
 		else
 		{
 			return MOD_RES_PASSTHRU;
 		}
-		serializer.EndBlock();
+
+		std::unique_ptr<Stats::Stream> stream;
+		if (!channels && !users)
+		{
+			serializer.EndBlock();
+			serializer.Finish();
+		}
 
 		/* Send the document back to m_httpd */
-		HTTPDocumentResponse response(this, request, serializer.GetData(), 200);
+		std::stringstream data(serializer.Take());
+		if (channels || users)
+			stream = std::make_unique<Stats::Stream>(std::move(serializer), std::move(channels), std::move(users), trailer);
+
+		HTTPDocumentResponse response(this, request, &data, 200);
 		response.headers.SetHeader("X-Powered-By", MODNAME);
-		response.headers.SetHeader("Content-Type", "text/xml");
+		response.headers.SetHeader("Content-Type", json ? "application/json" : "text/xml");
+		response.stream = std::move(stream);
 		API->SendResponse(response);
 		return MOD_RES_DENY; // Handled
 	}
@@ -23,11 +23,13 @@
 
 #include "inspircd.h"
 #include "extension.h"
+#include "modules/authcache.h"
 #include "modules/ldap.h"
 
 namespace
 {
 	Module* me;
+	AuthCache* cache;
 	std::string killreason;
 	BoolExtItem* authed;
 	bool verbose;
@@ -41,9 +43,12 @@ class BindInterface final
 {
 	const std::string provider;
 	const std::string uid;
+	const std::string cachekey;
+	const std::string label;
 	std::string DN;
 	bool checkingAttributes = false;
 	bool passed = false;
+	bool rejected = true;
 	int attrCount = 0;
 
 	static std::string SafeReplace(const std::string& text, std::map<std::string, std::string>& replacements)
@@ -100,14 +105,25 @@ class BindInterface final
 	}
 
 public:
-	BindInterface(Module* c, const std::string& p, const std::string& u, const std::string& dn)
+	BindInterface(Module* c, const std::string& p, const std::string& u, const std::string& ck, const std::string& l, const std::string& dn)
 		: LDAPInterface(c)
 		, provider(p)
 		, uid(u)
+		, cachekey(ck)
+		, label(l)
 		, DN(dn)
 	{
 	}
 
+	static void Accept(User* user, const std::string& DN)
+	{
+		if (verbose)
+			ServerInstance->SNO.WriteToSnoMask('c', "Successful connection from {} (dn={})", user->GetRealMask(), DN);
+
+		SetVHost(user, DN);
+		authed->Set(user);
+	}
+
 	void OnResult(const LDAPResult& r) override
 	{
 		auto* user = ServerInstance->Users.FindUUID(uid);
@@ -122,12 +138,9 @@ public:
 
 		if (!checkingAttributes && requiredattributes.empty())
 		{
-			if (verbose)
-				ServerInstance->SNO.WriteToSnoMask('c', "Successful connection from {} (dn={})", user->GetRealMask(), DN);
-
 			// We're done, there are no attributes to check
-			SetVHost(user, DN);
-			authed->Set(user);
+			Accept(user, DN);
+			cache->Add(cachekey, label, true, DN);
 
 			delete this;
 			return;
@@ -140,12 +153,8 @@ public:
 			{
 				// Only one has to pass
 				passed = true;
-
-				if (verbose)
-					ServerInstance->SNO.WriteToSnoMask('c', "Successful connection from {} (dn={})", user->GetRealMask(), DN);
-
-				SetVHost(user, DN);
-				authed->Set(user);
+				Accept(user, DN);
+				cache->Add(cachekey, label, true, DN);
 			}
 
 			// Delete this if this is the last ref
@@ -189,6 +198,8 @@ public:
 
 	void OnError(const LDAPResult& err) override
 	{
+		// Only cache the failure if every request was rejected by the server.
+		rejected &= err.rejected;
 		if (checkingAttributes && --attrCount)
 			return;
 
@@ -198,6 +209,9 @@ public:
 			return;
 		}
 
+		if (rejected)
+			cache->Add(cachekey, label, false);
+
 		auto* user = ServerInstance->Users.FindUUID(uid);
 		if (user)
 		{
@@ -218,17 +232,25 @@ class SearchInterface final
 {
 	const std::string provider;
 	const std::string uid;
+	const std::string cachekey;
+	const std::string label;
 
 public:
-	SearchInterface(Module* c, const std::string& p, const std::string& u)
+	SearchInterface(Module* c, const std::string& p, const std::string& u, const std::string& ck, const std::string& l)
 		: LDAPInterface(c)
 		, provider(p)
 		, uid(u)
+		, cachekey(ck)
+		, label(l)
 	{
 	}
 
 	void OnResult(const LDAPResult& r) override
 	{
+		// The user does not exist.
+		if (r.empty())
+			cache->Add(cachekey, label, false);
+
 		LocalUser* user = ServerInstance->Users.FindUUID<LocalUser>(uid);
 		dynamic_reference<LDAPProvider> LDAP(me, provider);
 		if (!LDAP || r.empty() || !user)
@@ -250,7 +272,7 @@ public:
 				return;
 			}
 
-			LDAP->Bind(new BindInterface(this->creator, provider, uid, bindDn), bindDn, user->password);
+			LDAP->Bind(new BindInterface(this->creator, provider, uid, cachekey, label, bindDn), bindDn, user->password);
 		}
 		catch (const LDAPException& ex)
 		{
@@ -274,14 +296,16 @@ class AdminBindInterface final
 {
 	const std::string provider;
 	const std::string uuid;
+	const std::string cachekey;
 	const std::string base;
 	const std::string what;
 
 public:
-	AdminBindInterface(Module* c, const std::string& p, const std::string& u, const std::string& b, const std::string& w)
+	AdminBindInterface(Module* c, const std::string& p, const std::string& u, const std::string& ck, const std::string& b, const std::string& w)
 		: LDAPInterface(c)
 		, provider(p)
 		, uuid(u)
+		, cachekey(ck)
 		, base(b)
 		, what(w)
 	{
@@ -294,7 +318,7 @@ public:
 		{
 			try
 			{
-				LDAP->Search(new SearchInterface(this->creator, provider, uuid), base, what);
+				LDAP->Search(new SearchInterface(this->creator, provider, uuid, cachekey, what), base, what);
 			}
 			catch (const LDAPException& ex)
 			{
@@ -325,6 +349,8 @@ class ModuleLDAPAuth final
 	dynamic_reference<LDAPProvider> LDAP;
 	BoolExtItem ldapAuthed;
 	StringExtItem ldapVhost;
+	AuthCache ldapCache;
+	CommandAuthCache cmd;
 	std::string base;
 	std::string attribute;
 	std::vector<std::string> exemptions;
@@ -336,9 +362,12 @@ public:
 		, LDAP(this, "LDAP")
 		, ldapAuthed(this, "ldapauth", ExtensionType::USER)
 		, ldapVhost(this, "ldapauth-vhost", ExtensionType::USER)
+		, ldapCache(this)
+		, cmd(this, "LDAPAUTH", ldapCache)
 	{
 		me = this;
 		authed = &ldapAuthed;
+		cache = &ldapCache;
 		vhosts = &ldapVhost;
 	}
 
@@ -358,6 +387,7 @@ public:
 		});
 
 		LDAP.SetProvider("LDAP/" + tag->getString("dbid"));
+		ldapCache.Configure(tag);
 
 		requiredattributes.clear();
 		for (const auto& [_, rtag] : ServerInstance->Config->ConfTags("ldaprequire"))
@@ -457,9 +487,25 @@ public:
 			}
 		}
 
+		const std::string cachekey = ldapCache.MakeKey({ LDAP.GetProvider(), base, what, user->password });
+		const AuthCache::Entry* entry = ldapCache.Find(cachekey);
+		if (entry)
+		{
+			if (entry->success)
+			{
+				BindInterface::Accept(user, entry->data);
+				return MOD_RES_PASSTHRU;
+			}
+
+			if (verbose)
+				ServerInstance->SNO.WriteToSnoMask('c', "Forbidden connection from {} (cached failure)", user->GetRealMask());
+			ServerInstance->Users.QuitUser(user, killreason);
+			return MOD_RES_DENY;
+		}
+
 		try
 		{
-			LDAP->BindAsManager(new AdminBindInterface(this, LDAP.GetProvider(), user->uuid, base, what));
+			LDAP->BindAsManager(new AdminBindInterface(this, LDAP.GetProvider(), user->uuid, cachekey, base, what));
 		}
 		catch (const LDAPException& ex)
 		{
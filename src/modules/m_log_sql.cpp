@@ -68,7 +68,7 @@ public:
 			if (ServerInstance->Time() - lastwarning > 300)
 			{
 				lastwarning = ServerInstance->Time();
-				ServerInstance->SNO.WriteGlobalSno('a', "Unable to write to SQL log (database {} not available).", sql->GetId());
+				ServerInstance->SNO.WriteGlobalSno('a', "Unable to write to SQL log (database {} not available).", sql.GetProvider());
 			}
 			return;
 		}
@@ -142,7 +142,11 @@ class CommandFJoin final
 	 * @param newname The new name of the channel; must be the same or a case change of the current name
 	 */
 	static void LowerTS(Channel* chan, time_t TS, const std::string& newname);
-	static void ProcessModeUUIDPair(const std::string& item, TreeServer* sourceserver, Channel* chan, Modes::ChangeList* modechangelist, FwdFJoinBuilder& fwdfjoin);
+
+	/** Parses a member from an FJOIN and adds any prefix modes they have to the mode change list.
+	 * @return The user or nullptr if they do not exist or came from the wrong direction.
+	 */
+	static User* ProcessModeUUIDPair(const std::string& item, TreeServer* sourceserver, Modes::ChangeList* modechangelist, std::string::size_type& modeend);
 public:
 	CommandFJoin(Module* Creator)
 		: ServerCommand(Creator, "FJOIN", 3)
@@ -181,13 +181,51 @@ CmdResult CommandFJoin::Handle(User* srcuser, Params& params)
 	// after applying theirs. If they lost, the prefix modes from their message are not forwarded.
 	FwdFJoinBuilder fwdfjoin(chan, sourceserver);
 
-	// Process every member in the message
+	// Parse every member in the message
 	irc::spacesepstream users(params.back());
+	std::vector<std::string> items;
+	std::vector<std::string::size_type> modeends;
+	std::vector<User*> joiners;
 	std::string item;
 	Modes::ChangeList* modechangelistptr = (apply_other_sides_modes ? &modechangelist : nullptr);
 	while (users.GetToken(item))
 	{
-		ProcessModeUUIDPair(item, sourceserver, chan, modechangelistptr, fwdfjoin);
+		std::string::size_type modeend;
+		User* who = ProcessModeUUIDPair(item, sourceserver, modechangelistptr, modeend);
+		if (!who)
+			continue;
+
+		items.push_back(std::move(item));
+		modeends.push_back(modeend);
+		joiners.push_back(who);
+	}
+
+	// Join them all at once; during a burst this is usually a large number of users
+	const std::vector<Membership*> membs = chan->ForceJoin(joiners, sourceserver->IsBursting());
+	for (size_t idx = 0; idx < joiners.size(); ++idx)
+	{
+		const std::string& joinitem = items[idx];
+		const std::string::const_iterator modeendit = joinitem.begin() + modeends[idx];
+		Membership* memb = membs[idx];
+		if (!memb)
+		{
+			// User was already on the channel, forward because of the modes they potentially got. If
+			// they were removed from the channel while joining then there is nothing to forward.
+			memb = chan->GetUser(joiners[idx]);
+			if (memb)
+				fwdfjoin.add(memb, joinitem.begin(), modeendit);
+			continue;
+		}
+
+		// Assign the id to the new Membership
+		Membership::Id membid = 0;
+		const std::string::size_type colon = joinitem.rfind(':');
+		if (colon != std::string::npos)
+			membid = Membership::IdFromString(joinitem.substr(colon+1));
+		memb->id = membid;
+
+		// Add member to fwdfjoin with prefix modes
+		fwdfjoin.add(memb, joinitem.begin(), modeendit);
 	}
 
 	fwdfjoin.finalize();
@@ -200,7 +238,7 @@ CmdResult CommandFJoin::Handle(User* srcuser, Params& params)
 	return CmdResult::SUCCESS;
 }
 
-void CommandFJoin::ProcessModeUUIDPair(const std::string& item, TreeServer* sourceserver, Channel* chan, Modes::ChangeList* modechangelist, FwdFJoinBuilder& fwdfjoin)
+User* CommandFJoin::ProcessModeUUIDPair(const std::string& item, TreeServer* sourceserver, Modes::ChangeList* modechangelist, std::string::size_type& modeend)
 {
 	std::string::size_type comma = item.find(',');
 
@@ -211,7 +249,7 @@ void CommandFJoin::ProcessModeUUIDPair(const std::string& item, TreeServer* sour
 	if (!who)
 	{
 		// Probably KILLed, ignore
-		return;
+		return nullptr;
 	}
 
 	TreeSocket* src_socket = sourceserver->GetSocket();
@@ -219,45 +257,26 @@ void CommandFJoin::ProcessModeUUIDPair(const std::string& item, TreeServer* sour
 	TreeServer* route_back_again = TreeServer::Get(who);
 	if (route_back_again->GetSocket() != src_socket)
 	{
-		return;
+		return nullptr;
 	}
 
-	std::string::const_iterator modeendit = item.begin(); // End of the "ov" mode string
+	modeend = 0; // End of the "ov" mode string
 	/* Check if the user received at least one mode */
 	if ((modechangelist) && (comma != std::string::npos))
 	{
-		modeendit += comma;
+		modeend = comma;
 		/* Iterate through the modes and see if they are valid here, if so, apply */
-		for (std::string::const_iterator i = item.begin(); i != modeendit; ++i)
+		for (std::string::size_type i = 0; i != modeend; ++i)
 		{
-			ModeHandler* mh = ServerInstance->Modes.FindMode(*i, MODETYPE_CHANNEL);
+			ModeHandler* mh = ServerInstance->Modes.FindMode(item[i], MODETYPE_CHANNEL);
 			if (!mh)
-				throw ProtocolException("Unrecognised mode '" + std::string(1, *i) + "'");
+				throw ProtocolException("Unrecognised mode '" + std::string(1, item[i]) + "'");
 
 			/* Add any modes this user had to the mode stack */
 			modechangelist->push_add(mh, who->nick);
 		}
 	}
-
-	Membership* memb = chan->ForceJoin(who, nullptr, sourceserver->IsBursting());
-	if (!memb)
-	{
-		// User was already on the channel, forward because of the modes they potentially got
-		memb = chan->GetUser(who);
-		if (memb)
-			fwdfjoin.add(memb, item.begin(), modeendit);
-		return;
-	}
-
-	// Assign the id to the new Membership
-	Membership::Id membid = 0;
-	const std::string::size_type colon = item.rfind(':');
-	if (colon != std::string::npos)
-		membid = Membership::IdFromString(item.substr(colon+1));
-	memb->id = membid;
-
-	// Add member to fwdfjoin with prefix modes
-	fwdfjoin.add(memb, item.begin(), modeendit);
+	return who;
 }
 
 void CommandFJoin::RemoveStatus(Channel* c)
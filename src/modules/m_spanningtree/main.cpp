@@ -27,6 +27,7 @@
 
 
 #include "inspircd.h"
+#include "clientprotocolevent.h"
 #include "clientprotocolmsg.h"
 #include "iohook.h"
 #include "socket.h"
@@ -41,6 +42,32 @@
 #include "treesocket.h"
 #include "utils.h"
 
+ModResult NetJoinHook::OnPreEventSend(LocalUser* user, const ClientProtocol::Event& ev, ClientProtocol::MessageList& messagelist)
+{
+	const Membership* memb = static_cast<const ClientProtocol::Events::Join&>(ev).GetMember();
+	if (IS_LOCAL(memb->user))
+		return MOD_RES_PASSTHRU;
+
+	TreeServer* route = TreeServer::Get(memb->user)->GetRoute();
+	if (!route->IsBursting())
+		return MOD_RES_PASSTHRU;
+
+	IRCv3::Batch::Batch* batch = route->GetNetJoinBatch();
+	if (!batch)
+		return MOD_RES_PASSTHRU;
+
+	for (auto* msg : messagelist)
+	{
+		// The messages are shared between all recipients so they only need to be added once.
+		if (msg->GetTags().find("batch") != msg->GetTags().end())
+			continue;
+
+		batch->AddToBatch(*msg);
+		msg->InvalidateCache();
+	}
+	return MOD_RES_PASSTHRU;
+}
+
 ModuleSpanningTree::ModuleSpanningTree()
 	: Module(VF_VENDOR, "Allows linking multiple servers together as part of one network.")
 	, Away::EventListener(this)
@@ -55,6 +82,8 @@ ModuleSpanningTree::ModuleSpanningTree()
 	, messageeventprov(this, "event/server-message")
 	, synceventprov(this, "event/server-sync")
 	, sslapi(this)
+	, batchmanager(this)
+	, netjoinhook(this)
 	, servertags(this)
 	, DNS(this)
 	, tagevprov(this)
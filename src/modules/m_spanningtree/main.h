@@ -31,6 +31,7 @@
 #include "inspircd.h"
 #include "event.h"
 #include "modules/dns.h"
+#include "modules/ircv3_batch.h"
 #include "modules/ssl.h"
 #include "modules/stats.h"
 #include "modules/ctctags.h"
@@ -48,6 +49,20 @@ class TreeServer;
 class Link;
 class Autoconnect;
 
+/** Adds the joins of users behind a bursting server to the netjoin batch of that server.
+ */
+class NetJoinHook final
+	: public ClientProtocol::EventHook
+{
+public:
+	NetJoinHook(Module* mod)
+		: ClientProtocol::EventHook(mod, "JOIN", 200) // Run after hooks which replace the join message.
+	{
+	}
+
+	ModResult OnPreEventSend(LocalUser* user, const ClientProtocol::Event& ev, ClientProtocol::MessageList& messagelist) override;
+};
+
 /** This is the main class for the spanningtree module
  */
 class ModuleSpanningTree final
@@ -90,6 +105,12 @@ public:
 	/** API for accessing user client certificates. */
 	UserCertificateAPI sslapi;
 
+	/** API for sending netjoin and netsplit batches. */
+	IRCv3::Batch::API batchmanager;
+
+	/** Hook for adding joins during a netburst to a netjoin batch. */
+	NetJoinHook netjoinhook;
+
 	/** Tags for server to server messages. */
 	ServerTags servertags;
 
@@ -160,6 +160,37 @@ void TreeServer::FinishBurst()
 
 	StartBurst = 0;
 	FinishBurstInternal();
+
+	// Destroying the batch ends it.
+	netjoinbatch.reset();
+}
+
+IRCv3::Batch::Batch* TreeServer::GetNetJoinBatch()
+{
+	if (netjoinbatch)
+		return netjoinbatch->IsRunning() ? netjoinbatch.get() : nullptr;
+
+	IRCv3::Batch::API& batchmanager = Utils->Creator->batchmanager;
+	if (!batchmanager)
+		return nullptr;
+
+	netjoinbatch = std::make_unique<IRCv3::Batch::Batch>("netjoin");
+	batchmanager->Start(*netjoinbatch);
+	if (!netjoinbatch->IsRunning())
+		return nullptr;
+
+	ClientProtocol::Message& batchstartmsg = netjoinbatch->GetBatchStartMessage();
+	if (Utils->HideSplits)
+	{
+		batchstartmsg.PushParam("*.net");
+		batchstartmsg.PushParam("*.split");
+	}
+	else
+	{
+		batchstartmsg.PushParam(Parent->GetName());
+		batchstartmsg.PushParam(GetName());
+	}
+	return netjoinbatch.get();
 }
 
 void TreeServer::SQuitChild(TreeServer* server, const std::string& reason, bool error)
@@ -177,11 +208,14 @@ void TreeServer::SQuitChild(TreeServer* server, const std::string& reason, bool
 		ServerInstance->SNO.WriteToSnoMask('L', "Server \002" + server->GetName() + "\002 split from server \002" + GetName() + "\002 with reason: " + reason);
 	}
 
+	// End the netjoin batch before the netsplit batch starts if the server split during its burst.
+	server->netjoinbatch.reset();
+
 	unsigned int num_lost_servers = 0;
 	server->SQuitInternal(num_lost_servers, error);
 
 	const std::string quitreason = GetName() + " " + server->GetName();
-	size_t num_lost_users = QuitUsers(quitreason);
+	size_t num_lost_users = QuitUsers(quitreason, server);
 
 	ServerInstance->SNO.WriteToSnoMask(IsRoot() ? 'l' : 'L', "Netsplit complete, lost \002{}\002 user{} on \002{}\002 server{}.",
 		num_lost_users, num_lost_users != 1 ? "s" : "", num_lost_servers, num_lost_servers != 1 ? "s" : "");
@@ -214,22 +248,49 @@ void TreeServer::SQuitInternal(unsigned int& num_lost_servers, bool error)
 		Utils->Creator->linkeventprov.Call(&ServerProtocol::LinkEventListener::OnServerSplit, this, error);
 }
 
-size_t TreeServer::QuitUsers(const std::string& reason)
+size_t TreeServer::QuitUsers(const std::string& reason, TreeServer* server)
 {
 	std::string publicreason = Utils->HideSplits ? "*.net *.split" : reason;
 
-	const UserMap& users = ServerInstance->Users.GetUsers();
-	size_t original_size = users.size();
-	for (UserMap::const_iterator i = users.begin(); i != users.end(); )
+	std::vector<User*> quitters;
+	for (const auto& [_, user] : ServerInstance->Users.GetUsers())
 	{
-		User* user = i->second;
-		// Increment the iterator now because QuitUser() removes the user from the container
-		++i;
-		TreeServer* server = TreeServer::Get(user);
-		if (server->IsDead())
-			ServerInstance->Users.QuitUser(user, publicreason, &reason);
+		if (TreeServer::Get(user)->IsDead())
+			quitters.push_back(user);
 	}
-	return original_size - users.size();
+
+	if (quitters.empty())
+		return 0;
+
+	// Wrap the quits in a netsplit batch for clients that support it.
+	IRCv3::Batch::API& batchmanager = Utils->Creator->batchmanager;
+	IRCv3::Batch::Batch batch("netsplit");
+	if (batchmanager)
+	{
+		batchmanager->Start(batch);
+		if (batch.IsRunning())
+		{
+			ClientProtocol::Message& batchstartmsg = batch.GetBatchStartMessage();
+			if (Utils->HideSplits)
+			{
+				batchstartmsg.PushParam("*.net");
+				batchstartmsg.PushParam("*.split");
+			}
+			else
+			{
+				batchstartmsg.PushParam(GetName());
+				batchstartmsg.PushParam(server->GetName());
+			}
+		}
+	}
+
+	ServerInstance->Users.QuitUsers(quitters, publicreason, &reason, [&batch](ClientProtocol::Message& msg) {
+		batch.AddToBatch(msg);
+	});
+
+	if (batchmanager)
+		batchmanager->End(batch);
+	return quitters.size();
 }
 
 void TreeServer::CheckService()
@@ -26,6 +26,8 @@
 
 #pragma once
 
+#include "modules/ircv3_batch.h"
+
 #include "treesocket.h"
 #include "pingtimer.h"
 
@@ -66,6 +68,10 @@ class TreeServer final
 	 */
 	PingTimer pingtimer;
 
+	/** The batch which the joins of users behind this server are added to whilst it is bursting.
+	 */
+	std::unique_ptr<IRCv3::Batch::Batch> netjoinbatch;
+
 	/** This method is used to add this TreeServer to the
 	 * hash maps. It is only called by the constructors.
 	 */
@@ -119,7 +125,12 @@ public:
 		GetParent()->SQuitChild(this, reason, error);
 	}
 
-	static size_t QuitUsers(const std::string& reason);
+	/** Quits all users on servers that have been marked as dead.
+	 * @param reason The reason to quit the users with.
+	 * @param server The child of this server which split from the network.
+	 * @return The number of users which were quit.
+	 */
+	size_t QuitUsers(const std::string& reason, TreeServer* server);
 
 	/** Get route.
 	 * The 'route' is defined as the locally-
@@ -140,6 +151,12 @@ public:
 	 */
 	bool IsDead() const { return isdead; }
 
+	/** Retrieves the batch which the joins of users behind this server are added to whilst it is
+	 * bursting, starting it if it has not been started yet. Only used for local servers.
+	 * @return The netjoin batch or nullptr if batches are not available.
+	 */
+	IRCv3::Batch::Batch* GetNetJoinBatch();
+
 	/** Round trip time of last ping
 	 */
 	unsigned long rtt = 0;
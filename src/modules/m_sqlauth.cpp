@@ -26,6 +26,7 @@
 
 #include "inspircd.h"
 #include "extension.h"
+#include "modules/authcache.h"
 #include "modules/sql.h"
 #include "modules/hash.h"
 #include "modules/ssl.h"
@@ -45,17 +46,27 @@ public:
 	bool verbose;
 	const std::string& kdf;
 	const std::string& pwcolumn;
+	AuthCache& cache;
+	const std::string cachekey;
 
-	AuthQuery(Module* me, const std::string& u, IntExtItem& e, bool v, const std::string& kd, const std::string& pwcol)
+	AuthQuery(Module* me, const std::string& u, IntExtItem& e, bool v, const std::string& kd, const std::string& pwcol, AuthCache& ac, const std::string& ck)
 		: SQL::Query(me)
 		, uid(u)
 		, pendingExt(e)
 		, verbose(v)
 		, kdf(kd)
 		, pwcolumn(pwcol)
+		, cache(ac)
+		, cachekey(ck)
 	{
 	}
 
+	void SetResult(LocalUser* user, bool success)
+	{
+		pendingExt.Set(user, success ? AUTH_STATE_NONE : AUTH_STATE_FAIL);
+		cache.Add(cachekey, user->nick, success);
+	}
+
 	void OnResult(SQL::Result& res) override
 	{
 		LocalUser* user = ServerInstance->Users.FindUUID<LocalUser>(uid);
@@ -89,24 +100,24 @@ public:
 				{
 					if (row[colindex].has_value() && hashprov->Compare(user->password, *row[colindex]))
 					{
-						pendingExt.Set(user, AUTH_STATE_NONE);
+						SetResult(user, true);
 						return;
 					}
 				}
 
 				if (verbose)
 					ServerInstance->SNO.WriteGlobalSno('a', "Forbidden connection from {} (password from the SQL query did not match the user provided password)", user->GetRealMask());
-				pendingExt.Set(user, AUTH_STATE_FAIL);
+				SetResult(user, false);
 				return;
 			}
 
-			pendingExt.Set(user, AUTH_STATE_NONE);
+			SetResult(user, true);
 		}
 		else
 		{
 			if (verbose)
 				ServerInstance->SNO.WriteGlobalSno('a', "Forbidden connection from {} (SQL query returned no matches)", user->GetRealMask());
-			pendingExt.Set(user, AUTH_STATE_FAIL);
+			SetResult(user, false);
 		}
 	}
 
@@ -127,6 +138,8 @@ class ModuleSQLAuth final
 	IntExtItem pendingExt;
 	dynamic_reference<SQL::Provider> SQL;
 	UserCertificateAPI sslapi;
+	AuthCache cache;
+	CommandAuthCache cmd;
 
 	std::string freeformquery;
 	std::string killreason;
@@ -142,6 +155,8 @@ public:
 		, pendingExt(this, "sqlauth-wait", ExtensionType::USER)
 		, SQL(this, "SQL")
 		, sslapi(this)
+		, cache(this)
+		, cmd(this, "SQLAUTH", cache)
 	{
 	}
 
@@ -158,6 +173,7 @@ public:
 		verbose = conf->getBool("verbose");
 		kdf = conf->getString("kdf");
 		pwcolumn = conf->getString("column");
+		cache.Configure(conf);
 
 		exemptions.clear();
 		for (const auto& [_, etag] : ServerInstance->Config->ConfTags("sqlexemption"))
@@ -216,7 +232,31 @@ public:
 				userinfo[algo + "pass"] = hashprov->Generate(user->password);
 		}
 
-		SQL->Submit(new AuthQuery(this, user->uuid, pendingExt, verbose, kdf, pwcolumn), freeformquery, userinfo);
+		// The cache key is made from the parameters used by the query and the password (which
+		// may be checked locally if a KDF is in use) so that the key does not contain per-connection
+		// data like the UUID unless the query actually uses it.
+		std::vector<std::string> keyparts = { SQL.GetProvider(), freeformquery, user->password };
+		for (std::string::size_type pos = freeformquery.find('$'); pos != std::string::npos; pos = freeformquery.find('$', pos))
+		{
+			std::string::size_type endpos = ++pos;
+			while (endpos < freeformquery.length() && isalnum(freeformquery[endpos]))
+				endpos++;
+
+			auto it = userinfo.find(freeformquery.substr(pos, endpos - pos));
+			keyparts.push_back(it == userinfo.end() ? "" : it->second);
+		}
+
+		const std::string cachekey = cache.MakeKey(keyparts);
+		const AuthCache::Entry* entry = cache.Find(cachekey);
+		if (entry)
+		{
+			if (!entry->success && verbose)
+				ServerInstance->SNO.WriteGlobalSno('a', "Forbidden connection from {} (cached failure)", user->GetRealMask());
+			pendingExt.Set(user, entry->success ? AUTH_STATE_NONE : AUTH_STATE_FAIL);
+			return MOD_RES_PASSTHRU;
+		}
+
+		SQL->Submit(new AuthQuery(this, user->uuid, pendingExt, verbose, kdf, pwcolumn, cache, cachekey), freeformquery, userinfo);
 
 		return MOD_RES_PASSTHRU;
 	}
@@ -22,19 +22,72 @@
 
 #include "inspircd.h"
 #include "iohook.h"
+#include "modules/deflate.h"
 #include "modules/hash.h"
+#include "modules/stats.h"
 #include "utility/string.h"
 
 #define UTF_CPP_CPLUSPLUS 199711L
+#include <utfcpp/core.h>
 #include <utfcpp/unchecked.h>
 
+#ifdef __GNUC__
+# pragma GCC diagnostic push
+#endif
+
+// Fix warnings about shadowing in http_parser.
+#ifdef __GNUC__
+# pragma GCC diagnostic ignored "-Wshadow"
+#endif
+
+#include <http_parser/http_parser.c>
+
+#ifdef __GNUC__
+# pragma GCC diagnostic pop
+#endif
+
 static constexpr char MagicGUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 static constexpr char newline[] = "\r\n";
 static constexpr char whitespace[] = " \t";
 static dynamic_reference_nocheck<HashProvider>* sha1;
+static dynamic_reference_nocheck<Deflate::Provider>* deflate;
+static http_parser_settings parsersettings;
+
+class WebSocketHook;
+static insp::intrusive_list<WebSocketHook> deflatehooks;
 
 struct WebSocketConfig final
 {
+	struct DeflateConfig final
+	{
+		// Whether to allow clients to negotiate the permessage-deflate extension.
+		bool enabled;
+
+		// Whether to keep the compression history between messages.
+		bool contexttakeover;
+
+		// The level to compress messages at.
+		int level;
+
+		// The amount of memory to use for the compression state.
+		int memlevel;
+
+		// The maximum amount of memory that the compression streams of a connection can use.
+		size_t maxmemory;
+
+		// The maximum size of the LZ77 window in bits.
+		int windowbits;
+	};
+
+	struct Origin final
+	{
+		// A glob pattern for the HTTP origin.
+		std::string mask;
+
+		// The compression settings for connections from this origin.
+		DeflateConfig deflate;
+	};
+
 	enum DefaultMode
 	{
 		// Reject connections if a subprotocol is not requested.
@@ -47,12 +100,15 @@ struct WebSocketConfig final
 		DM_TEXT
 	};
 
-	typedef std::vector<std::string> OriginList;
+	typedef std::vector<Origin> OriginList;
 	typedef std::vector<std::string> ProxyRanges;
 
 	// The HTTP origins that can connect to the server.
 	OriginList allowedorigins;
 
+	// The compression settings for connections which do not send an origin.
+	DeflateConfig deflate;
+
 	// The method to use if a subprotocol is not negotiated.
 	DefaultMode defaultmode;
 
@@ -69,6 +125,11 @@ struct WebSocketConfig final
 class WebSocketHookProvider final
 	: public IOHookProvider
 {
+private:
+	// Compression streams which are shared by connections that do not keep a compression history.
+	std::map<std::tuple<int, int, int>, std::unique_ptr<Deflate::Stream>> sharedcompressors;
+	std::unique_ptr<Deflate::Stream> shareddecompressor;
+
 public:
 	WebSocketConfig config;
 	WebSocketHookProvider(Module* mod)
@@ -76,6 +137,39 @@ public:
 	{
 	}
 
+	Deflate::Stream* GetSharedCompressor(int windowbits, int level, int memlevel)
+	{
+		auto& compressor = sharedcompressors[std::make_tuple(windowbits, level, memlevel)];
+		if (!compressor)
+			compressor = (*deflate)->CreateCompressor(windowbits, level, memlevel);
+		return compressor.get();
+	}
+
+	Deflate::Stream* GetSharedDecompressor()
+	{
+		// A decompressor with the largest window can decompress data from any smaller window.
+		if (!shareddecompressor)
+			shareddecompressor = (*deflate)->CreateDecompressor(Deflate::MAX_WINDOW_BITS);
+		return shareddecompressor.get();
+	}
+
+	size_t GetSharedMemoryUsage() const
+	{
+		size_t memory = shareddecompressor ? shareddecompressor->GetMemoryUsage() : 0;
+		for (const auto& [_, compressor] : sharedcompressors)
+		{
+			if (compressor)
+				memory += compressor->GetMemoryUsage();
+		}
+		return memory;
+	}
+
+	void ResetShared()
+	{
+		sharedcompressors.clear();
+		shareddecompressor.reset();
+	}
+
 	void OnAccept(StreamSocket* sock, const irc::sockets::sockaddrs& client, const irc::sockets::sockaddrs& server) override;
 
 	void OnConnect(StreamSocket* sock) override
@@ -85,54 +179,184 @@ public:
 
 class WebSocketHook final
 	: public IOHookMiddle
+	, public insp::intrusive_list_node<WebSocketHook>
 {
-	class HTTPHeaderFinder final
+public:
+	// The state of a connection which has negotiated the permessage-deflate extension.
+	struct DeflateState final
+	{
+		// The stream used to compress messages if the compression history is kept.
+		std::unique_ptr<Deflate::Stream> owncompressor;
+
+		// The stream used to decompress messages if the compression history is kept.
+		std::unique_ptr<Deflate::Stream> owndecompressor;
+
+		// The stream used to compress messages.
+		Deflate::Stream* compressor = nullptr;
+
+		// The stream used to decompress messages.
+		Deflate::Stream* decompressor = nullptr;
+
+		// The compressed data of the message which is currently being received.
+		std::string message;
+
+		// Whether the message which is currently being received is compressed.
+		bool receiving = false;
+
+		// The number of bytes before and after compressing messages sent to the client.
+		unsigned long rawout = 0;
+		unsigned long compressedout = 0;
+
+		// The number of bytes before and after decompressing messages received from the client.
+		unsigned long compressedin = 0;
+		unsigned long rawin = 0;
+
+		// The amount of time which has been spent compressing and decompressing messages.
+		std::chrono::steady_clock::duration cputime{};
+
+		size_t GetMemoryUsage() const
+		{
+			size_t memory = sizeof(*this) + message.capacity();
+			if (owncompressor)
+				memory += owncompressor->GetMemoryUsage();
+			if (owndecompressor)
+				memory += owndecompressor->GetMemoryUsage();
+			return memory;
+		}
+	};
+
+private:
+	// Parses the HTTP request which starts the handshake in a single pass. As the parser keeps its
+	// state between reads only data which has not been seen before needs to be passed to it.
+	class HandshakeParser final
 	{
 	private:
-		std::string::size_type bpos;
-		std::string::size_type len;
+		// The underlying HTTP parser.
+		http_parser parser;
 
-	public:
-		bool Find(const std::string& req, const char* header, std::string::size_type headerlen, std::string::size_type maxpos)
+		// The name of the header which is currently being received.
+		std::string field;
+
+		// Where to store the value of the header which is currently being received or nullptr if it is not used.
+		std::string* value = nullptr;
+
+		// Whether the value of a header is currently being received.
+		bool receivingvalue = false;
+
+		// Whether the entire request has been received.
+		bool complete = false;
+
+		static int OnHeaderField(http_parser* p, const char* buf, size_t len)
 		{
-			// Skip the GET /wibble HTTP/1.1 line.
-			size_t startpos = req.find(newline) + sizeof(newline) - 1;
-			while (startpos < maxpos)
+			auto* hp = static_cast<HandshakeParser*>(p->data);
+			if (hp->receivingvalue)
 			{
-				size_t endpos = req.find(newline, startpos);
-				if (strncasecmp(req.c_str() + startpos, header, headerlen) != 0)
-				{
-					startpos = endpos + sizeof(newline) - 1;
-					continue; // Incorrect header.
-				}
+				// This is the start of a new header.
+				hp->receivingvalue = false;
+				hp->field.clear();
+			}
+			hp->field.append(buf, len);
+			return 0;
+		}
+
+		static int OnHeaderValue(http_parser* p, const char* buf, size_t len)
+		{
+			auto* hp = static_cast<HandshakeParser*>(p->data);
+			if (!hp->receivingvalue)
+			{
+				hp->receivingvalue = true;
+				hp->value = hp->GetHeader(hp->field);
+			}
+			if (hp->value)
+				hp->value->append(buf, len);
+			return 0;
+		}
 
-				bpos = req.find_first_not_of(whitespace, startpos + headerlen);
-				if (bpos >= endpos)
-					return false; // Empty value.
+		static int OnHeadersComplete(http_parser* p)
+		{
+			auto* hp = static_cast<HandshakeParser*>(p->data);
+			for (auto* header : { &hp->origin, &hp->key, &hp->protocol, &hp->extensions, &hp->realip, &hp->forwardedfor })
+				*header = Trim(*header);
 
-				size_t epos = std::min(req.find_last_not_of(whitespace), endpos);
-				if (epos < bpos)
-					return false; // Should never happen.
+			// The handshake request never has a body and anything after it is a WebSocket frame.
+			return 2;
+		}
 
-				len = epos - bpos;
-				return true;
-			}
+		static int OnMessageComplete(http_parser* p)
+		{
+			auto* hp = static_cast<HandshakeParser*>(p->data);
+			hp->complete = true;
+			return 0;
+		}
 
-			// No header found.
-			return false;
+		// Retrieves the storage for the value of the specified header or nullptr if it is not used.
+		std::string* GetHeader(const std::string& name)
+		{
+			std::string* header = nullptr;
+			if (insp::equalsci(name, "Origin"))
+				header = &origin;
+			else if (insp::equalsci(name, "Sec-WebSocket-Key"))
+				header = &key;
+			else if (insp::equalsci(name, "Sec-WebSocket-Protocol"))
+				header = &protocol;
+			else if (insp::equalsci(name, "Sec-WebSocket-Extensions"))
+				header = &extensions;
+			else if (insp::equalsci(name, "X-Real-IP"))
+				header = &realip;
+			else if (insp::equalsci(name, "X-Forwarded-For"))
+				header = &forwardedfor;
+
+			// Only the first instance of a header is used.
+			return header && header->empty() ? header : nullptr;
+		}
+
+	public:
+		// The values of the headers which are used by the handshake. These are empty if the header was not sent.
+		std::string origin;
+		std::string key;
+		std::string protocol;
+		std::string extensions;
+		std::string realip;
+		std::string forwardedfor;
+
+		HandshakeParser()
+		{
+			http_parser_init(&parser, HTTP_REQUEST);
+			parser.data = this;
 		}
 
-		std::string ExtractValue(const std::string& req) const
+		static void ConfigureSettings(http_parser_settings& settings)
 		{
-			return std::string(req, bpos, len);
+			http_parser_settings_init(&settings);
+			settings.on_header_field = OnHeaderField;
+			settings.on_header_value = OnHeaderValue;
+			settings.on_headers_complete = OnHeadersComplete;
+			settings.on_message_complete = OnMessageComplete;
 		}
+
+		// Parses data received from the client.
+		// Returns the number of bytes which were part of the request or -1 if the request is malformed.
+		ssize_t Parse(const std::string& data)
+		{
+			const size_t parsed = http_parser_execute(&parser, &parsersettings, data.data(), data.size());
+			if (HTTP_PARSER_ERRNO(&parser) != HPE_OK)
+				return -1;
+			return parsed;
+		}
+
+		// Retrieves a description of the error which caused the request to be rejected.
+		const char* GetError() const { return http_errno_description(HTTP_PARSER_ERRNO(&parser)); }
+
+		// Determines whether the entire request has been received.
+		bool IsComplete() const { return complete; }
 	};
 
 	enum CloseCode
 	{
 		CLOSE_PROTOCOL_ERROR = 1002,
 		CLOSE_POLICY_VIOLATION = 1008,
-		CLOSE_TOO_LARGE = 1009
+		CLOSE_TOO_LARGE = 1009,
+		CLOSE_INTERNAL_ERROR = 1011
 	};
 
 	enum OpCode
@@ -148,11 +372,14 @@ class WebSocketHook final
 	enum State
 	{
 		STATE_HTTPREQ,
-		STATE_ESTABLISHED
+		STATE_ESTABLISHED,
+		STATE_CLOSING
 	};
 
 	static constexpr unsigned char WS_MASKBIT = (1 << 7);
 	static constexpr unsigned char WS_FINBIT = (1 << 7);
+	static constexpr unsigned char WS_RSV1BIT = (1 << 6);
+	static constexpr unsigned char WS_CONTROLBIT = (1 << 3);
 	static constexpr unsigned char WS_PAYLOAD_LENGTH_MAGIC_LARGE = 126;
 	static constexpr unsigned char WS_PAYLOAD_LENGTH_MAGIC_HUGE = 127;
 	static constexpr size_t WS_MAX_PAYLOAD_LENGTH_SMALL = 125;
@@ -163,14 +390,28 @@ class WebSocketHook final
 	static constexpr time_t MINPINGPONGDELAY = 10;
 
 	State state = STATE_HTTPREQ;
+
+	// The reason the connection is being closed when in STATE_CLOSING.
+	std::string closereason;
+
+	// The parser for the HTTP request which starts the handshake or nullptr if the handshake has completed.
+	std::unique_ptr<HandshakeParser> httpreq = std::make_unique<HandshakeParser>();
 	time_t lastpingpong = 0;
 	WebSocketConfig& config;
 	bool sendastext;
 
-	static size_t FillHeader(unsigned char* outbuf, size_t sendlength, OpCode opcode)
+public:
+	// The compression state of the connection or nullptr if it is not compressed.
+	std::unique_ptr<DeflateState> deflatestate;
+
+	// The socket which this hook is attached to.
+	StreamSocket* const streamsock;
+
+private:
+	static size_t FillHeader(unsigned char* outbuf, size_t sendlength, OpCode opcode, bool compressed = false)
 	{
 		size_t pos = 0;
-		outbuf[pos++] = WS_FINBIT | opcode;
+		outbuf[pos++] = WS_FINBIT | opcode | (compressed ? WS_RSV1BIT : 0);
 
 		if (sendlength <= WS_MAX_PAYLOAD_LENGTH_SMALL)
 		{
@@ -193,14 +434,125 @@ class WebSocketHook final
 		return pos;
 	}
 
-	static StreamSocket::SendQueue::Element PrepareSendQElem(size_t size, OpCode opcode)
+	static StreamSocket::SendQueue::Element PrepareSendQElem(size_t size, OpCode opcode, bool compressed = false)
 	{
 		unsigned char header[MAXHEADERSIZE];
-		const size_t n = FillHeader(header, size, opcode);
+		const size_t n = FillHeader(header, size, opcode, compressed);
 
 		return StreamSocket::SendQueue::Element(reinterpret_cast<const char*>(header), n);
 	}
 
+	static void ApplyMask(char* data, size_t length, const unsigned char* maskkey)
+	{
+		// Apply the masking key a word at a time. The key is four bytes long so a
+		// word always starts at the beginning of the key.
+		const unsigned char wordkey[sizeof(uint64_t)] = {
+			maskkey[0], maskkey[1], maskkey[2], maskkey[3],
+			maskkey[0], maskkey[1], maskkey[2], maskkey[3],
+		};
+		uint64_t wordmask;
+		memcpy(&wordmask, wordkey, sizeof(wordmask));
+
+		size_t pos = 0;
+		for (; pos + sizeof(uint64_t) <= length; pos += sizeof(uint64_t))
+		{
+			uint64_t word;
+			memcpy(&word, data + pos, sizeof(word));
+			word ^= wordmask;
+			memcpy(data + pos, &word, sizeof(word));
+		}
+
+		for (; pos < length; ++pos)
+			data[pos] ^= maskkey[pos % 4];
+	}
+
+	static bool IsValidUTF8(std::string_view str)
+	{
+		// Most messages are entirely ASCII so check for that a word at a time
+		// before falling back to the full validator.
+		size_t pos = 0;
+		for (; pos + sizeof(uint64_t) <= str.length(); pos += sizeof(uint64_t))
+		{
+			uint64_t word;
+			memcpy(&word, str.data() + pos, sizeof(word));
+			if (word & UINT64_C(0x8080808080808080))
+				break;
+		}
+		return utf8::find_invalid(str.begin() + pos, str.end()) == str.end();
+	}
+
+	void SendFrame(StreamSocket::SendQueue& mysendq, std::string_view message)
+	{
+		// Messages are terminated with a CR+LF but this is not needed in a frame.
+		std::string stripped;
+		if (!message.empty() && message.back() == '\r')
+			message.remove_suffix(1);
+		if (memchr(message.data(), '\r', message.length()))
+		{
+			std::remove_copy(message.begin(), message.end(), std::back_inserter(stripped), '\r');
+			message = stripped;
+		}
+
+		// If we send messages as text then we need to ensure they are valid UTF-8.
+		std::string encoded;
+		if (sendastext && !IsValidUTF8(message))
+		{
+			utf8::unchecked::replace_invalid(message.begin(), message.end(), std::back_inserter(encoded));
+			message = encoded;
+		}
+
+		const OpCode opcode = sendastext ? OP_TEXT : OP_BINARY;
+		std::string compressed;
+		if (deflatestate && Compress(message, compressed))
+		{
+			StreamSocket::SendQueue::Element frame = PrepareSendQElem(compressed.length(), opcode, true);
+			frame.append(compressed);
+			mysendq.push_back(std::move(frame));
+			return;
+		}
+
+		StreamSocket::SendQueue::Element frame = PrepareSendQElem(message.length(), opcode);
+		frame.append(message);
+		mysendq.push_back(std::move(frame));
+	}
+
+	bool Compress(std::string_view message, std::string& out)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const bool shared = !deflatestate->owncompressor;
+		const bool success = deflatestate->compressor->Compress(message, out);
+		if (shared || !success)
+			deflatestate->compressor->Reset();
+		deflatestate->cputime += std::chrono::steady_clock::now() - start;
+
+		// The compressed data always ends with an empty block which is implied by the frame.
+		if (!success || out.length() < 4)
+			return false;
+
+		out.erase(out.length() - 4);
+		deflatestate->rawout += message.length();
+		deflatestate->compressedout += out.length();
+		return true;
+	}
+
+	bool Decompress(std::string& message, std::string& out)
+	{
+		// The empty block at the end of the message is implied by the frame.
+		message.append("\x00\x00\xFF\xFF", 4);
+
+		const auto start = std::chrono::steady_clock::now();
+		const bool shared = !deflatestate->owndecompressor;
+		const bool success = deflatestate->decompressor->Decompress(message, out, WS_MAX_PAYLOAD_LENGTH_LARGE);
+		if (shared || !success)
+			deflatestate->decompressor->Reset();
+		deflatestate->cputime += std::chrono::steady_clock::now() - start;
+
+		deflatestate->compressedin += message.length() - 4;
+		deflatestate->rawin += out.length();
+		message.clear();
+		return success;
+	}
+
 	int HandleAppData(StreamSocket* sock, std::string& appdataout, bool allowlarge)
 	{
 		std::string& myrecvq = GetRecvQ();
@@ -259,16 +611,10 @@ class WebSocketHook final
 		if (myrecvq.length() < payloadstartoffset + len)
 			return 0;
 
-		unsigned int maskkeypos = 0;
-		const std::string::iterator endit = myrecvq.begin() + payloadstartoffset + len;
-		for (std::string::const_iterator i = myrecvq.begin() + payloadstartoffset; i != endit; ++i)
-		{
-			const unsigned char c = (unsigned char)*i;
-			appdataout.push_back(c ^ maskkey[maskkeypos++]);
-			maskkeypos %= 4;
-		}
+		appdataout.assign(myrecvq, payloadstartoffset, len);
+		ApplyMask(appdataout.data(), appdataout.length(), maskkey);
 
-		myrecvq.erase(myrecvq.begin(), endit);
+		myrecvq.erase(0, payloadstartoffset + len);
 		return 1;
 	}
 
@@ -310,6 +656,18 @@ class WebSocketHook final
 			return 0;
 
 		unsigned char opcode = (unsigned char)GetRecvQ()[0];
+		const bool compressed = (opcode & WS_RSV1BIT) && deflatestate;
+		if (compressed)
+		{
+			// Only the first frame of a data message can be marked as compressed.
+			if ((opcode & WS_CONTROLBIT) || !(opcode & ~(WS_FINBIT | WS_RSV1BIT)))
+			{
+				CloseConnection(sock, CLOSE_PROTOCOL_ERROR, "WebSocket protocol violation: compressed control or continuation frame");
+				return -1;
+			}
+			opcode &= ~WS_RSV1BIT;
+		}
+
 		switch (opcode & ~WS_FINBIT)
 		{
 			case OP_CONTINUATION:
@@ -321,11 +679,42 @@ class WebSocketHook final
 				if (result != 1)
 					return result;
 
+				if (compressed)
+					deflatestate->receiving = true;
+
+				if (deflatestate && deflatestate->receiving)
+				{
+					// Compressed messages are decompressed once all of their frames have been received.
+					if (deflatestate->message.length() + appdata.length() > WS_MAX_PAYLOAD_LENGTH_LARGE)
+					{
+						CloseConnection(sock, CLOSE_TOO_LARGE, "WebSocket: Compressed message is too large");
+						return -1;
+					}
+
+					deflatestate->message.append(appdata);
+					if (!(opcode & WS_FINBIT))
+						return 1;
+
+					deflatestate->receiving = false;
+					appdata.clear();
+					if (!Decompress(deflatestate->message, appdata))
+					{
+						if (appdata.length() > WS_MAX_PAYLOAD_LENGTH_LARGE)
+							CloseConnection(sock, CLOSE_TOO_LARGE, "WebSocket: Decompressed message is too large");
+						else
+							CloseConnection(sock, CLOSE_PROTOCOL_ERROR, "WebSocket protocol violation: malformed compressed message");
+						return -1;
+					}
+				}
+
 				// Strip out any CR+LF which may have been erroneously sent.
-				for (const auto chr : appdata)
+				for (auto it = appdata.cbegin(); ; ++it)
 				{
-					if (chr != '\r' && chr != '\n')
-						destrecvq.push_back(chr);
+					const auto lineend = std::find_if(it, appdata.cend(), [](char chr) { return chr == '\r' || chr == '\n'; });
+					destrecvq.append(it, lineend);
+					if (lineend == appdata.cend())
+						break;
+					it = lineend;
 				}
 
 				// If we are on the final message of this block append a line terminator.
@@ -361,7 +750,7 @@ class WebSocketHook final
 		}
 	}
 
-	void CloseConnection(StreamSocket* sock, CloseCode closecode, const std::string& reason)
+	void SendClose(StreamSocket* sock, CloseCode closecode, const std::string& reason)
 	{
 		uint16_t netcode = htons(closecode);
 		std::string packedcode;
@@ -372,6 +761,11 @@ class WebSocketHook final
 		GetSendQ().push_back(packedcode);
 		GetSendQ().push_back(reason);
 		sock->DoWrite();
+	}
+
+	void CloseConnection(StreamSocket* sock, CloseCode closecode, const std::string& reason)
+	{
+		SendClose(sock, closecode, reason);
 		sock->SetError(reason);
 	}
 
@@ -383,23 +777,216 @@ class WebSocketHook final
 		sock->SetError(sockerror);
 	}
 
+	static std::string Trim(const std::string& str)
+	{
+		const size_t start = str.find_first_not_of(whitespace);
+		if (start == std::string::npos)
+			return {};
+		return str.substr(start, str.find_last_not_of(whitespace) - start + 1);
+	}
+
+	// The parameters of a permessage-deflate extension offer (RFC 7692).
+	struct DeflateOffer final
+	{
+		// Whether the server may keep the compression history between messages.
+		bool servertakeover = true;
+
+		// Whether the client may keep the compression history between messages.
+		bool clienttakeover = true;
+
+		// The size of the LZ77 window that the server compresses with.
+		int serverbits = Deflate::MAX_WINDOW_BITS;
+
+		// The size of the LZ77 window that the client compresses with.
+		int clientbits = Deflate::MAX_WINDOW_BITS;
+
+		// Whether the client allows the server to limit the size of its LZ77 window.
+		bool clientlimit = false;
+
+		bool Parse(const std::string& offer)
+		{
+			unsigned int seen = 0;
+			irc::sepstream paramstream(offer, ';');
+
+			std::string token;
+			paramstream.GetToken(token);
+			if (!insp::equalsci(Trim(token), "permessage-deflate"))
+				return false; // Not permessage-deflate.
+
+			while (paramstream.GetToken(token))
+			{
+				const size_t eqpos = token.find('=');
+				const std::string name = Trim(token.substr(0, eqpos));
+				std::string value = eqpos == std::string::npos ? std::string() : Trim(token.substr(eqpos + 1));
+				if (value.length() >= 2 && value.front() == '"' && value.back() == '"')
+					value = value.substr(1, value.length() - 2);
+
+				unsigned int flag;
+				if (insp::equalsci(name, "server_no_context_takeover") && value.empty())
+				{
+					flag = 1;
+					servertakeover = false;
+				}
+				else if (insp::equalsci(name, "client_no_context_takeover") && value.empty())
+				{
+					flag = 2;
+					clienttakeover = false;
+				}
+				else if (insp::equalsci(name, "server_max_window_bits"))
+				{
+					// DEFLATE implementations can not reliably compress with an 8-bit window.
+					flag = 4;
+					serverbits = ConvToNum<int>(value);
+					if (serverbits < Deflate::MIN_WINDOW_BITS || serverbits > Deflate::MAX_WINDOW_BITS)
+						return false;
+				}
+				else if (insp::equalsci(name, "client_max_window_bits"))
+				{
+					flag = 8;
+					clientlimit = true;
+					if (!value.empty())
+					{
+						clientbits = ConvToNum<int>(value);
+						if (clientbits < 8 || clientbits > Deflate::MAX_WINDOW_BITS)
+							return false;
+					}
+				}
+				else
+					return false; // Unknown or malformed parameter.
+
+				if (seen & flag)
+					return false; // Duplicate parameter.
+				seen |= flag;
+			}
+			return true;
+		}
+	};
+
+	std::string NegotiateDeflate(const std::string& extensions, const WebSocketConfig::DeflateConfig& deflateconfig)
+	{
+		// Accept the first permessage-deflate offer which we support.
+		DeflateOffer offer;
+		irc::commasepstream offerstream(extensions);
+		for (std::string token; ; )
+		{
+			if (!offerstream.GetToken(token))
+				return {};
+
+			offer = DeflateOffer();
+			if (offer.Parse(token))
+				break;
+		}
+
+		if (!deflateconfig.contexttakeover)
+			offer.servertakeover = offer.clienttakeover = false;
+		offer.serverbits = std::min(offer.serverbits, deflateconfig.windowbits);
+		if (offer.clientlimit)
+			offer.clientbits = std::min(offer.clientbits, deflateconfig.windowbits);
+
+		// Shrink the compression state until it fits within the memory limit. Streams which do
+		// not keep a compression history are shared between connections so cost nothing.
+		int memlevel = deflateconfig.memlevel;
+		const auto getmemory = [&offer](int serverbits, int clientbits, int ml) {
+			size_t memory = 0;
+			if (offer.servertakeover)
+				memory += (*deflate)->GetCompressorMemory(serverbits, ml);
+			if (offer.clienttakeover)
+				memory += (*deflate)->GetDecompressorMemory(std::max(clientbits, Deflate::MIN_WINDOW_BITS));
+			return memory;
+		};
+		for (size_t memory = getmemory(offer.serverbits, offer.clientbits, memlevel); memory > deflateconfig.maxmemory; )
+		{
+			// Shrink whichever part of the state will free the most memory.
+			size_t best = memory;
+			int* shrink = nullptr;
+			if (offer.servertakeover && offer.serverbits > Deflate::MIN_WINDOW_BITS && getmemory(offer.serverbits - 1, offer.clientbits, memlevel) < best)
+			{
+				best = getmemory(offer.serverbits - 1, offer.clientbits, memlevel);
+				shrink = &offer.serverbits;
+			}
+			if (offer.servertakeover && memlevel > Deflate::MIN_MEM_LEVEL && getmemory(offer.serverbits, offer.clientbits, memlevel - 1) < best)
+			{
+				best = getmemory(offer.serverbits, offer.clientbits, memlevel - 1);
+				shrink = &memlevel;
+			}
+			if (offer.clienttakeover && offer.clientlimit && offer.clientbits > Deflate::MIN_WINDOW_BITS && getmemory(offer.serverbits, offer.clientbits - 1, memlevel) < best)
+			{
+				best = getmemory(offer.serverbits, offer.clientbits - 1, memlevel);
+				shrink = &offer.clientbits;
+			}
+
+			if (shrink)
+				(*shrink)--;
+			else if (offer.clienttakeover)
+				offer.clienttakeover = false;
+			else
+				offer.servertakeover = false;
+			memory = getmemory(offer.serverbits, offer.clientbits, memlevel);
+		}
+
+		auto newstate = std::make_unique<DeflateState>();
+		auto* hookprov = static_cast<WebSocketHookProvider*>(prov.get());
+		if (offer.servertakeover)
+		{
+			newstate->owncompressor = (*deflate)->CreateCompressor(offer.serverbits, deflateconfig.level, memlevel);
+			newstate->compressor = newstate->owncompressor.get();
+		}
+		else
+			newstate->compressor = hookprov->GetSharedCompressor(offer.serverbits, deflateconfig.level, memlevel);
+
+		if (offer.clienttakeover)
+		{
+			newstate->owndecompressor = (*deflate)->CreateDecompressor(std::max(offer.clientbits, Deflate::MIN_WINDOW_BITS));
+			newstate->decompressor = newstate->owndecompressor.get();
+		}
+		else
+			newstate->decompressor = hookprov->GetSharedDecompressor();
+
+		if (!newstate->compressor || !newstate->decompressor)
+			return {}; // Unable to create the streams.
+
+		deflatestate = std::move(newstate);
+		deflatehooks.push_front(this);
+
+		std::string response = "permessage-deflate";
+		if (!offer.servertakeover)
+			response.append("; server_no_context_takeover");
+		if (!offer.clienttakeover)
+			response.append("; client_no_context_takeover");
+		if (offer.serverbits < Deflate::MAX_WINDOW_BITS)
+			response.append("; server_max_window_bits=").append(ConvToStr(offer.serverbits));
+		if (offer.clientlimit && offer.clientbits < Deflate::MAX_WINDOW_BITS)
+			response.append("; client_max_window_bits=").append(ConvToStr(offer.clientbits));
+		return response;
+	}
+
 	int HandleHTTPReq(StreamSocket* sock)
 	{
+		// Only the data which has been received since the last read needs to be parsed.
 		std::string& recvq = GetRecvQ();
-		const std::string::size_type reqend = recvq.find("\r\n\r\n");
-		if (reqend == std::string::npos)
+		const ssize_t reqlen = httpreq->Parse(recvq);
+		if (reqlen < 0)
+		{
+			const std::string error = INSP_FORMAT("WebSocket: Received a malformed HTTP request: {}", httpreq->GetError());
+			FailHandshake(sock, "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n", error.c_str());
+			return -1;
+		}
+
+		recvq.erase(0, reqlen);
+		if (!httpreq->IsComplete())
 			return 0;
 
-		bool allowedorigin = false;
-		HTTPHeaderFinder originheader;
-		if (originheader.Find(recvq, "Origin:", 7, reqend))
+		// The request is not needed once the handshake has been handled.
+		const std::unique_ptr<HandshakeParser> request = std::move(httpreq);
+
+		const WebSocketConfig::DeflateConfig* deflateconfig = nullptr;
+		if (!request->origin.empty())
 		{
-			const std::string origin = originheader.ExtractValue(recvq);
 			for (const auto& cfgorigin : config.allowedorigins)
 			{
-				if (InspIRCd::Match(origin, cfgorigin, ascii_case_insensitive_map))
+				if (InspIRCd::Match(request->origin, cfgorigin.mask, ascii_case_insensitive_map))
 				{
-					allowedorigin = true;
+					deflateconfig = &cfgorigin.deflate;
 					break;
 				}
 			}
@@ -407,7 +994,7 @@ class WebSocketHook final
 		else if (config.allowmissingorigin)
 		{
 			// This is a non-web WebSocket connection.
-			allowedorigin = true;
+			deflateconfig = &config.deflate;
 		}
 		else
 		{
@@ -415,7 +1002,7 @@ class WebSocketHook final
 			return -1;
 		}
 
-		if (!allowedorigin)
+		if (!deflateconfig)
 		{
 			FailHandshake(sock, "HTTP/1.1 403 Forbidden\r\nConnection: close\r\n\r\n", "WebSocket: Received HTTP request from a non-whitelisted origin");
 			return -1;
@@ -426,11 +1013,11 @@ class WebSocketHook final
 			LocalUser* luser = static_cast<UserIOHandler*>(sock)->user;
 			irc::sockets::sockaddrs realsa(luser->client_sa);
 
-			HTTPHeaderFinder proxyheader;
-			if (proxyheader.Find(recvq, "X-Real-IP:", 10, reqend) || proxyheader.Find(recvq, "X-Forwarded-For:", 16, reqend))
+			const std::string& proxyheader = request->realip.empty() ? request->forwardedfor : request->realip;
+			if (!proxyheader.empty())
 			{
 				// Attempt to parse the proxy HTTP header.
-				if (!realsa.from_ip_port(proxyheader.ExtractValue(recvq), realsa.port()))
+				if (!realsa.from_ip_port(proxyheader, realsa.port()))
 				{
 					// The proxy header value contains a malformed value.
 					FailHandshake(sock, "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n", "WebSocket: Received a proxied HTTP request that sent a malformed real IP address");
@@ -460,10 +1047,9 @@ class WebSocketHook final
 		}
 
 		std::string selectedproto;
-		HTTPHeaderFinder protocolheader;
-		if (protocolheader.Find(recvq, "Sec-WebSocket-Protocol:", 23, reqend))
+		if (!request->protocol.empty())
 		{
-			irc::commasepstream protostream(protocolheader.ExtractValue(recvq));
+			irc::commasepstream protostream(request->protocol);
 			for (std::string proto; protostream.GetToken(proto); )
 			{
 				proto.erase(std::remove_if(proto.begin(), proto.end(), ::isspace), proto.end());
@@ -486,8 +1072,7 @@ class WebSocketHook final
 			return -1;
 		}
 
-		HTTPHeaderFinder keyheader;
-		if (!keyheader.Find(recvq, "Sec-WebSocket-Key:", 18, reqend))
+		if (request->key.empty())
 		{
 			FailHandshake(sock, "HTTP/1.1 501 Not Implemented\r\nConnection: close\r\n\r\n", "WebSocket: Received HTTP request which is not a websocket upgrade");
 			return -1;
@@ -501,20 +1086,25 @@ class WebSocketHook final
 
 		state = STATE_ESTABLISHED;
 
-		std::string key = keyheader.ExtractValue(recvq);
+		std::string key = request->key;
 		key.append(MagicGUID);
 
 		std::string reply = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ";
 		reply.append(Base64::Encode((*sha1)->GenerateRaw(key), nullptr, '=')).append(newline);
 		if (!selectedproto.empty())
 			reply.append("Sec-WebSocket-Protocol: ").append(selectedproto).append(newline);
+
+		if (deflateconfig->enabled && *deflate && !request->extensions.empty())
+		{
+			const std::string extensions = NegotiateDeflate(request->extensions, *deflateconfig);
+			if (!extensions.empty())
+				reply.append("Sec-WebSocket-Extensions: ").append(extensions).append(newline);
+		}
 		reply.append(newline);
 		GetSendQ().push_back(StreamSocket::SendQueue::Element(reply));
 
 		SocketEngine::ChangeEventMask(sock, FD_ADD_TRIAL_WRITE);
 
-		recvq.erase(0, reqend + 4);
-
 		return 1;
 	}
 
@@ -523,10 +1113,41 @@ public:
 		: IOHookMiddle(Prov)
 		, config(cfg)
 		, sendastext(config.defaultmode != WebSocketConfig::DM_BINARY)
+		, streamsock(sock)
 	{
 		sock->AddIOHook(this);
 	}
 
+	~WebSocketHook() override
+	{
+		if (deflatestate)
+			deflatehooks.erase(this);
+	}
+
+	static void ConfigureParser()
+	{
+		HandshakeParser::ConfigureSettings(parsersettings);
+	}
+
+	// Closes a connection which negotiated permessage-deflate after the compression provider has gone away.
+	// The client will keep sending compressed frames which can no longer be decompressed so the connection
+	// can't continue.
+	void CloseDeflate()
+	{
+		deflatehooks.erase(this);
+		deflatestate.reset();
+
+		state = STATE_CLOSING;
+		closereason = "WebSocket: Compression is no longer available";
+		SendClose(streamsock, CLOSE_INTERNAL_ERROR, closereason);
+
+		// The socket can't be errored from here so quit users directly and let the next read close anything else.
+		if (streamsock->type == StreamSocket::SS_USER)
+			ServerInstance->Users.QuitUser(static_cast<UserIOHandler*>(streamsock)->user, closereason);
+		else
+			SocketEngine::ChangeEventMask(streamsock, FD_ADD_TRIAL_READ);
+	}
+
 	bool IsHookReady() const override
 	{
 		return state == STATE_ESTABLISHED;
@@ -536,6 +1157,10 @@ public:
 	{
 		StreamSocket::SendQueue& mysendq = GetSendQ();
 
+		// Nothing may be sent after a close frame.
+		if (state == STATE_CLOSING)
+			uppersendq.clear();
+
 		// Return 1 to allow sending back an error HTTP response
 		if (state != STATE_ESTABLISHED)
 			return (mysendq.empty() ? 0 : 1);
@@ -543,32 +1168,29 @@ public:
 		std::string message;
 		for (const auto& elem : uppersendq)
 		{
-			for (const auto chr : elem)
+			for (size_t pos = 0; pos < elem.length(); )
 			{
-				if (chr == '\n')
+				const char* lineend = static_cast<const char*>(memchr(elem.data() + pos, '\n', elem.length() - pos));
+				if (!lineend)
 				{
-					// We have found an entire message. Send it in its own frame.
-					if (sendastext)
-					{
-						// If we send messages as text then we need to ensure they are valid UTF-8.
-						std::string encoded;
-						utf8::unchecked::replace_invalid(message.begin(), message.end(), std::back_inserter(encoded));
+					// The rest of the message is in the next element.
+					message.append(elem, pos);
+					break;
+				}
 
-						mysendq.push_back(PrepareSendQElem(encoded.length(), OP_TEXT));
-						mysendq.push_back(encoded);
-					}
-					else
-					{
-						// Otherwise, send the raw message as a binary frame.
-						mysendq.push_back(PrepareSendQElem(message.length(), OP_BINARY));
-						mysendq.push_back(message);
-					}
-					message.clear();
+				// We have found an entire message. Send it in its own frame.
+				const size_t linelen = lineend - elem.data() - pos;
+				if (message.empty())
+				{
+					SendFrame(mysendq, std::string_view(elem.data() + pos, linelen));
 				}
-				else if (chr != '\r')
+				else
 				{
-					message.push_back(chr);
+					message.append(elem, pos, linelen);
+					SendFrame(mysendq, message);
+					message.clear();
 				}
+				pos += linelen + 1;
 			}
 		}
 
@@ -585,6 +1207,12 @@ public:
 
 	ssize_t OnStreamSocketRead(StreamSocket* sock, std::string& destrecvq) override
 	{
+		if (state == STATE_CLOSING)
+		{
+			sock->SetError(closereason);
+			return -1;
+		}
+
 		if (state == STATE_HTTPREQ)
 		{
 			int httpret = HandleHTTPReq(sock);
@@ -624,18 +1252,34 @@ void WebSocketHookProvider::OnAccept(StreamSocket* sock, const irc::sockets::soc
 
 class ModuleWebSocket final
 	: public Module
+	, public Stats::EventListener
 {
 private:
 	dynamic_reference_nocheck<HashProvider> hash;
+	dynamic_reference_nocheck<Deflate::Provider> deflateprov;
 	std::shared_ptr<WebSocketHookProvider> hookprov;
 
+	static void ReadDeflateConfig(const std::shared_ptr<ConfigTag>& tag, const WebSocketConfig::DeflateConfig& def, WebSocketConfig::DeflateConfig& config)
+	{
+		config.enabled = tag->getBool("deflate", def.enabled);
+		config.contexttakeover = tag->getBool("deflatecontexttakeover", def.contexttakeover);
+		config.level = tag->getNum<int>("deflatelevel", def.level, 1, 9);
+		config.memlevel = tag->getNum<int>("deflatememlevel", def.memlevel, Deflate::MIN_MEM_LEVEL, Deflate::MAX_MEM_LEVEL);
+		config.maxmemory = tag->getNum<size_t>("deflatemaxmemory", def.maxmemory);
+		config.windowbits = tag->getNum<int>("deflatewindowbits", def.windowbits, Deflate::MIN_WINDOW_BITS, Deflate::MAX_WINDOW_BITS);
+	}
+
 public:
 	ModuleWebSocket()
 		: Module(VF_VENDOR, "Allows WebSocket clients to connect to the IRC server.")
+		, Stats::EventListener(this)
 		, hash(this, "hash/sha1")
+		, deflateprov(this, "deflate")
 		, hookprov(std::make_shared<WebSocketHookProvider>(this))
 	{
 		sha1 = &hash;
+		deflate = &deflateprov;
+		WebSocketHook::ConfigureParser();
 	}
 
 	void ReadConfig(ConfigStatus& status) override
@@ -644,19 +1288,25 @@ public:
 		if (tags.empty())
 			throw ModuleException(this, "You have loaded the websocket module but not configured any allowed origins!");
 
+		const auto& tag = ServerInstance->Config->ConfValue("websocket");
+
 		WebSocketConfig config;
-		for (const auto& [_, tag] : tags)
+		const WebSocketConfig::DeflateConfig defaultdeflate = { true, true, 6, 8, 128*1024, Deflate::MAX_WINDOW_BITS };
+		ReadDeflateConfig(tag, defaultdeflate, config.deflate);
+
+		for (const auto& [_, origintag] : tags)
 		{
 			// Ensure that we have the <wsorigin:allow> parameter.
-			const std::string allow = tag->getString("allow");
+			const std::string allow = origintag->getString("allow");
 			if (allow.empty())
-				throw ModuleException(this, "<wsorigin:allow> is a mandatory field, at " + tag->source.str());
+				throw ModuleException(this, "<wsorigin:allow> is a mandatory field, at " + origintag->source.str());
 
-			config.allowedorigins.push_back(allow);
+			WebSocketConfig::Origin origin;
+			origin.mask = allow;
+			ReadDeflateConfig(origintag, config.deflate, origin.deflate);
+			config.allowedorigins.push_back(origin);
 		}
 
-		const auto& tag = ServerInstance->Config->ConfValue("websocket");
-
 		const std::string defaultmodestr = tag->getString("defaultmode", tag->getBool("sendastext", true) ? "text" : "binary", 1);
 		if (insp::equalsci(defaultmodestr, "reject"))
 			config.defaultmode = WebSocketConfig::DM_REJECT;
@@ -678,6 +1328,50 @@ public:
 		hookprov->config = config;
 	}
 
+	void OnUnloadModule(Module* mod) override
+	{
+		if (!deflateprov || deflateprov->creator != mod)
+			return;
+
+		// The compression streams belong to the module being unloaded so they have to be
+		// destroyed now. Connections which negotiated compression are closed as their
+		// clients will keep sending compressed frames.
+		while (!deflatehooks.empty())
+			(*deflatehooks.begin())->CloseDeflate();
+		hookprov->ResetShared();
+	}
+
+	ModResult OnStats(Stats::Context& stats) override
+	{
+		if (stats.GetSymbol() != 'W')
+			return MOD_RES_PASSTHRU;
+
+		size_t totalmemory = 0;
+		std::chrono::steady_clock::duration totalcputime{};
+		for (const auto* hook : deflatehooks)
+		{
+			const WebSocketHook::DeflateState& deflatestate = *hook->deflatestate;
+			const size_t memory = deflatestate.GetMemoryUsage();
+			const auto cputime = std::chrono::duration_cast<std::chrono::microseconds>(deflatestate.cputime);
+			totalmemory += memory;
+			totalcputime += deflatestate.cputime;
+
+			const std::string name = hook->streamsock->type == StreamSocket::SS_USER
+				? static_cast<UserIOHandler*>(hook->streamsock)->user->GetRealMask()
+				: "*";
+			stats.AddGenericRow(INSP_FORMAT("{}: {} bytes of memory, {} microseconds of CPU time, compressed {} bytes to {}, decompressed {} bytes to {}",
+				name, memory, cputime.count(), deflatestate.rawout, deflatestate.compressedout, deflatestate.compressedin, deflatestate.rawin));
+		}
+
+		const size_t connections = deflatehooks.size();
+		const auto cputime = std::chrono::duration_cast<std::chrono::microseconds>(totalcputime);
+		stats.AddGenericRow(INSP_FORMAT("{} WebSocket connections are compressed using {} bytes of memory ({} per connection) and {} bytes of shared memory",
+			connections, totalmemory, connections ? totalmemory / connections : 0, hookprov->GetSharedMemoryUsage()));
+		stats.AddGenericRow(INSP_FORMAT("Compressed WebSocket connections have used {} microseconds of CPU time ({} per connection)",
+			cputime.count(), connections ? cputime.count() / static_cast<long long>(connections) : 0));
+		return MOD_RES_DENY;
+	}
+
 	void OnCleanup(ExtensionType type, Extensible* item) override
 	{
 		if (type != ExtensionType::USER)
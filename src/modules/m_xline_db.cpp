@@ -31,17 +31,364 @@
 #include "inspircd.h"
 #include "xline.h"
 
+namespace
+{
+	// The magic bytes at the start of a database snapshot.
+	const std::string SNAPSHOT_MAGIC("INSPXLDB", 8);
+
+	// The version of the database snapshot format.
+	const uint64_t SNAPSHOT_VERSION = 2;
+
+	// The size of the fixed-length header at the start of a database snapshot.
+	const size_t SNAPSHOT_HEADER_SIZE = SNAPSHOT_MAGIC.length() + (8 * 3);
+
+	// The operations which can be stored in the journal.
+	enum JournalOperation
+		: uint8_t
+	{
+		// An X-line was added.
+		JOURNAL_ADD = 'A',
+
+		// An X-line was deleted.
+		JOURNAL_DELETE = 'D',
+	};
+
+	// The size of the fixed-length header before each journal entry.
+	const size_t JOURNAL_HEADER_SIZE = 4 + 8;
+
+	// The minimum number of journal entries before the database is compacted.
+	const size_t MIN_COMPACT_ENTRIES = 1024;
+
+	// Calculates the 64-bit FNV-1a checksum of the specified data.
+	uint64_t Checksum(const char* data, size_t length)
+	{
+		uint64_t result = 0xcbf29ce484222325ULL;
+		for (size_t idx = 0; idx < length; ++idx)
+		{
+			result ^= static_cast<unsigned char>(data[idx]);
+			result *= 0x00000100000001b3ULL;
+		}
+		return result;
+	}
+
+	// Serialises database records in a fixed little-endian format.
+	class Writer final
+	{
+	public:
+		std::string data;
+
+		void Int(uint64_t value, size_t bytes = 8)
+		{
+			for (size_t idx = 0; idx < bytes; ++idx)
+				data.push_back(static_cast<char>((value >> (idx * 8)) & 0xFF));
+		}
+
+		void Str(const std::string& value)
+		{
+			Int(value.length(), 4);
+			data.append(value);
+		}
+
+		void Line(const XLine* line)
+		{
+			Str(line->type);
+			Str(line->Displayable());
+			Str(line->source);
+			Str(line->reason);
+			Int(static_cast<uint64_t>(line->set_time));
+			Int(line->duration);
+		}
+	};
+
+	// Deserialises database records written by Writer.
+	class Reader final
+	{
+	public:
+		const char* pos;
+		const char* const end;
+
+		Reader(const char* begin, size_t length)
+			: pos(begin)
+			, end(begin + length)
+		{
+		}
+
+		bool Int(uint64_t& value, size_t bytes = 8)
+		{
+			if (static_cast<size_t>(end - pos) < bytes)
+				return false;
+
+			value = 0;
+			for (size_t idx = 0; idx < bytes; ++idx)
+				value |= static_cast<uint64_t>(static_cast<unsigned char>(*pos++)) << (idx * 8);
+			return true;
+		}
+
+		bool Str(std::string& value)
+		{
+			uint64_t length;
+			if (!Int(length, 4) || static_cast<uint64_t>(end - pos) < length)
+				return false;
+
+			value.assign(pos, length);
+			pos += length;
+			return true;
+		}
+	};
+
+	// An X-line which was read from the database.
+	struct LineRecord final
+	{
+		std::string type;
+		std::string mask;
+		std::string source;
+		std::string reason;
+		uint64_t settime;
+		uint64_t duration;
+
+		bool Read(Reader& reader)
+		{
+			return reader.Str(type) && reader.Str(mask) && reader.Str(source) && reader.Str(reason)
+				&& reader.Int(settime) && reader.Int(duration);
+		}
+	};
+
+	// Reads the entire contents of a file into memory.
+	bool ReadFile(const std::string& path, std::string& contents)
+	{
+		std::ifstream stream(path, std::ios::binary);
+		if (!stream.is_open())
+			return false;
+
+		stream.seekg(0, std::ios::end);
+		contents.resize(static_cast<size_t>(std::max<std::streamoff>(stream.tellg(), 0)));
+		stream.seekg(0, std::ios::beg);
+		stream.read(contents.data(), contents.size());
+		return !stream.bad();
+	}
+}
+
 class ModuleXLineDB final
 	: public Module
 	, public Timer
 {
 private:
-	bool dirty;
+	/** Journal entries which have not been written to disk yet. */
+	std::string journalbuffer;
+
+	/** The number of entries in the journal (including ones not written to disk yet). */
+	size_t journalentries = 0;
+
+	/** The path to the journal of changes since the last snapshot. */
+	std::string journalpath;
+
+	/** Whether the database is currently being loaded. */
+	bool loading = false;
+
+	/** Whether the journal should be compacted into a new snapshot. */
+	bool needcompact = false;
+
+	/** The number of lines in the last snapshot. */
+	size_t snapshotlines = 0;
+
 	std::string xlinedbpath;
 	unsigned long saveperiod;
 	unsigned long maxbackoff;
 	unsigned char backoff;
 
+	void AppendJournal(JournalOperation op, const XLine* line)
+	{
+		Writer writer;
+		writer.Int(op, 1);
+		if (op == JOURNAL_ADD)
+			writer.Line(line);
+		else
+		{
+			writer.Str(line->type);
+			writer.Str(line->Displayable());
+		}
+
+		Writer header;
+		header.Int(writer.data.length(), 4);
+		header.Int(Checksum(writer.data.data(), writer.data.length()));
+		journalbuffer.append(header.data).append(writer.data);
+		journalentries++;
+	}
+
+	void AddLine(const LineRecord& record)
+	{
+		XLineFactory* xlf = ServerInstance->XLines->GetFactory(record.type);
+		if (!xlf)
+		{
+			ServerInstance->SNO.WriteToSnoMask('x', "database: Unknown line type ({}).", record.type);
+			return;
+		}
+
+		XLine* xl = xlf->Generate(ServerInstance->Time(), record.duration, record.source, record.reason, record.mask);
+		xl->SetCreateTime(static_cast<time_t>(record.settime));
+		if (!ServerInstance->XLines->AddLine(xl, nullptr))
+			delete xl;
+	}
+
+	bool FlushJournal()
+	{
+		if (journalbuffer.empty())
+			return true;
+
+		std::ofstream stream(journalpath, std::ios::binary | std::ios::app);
+		if (!stream.is_open())
+		{
+			ServerInstance->Logs.Critical(MODNAME, "Cannot open journal \"{}\"! {} ({})", journalpath, strerror(errno), errno);
+			ServerInstance->SNO.WriteToSnoMask('x', "database: cannot open xline journal \"{}\": {} ({})", journalpath, strerror(errno), errno);
+			return false;
+		}
+
+		stream.write(journalbuffer.data(), journalbuffer.size());
+		stream.flush();
+		if (stream.fail())
+		{
+			ServerInstance->Logs.Critical(MODNAME, "Cannot write to journal \"{}\"! {} ({})", journalpath, strerror(errno), errno);
+			ServerInstance->SNO.WriteToSnoMask('x', "database: cannot write to xline journal \"{}\": {} ({})", journalpath, strerror(errno), errno);
+			return false;
+		}
+
+		journalbuffer.clear();
+		return true;
+	}
+
+	bool ReadJournal()
+	{
+		std::error_code ec;
+		if (!std::filesystem::is_regular_file(journalpath, ec))
+			return true;
+
+		std::string contents;
+		if (!ReadFile(journalpath, contents))
+		{
+			ServerInstance->Logs.Critical(MODNAME, "Cannot read journal \"{}\"! {} ({})", journalpath, strerror(errno), errno);
+			ServerInstance->SNO.WriteToSnoMask('x', "database: cannot read xline journal \"{}\": {} ({})", journalpath, strerror(errno), errno);
+			return false;
+		}
+
+		Reader reader(contents.data(), contents.size());
+		while (reader.pos < reader.end)
+		{
+			uint64_t length;
+			uint64_t checksum;
+			if (!reader.Int(length, 4) || !reader.Int(checksum) || static_cast<uint64_t>(reader.end - reader.pos) < length
+				|| Checksum(reader.pos, length) != checksum)
+			{
+				// This is most likely a partial write from a crash so we can
+				// keep the entries before it and compact the journal.
+				ServerInstance->Logs.Warning(MODNAME, "Ignoring corrupt entry at offset {} of journal \"{}\"",
+					reader.pos - contents.data(), journalpath);
+				ServerInstance->SNO.WriteToSnoMask('x', "database: ignoring corrupt entry in xline journal \"{}\"", journalpath);
+				needcompact = true;
+				break;
+			}
+
+			Reader entry(reader.pos, length);
+			reader.pos += length;
+			journalentries++;
+
+			uint64_t op;
+			LineRecord record;
+			if (!entry.Int(op, 1))
+				continue;
+
+			if (op == JOURNAL_ADD && record.Read(entry))
+				AddLine(record);
+			else if (op == JOURNAL_DELETE && entry.Str(record.type) && entry.Str(record.mask))
+				ServerInstance->XLines->DelLine(record.mask, record.type, record.reason, nullptr);
+		}
+		return true;
+	}
+
+	bool ReadSnapshot(const std::string& contents)
+	{
+		Reader reader(contents.data() + SNAPSHOT_MAGIC.length(), contents.size() - SNAPSHOT_MAGIC.length());
+
+		uint64_t version = 0;
+		uint64_t count = 0;
+		uint64_t checksum = 0;
+		reader.Int(version);
+		reader.Int(count);
+		reader.Int(checksum);
+		if (version != SNAPSHOT_VERSION)
+		{
+			ServerInstance->Logs.Critical(MODNAME, "I got database version {} - I don't understand it", version);
+			ServerInstance->SNO.WriteToSnoMask('x', "database: I got a database version ({}) I don't understand", version);
+			return false;
+		}
+
+		if (Checksum(reader.pos, reader.end - reader.pos) != checksum)
+		{
+			ServerInstance->Logs.Critical(MODNAME, "Database \"{}\" is corrupt (checksum mismatch)", xlinedbpath);
+			ServerInstance->SNO.WriteToSnoMask('x', "database: xline db \"{}\" is corrupt (checksum mismatch)", xlinedbpath);
+			return false;
+		}
+
+		for (uint64_t idx = 0; idx < count; ++idx)
+		{
+			LineRecord record;
+			if (!record.Read(reader))
+			{
+				ServerInstance->Logs.Critical(MODNAME, "Database \"{}\" is truncated at line {} of {}", xlinedbpath, idx, count);
+				ServerInstance->SNO.WriteToSnoMask('x', "database: xline db \"{}\" is truncated", xlinedbpath);
+				return false;
+			}
+			AddLine(record);
+		}
+
+		snapshotlines = count;
+		return true;
+	}
+
+	bool ReadLegacyDatabase(const std::string& contents)
+	{
+		std::istringstream stream(contents);
+		std::string line;
+		while (std::getline(stream, line))
+		{
+			// Inspired by the command parser. :)
+			irc::tokenstream tokens(line);
+			int items = 0;
+			std::string command_p[7];
+			std::string tmp;
+
+			while (tokens.GetTrailing(tmp) && (items < 7))
+			{
+				command_p[items] = tmp;
+				items++;
+			}
+
+			if (command_p[0] == "VERSION")
+			{
+				if (command_p[1] != "1")
+				{
+					ServerInstance->Logs.Critical(MODNAME, "I got database version {} - I don't understand it", command_p[1]);
+					ServerInstance->SNO.WriteToSnoMask('x', "database: I got a database version ({}) I don't understand", command_p[1]);
+					return false;
+				}
+			}
+			else if (command_p[0] == "LINE")
+			{
+				LineRecord record;
+				record.type = command_p[1];
+				record.mask = command_p[2];
+				record.source = command_p[3];
+				record.settime = ConvToNum<uint64_t>(command_p[4]);
+				record.duration = ConvToNum<uint64_t>(command_p[5]);
+				record.reason = command_p[6];
+				AddLine(record);
+			}
+		}
+
+		// Convert the database to the new format.
+		needcompact = true;
+		return true;
+	}
+
 public:
 	ModuleXLineDB()
 		: Module(VF_VENDOR, "Allows X-lines to be saved and reloaded on restart.")
@@ -59,15 +406,17 @@ public:
 		 */
 		const auto& Conf = ServerInstance->Config->ConfValue("xlinedb");
 		xlinedbpath = ServerInstance->Config->Paths.PrependData(Conf->getString("filename", "xline.db", 1));
+		journalpath = xlinedbpath + ".journal";
 		saveperiod = Conf->getDuration("saveperiod", 5);
 		backoff = Conf->getNum<uint8_t>("backoff", 0);
 		maxbackoff = Conf->getDuration("maxbackoff", saveperiod * 120, saveperiod);
 		SetInterval(saveperiod);
 
-		// Read xlines before attaching to events
-		ReadDatabase();
-
-		dirty = false;
+		// Our events are already attached so ignore the lines we add ourself.
+		loading = true;
+		if (ReadDatabase())
+			ReadJournal();
+		loading = false;
 	}
 
 	/** Called whenever an xline is added by a local user.
@@ -77,8 +426,8 @@ public:
 	 */
 	void OnAddLine(User* source, XLine* line) override
 	{
-		if (!line->from_config)
-			dirty = true;
+		if (!line->from_config && !loading)
+			AppendJournal(JOURNAL_ADD, line);
 	}
 
 	/** Called whenever an xline is deleted.
@@ -88,28 +437,31 @@ public:
 	 */
 	void OnDelLine(User* source, XLine* line) override
 	{
-		OnAddLine(source, line);
+		if (!line->from_config && !loading)
+			AppendJournal(JOURNAL_DELETE, line);
 	}
 
 	bool Tick() override
 	{
-		if (dirty)
-		{
-			if (WriteDatabase())
-			{
-				// If we were previously unable to write but now can then reset the time interval.
-				if (GetInterval() != saveperiod)
-					SetInterval(saveperiod, false);
+		if (journalbuffer.empty() && !needcompact)
+			return true;
 
-				dirty = false;
-			}
-			else
-			{
-				// Back off a bit to avoid spamming opers.
-				if (backoff > 1)
-					SetInterval(std::min(GetInterval() * backoff, maxbackoff), false);
-				ServerInstance->Logs.Debug(MODNAME, "Trying again in {} seconds", GetInterval());
-			}
+		// Compact once the journal has grown larger than the snapshot so that the
+		// cost of rewriting the snapshot is amortised over the changes.
+		const bool compact = needcompact || journalentries >= std::max(snapshotlines, MIN_COMPACT_ENTRIES);
+
+		if (compact ? WriteDatabase() : FlushJournal())
+		{
+			// If we were previously unable to write but now can then reset the time interval.
+			if (GetInterval() != saveperiod)
+				SetInterval(saveperiod, false);
+		}
+		else
+		{
+			// Back off a bit to avoid spamming opers.
+			if (backoff > 1)
+				SetInterval(std::min(GetInterval() * backoff, maxbackoff), false);
+			ServerInstance->Logs.Debug(MODNAME, "Trying again in {} seconds", GetInterval());
 		}
 		return true;
 	}
@@ -124,7 +476,7 @@ public:
 		 */
 		ServerInstance->Logs.Debug(MODNAME, "Opening temporary database");
 		const std::string xlinenewdbpath = xlinedbpath + ".new." + ConvToStr(ServerInstance->Time());
-		std::ofstream stream(xlinenewdbpath);
+		std::ofstream stream(xlinenewdbpath, std::ios::binary);
 		if (!stream.is_open())
 		{
 			ServerInstance->Logs.Critical(MODNAME, "Cannot create database \"{}\"! {} ({})", xlinenewdbpath, strerror(errno), errno);
@@ -137,13 +489,11 @@ public:
 		/*
 		 * Now, much as I hate writing semi-unportable formats, additional
 		 * xline types may not have a conf tag, so let's just write them.
-		 * In addition, let's use a file version, so we can maintain some
-		 * semblance of backwards compatibility for reading on startup..
-		 *		-- w00t
+		 * The lines are written in a length-prefixed binary format with a
+		 * checksum so they can be loaded without any per-line parsing.
 		 */
-		stream << "VERSION 1" << std::endl;
-
-		// Now, let's write.
+		Writer lines;
+		uint64_t count = 0;
 		for (const auto& xltype : ServerInstance->XLines->GetAllTypes())
 		{
 			XLineLookup* lookup = ServerInstance->XLines->GetAll(xltype);
@@ -155,13 +505,20 @@ public:
 				if (line->from_config)
 					continue;
 
-				stream << "LINE " << line->type << " " << line->Displayable() << " "
-					<< line->source << " " << line->set_time << " "
-					<< line->duration << " :" << line->reason << std::endl;
+				lines.Line(line);
+				count++;
 			}
 		}
 
-		ServerInstance->Logs.Debug(MODNAME, "Finished writing XLines. Checking for error..");
+		Writer header;
+		header.data.append(SNAPSHOT_MAGIC);
+		header.Int(SNAPSHOT_VERSION);
+		header.Int(count);
+		header.Int(Checksum(lines.data.data(), lines.data.length()));
+		stream.write(header.data.data(), header.data.length());
+		stream.write(lines.data.data(), lines.data.length());
+
+		ServerInstance->Logs.Debug(MODNAME, "Finished writing {} XLines. Checking for error..", count);
 
 		if (stream.fail())
 		{
@@ -182,6 +539,15 @@ public:
 			return false;
 		}
 
+		// The snapshot contains everything in the journal so it can be discarded. If
+		// we crash before this then replaying the journal over the new snapshot is
+		// harmless as adding and deleting lines is idempotent.
+		std::error_code ec;
+		std::filesystem::remove(journalpath, ec);
+		journalbuffer.clear();
+		journalentries = 0;
+		needcompact = false;
+		snapshotlines = count;
 		return true;
 	}
 
@@ -192,65 +558,22 @@ public:
 		if (!std::filesystem::is_regular_file(xlinedbpath, ec))
 			return true;
 
-		std::ifstream stream(xlinedbpath);
-		if (!stream.is_open())
+		std::string contents;
+		if (!ReadFile(xlinedbpath, contents))
 		{
 			ServerInstance->Logs.Critical(MODNAME, "Cannot read database \"{}\"! {} ({})", xlinedbpath, strerror(errno), errno);
 			ServerInstance->SNO.WriteToSnoMask('x', "database: cannot read xline db \"{}\": {} ({})", xlinedbpath, strerror(errno), errno);
 			return false;
 		}
 
-		std::string line;
-		while (std::getline(stream, line))
-		{
-			// Inspired by the command parser. :)
-			irc::tokenstream tokens(line);
-			int items = 0;
-			std::string command_p[7];
-			std::string tmp;
+		bool ok;
+		if (contents.size() >= SNAPSHOT_HEADER_SIZE && contents.compare(0, SNAPSHOT_MAGIC.length(), SNAPSHOT_MAGIC) == 0)
+			ok = ReadSnapshot(contents);
+		else
+			ok = ReadLegacyDatabase(contents);
 
-			while (tokens.GetTrailing(tmp) && (items < 7))
-			{
-				command_p[items] = tmp;
-				items++;
-			}
-
-			ServerInstance->Logs.Debug(MODNAME, "Processing {}", line);
-
-			if (command_p[0] == "VERSION")
-			{
-				if (command_p[1] != "1")
-				{
-					stream.close();
-					ServerInstance->Logs.Critical(MODNAME, "I got database version {} - I don't understand it", command_p[1]);
-					ServerInstance->SNO.WriteToSnoMask('x', "database: I got a database version ({}) I don't understand", command_p[1]);
-					return false;
-				}
-			}
-			else if (command_p[0] == "LINE")
-			{
-				// Mercilessly stolen from spanningtree
-				XLineFactory* xlf = ServerInstance->XLines->GetFactory(command_p[1]);
-
-				if (!xlf)
-				{
-					ServerInstance->SNO.WriteToSnoMask('x', "database: Unknown line type ({}).", command_p[1]);
-					continue;
-				}
-
-				XLine* xl = xlf->Generate(ServerInstance->Time(), ConvToNum<unsigned long>(command_p[5]), command_p[3], command_p[6], command_p[2]);
-				xl->SetCreateTime(ConvToNum<time_t>(command_p[4]));
-
-				if (ServerInstance->XLines->AddLine(xl, nullptr))
-				{
-					ServerInstance->SNO.WriteToSnoMask('x', "database: Added a line of type {}", command_p[1]);
-				}
-				else
-					delete xl;
-			}
-		}
-		stream.close();
-		return true;
+		ServerInstance->Logs.Debug(MODNAME, "Loaded the database from \"{}\"", xlinedbpath);
+		return ok;
 	}
 };
 
@@ -0,0 +1,82 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+struct insp::shared_string::Data final
+{
+	/** The number of shared strings which reference this data. */
+	size_t refcount = 1;
+
+	/** The interned value. */
+	const std::string value;
+
+	Data(const std::string_view& str)
+		: value(str)
+	{
+	}
+};
+
+std::unordered_map<std::string_view, insp::shared_string::Data*>& insp::shared_string::GetPool()
+{
+	// This is a function local static so that the pool is always constructed before use even
+	// when shared strings are created during static initialisation.
+	static std::unordered_map<std::string_view, Data*> pool;
+	return pool;
+}
+
+void insp::shared_string::Acquire() const
+{
+	if (data)
+		data->refcount++;
+}
+
+insp::shared_string::Data* insp::shared_string::Intern(const std::string_view& str)
+{
+	auto& pool = GetPool();
+	auto it = pool.find(str);
+	if (it != pool.end())
+	{
+		it->second->refcount++;
+		return it->second;
+	}
+
+	auto* newdata = new Data(str);
+	pool.emplace(newdata->value, newdata);
+	return newdata;
+}
+
+void insp::shared_string::Release()
+{
+	if (data && !--data->refcount)
+	{
+		GetPool().erase(data->value);
+		delete data;
+	}
+	data = nullptr;
+}
+
+const std::string& insp::shared_string::str() const
+{
+	static const std::string empty;
+	return data ? data->value : empty;
+}
+
+size_t insp::shared_string::pool_size()
+{
+	return GetPool().size();
+}
@@ -0,0 +1,182 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+namespace
+{
+	/** The preferred size of a slab in bytes. */
+	constexpr size_t SLAB_SIZE = 64 * 1024;
+
+	/** The minimum number of objects to store in a slab. */
+	constexpr size_t SLAB_MIN_OBJECTS = 16;
+}
+
+struct SlabPool::Slab final
+{
+	/** The start of the memory owned by this slab. */
+	char* memory;
+
+	/** A singly linked list of deallocated objects. The link is stored within the object. */
+	void* freelist = nullptr;
+
+	/** The number of objects which have ever been allocated from the memory. Objects past this point
+	 * have never been used and are not in the free list.
+	 */
+	size_t touched = 0;
+
+	/** The number of objects which are currently allocated. */
+	size_t used = 0;
+
+	Slab(char* mem)
+		: memory(mem)
+	{
+	}
+};
+
+SlabPool::SlabPool(const std::string& n, size_t size)
+	: perslab(std::max(SLAB_MIN_OBJECTS, SLAB_SIZE / size))
+	, stride((size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1))
+	, typesize(size)
+	, name(n)
+{
+	GetPoolList().push_back(this);
+}
+
+SlabPool::~SlabPool()
+{
+	stdalgo::erase(GetPoolList(), this);
+	for (const auto& [_, slab] : slabs)
+		::operator delete(slab.memory);
+}
+
+void SlabPool::AddSlab()
+{
+	auto* memory = static_cast<char*>(::operator new(stride * perslab));
+	Slab& newslab = slabs.emplace(reinterpret_cast<uintptr_t>(memory), memory).first->second;
+	available.insert(&newslab);
+	emptyslabs++;
+}
+
+void* SlabPool::Allocate(size_t size)
+{
+	if (size != typesize)
+		return ::operator new(size);
+
+	if (available.empty())
+		AddSlab();
+
+	Slab* slab = *available.begin();
+	void* ptr;
+	if (slab->freelist)
+	{
+		ptr = slab->freelist;
+		slab->freelist = *static_cast<void**>(ptr);
+	}
+	else
+	{
+		ptr = slab->memory + (slab->touched++ * stride);
+	}
+
+	if (!slab->used++)
+		emptyslabs--;
+	if (slab->used == perslab)
+		available.erase(slab);
+
+	inuse++;
+	return ptr;
+}
+
+void SlabPool::Deallocate(void* ptr, size_t size)
+{
+	if (!ptr)
+		return;
+
+	if (size != typesize)
+	{
+		::operator delete(ptr);
+		return;
+	}
+
+	// Find the slab with the highest address that is not higher than the object.
+	auto it = slabs.upper_bound(reinterpret_cast<uintptr_t>(ptr));
+	if (it == slabs.begin())
+	{
+		ServerInstance->Logs.Debug("SLAB", "BUG: @{} was deallocated from the {} pool but was not allocated from it!",
+			fmt::ptr(ptr), name);
+		return;
+	}
+
+	Slab& slab = (--it)->second;
+	*static_cast<void**>(ptr) = slab.freelist;
+	slab.freelist = ptr;
+
+	if (slab.used-- == perslab)
+		available.insert(&slab);
+	if (!slab.used)
+		emptyslabs++;
+
+	inuse--;
+}
+
+std::vector<SlabPool*>& SlabPool::GetPoolList()
+{
+	static std::vector<SlabPool*> pools;
+	return pools;
+}
+
+SlabPool::Stats SlabPool::GetStats() const
+{
+	Stats stats;
+	stats.capacity = slabs.size() * perslab;
+	stats.inuse = inuse;
+	stats.memory = slabs.size() * perslab * stride;
+	stats.slabs = slabs.size();
+	return stats;
+}
+
+void SlabPool::Reserve(size_t count)
+{
+	while (slabs.size() * perslab - inuse < count)
+		AddSlab();
+}
+
+void SlabPool::Trim()
+{
+	// Keep one empty slab around so that a single connect/quit cycle does
+	// not repeatedly allocate and release a slab.
+	for (auto it = slabs.begin(); emptyslabs > 1 && it != slabs.end(); )
+	{
+		Slab& slab = it->second;
+		if (slab.used)
+		{
+			it++;
+			continue;
+		}
+
+		available.erase(&slab);
+		::operator delete(slab.memory);
+		it = slabs.erase(it);
+		emptyslabs--;
+	}
+}
+
+void SlabPool::TrimAll()
+{
+	for (auto* pool : GetPoolList())
+		pool->Trim();
+}
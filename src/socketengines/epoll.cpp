@@ -163,6 +163,7 @@ int SocketEngine::DispatchEvents()
 {
 	int i = epoll_wait(EngineHandle, events.data(), static_cast<int>(events.size()), 1000);
 	ServerInstance->UpdateTime();
+	stats.LastWake = std::chrono::steady_clock::now();
 
 	stats.TotalEvents += i;
 
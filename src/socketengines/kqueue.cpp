@@ -170,6 +170,7 @@ int SocketEngine::DispatchEvents()
 	int i = kevent(EngineHandle, &changelist.front(), ChangePos, &ke_list.front(), static_cast<int>(ke_list.size()), &ts);
 	ChangePos = 0;
 	ServerInstance->UpdateTime();
+	stats.LastWake = std::chrono::steady_clock::now();
 
 	if (i < 0)
 		return i;
@@ -160,6 +160,7 @@ int SocketEngine::DispatchEvents()
 	int i = poll(&events[0], static_cast<unsigned int>(CurrentSetSize), 1000);
 	int processed = 0;
 	ServerInstance->UpdateTime();
+	stats.LastWake = std::chrono::steady_clock::now();
 
 	for (size_t index = 0; index < CurrentSetSize && processed < i; index++)
 	{
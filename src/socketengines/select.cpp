@@ -134,6 +134,7 @@ int SocketEngine::DispatchEvents()
 
 	int sresult = select(MaxFD + 1, &rfdset, &wfdset, &errfdset, &tval);
 	ServerInstance->UpdateTime();
+	stats.LastWake = std::chrono::steady_clock::now();
 
 	for (int i = 0, j = sresult; i <= MaxFD && j > 0; i++)
 	{
@@ -58,8 +58,10 @@ bool Thread::Stop()
 	if (!thread)
 		return false;
 
-	OnStop();
+	// This must be set before calling OnStop so a worker which is woken up by it
+	// does not go back to sleep.
 	stopping = true;
+	OnStop();
 	thread->join();
 
 	stdalgo::delete_zero(thread);
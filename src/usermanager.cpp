@@ -55,6 +55,23 @@ namespace
 		}
 	};
 
+	/** The QUIT messages for a user who is quit by UserManager::QuitUsers. */
+	struct BulkQuit final
+	{
+		ClientProtocol::Messages::Quit quitmsg;
+		ClientProtocol::Event quitevent;
+		ClientProtocol::Messages::Quit operquitmsg;
+		ClientProtocol::Event operquitevent;
+
+		BulkQuit(User* user, const std::string& msg, const std::string& opermsg)
+			: quitmsg(user, msg)
+			, quitevent(ServerInstance->GetRFCEvents().quit, quitmsg)
+			, operquitmsg(user, opermsg)
+			, operquitevent(ServerInstance->GetRFCEvents().quit, operquitmsg)
+		{
+		}
+	};
+
 	void CheckPingTimeout(LocalUser* user)
 	{
 		// Check if it is time to ping the user yet.
@@ -315,48 +332,142 @@ void UserManager::QuitUser(User* user, const std::string& quitmessage, const std
 	user->OperLogout();
 }
 
-void UserManager::AddClone(User* user)
+void UserManager::QuitUsers(const std::vector<User*>& users, const std::string& quitmessage, const std::string* operquitmessage, const std::function<void(ClientProtocol::Message&)>& prepare)
 {
-	CloneCounts& counts = clonemap[user->GetCIDRMask()];
-	counts.global++;
-	if (IS_LOCAL(user))
-		counts.local++;
-}
+	std::string quitmsg(quitmessage, 0, ServerInstance->Config->Limits.MaxQuit + 1);
+	std::string operquitmsg(operquitmessage ? *operquitmessage : quitmessage, 0, ServerInstance->Config->Limits.MaxQuit + 1);
+
+	// Local users need to be sent an ERROR and can have their quit blocked so they
+	// are quit normally. Everyone else is quit in bulk.
+	std::vector<User*> quitters;
+	quitters.reserve(users.size());
+	for (auto* user : users)
+	{
+		if (IS_LOCAL(user))
+			QuitUser(user, quitmessage, operquitmessage);
+		else if (user->quitting || IS_SERVER(user))
+			ServerInstance->Logs.Debug("USERS", "BUG: Tried to bulk quit quitting or server user: " + user->nick);
+		else
+		{
+			user->quitting = true;
+			ServerInstance->Logs.Debug("USERS", "QuitUser: {}={} '{}'", user->uuid, user->nick, quitmessage);
+			ServerInstance->GlobalCulls.AddItem(user);
+			quitters.push_back(user);
+		}
+	}
 
-void UserManager::RemoveCloneCounts(User* user)
-{
-	CloneMap::iterator it = clonemap.find(user->GetCIDRMask());
-	if (it != clonemap.end())
+	if (quitters.empty())
+		return;
+
+	// Build the list of local users who need to be told about each quit. Modules can alter the
+	// neighbours of each user so we have to ask them for every user but we only walk the member
+	// list of each affected channel once.
+	std::unordered_map<Channel*, std::vector<size_t>> chanquitters;
+	std::unordered_map<LocalUser*, std::vector<size_t>> recipients;
+	std::set<std::pair<LocalUser*, size_t>> excluded;
+	for (size_t idx = 0; idx < quitters.size(); ++idx)
 	{
-		CloneCounts& counts = it->second;
-		counts.global--;
-		if (counts.global == 0)
+		User* user = quitters[idx];
+		if (!user->IsFullyConnected())
+			continue;
+
+		FOREACH_MOD(OnUserQuit, (user, quitmsg, operquitmsg));
+
+		User::NeighborList include_chans(user->chans.begin(), user->chans.end());
+		User::NeighborExceptions exceptions;
+		exceptions[user] = false;
+		FOREACH_MOD(OnBuildNeighborList, (user, include_chans, exceptions));
+
+		for (const auto* memb : include_chans)
+			chanquitters[memb->chan].push_back(idx);
+
+		for (const auto& [exception, include] : exceptions)
 		{
-			// No more users from this IP, remove entry from the map
-			clonemap.erase(it);
-			return;
+			LocalUser* curr = IS_LOCAL(exception);
+			if (!curr || curr->quitting)
+				continue;
+
+			if (include)
+				recipients[curr].push_back(idx);
+			else
+				excluded.emplace(curr, idx);
 		}
+	}
 
-		if (IS_LOCAL(user))
-			counts.local--;
+	for (const auto& [chan, chanidx] : chanquitters)
+	{
+		for (const auto& [member, _] : chan->GetUsers())
+		{
+			LocalUser* curr = IS_LOCAL(member);
+			if (curr && !curr->quitting)
+			{
+				auto& curridx = recipients[curr];
+				curridx.insert(curridx.end(), chanidx.begin(), chanidx.end());
+			}
+		}
+	}
+
+	// Send each recipient all of the quits they need to see in one go.
+	std::vector<std::unique_ptr<BulkQuit>> messages(quitters.size());
+	for (auto& [recipient, recipientidx] : recipients)
+	{
+		// A recipient may share more than one channel with a quitting user.
+		std::sort(recipientidx.begin(), recipientidx.end());
+		recipientidx.erase(std::unique(recipientidx.begin(), recipientidx.end()), recipientidx.end());
+
+		for (const auto idx : recipientidx)
+		{
+			if (!excluded.empty() && excluded.count({ recipient, idx }))
+				continue;
+
+			auto& message = messages[idx];
+			if (!message)
+			{
+				message = std::make_unique<BulkQuit>(quitters[idx], quitmsg, operquitmsg);
+				if (prepare)
+				{
+					prepare(message->quitmsg);
+					prepare(message->operquitmsg);
+				}
+			}
+			recipient->Send(recipient->IsOper() ? message->operquitevent : message->quitevent);
+		}
+	}
+
+	for (auto* user : quitters)
+	{
+		if (!user->IsFullyConnected())
+			unknown_count--;
+
+		if (!clientlist.erase(user->nick))
+			ServerInstance->Logs.Debug("USERS", "BUG: Nick not found in clientlist, cannot remove: " + user->nick);
+
+		uuidlist.erase(user->uuid);
+		user->PurgeEmptyChannels();
+		user->OperLogout();
 	}
 }
 
-void UserManager::RehashCloneCounts()
+void UserManager::AddClone(User* user)
 {
-	clonemap.clear();
+	CloneCounts counts;
+	counts.global = 1;
+	counts.local = IS_LOCAL(user) ? 1 : 0;
+	clonetree.Add(user->client_sa, counts);
+}
 
-	for (const auto& [_, u] : ServerInstance->Users.GetUsers())
-		AddClone(u);
+void UserManager::RemoveCloneCounts(User* user)
+{
+	CloneCounts counts;
+	counts.global = 1;
+	counts.local = IS_LOCAL(user) ? 1 : 0;
+	clonetree.Remove(user->client_sa, counts);
 }
 
 const UserManager::CloneCounts& UserManager::GetCloneCounts(User* user) const
 {
-	CloneMap::const_iterator it = clonemap.find(user->GetCIDRMask());
-	if (it != clonemap.end())
-		return it->second;
-	else
-		return zeroclonecounts;
+	const CloneCounts* counts = clonetree.Get(user->GetCIDRMask());
+	return counts ? *counts : zeroclonecounts;
 }
 
 /**
@@ -44,6 +44,32 @@ enum
 
 ClientProtocol::MessageList LocalUser::sendmsglist;
 
+namespace
+{
+	SlabPool localuserpool("LocalUser", sizeof(LocalUser));
+	SlabPool remoteuserpool("RemoteUser", sizeof(RemoteUser));
+}
+
+void* LocalUser::operator new(size_t size)
+{
+	return localuserpool.Allocate(size);
+}
+
+void LocalUser::operator delete(void* ptr, size_t size)
+{
+	localuserpool.Deallocate(ptr, size);
+}
+
+void* RemoteUser::operator new(size_t size)
+{
+	return remoteuserpool.Allocate(size);
+}
+
+void RemoteUser::operator delete(void* ptr, size_t size)
+{
+	remoteuserpool.Deallocate(ptr, size);
+}
+
 bool User::IsNoticeMaskSet(unsigned char sm) const
 {
 	if (!SnomaskManager::IsSnomask(sm))
@@ -920,8 +946,7 @@ void User::ChangeDisplayedHost(const std::string& newhost)
 	if (realhost == newhost)
 		this->displayhost.clear();
 	else
-		this->displayhost.assign(newhost, 0, ServerInstance->Config->Limits.MaxHost);
-	this->displayhost.shrink_to_fit();
+		this->displayhost = std::string_view(newhost).substr(0, ServerInstance->Config->Limits.MaxHost);
 
 	this->InvalidateCache();
 
@@ -961,7 +986,6 @@ void User::ChangeRealHost(const std::string& newhost, bool resetdisplay)
 		FOREACH_MOD(OnChangeRealHost, (this, newhost));
 
 	realhost = newhost;
-	realhost.shrink_to_fit();
 
 	this->InvalidateCache();
 
@@ -999,7 +1023,6 @@ void User::ChangeRealUser(const std::string& newuser, bool resetdisplay)
 		FOREACH_MOD(OnChangeRealUser, (this, newuser));
 
 	realuser = newuser;
-	realuser.shrink_to_fit();
 
 	this->InvalidateCache();
 
@@ -1018,8 +1041,7 @@ void User::ChangeDisplayedUser(const std::string& newuser)
 	if (realuser == newuser)
 		this->displayuser.clear();
 	else
-		this->displayuser.assign(newuser, 0, ServerInstance->Config->Limits.MaxUser);
-	this->displayuser.shrink_to_fit();
+		this->displayuser = std::string_view(newuser).substr(0, ServerInstance->Config->Limits.MaxUser);
 
 	this->InvalidateCache();
 }
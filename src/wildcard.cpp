@@ -78,6 +78,10 @@ static bool MatchInternal(const unsigned char* str, const unsigned char* mask, c
 
 bool InspIRCd::Match(const std::string& str, const std::string& mask, const unsigned char* map)
 {
+	// A glob pattern always matches itself. This is common when matching interned strings.
+	if (str.data() == mask.data())
+		return true;
+
 	if (!map)
 		map = national_case_insensitive_map;
 
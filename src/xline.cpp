@@ -379,6 +379,7 @@ XLine* XLineManager::MatchesLine(const std::string& type, User* user)
 	if (x == lookup_lines.end())
 		return nullptr;
 
+	const ScopedTimer timer(matchtime);
 	const time_t current = ServerInstance->Time();
 
 	LookupIter safei;
@@ -413,6 +414,7 @@ XLine* XLineManager::MatchesLine(const std::string& type, const std::string& pat
 	if (x == lookup_lines.end())
 		return nullptr;
 
+	const ScopedTimer timer(matchtime);
 	const time_t current = ServerInstance->Time();
 
 	LookupIter safei;